@@ -0,0 +1,684 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+// --------------------------------------------------------
+// Settings
+// --------------------------------------------------------
+BenchmarkSettings::BenchmarkSettings() :
+	enabled(false),
+	serialStartup(false),
+	maxFrameLatency(1),
+	simulationRate(60),
+	seed(1),
+	entityCount(2000),
+	meshCount(8),
+	materialCount(16),
+	lightCount(10),
+	frameCount(600),
+	warmupFrames(60),
+	timestep(1.0f / 60.0f),
+	width(1280),
+	height(720),
+	outputPath("Benchmark.json")
+{
+}
+
+// Splits on spaces, with double quotes around anything that has spaces in it
+static std::vector<std::string> SplitCommandLine(const char* commandLine)
+{
+	std::vector<std::string> arguments;
+	std::string current;
+	bool quoted = false;
+	bool any = false;
+	for (const char* c = commandLine; c && *c; c++)
+	{
+		if (*c == '"')
+		{
+			quoted = !quoted;
+			any = true;
+		}
+		else if ((*c == ' ' || *c == '\t') && !quoted)
+		{
+			if (any) arguments.push_back(current);
+			current.clear();
+			any = false;
+		}
+		else
+		{
+			current += *c;
+			any = true;
+		}
+	}
+	if (any) arguments.push_back(current);
+	return arguments;
+}
+
+bool BenchmarkSettings::Parse(const char* commandLine, std::string* error)
+{
+	std::vector<std::string> arguments = SplitCommandLine(commandLine);
+	for (const std::string& argument : arguments)
+	{
+		if (argument == "--benchmark")
+		{
+			enabled = true;
+			continue;
+		}
+		if (argument == "--serial-startup")
+		{
+			serialStartup = true;
+			continue;
+		}
+
+		size_t equals = argument.find('=');
+		if (argument.compare(0, 2, "--") != 0 || equals == std::string::npos)
+		{
+			if (error) *error = "Unknown argument: " + argument;
+			return false;
+		}
+		std::string name = argument.substr(2, equals - 2);
+		std::string value = argument.substr(equals + 1);
+
+		if (name == "output" || name == "record" || name == "replay" || name == "command-trace")
+		{
+			if (value.empty())
+			{
+				if (error) *error = "Empty --" + name;
+				return false;
+			}
+			std::string& path =
+				name == "output" ? outputPath :
+				name == "record" ? recordPath :
+				name == "replay" ? replayPath : commandTracePath;
+			path = value;
+			continue;
+		}
+
+		char* end = 0;
+		if (name == "timestep")
+		{
+			float seconds = strtof(value.c_str(), &end);
+			if (value.empty() || *end != 0 || !(seconds > 0.0f))
+			{
+				if (error) *error = "Bad --timestep: " + value;
+				return false;
+			}
+			timestep = seconds;
+			continue;
+		}
+
+		// Everything else is a whole number
+		unsigned int* target = 0;
+		if (name == "seed") target = &seed;
+		else if (name == "entities") target = &entityCount;
+		else if (name == "meshes") target = &meshCount;
+		else if (name == "materials") target = &materialCount;
+		else if (name == "lights") target = &lightCount;
+		else if (name == "frames") target = &frameCount;
+		else if (name == "warmup") target = &warmupFrames;
+		else if (name == "width") target = &width;
+		else if (name == "height") target = &height;
+		else if (name == "max-latency") target = &maxFrameLatency;
+		else if (name == "sim-rate") target = &simulationRate;
+		if (!target)
+		{
+			if (error) *error = "Unknown argument: " + argument;
+			return false;
+		}
+
+		unsigned long number = strtoul(value.c_str(), &end, 10);
+		if (value.empty() || *end != 0 || value[0] == '-')
+		{
+			if (error) *error = "Bad --" + name + ": " + value;
+			return false;
+		}
+		*target = (unsigned int)number;
+	}
+
+	// DXGI's limits
+	if (maxFrameLatency < 1 || maxFrameLatency > 16)
+	{
+		if (error) *error = "--max-latency has to be 1 to 16";
+		return false;
+	}
+	if (simulationRate < 1 || simulationRate > 1000)
+	{
+		if (error) *error = "--sim-rate has to be 1 to 1000";
+		return false;
+	}
+
+	// Nothing to draw with, or nowhere to draw it
+	if (meshCount == 0) meshCount = 1;
+	if (materialCount == 0) materialCount = 1;
+	if (lightCount == 0) lightCount = 1;
+	if (frameCount == 0) frameCount = 1;
+	if (width == 0) width = 1;
+	if (height == 0) height = 1;
+	return true;
+}
+
+// --------------------------------------------------------
+// Random numbers (SplitMix64)
+// --------------------------------------------------------
+BenchmarkRandom::BenchmarkRandom(uint32_t seed) :
+	state(seed)
+{
+}
+
+uint32_t BenchmarkRandom::Next()
+{
+	state += 0x9E3779B97F4A7C15ull;
+	uint64_t z = state;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z = z ^ (z >> 31);
+	return (uint32_t)(z >> 32);
+}
+
+float BenchmarkRandom::Range(float min, float max)
+{
+	// 24 bits is all a float holds, so this is exact
+	float unit = (float)(Next() >> 8) * (1.0f / 16777216.0f);
+	return min + unit * (max - min);
+}
+
+unsigned int BenchmarkRandom::Below(unsigned int count)
+{
+	return (unsigned int)(((uint64_t)Next() * count) >> 32);
+}
+
+// --------------------------------------------------------
+// Report
+// --------------------------------------------------------
+void BenchmarkReport::Clear()
+{
+	frameTimes.clear();
+	cpuStages.clear();
+	gpuPasses.clear();
+	info.clear();
+}
+
+void BenchmarkReport::AddTo(std::vector<Series>& series, const std::string& name, float ms)
+{
+	for (Series& existing : series)
+	{
+		if (existing.name == name)
+		{
+			existing.samples.push_back(ms);
+			return;
+		}
+	}
+
+	Series added;
+	added.name = name;
+	added.samples.push_back(ms);
+	series.push_back(added);
+}
+
+void BenchmarkReport::AddFrameTime(float ms)
+{
+	frameTimes.push_back(ms);
+}
+
+void BenchmarkReport::AddCpuStage(const std::string& name, float ms)
+{
+	AddTo(cpuStages, name, ms);
+}
+
+void BenchmarkReport::AddGpuPass(const std::string& name, float ms)
+{
+	AddTo(gpuPasses, name, ms);
+}
+
+void BenchmarkReport::SetInfo(const std::string& name, double value)
+{
+	for (Info& existing : info)
+	{
+		if (existing.name == name)
+		{
+			existing.number = value;
+			existing.isNumber = true;
+			return;
+		}
+	}
+	info.push_back({ name, "", value, true });
+}
+
+void BenchmarkReport::SetInfo(const std::string& name, const std::string& value)
+{
+	for (Info& existing : info)
+	{
+		if (existing.name == name)
+		{
+			existing.text = value;
+			existing.isNumber = false;
+			return;
+		}
+	}
+	info.push_back({ name, value, 0.0, false });
+}
+
+BenchmarkStatistics BenchmarkReport::Summarize(const std::vector<float>& samples)
+{
+	BenchmarkStatistics statistics = {};
+	statistics.count = (unsigned int)samples.size();
+	if (samples.empty())
+		return statistics;
+
+	std::vector<float> sorted = samples;
+	std::sort(sorted.begin(), sorted.end());
+
+	double total = 0.0;
+	for (float sample : sorted)
+		total += sample;
+
+	// Smallest sample that at least p percent of them are at or below
+	auto percentile = [&](double p)
+	{
+		size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+		if (rank < 1) rank = 1;
+		if (rank > sorted.size()) rank = sorted.size();
+		return (double)sorted[rank - 1];
+	};
+
+	statistics.mean = total / sorted.size();
+	statistics.min = sorted.front();
+	statistics.p50 = percentile(50);
+	statistics.p90 = percentile(90);
+	statistics.p95 = percentile(95);
+	statistics.p99 = percentile(99);
+	statistics.max = sorted.back();
+	return statistics;
+}
+
+static void WriteString(std::ofstream& file, const std::string& text)
+{
+	file << '"';
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			file << '\\';
+		if ((unsigned char)c >= 0x20)
+			file << c;
+	}
+	file << '"';
+}
+
+static void WriteStatistics(std::ofstream& file, const BenchmarkStatistics& statistics)
+{
+	char text[256];
+	snprintf(text, sizeof(text),
+		"{\"count\":%u,\"mean\":%.4f,\"min\":%.4f,\"p50\":%.4f,\"p90\":%.4f,\"p95\":%.4f,\"p99\":%.4f,\"max\":%.4f}",
+		statistics.count, statistics.mean, statistics.min, statistics.p50,
+		statistics.p90, statistics.p95, statistics.p99, statistics.max);
+	file << text;
+}
+
+bool BenchmarkReport::Write(const std::string& path, const BenchmarkSettings& settings) const
+{
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	char number[64];
+	file << "{\n\"settings\":{";
+	file << "\"seed\":" << settings.seed;
+	file << ",\"entities\":" << settings.entityCount;
+	file << ",\"meshes\":" << settings.meshCount;
+	file << ",\"materials\":" << settings.materialCount;
+	file << ",\"lights\":" << settings.lightCount;
+	file << ",\"frames\":" << settings.frameCount;
+	file << ",\"warmupFrames\":" << settings.warmupFrames;
+	snprintf(number, sizeof(number), "%.7g", settings.timestep);
+	file << ",\"timestep\":" << number;
+	file << ",\"simRate\":" << settings.simulationRate;
+	file << ",\"width\":" << settings.width;
+	file << ",\"height\":" << settings.height << "},\n";
+
+	file << "\"info\":{";
+	for (size_t i = 0; i < info.size(); i++)
+	{
+		if (i > 0) file << ",";
+		WriteString(file, info[i].name);
+		file << ":";
+		if (info[i].isNumber)
+		{
+			snprintf(number, sizeof(number), "%.10g", info[i].number);
+			file << number;
+		}
+		else
+		{
+			WriteString(file, info[i].text);
+		}
+	}
+	file << "},\n";
+
+	file << "\"frameTime\":";
+	WriteStatistics(file, Summarize(frameTimes));
+	file << ",\n";
+
+	auto writeSeries = [&](const char* name, const std::vector<Series>& series)
+	{
+		file << "\"" << name << "\":{";
+		for (size_t i = 0; i < series.size(); i++)
+		{
+			file << (i > 0 ? ",\n\t" : "\n\t");
+			WriteString(file, series[i].name);
+			file << ":";
+			WriteStatistics(file, Summarize(series[i].samples));
+		}
+		file << "}";
+	};
+	writeSeries("cpuStages", cpuStages);
+	file << ",\n";
+	writeSeries("gpuPasses", gpuPasses);
+	file << "\n}\n";
+
+	return file.good();
+}
+
+// --------------------------------------------------------
+// Camera path
+// --------------------------------------------------------
+void GetBenchmarkCameraPose(float time, float extent, float position[3], float target[3])
+{
+	// Slow loop around the middle, in close enough at times that
+	// most of the scene is behind the camera or hidden
+	float angle = time * 0.3f;
+	float radius = extent * (0.9f + 0.6f * sinf(time * 0.17f));
+	float height = extent * 0.25f * (1.0f + sinf(time * 0.23f));
+
+	position[0] = cosf(angle) * radius;
+	position[1] = height;
+	position[2] = sinf(angle) * radius;
+
+	target[0] = sinf(time * 0.11f) * extent * 0.25f;
+	target[1] = 0.0f;
+	target[2] = cosf(time * 0.13f) * extent * 0.25f;
+}
+
+// --------------------------------------------------------
+// Meshes
+// --------------------------------------------------------
+static const float benchmarkPi = 3.14159265358979f;
+
+static Vertex MakeVertex(float x, float y, float z, float u, float v, float nx, float ny, float nz)
+{
+	Vertex vertex = {};
+	vertex.Position = DirectX::XMFLOAT3(x, y, z);
+	vertex.UV = DirectX::XMFLOAT2(u, v);
+	vertex.Normal = DirectX::XMFLOAT3(nx, ny, nz);
+	return vertex;
+}
+
+// Two triangles per cell of a (columns + 1) x (rows + 1) vertex grid
+static void AddGridIndices(unsigned int first, unsigned int columns, unsigned int rows, std::vector<unsigned int>& indices)
+{
+	for (unsigned int r = 0; r < rows; r++)
+	{
+		for (unsigned int c = 0; c < columns; c++)
+		{
+			unsigned int a = first + r * (columns + 1) + c;
+			unsigned int b = a + 1;
+			unsigned int d = a + columns + 1;
+			unsigned int e = d + 1;
+			indices.push_back(a); indices.push_back(b); indices.push_back(d);
+			indices.push_back(b); indices.push_back(e); indices.push_back(d);
+		}
+	}
+}
+
+// Face normal from the winding (b - a) x (c - a)
+static void TriangleNormal(const Vertex& a, const Vertex& b, const Vertex& c, float normal[3])
+{
+	float ab[3] = { b.Position.x - a.Position.x, b.Position.y - a.Position.y, b.Position.z - a.Position.z };
+	float ac[3] = { c.Position.x - a.Position.x, c.Position.y - a.Position.y, c.Position.z - a.Position.z };
+	normal[0] = ab[1] * ac[2] - ab[2] * ac[1];
+	normal[1] = ab[2] * ac[0] - ab[0] * ac[2];
+	normal[2] = ab[0] * ac[1] - ab[1] * ac[0];
+}
+
+static float FacingDot(const Vertex& a, const Vertex& b, const Vertex& c)
+{
+	float normal[3];
+	TriangleNormal(a, b, c, normal);
+	return normal[0] * (a.Normal.x + b.Normal.x + c.Normal.x) +
+		normal[1] * (a.Normal.y + b.Normal.y + c.Normal.y) +
+		normal[2] * (a.Normal.z + b.Normal.z + c.Normal.z);
+}
+
+// Clockwise when looked at from outside (the way the vertex normals point)
+static void OrientTriangles(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		if (FacingDot(vertices[indices[i]], vertices[indices[i + 1]], vertices[indices[i + 2]]) < 0.0f)
+		{
+			unsigned int swap = indices[i + 1];
+			indices[i + 1] = indices[i + 2];
+			indices[i + 2] = swap;
+		}
+	}
+}
+
+void GenerateBenchmarkMesh(unsigned int index, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	vertices.clear();
+	indices.clear();
+
+	// Every unit cube sized, so entity scales mean the same thing for all of them
+	unsigned int detail = index / 3;
+	switch (index % 3)
+	{
+	case 0: // Sphere
+	{
+		unsigned int rings = 8 + 4 * detail;
+		if (rings > 64) rings = 64;
+		unsigned int segments = rings * 2;
+		for (unsigned int r = 0; r <= rings; r++)
+		{
+			float phi = benchmarkPi * r / rings;
+			for (unsigned int s = 0; s <= segments; s++)
+			{
+				float theta = 2.0f * benchmarkPi * s / segments;
+				float x = sinf(phi) * cosf(theta);
+				float y = cosf(phi);
+				float z = sinf(phi) * sinf(theta);
+				vertices.push_back(MakeVertex(x * 0.5f, y * 0.5f, z * 0.5f, (float)s / segments, (float)r / rings, x, y, z));
+			}
+		}
+		AddGridIndices(0, segments, rings, indices);
+		break;
+	}
+
+	case 1: // Torus
+	{
+		unsigned int around = 12 + 6 * detail;
+		unsigned int tube = 8 + 4 * detail;
+		if (around > 96) around = 96;
+		if (tube > 64) tube = 64;
+		const float major = 0.35f;
+		const float minor = 0.15f;
+		for (unsigned int t = 0; t <= tube; t++)
+		{
+			float v = 2.0f * benchmarkPi * t / tube;
+			for (unsigned int a = 0; a <= around; a++)
+			{
+				float u = 2.0f * benchmarkPi * a / around;
+				float nx = cosf(v) * cosf(u);
+				float ny = sinf(v);
+				float nz = cosf(v) * sinf(u);
+				vertices.push_back(MakeVertex(
+					major * cosf(u) + minor * nx, minor * ny, major * sinf(u) + minor * nz,
+					2.0f * a / around, (float)t / tube, nx, ny, nz));
+			}
+		}
+		AddGridIndices(0, around, tube, indices);
+		break;
+	}
+
+	default: // Box, with each face split into a grid
+	{
+		unsigned int cells = 1 + detail;
+		if (cells > 32) cells = 32;
+		static const float faces[6][9] =
+		{
+			// Normal, then the two directions across the face
+			{  1, 0, 0,   0, 0, 1,   0, 1, 0 },
+			{ -1, 0, 0,   0, 0, 1,   0, 1, 0 },
+			{  0, 1, 0,   1, 0, 0,   0, 0, 1 },
+			{  0,-1, 0,   1, 0, 0,   0, 0, 1 },
+			{  0, 0, 1,   1, 0, 0,   0, 1, 0 },
+			{  0, 0,-1,   1, 0, 0,   0, 1, 0 },
+		};
+		for (const float* face : faces)
+		{
+			unsigned int first = (unsigned int)vertices.size();
+			for (unsigned int r = 0; r <= cells; r++)
+			{
+				float t = (float)r / cells;
+				for (unsigned int c = 0; c <= cells; c++)
+				{
+					float s = (float)c / cells;
+					float x = face[0] * 0.5f + face[3] * (s - 0.5f) + face[6] * (t - 0.5f);
+					float y = face[1] * 0.5f + face[4] * (s - 0.5f) + face[7] * (t - 0.5f);
+					float z = face[2] * 0.5f + face[5] * (s - 0.5f) + face[8] * (t - 0.5f);
+					vertices.push_back(MakeVertex(x, y, z, s, 1.0f - t, face[0], face[1], face[2]));
+				}
+			}
+			AddGridIndices(first, cells, cells, indices);
+		}
+		break;
+	}
+	}
+
+	OrientTriangles(vertices, indices);
+}
+
+// --------------------------------------------------------
+// Self test
+// --------------------------------------------------------
+bool BenchmarkReport::SelfTest(std::string* error)
+{
+	auto fail = [&](const char* message)
+	{
+		if (error) *error = message;
+		return false;
+	};
+
+	// Command line
+	{
+		BenchmarkSettings settings;
+		if (!settings.Parse("--benchmark --seed=7 --entities=123 --timestep=0.01 --output=\"some folder/out.json\"", 0))
+			return fail("Parse rejected a valid command line");
+		if (!settings.enabled || settings.seed != 7 || settings.entityCount != 123 ||
+			fabsf(settings.timestep - 0.01f) > 1e-6f || settings.outputPath != "some folder/out.json")
+			return fail("Parse read the wrong values");
+
+		BenchmarkSettings defaults;
+		if (!defaults.Parse("", 0) || defaults.enabled || defaults.serialStartup)
+			return fail("An empty command line isn't a benchmark");
+
+		BenchmarkSettings serial;
+		if (!serial.Parse("--serial-startup --max-latency=3 --sim-rate=120", 0) || serial.enabled || !serial.serialStartup ||
+			serial.maxFrameLatency != 3 || serial.simulationRate != 120)
+			return fail("Parse read --serial-startup, --max-latency or --sim-rate wrong");
+
+		BenchmarkSettings replay;
+		if (!replay.Parse("--replay=session.irec --command-trace=frames.ctrace", 0) || replay.enabled ||
+			replay.replayPath != "session.irec" || !replay.recordPath.empty() || replay.commandTracePath != "frames.ctrace")
+			return fail("Parse read --replay or --command-trace wrong");
+
+		BenchmarkSettings bad;
+		if (bad.Parse("--benchmark --frames=ten", 0) || bad.Parse("--bogus=1", 0) || bad.Parse("--timestep=-1", 0) || bad.Parse("--record=", 0) ||
+			bad.Parse("--max-latency=0", 0) || bad.Parse("--max-latency=17", 0) || bad.Parse("--sim-rate=0", 0))
+			return fail("Parse accepted a bad command line");
+	}
+
+	// Same seed, same numbers - and within range
+	{
+		BenchmarkRandom a(42), b(42), c(43);
+		bool differs = false;
+		for (int i = 0; i < 1000; i++)
+		{
+			uint32_t x = a.Next();
+			if (x != b.Next()) return fail("Random numbers differ for the same seed");
+			differs |= x != c.Next();
+
+			float f = a.Range(-3.0f, 5.0f);
+			b.Range(-3.0f, 5.0f);
+			if (f < -3.0f || f > 5.0f) return fail("Range() out of range");
+			unsigned int below = a.Below(7);
+			b.Below(7);
+			if (below >= 7) return fail("Below() out of range");
+		}
+		if (!differs) return fail("Different seeds gave the same numbers");
+	}
+
+	// Percentiles
+	{
+		std::vector<float> samples;
+		for (int i = 100; i >= 1; i--)
+			samples.push_back((float)i);
+		BenchmarkStatistics statistics = Summarize(samples);
+		if (statistics.count != 100 || statistics.min != 1.0 || statistics.max != 100.0 ||
+			statistics.p50 != 50.0 || statistics.p90 != 90.0 || statistics.p99 != 99.0 || fabs(statistics.mean - 50.5) > 1e-9)
+			return fail("Wrong percentiles");
+		if (Summarize(std::vector<float>()).count != 0)
+			return fail("Empty series isn't empty");
+	}
+
+	// The camera never sits on what it's looking at
+	for (int i = 0; i < 1000; i++)
+	{
+		float position[3], target[3];
+		GetBenchmarkCameraPose(i * 0.1f, 20.0f, position, target);
+		float dx = position[0] - target[0], dy = position[1] - target[1], dz = position[2] - target[2];
+		if (!(dx * dx + dy * dy + dz * dz > 1.0f))
+			return fail("Camera path goes through its target");
+	}
+
+	// Meshes: valid indices, everything facing out
+	for (unsigned int m = 0; m < 12; m++)
+	{
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		GenerateBenchmarkMesh(m, vertices, indices);
+		if (vertices.empty() || indices.empty() || indices.size() % 3 != 0)
+			return fail("Empty mesh");
+		for (unsigned int i : indices)
+		{
+			if (i >= vertices.size())
+				return fail("Mesh index out of range");
+		}
+
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			const Vertex& a = vertices[indices[i]];
+			const Vertex& b = vertices[indices[i + 1]];
+			const Vertex& c = vertices[indices[i + 2]];
+			float normal[3];
+			TriangleNormal(a, b, c, normal);
+			float area = normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2];
+			if (area < 1e-12f)
+				continue; // Sphere poles
+
+			// Outward from the middle too, not just agreeing with the normals
+			// (the torus is the exception - its inner side faces the hole)
+			float center[3] = {
+				(a.Position.x + b.Position.x + c.Position.x) / 3.0f,
+				(a.Position.y + b.Position.y + c.Position.y) / 3.0f,
+				(a.Position.z + b.Position.z + c.Position.z) / 3.0f };
+			bool outward = normal[0] * center[0] + normal[1] * center[1] + normal[2] * center[2] > 0.0f;
+			if (FacingDot(a, b, c) <= 0.0f || (m % 3 != 1 && !outward))
+				return fail("Mesh triangle faces the wrong way");
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Vertex.h"
+
+// --------------------------------------------------------
+// What a benchmark run looks like, from the command line:
+//
+//  --benchmark [--seed=1] [--entities=2000] [--meshes=8]
+//  [--materials=16] [--lights=10] [--frames=600] [--warmup=60]
+//  [--timestep=0.0166667] [--width=1280] [--height=720]
+//  [--output=Benchmark.json]
+//
+// Everything but --benchmark is optional. The same settings
+// always build the same scene and fly the same camera path,
+// and every frame steps the same amount of time, so two runs
+// only differ in how long things took.
+//
+// --command-trace=file.ctrace captures every command list call
+// from the first few frames (the first measured ones, in a
+// benchmark) for Tools/CommandTraceAnalyzer.
+//
+// --record=file.irec and --replay=file.irec work with or
+// without --benchmark: record saves every frame's input, replay
+// plays it back (and quits at the end of it). A benchmark that
+// replays follows the recording instead of its camera path.
+//
+// --max-latency=1 (up to 16) is how many frames can be queued
+// up for the swap chain before the next one waits to start.
+//
+// --sim-rate=60 is how many fixed simulation steps run per
+// second of frame time (see SimulationClock.h). With the same
+// rate as the timestep, every frame is exactly one step.
+//
+// --serial-startup loads everything one piece at a time on the
+// main thread instead of on the job system, to compare startup
+// times against (see StartupProfiler.h).
+// --------------------------------------------------------
+struct BenchmarkSettings
+{
+	bool enabled;
+	bool serialStartup;			// No startup jobs
+	unsigned int maxFrameLatency;	// Frames queued for the swap chain, 1 - 16
+	unsigned int simulationRate;	// Fixed simulation steps per second, 1 - 1000
+	uint32_t seed;
+	unsigned int entityCount;
+	unsigned int meshCount;		// Procedural meshes the entities pick from
+	unsigned int materialCount;
+	unsigned int lightCount;	// Capped at MAX_LIGHTS
+	unsigned int frameCount;	// Measured
+	unsigned int warmupFrames;	// Run first, not measured
+	float timestep;				// Seconds of simulation per frame
+	unsigned int width;
+	unsigned int height;
+	std::string outputPath;		// Relative to the exe unless it's absolute
+	std::string recordPath;		// Input recording to write, if any
+	std::string replayPath;		// Input recording to play back, if any
+	std::string commandTracePath;	// Command trace to capture, if any
+
+	BenchmarkSettings();
+
+	// Fills in whatever the command line mentions. Returns false (and
+	// says why) on anything it doesn't recognize or can't read.
+	bool Parse(const char* commandLine, std::string* error);
+};
+
+// --------------------------------------------------------
+// Small seeded generator for building the scene. rand() and
+// the std:: distributions are free to differ between
+// standard libraries - this gives the same numbers everywhere.
+// --------------------------------------------------------
+class BenchmarkRandom
+{
+public:
+	BenchmarkRandom(uint32_t seed);
+
+	uint32_t Next();
+	float Range(float min, float max);
+	unsigned int Below(unsigned int count); // 0 to count - 1
+
+private:
+	uint64_t state;
+};
+
+// Sum-up of one series of samples, in milliseconds
+struct BenchmarkStatistics
+{
+	unsigned int count;
+	double mean;
+	double min;
+	double p50;
+	double p90;
+	double p95;
+	double p99;
+	double max;
+};
+
+// --------------------------------------------------------
+// Collects every measured frame's timings and writes them
+// out as JSON: frame time, each CPU stage and each GPU pass,
+// all as percentiles, plus whatever describes the run.
+//
+// Unlike the performance window (which only keeps a few
+// hundred frames), nothing is thrown away, so percentiles
+// cover the whole run.
+// --------------------------------------------------------
+class BenchmarkReport
+{
+public:
+	void Clear();
+
+	void AddFrameTime(float ms);
+	void AddCpuStage(const std::string& name, float ms);
+	void AddGpuPass(const std::string& name, float ms);
+
+	// Extra numbers and strings to describe the run (scene size, adapter...)
+	void SetInfo(const std::string& name, double value);
+	void SetInfo(const std::string& name, const std::string& value);
+
+	bool Write(const std::string& path, const BenchmarkSettings& settings) const;
+
+	unsigned int GetFrameCount() const { return (unsigned int)frameTimes.size(); }
+	BenchmarkStatistics GetFrameTimeStatistics() const { return Summarize(frameTimes); }
+
+	// Nearest rank percentiles
+	static BenchmarkStatistics Summarize(const std::vector<float>& samples);
+
+	// Parsing, the generator, percentiles, camera path and meshes
+	static bool SelfTest(std::string* error);
+
+private:
+	struct Series
+	{
+		std::string name;
+		std::vector<float> samples;
+	};
+	std::vector<float> frameTimes;
+	std::vector<Series> cpuStages;	// In the order they first showed up
+	std::vector<Series> gpuPasses;
+
+	struct Info
+	{
+		std::string name;
+		std::string text;	// Used when isNumber is false
+		double number;
+		bool isNumber;
+	};
+	std::vector<Info> info;
+
+	static void AddTo(std::vector<Series>& series, const std::string& name, float ms);
+};
+
+// Where the camera is at some point along the benchmark's path:
+// a loop around the scene that dips in and out of it, always
+// looking somewhere near the middle. extent is the scene's half size.
+void GetBenchmarkCameraPose(float time, float extent, float position[3], float target[3]);
+
+// Procedural geometry for benchmark mesh number index: spheres,
+// tori and boxes, getting more detailed as index goes up.
+// Wound clockwise, the same as the rest of the meshes.
+void GenerateBenchmarkMesh(unsigned int index, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
@@ -3,13 +3,16 @@
 #include "Lights.h"
 #include <DirectXMath.h>
 
-//Make sure to match vertex shader definition
-struct VertexShaderExternalData
+//Per-instance vertex data (second vertex buffer slot)
+//Make sure to match the input layout and vertex shader definition
+struct InstanceData
 {
 	DirectX::XMFLOAT4X4 world;
 	DirectX::XMFLOAT4X4 worldInverseTranspose;
-	DirectX::XMFLOAT4X4 view;
-	DirectX::XMFLOAT4X4 projection;
+	// Precomputed on the CPU (see MatrixKernels), always. The render queue
+	// needs it to sort by depth anyway, and the prepass and main pass both
+	// read this same matrix so their depths come out identical.
+	DirectX::XMFLOAT4X4 worldViewProjection;
 };
 
 //Same as above, but match with pixel shader!
@@ -19,5 +22,8 @@ struct PixelShaderExternalData
 	DirectX::XMFLOAT2 uvOffset;
 	DirectX::XMFLOAT3 cameraPosition;
 	int lightCount;
-	Light lights[MAX_LIGHTS];
+	float roughness;	//Used by shader permutations without a roughness map
+	float metal;		//Same, for metal maps
+	DirectX::XMFLOAT2 padding;
+	Light lights[MAX_LIGHTS]; //Sorted by type for the permutations
 };
\ No newline at end of file
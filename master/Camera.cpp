@@ -2,6 +2,9 @@
 //3/02/2021
 //Class implementation of a camera object that the user can operate to navigate around the scene.
 #include "Camera.h"
+#include "Input.h"
+
+#include <cmath>
 
 using namespace DirectX;
 Camera::Camera(float x, float y, float z, float aspectRatio)
@@ -17,46 +20,54 @@ Camera::~Camera()
 }
 
 
-void Camera::Update(float deltaTime, HWND windowHandle)
+void Camera::Update(float deltaTime)
 {
-	//TODO: Move this into an input class
-	//if (!ImGui::GetIO().WantCaptureMouse)
+	//Input already leaves out anything ImGui is using
+	Input& input = Input::GetInstance();
+
+	//speed
+	float speed = deltaTime * 2.0f;
+
+	//Check for user key press
+	if (input.KeyDown('W')) { transform.MoveRelative(0, 0, speed); }
+	if (input.KeyDown('S')) { transform.MoveRelative(0, 0, -speed); }
+	if (input.KeyDown('A')) { transform.MoveRelative(-speed, 0, 0); }
+	if (input.KeyDown('D')) { transform.MoveRelative(speed, 0, 0); }
+
+	if (input.MouseLeftDown())
 	{
-		//speed
-		float speed = deltaTime * 2.0f;
-
-		//Check for user key press
-		if (GetAsyncKeyState('W') & 0x8000) { transform.MoveRelative(0, 0, speed); }
-		if (GetAsyncKeyState('S') & 0x8000) { transform.MoveRelative(0, 0, -speed); }
-		if (GetAsyncKeyState('A') & 0x8000) { transform.MoveRelative(-speed, 0, 0); }
-		if (GetAsyncKeyState('D') & 0x8000) { transform.MoveRelative(speed, 0, 0); }
-
-		//Get current Mouse position
-		POINT mousePos = {};
-		GetCursorPos(&mousePos);
-		ScreenToClient(windowHandle, &mousePos);
-
-		if (GetAsyncKeyState(VK_LBUTTON) & 0x8000)
-		{
-			//Calculate change in cursor pos
-			float xDifference = deltaTime * (mousePos.x - prevMousePosition.x);
-			float yDifference = deltaTime * (mousePos.y - prevMousePosition.y);
-
-			transform.Rotate(yDifference, xDifference, 0); //Yes in that order :(
-		}
-
-		UpdateViewMatrix();
-		prevMousePosition = mousePos;
+		//Change in cursor pos since last frame
+		float xDifference = deltaTime * input.GetMouseXDelta();
+		float yDifference = deltaTime * input.GetMouseYDelta();
+
+		transform.Rotate(yDifference, xDifference, 0); //Yes in that order :(
 	}
+
+	UpdateViewMatrix();
+}
+
+void Camera::LookAt(XMFLOAT3 position, XMFLOAT3 target)
+{
+	transform.SetPosition(position.x, position.y, position.z);
+
+	//Pitch and yaw that turn +Z towards the target (no roll)
+	XMVECTOR direction = XMVector3Normalize(XMVectorSubtract(XMLoadFloat3(&target), XMLoadFloat3(&position)));
+	XMFLOAT3 dir;
+	XMStoreFloat3(&dir, direction);
+	float pitch = asinf(fmaxf(-1.0f, fminf(1.0f, -dir.y)));
+	float yaw = atan2f(dir.x, dir.z);
+	transform.SetRotation(pitch, yaw, 0);
+
+	UpdateViewMatrix();
 }
 
 void Camera::UpdateViewMatrix()
 {
-	//Get rotation value
-	XMFLOAT3 pitchYawRollValues = transform.GetRotation();
+	//Get rotation value (transform already keeps it as a quaternion)
+	XMFLOAT4 rotationQuaternion = transform.GetRotationQuaternion();
 	XMVECTOR forwardDirection = XMVector3Rotate(
 		XMVectorSet(0, 0, 1, 0),
-		XMQuaternionRotationRollPitchYawFromVector(XMLoadFloat3(&pitchYawRollValues)));
+		XMLoadFloat4(&rotationQuaternion));
 
 	//Look to is looking in a direction
 	//Look at matarix means look at specific location
@@ -16,10 +16,11 @@ public:
 	~Camera();
 
 	//Update functions
-	void Update(float deltaTime, HWND windowHandle);
+	void Update(float deltaTime); //Moves with the Input manager's keys and mouse (so replays drive it too)
 	void UpdateViewMatrix();
 	void UpdateProjectionMatrix(float aspectRatio);
 	void CenterCamera(); //Needs parameters of entities;
+	void LookAt(DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 target); //Scripted cameras (benchmark path)
 
 	//Getters
 	DirectX::XMFLOAT4X4 GetViewMatrix();
@@ -30,5 +31,4 @@ private:
 	DirectX::XMFLOAT4X4 viewMatrix;
 	DirectX::XMFLOAT4X4 projectionMatrix;
 	Transform transform;
-	POINT prevMousePosition;
 };
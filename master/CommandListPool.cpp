@@ -0,0 +1,190 @@
+#include "CommandListPool.h"
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+#include "TracedCommandList.h"
+
+#include <chrono>
+
+CommandListPool::CommandListPool() :
+	framesInFlight(0),
+	listCount(0),
+	currentFrame(0),
+	serialListsUsed(0),
+	openSerialList(0),
+	parallelListsUsed(0),
+	frameFenceEvent(0),
+	frameFenceCounter(0),
+	lastRecordTimeMs(0)
+{
+}
+
+CommandListPool::~CommandListPool()
+{
+	if (frameFenceEvent)
+		CloseHandle(frameFenceEvent);
+}
+
+void CommandListPool::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, unsigned int framesInFlight, unsigned int listCount)
+{
+	this->device = device;
+	this->framesInFlight = framesInFlight;
+
+	if (listCount == 0)
+		listCount = JobSystem::GetInstance().GetWorkerCount();
+	this->listCount = listCount;
+
+	// Enough for one pass to start with, more get made as needed
+	allocators.resize(framesInFlight);
+	CreateLists(maxSerialLists + listCount);
+
+	device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(frameFence.GetAddressOf()));
+	frameFenceEvent = CreateEventEx(0, 0, 0, EVENT_ALL_ACCESS);
+	frameFenceCounter = 0;
+	frameFenceValues.resize(framesInFlight, 0);
+}
+
+void CommandListPool::CreateLists(unsigned int totalLists)
+{
+	unsigned int first = (unsigned int)commandLists.size();
+	if (totalLists <= first)
+		return;
+
+	// One allocator per list per frame, parallel and serial lists alike
+	for (unsigned int f = 0; f < framesInFlight; f++)
+	{
+		allocators[f].resize(totalLists);
+		for (unsigned int i = first; i < totalLists; i++)
+		{
+			device->CreateCommandAllocator(
+				D3D12_COMMAND_LIST_TYPE_DIRECT,
+				IID_PPV_ARGS(allocators[f][i].GetAddressOf()));
+		}
+	}
+
+	// The lists themselves don't need to be per frame, just their memory
+	commandLists.resize(totalLists);
+	for (unsigned int i = first; i < totalLists; i++)
+	{
+		device->CreateCommandList(
+			0,
+			D3D12_COMMAND_LIST_TYPE_DIRECT,
+			allocators[currentFrame][i].Get(),
+			0,
+			IID_PPV_ARGS(commandLists[i].GetAddressOf()));
+
+		// Lists are created open, but OpenList() expects them closed
+		commandLists[i]->Close();
+		CommandTracer::GetInstance().Wrap(commandLists[i]);
+	}
+}
+
+void CommandListPool::BeginFrame(unsigned int frameIndex)
+{
+	currentFrame = frameIndex % framesInFlight;
+	recordedLists.clear();
+	serialListsUsed = 0;
+	openSerialList = 0;
+	parallelListsUsed = 0;
+	lastRecordTimeMs = 0;
+
+	// Allocators can't be reset while the GPU might still be using them
+	UINT64 waitValue = frameFenceValues[currentFrame];
+	if (frameFence->GetCompletedValue() < waitValue)
+	{
+		frameFence->SetEventOnCompletion(waitValue, frameFenceEvent);
+		WaitForSingleObject(frameFenceEvent, INFINITE);
+	}
+
+	for (auto& allocator : allocators[currentFrame])
+		allocator->Reset();
+}
+
+ID3D12GraphicsCommandList* CommandListPool::OpenList(unsigned int index)
+{
+	ID3D12GraphicsCommandList* list = commandLists[index].Get();
+	list->Reset(allocators[currentFrame][index].Get(), 0);
+	return list;
+}
+
+unsigned int CommandListPool::Record(unsigned int itemCount, unsigned int minItemsPerList, const RecordFunction& record)
+{
+	PROFILE_SCOPE("Command list recording");
+
+	if (itemCount == 0)
+		return 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Small workloads aren't worth splitting up
+	if (minItemsPerList == 0) minItemsPerList = 1;
+	unsigned int chunkCount = (itemCount + minItemsPerList - 1) / minItemsPerList;
+	if (chunkCount > listCount) chunkCount = listCount;
+
+	// Lists already used this frame are waiting to be submitted, so take fresh ones
+	unsigned int firstList = maxSerialLists + parallelListsUsed;
+	CreateLists(firstList + chunkCount);
+	parallelListsUsed += chunkCount;
+
+	// Each chunk is one job with its own list, so it doesn't
+	// matter which worker ends up running it
+	JobSystem::GetInstance().ParallelFor(chunkCount, 1,
+		[&](unsigned int firstChunk, unsigned int lastChunk)
+		{
+			for (unsigned int chunk = firstChunk; chunk < lastChunk; chunk++)
+			{
+				// Even split, with the leftovers going to the first few chunks
+				unsigned int perChunk = itemCount / chunkCount;
+				unsigned int leftover = itemCount % chunkCount;
+				unsigned int begin = chunk * perChunk + (chunk < leftover ? chunk : leftover);
+				unsigned int end = begin + perChunk + (chunk < leftover ? 1 : 0);
+
+				ID3D12GraphicsCommandList* list = OpenList(firstList + chunk);
+				record(list, begin, end);
+				list->Close();
+			}
+		});
+
+	// Lists go out in chunk order, no matter which finished first
+	for (unsigned int i = 0; i < chunkCount; i++)
+		recordedLists.push_back(commandLists[firstList + i].Get());
+
+	auto end = std::chrono::high_resolution_clock::now();
+	lastRecordTimeMs += std::chrono::duration<float, std::milli>(end - start).count();
+	return chunkCount;
+}
+
+ID3D12GraphicsCommandList* CommandListPool::GetSerialList()
+{
+	CloseSerialLists();
+
+	// Out of reserved serial lists? Take a fresh one from after the
+	// parallel lists, the same way Record() does when it runs out
+	unsigned int index = serialListsUsed;
+	if (serialListsUsed >= maxSerialLists)
+	{
+		index = maxSerialLists + parallelListsUsed;
+		CreateLists(index + 1);
+		parallelListsUsed++;
+	}
+
+	openSerialList = OpenList(index);
+	serialListsUsed++;
+	recordedLists.push_back(openSerialList);
+	return openSerialList;
+}
+
+void CommandListPool::CloseSerialLists()
+{
+	if (openSerialList)
+	{
+		openSerialList->Close();
+		openSerialList = 0;
+	}
+}
+
+void CommandListPool::EndFrame(ID3D12CommandQueue* commandQueue)
+{
+	frameFenceCounter++;
+	commandQueue->Signal(frameFence.Get(), frameFenceCounter);
+	frameFenceValues[currentFrame] = frameFenceCounter;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <d3d12.h>
+#include <wrl/client.h>
+#include <vector>
+#include <functional>
+
+// --------------------------------------------------------
+// A set of command lists that can be recorded in parallel.
+//
+// Every list gets its own allocator per frame in flight, so
+// each recording thread only ever touches its own memory and
+// a frame's allocators are never reset while the GPU may still
+// be reading them (a fence is signaled per frame to check).
+//
+// Record() splits a range of work into chunks, one list per
+// chunk, and records the chunks as jobs on the JobSystem's
+// workers (the main thread included). The lists come back
+// closed and in chunk order, ready to go into a single
+// ExecuteCommandLists call. Record() can be called more than
+// once a frame (one per pass, say) - every call gets lists
+// of its own, and more are made if a frame runs out.
+// --------------------------------------------------------
+class CommandListPool
+{
+public:
+	// Records items [begin, end) of a chunk into the given list
+	typedef std::function<void(ID3D12GraphicsCommandList* commandList, unsigned int begin, unsigned int end)> RecordFunction;
+
+	CommandListPool();
+	~CommandListPool();
+
+	// listCount of 0 picks one per job system worker
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, unsigned int framesInFlight, unsigned int listCount = 0);
+
+	// Waits until the GPU is done with this frame's allocators, then resets them
+	void BeginFrame(unsigned int frameIndex);
+
+	// Splits itemCount items across up to GetListCount() lists (never fewer
+	// than minItemsPerList each) and records them in parallel. Returns how many
+	// lists were recorded - they're available through GetRecordedLists(), after
+	// anything recorded earlier in the frame.
+	unsigned int Record(unsigned int itemCount, unsigned int minItemsPerList, const RecordFunction& record);
+
+	// Opens a list for single threaded work that has to come after everything
+	// recorded so far (e.g. the transition back to present). Closes the
+	// previous serial list, if any. Never runs out - more lists are made
+	// if a frame needs them.
+	ID3D12GraphicsCommandList* GetSerialList();
+
+	// Closes the last serial list so everything is ready to submit
+	void CloseSerialLists();
+
+	// Everything recorded this frame in submission order
+	const std::vector<ID3D12CommandList*>& GetRecordedLists() { return recordedLists; }
+
+	// Marks this frame's allocators as in use until the queue gets past this point.
+	// Call right after the lists have been executed.
+	void EndFrame(ID3D12CommandQueue* commandQueue);
+
+	unsigned int GetListCount() { return listCount; }
+	float GetLastRecordTimeMs() { return lastRecordTimeMs; } // Every Record() in the frame
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> device;
+	unsigned int framesInFlight;
+	unsigned int listCount;
+	unsigned int currentFrame;
+
+	// [frame][list] - the serial lists come first, then the parallel ones
+	std::vector<std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>>> allocators;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> commandLists;
+	std::vector<ID3D12CommandList*> recordedLists;
+
+	static const unsigned int maxSerialLists = 8; // Reserved up front, more come from the rest of the pool
+	unsigned int serialListsUsed;
+	ID3D12GraphicsCommandList* openSerialList;
+	unsigned int parallelListsUsed; // Lists past the reserved serial ones handed out this frame
+
+	// One fence value per frame so we know when its allocators are free
+	Microsoft::WRL::ComPtr<ID3D12Fence> frameFence;
+	HANDLE frameFenceEvent;
+	UINT64 frameFenceCounter;
+	std::vector<UINT64> frameFenceValues;
+
+	// Opens list i on this frame's allocator
+	ID3D12GraphicsCommandList* OpenList(unsigned int index);
+
+	// Makes lists (and their allocators) until there are at least totalLists
+	void CreateLists(unsigned int totalLists);
+
+	float lastRecordTimeMs;
+};
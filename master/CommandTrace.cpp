@@ -0,0 +1,695 @@
+#include "CommandTrace.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const unsigned char traceMagic[4] = { 'C', 'T', 'R', 'C' };
+static const unsigned char traceVersion = 1;
+
+// Values after the op byte, not counting the per item ones that
+// some ops follow up with (barriers, heaps, vertex buffers, targets)
+static const unsigned char opValueCounts[TRACE_OP_COUNT] =
+{
+	0,			// (unused)
+	1, 1, 1,	// Frame, submit, list
+	2, 0, 1,	// Reset, close, clear state
+	4, 5, 3,	// Draw, draw indexed, dispatch
+	6, 1,		// Execute indirect, execute bundle
+	5, 2, 2, 2, 2, 1,	// Copies, resolve, discard
+	1, 2, 2, 1, 1,	// Topology, viewports, scissors, blend factor, stencil ref
+	1, 1, 1,	// Pipeline, barriers, descriptor heaps
+	2, 3, 5, 4,	// Root signature, table, constants, view
+	3, 2, 3, 2,	// Index buffer, vertex buffers, stream output, render targets
+	1, 2, 1,	// Clears
+	3, 3, 5, 3,	// Queries, predication
+	1, 1, 0,	// Marker, begin event, end event
+};
+
+static const char* opNames[TRACE_OP_COUNT] =
+{
+	"(none)",
+	"Frame", "Submit", "List",
+	"Reset", "Close", "ClearState",
+	"DrawInstanced", "DrawIndexedInstanced", "Dispatch",
+	"ExecuteIndirect", "ExecuteBundle",
+	"CopyBufferRegion", "CopyTextureRegion", "CopyResource", "CopyTiles", "ResolveSubresource", "DiscardResource",
+	"IASetPrimitiveTopology", "RSSetViewports", "RSSetScissorRects", "OMSetBlendFactor", "OMSetStencilRef",
+	"SetPipelineState", "ResourceBarrier", "SetDescriptorHeaps",
+	"SetRootSignature", "SetRootDescriptorTable", "SetRoot32BitConstants", "SetRootView",
+	"IASetIndexBuffer", "IASetVertexBuffers", "SOSetTargets", "OMSetRenderTargets",
+	"ClearRenderTargetView", "ClearDepthStencilView", "ClearUnorderedAccessView",
+	"BeginQuery", "EndQuery", "ResolveQueryData", "SetPredication",
+	"SetMarker", "BeginEvent", "EndEvent",
+};
+
+static const char* stateNames[TRACE_STATE_COUNT] =
+{
+	"Pipeline",
+	"Root signature",
+	"Root table",
+	"Root constants",
+	"Root view",
+	"Descriptor heaps",
+	"Topology",
+	"Viewports",
+	"Scissors",
+	"Vertex buffers",
+	"Index buffer",
+	"Render targets",
+	"Blend factor",
+	"Stencil ref",
+};
+
+const char* GetCommandTraceOpName(unsigned int op)
+{
+	return op < TRACE_OP_COUNT ? opNames[op] : "(unknown)";
+}
+
+// --------------------------------------------------------
+// Writing
+// --------------------------------------------------------
+void CommandTraceBuffer::Put(uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		data.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	data.push_back((unsigned char)value);
+}
+
+void CommandTraceBuffer::PutSigned(int64_t value)
+{
+	Put(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void CommandTraceBuffer::WriteHeader()
+{
+	data.insert(data.end(), traceMagic, traceMagic + 4);
+	data.push_back(traceVersion);
+}
+
+// --------------------------------------------------------
+// Reading
+// --------------------------------------------------------
+bool CommandTraceAnalyzer::LoadFile(const std::string& path, std::vector<unsigned char>& trace)
+{
+	FILE* file = 0;
+#if defined(_MSC_VER)
+	fopen_s(&file, path.c_str(), "rb");
+#else
+	file = fopen(path.c_str(), "rb");
+#endif
+	if (!file)
+		return false;
+
+	trace.clear();
+	unsigned char chunk[64 * 1024];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		trace.insert(trace.end(), chunk, chunk + read);
+	fclose(file);
+	return true;
+}
+
+static bool GetValue(const std::vector<unsigned char>& in, size_t& position, uint64_t* value)
+{
+	uint64_t result = 0;
+	for (int shift = 0; shift < 70; shift += 7)
+	{
+		if (position >= in.size())
+			return false;
+		unsigned char byte = in[position++];
+		result |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			*value = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Triangles (or lines, or points) in a draw of this many vertices
+static uint64_t CountPrimitives(uint64_t topology, uint64_t vertices)
+{
+	switch (topology)
+	{
+	case 1: return vertices;								// Point list
+	case 2: return vertices / 2;							// Line list
+	case 3: return vertices > 1 ? vertices - 1 : 0;			// Line strip
+	case 4: return vertices / 3;							// Triangle list
+	case 5: return vertices > 2 ? vertices - 2 : 0;			// Triangle strip
+	default: return 0;
+	}
+}
+
+// Most draws first, then most primitives, then earliest
+static bool LargerBatch(const CommandTraceBatch& a, const CommandTraceBatch& b)
+{
+	if (a.draws != b.draws) return a.draws > b.draws;
+	if (a.primitives != b.primitives) return a.primitives > b.primitives;
+	if (a.frame != b.frame) return a.frame < b.frame;
+	if (a.list != b.list) return a.list < b.list;
+	return a.firstCommand < b.firstCommand;
+}
+
+// Everything a list has set so far. 0 means never set.
+struct TraceListState
+{
+	static const unsigned int maxRootParameters = 64;
+	static const unsigned int maxVertexBuffers = 32;
+
+	uint64_t keys[TRACE_STATE_COUNT];
+	uint64_t rootSignature[2];			// Graphics, compute
+	uint64_t root[2][maxRootParameters];
+	uint64_t vertexBuffers[maxVertexBuffers];
+	uint64_t topology;
+	uint64_t pipeline;
+	unsigned int changesSinceWork;
+
+	void Reset(uint64_t initialPipeline)
+	{
+		memset(this, 0, sizeof(TraceListState));
+		pipeline = initialPipeline;
+		// Same key a TRACE_PIPELINE with this pipeline would get
+		keys[TRACE_STATE_PIPELINE] = initialPipeline ? HashValue(HashStart + TRACE_PIPELINE, initialPipeline) : 0;
+	}
+};
+
+bool CommandTraceAnalyzer::Analyze(const std::vector<unsigned char>& trace, std::string* error, unsigned int batchesToKeep)
+{
+	stats = CommandTraceStats();
+	stats.bytes = trace.size();
+
+	size_t position = 0;
+	auto fail = [&](const char* message)
+	{
+		if (error)
+		{
+			char text[160];
+			snprintf(text, sizeof(text), "%s (at byte %llu)", message, (unsigned long long)position);
+			*error = text;
+		}
+		return false;
+	};
+
+	if (trace.size() < 5 || memcmp(trace.data(), traceMagic, 4) != 0)
+		return fail("Not a command trace");
+	if (trace[4] != traceVersion)
+		return fail("Unsupported command trace version");
+	position = 5;
+
+	TraceListState state;
+	state.Reset(0);
+	bool inList = false;
+	unsigned int frame = 0;
+	unsigned int listId = 0;
+	unsigned int commandIndex = 0;
+	unsigned int lastOp = 0;
+
+	CommandTraceBatch batch = {};
+	auto endBatch = [&]()
+	{
+		if (batch.draws == 0)
+			return;
+		stats.largestBatches.push_back(batch);
+		batch.draws = 0;
+
+		// Trim now and then rather than keeping every batch around
+		if (stats.largestBatches.size() > batchesToKeep * 2 + 64)
+		{
+			std::sort(stats.largestBatches.begin(), stats.largestBatches.end(), LargerBatch);
+			stats.largestBatches.resize(batchesToKeep);
+		}
+	};
+
+	// Counts a set and whether it changed anything
+	auto set = [&](CommandTraceState category, uint64_t& slot, uint64_t key)
+	{
+		stats.stateSets[category]++;
+		if (slot == key)
+		{
+			stats.redundantSets[category]++;
+			return false;
+		}
+		slot = key;
+		state.changesSinceWork++;
+		return true;
+	};
+
+	auto addDraw = [&](uint64_t instances, uint64_t primitives)
+	{
+		if (batch.draws == 0)
+		{
+			batch.frame = frame;
+			batch.list = listId;
+			batch.firstCommand = commandIndex;
+			batch.instances = 0;
+			batch.primitives = 0;
+			batch.pipeline = state.pipeline;
+		}
+		batch.draws++;
+		batch.instances += instances;
+		batch.primitives += primitives;
+
+		stats.draws++;
+		stats.drawChanges += state.changesSinceWork;
+		stats.maxDrawChanges = std::max(stats.maxDrawChanges, state.changesSinceWork);
+		unsigned int c = state.changesSinceWork;
+		stats.drawChangeHistogram[c == 0 ? 0 : c == 1 ? 1 : c == 2 ? 2 : c <= 4 ? 3 : c <= 8 ? 4 : 5]++;
+		state.changesSinceWork = 0;
+	};
+
+	uint64_t v[8];
+	while (position < trace.size())
+	{
+		unsigned int op = trace[position++];
+		if (op == 0 || op >= TRACE_OP_COUNT)
+			return fail("Unknown op");
+
+		for (unsigned int i = 0; i < opValueCounts[op]; i++)
+		{
+			if (!GetValue(trace, position, &v[i]))
+				return fail("Trace ends in the middle of a command");
+		}
+		stats.opCounts[op]++;
+
+		// Everything but the markers belongs to a list
+		if (op == TRACE_FRAME)
+		{
+			endBatch();
+			inList = false;
+			frame = (unsigned int)v[0];
+			stats.frames++;
+			continue;
+		}
+		if (op == TRACE_SUBMIT)
+		{
+			endBatch();
+			inList = false;
+			stats.submits++;
+			continue;
+		}
+		if (op == TRACE_LIST)
+		{
+			endBatch();
+			inList = true;
+			listId = (unsigned int)v[0];
+			commandIndex = 0;
+			lastOp = 0;
+			state.Reset(0);
+			stats.lists++;
+			continue;
+		}
+		if (!inList)
+			return fail("Command outside of a list");
+
+		stats.commands++;
+		uint64_t key = HashBytes(HashStart + op, v, sizeof(uint64_t) * opValueCounts[op]);
+
+		switch (op)
+		{
+		case TRACE_RESET:
+		case TRACE_CLEAR_STATE:
+			endBatch();
+			state.Reset(op == TRACE_RESET ? v[1] : v[0]);
+			break;
+
+		case TRACE_DRAW:
+			addDraw(v[1], CountPrimitives(state.topology, v[0]) * v[1]);
+			break;
+		case TRACE_DRAW_INDEXED:
+			addDraw(v[1], CountPrimitives(state.topology, v[0]) * v[1]);
+			break;
+		case TRACE_EXECUTE_INDIRECT:
+			addDraw(0, 0); // What it draws lives on the GPU
+			break;
+		case TRACE_DISPATCH:
+			stats.dispatches++;
+			stats.dispatchChanges += state.changesSinceWork;
+			state.changesSinceWork = 0;
+			break;
+
+		case TRACE_PIPELINE:
+			if (set(TRACE_STATE_PIPELINE, state.keys[TRACE_STATE_PIPELINE], key))
+			{
+				endBatch();
+				state.pipeline = v[0];
+			}
+			break;
+		case TRACE_ROOT_SIGNATURE:
+		{
+			// A different root signature throws away its side's arguments
+			int side = v[0] ? 1 : 0;
+			if (set(TRACE_STATE_ROOT_SIGNATURE, state.rootSignature[side], key))
+			{
+				memset(state.root[side], 0, sizeof(state.root[side]));
+				if (side == 0)
+					endBatch();
+			}
+			break;
+		}
+		case TRACE_ROOT_TABLE:
+		case TRACE_ROOT_CONSTANTS:
+		case TRACE_ROOT_VIEW:
+		{
+			unsigned int parameter = (unsigned int)(op == TRACE_ROOT_VIEW ? v[2] : v[1]);
+			if (parameter >= TraceListState::maxRootParameters)
+				return fail("Root parameter out of range");
+			CommandTraceState category = op == TRACE_ROOT_TABLE ? TRACE_STATE_ROOT_TABLE :
+				op == TRACE_ROOT_CONSTANTS ? TRACE_STATE_ROOT_CONSTANTS : TRACE_STATE_ROOT_VIEW;
+			set(category, state.root[v[0] ? 1 : 0][parameter], key);
+			break;
+		}
+
+		case TRACE_DESCRIPTOR_HEAPS:
+		case TRACE_RENDER_TARGETS:
+		{
+			// Heaps, or render targets then the depth target
+			uint64_t count = op == TRACE_DESCRIPTOR_HEAPS ? v[0] : v[0] + 1;
+			if (count > 64)
+				return fail("Too many descriptors");
+			for (uint64_t i = 0; i < count; i++)
+			{
+				uint64_t handle;
+				if (!GetValue(trace, position, &handle))
+					return fail("Trace ends in the middle of a command");
+				key = HashValue(key, handle);
+			}
+			CommandTraceState category = op == TRACE_DESCRIPTOR_HEAPS ? TRACE_STATE_DESCRIPTOR_HEAPS : TRACE_STATE_RENDER_TARGETS;
+			set(category, state.keys[category], key);
+			break;
+		}
+
+		case TRACE_VERTEX_BUFFERS:
+		{
+			// Redundant when every slot it touches already has that buffer
+			uint64_t first = v[0], count = v[1];
+			if (first + count > TraceListState::maxVertexBuffers)
+				return fail("Vertex buffer slot out of range");
+			bool changed = false;
+			for (uint64_t i = 0; i < count; i++)
+			{
+				uint64_t view[3];
+				for (int j = 0; j < 3; j++)
+				{
+					if (!GetValue(trace, position, &view[j]))
+						return fail("Trace ends in the middle of a command");
+				}
+				uint64_t viewKey = HashBytes(HashStart, view, sizeof(view));
+				if (state.vertexBuffers[first + i] != viewKey)
+				{
+					state.vertexBuffers[first + i] = viewKey;
+					changed = true;
+				}
+			}
+			stats.stateSets[TRACE_STATE_VERTEX_BUFFERS]++;
+			if (changed)
+				state.changesSinceWork++;
+			else
+				stats.redundantSets[TRACE_STATE_VERTEX_BUFFERS]++;
+			break;
+		}
+
+		case TRACE_TOPOLOGY:
+			if (set(TRACE_STATE_TOPOLOGY, state.keys[TRACE_STATE_TOPOLOGY], key))
+				state.topology = v[0];
+			break;
+		case TRACE_VIEWPORTS: set(TRACE_STATE_VIEWPORTS, state.keys[TRACE_STATE_VIEWPORTS], key); break;
+		case TRACE_SCISSORS: set(TRACE_STATE_SCISSORS, state.keys[TRACE_STATE_SCISSORS], key); break;
+		case TRACE_INDEX_BUFFER: set(TRACE_STATE_INDEX_BUFFER, state.keys[TRACE_STATE_INDEX_BUFFER], key); break;
+		case TRACE_BLEND_FACTOR: set(TRACE_STATE_BLEND_FACTOR, state.keys[TRACE_STATE_BLEND_FACTOR], key); break;
+		case TRACE_STENCIL_REF: set(TRACE_STATE_STENCIL_REF, state.keys[TRACE_STATE_STENCIL_REF], key); break;
+
+		case TRACE_BARRIERS:
+		{
+			stats.barrierCalls++;
+			if (lastOp == TRACE_BARRIERS)
+				stats.adjacentBarrierCalls++;
+			for (uint64_t i = 0; i < v[0]; i++)
+			{
+				uint64_t type, flags;
+				if (!GetValue(trace, position, &type) || !GetValue(trace, position, &flags))
+					return fail("Trace ends in the middle of a command");
+
+				// Transition, aliasing, UAV
+				unsigned int values = type == 0 ? 4 : type == 1 ? 2 : type == 2 ? 1 : 0;
+				if (type > 2)
+					return fail("Unknown barrier type");
+				for (unsigned int j = 0; j < values; j++)
+				{
+					uint64_t ignored;
+					if (!GetValue(trace, position, &ignored))
+						return fail("Trace ends in the middle of a command");
+				}
+
+				stats.barriers++;
+				if (type == 0) stats.transitions++;
+				else if (type == 1) stats.aliasingBarriers++;
+				else stats.uavBarriers++;
+				if (flags & 3) // Begin only, end only
+					stats.splitBarriers++;
+			}
+			break;
+		}
+		}
+
+		lastOp = op;
+		commandIndex++;
+	}
+	endBatch();
+
+	std::sort(stats.largestBatches.begin(), stats.largestBatches.end(), LargerBatch);
+	if (stats.largestBatches.size() > batchesToKeep)
+		stats.largestBatches.resize(batchesToKeep);
+	return true;
+}
+
+double CommandTraceAnalyzer::GetRedundantPercent() const
+{
+	uint64_t sets = 0, redundant = 0;
+	for (int i = 0; i < TRACE_STATE_COUNT; i++)
+	{
+		sets += stats.stateSets[i];
+		redundant += stats.redundantSets[i];
+	}
+	return sets ? 100.0 * redundant / sets : 0.0;
+}
+
+// --------------------------------------------------------
+// Reports
+// --------------------------------------------------------
+void CommandTraceAnalyzer::WriteText(FILE* file) const
+{
+	double frames = stats.frames ? (double)stats.frames : 1.0;
+	fprintf(file, "Command trace: %u frames, %u submits, %u lists, %llu commands (%.1f KB)\n",
+		stats.frames, stats.submits, stats.lists, (unsigned long long)stats.commands, stats.bytes / 1024.0);
+	fprintf(file, "Per frame: %.1f draws, %.1f dispatches, %.1f barriers in %.1f calls, %.1f commands\n\n",
+		stats.draws / frames, stats.dispatches / frames, stats.barriers / frames, stats.barrierCalls / frames, stats.commands / frames);
+
+	fprintf(file, "%-20s %12s %12s\n", "State sets", "total", "redundant");
+	uint64_t sets = 0, redundant = 0;
+	for (int i = 0; i < TRACE_STATE_COUNT; i++)
+	{
+		sets += stats.stateSets[i];
+		redundant += stats.redundantSets[i];
+		if (stats.stateSets[i])
+			fprintf(file, "  %-18s %12llu %12llu (%.1f%%)\n", stateNames[i],
+				(unsigned long long)stats.stateSets[i], (unsigned long long)stats.redundantSets[i],
+				100.0 * stats.redundantSets[i] / stats.stateSets[i]);
+	}
+	fprintf(file, "  %-18s %12llu %12llu (%.1f%%)\n\n", "All", (unsigned long long)sets, (unsigned long long)redundant, GetRedundantPercent());
+
+	fprintf(file, "Binding churn: %.2f state changes per draw, %u at most\n",
+		stats.draws ? (double)stats.drawChanges / stats.draws : 0.0, stats.maxDrawChanges);
+	static const char* buckets[6] = { "0", "1", "2", "3-4", "5-8", "9+" };
+	fprintf(file, "  draws by changes:");
+	for (int i = 0; i < 6; i++)
+		fprintf(file, "  %s: %llu", buckets[i], (unsigned long long)stats.drawChangeHistogram[i]);
+	fprintf(file, "\n  %.2f state changes per dispatch\n\n",
+		stats.dispatches ? (double)stats.dispatchChanges / stats.dispatches : 0.0);
+
+	fprintf(file, "Barriers: %llu in %llu calls (%llu transitions, %llu aliasing, %llu UAV, %llu split)\n",
+		(unsigned long long)stats.barriers, (unsigned long long)stats.barrierCalls,
+		(unsigned long long)stats.transitions, (unsigned long long)stats.aliasingBarriers,
+		(unsigned long long)stats.uavBarriers, (unsigned long long)stats.splitBarriers);
+	fprintf(file, "  %llu calls came straight after another and could have been merged\n\n",
+		(unsigned long long)stats.adjacentBarrierCalls);
+
+	fprintf(file, "Largest draw batches (same pipeline and root signature):\n");
+	fprintf(file, "  %8s %10s %12s %7s %6s %8s  %s\n", "draws", "instances", "primitives", "frame", "list", "command", "pipeline");
+	for (const CommandTraceBatch& batch : stats.largestBatches)
+	{
+		fprintf(file, "  %8u %10llu %12llu %7u %6u %8u  0x%llx\n", batch.draws,
+			(unsigned long long)batch.instances, (unsigned long long)batch.primitives,
+			batch.frame, batch.list, batch.firstCommand, (unsigned long long)batch.pipeline);
+	}
+
+	fprintf(file, "\nCommands:\n");
+	for (unsigned int op = TRACE_RESET; op < TRACE_OP_COUNT; op++)
+	{
+		if (stats.opCounts[op])
+			fprintf(file, "  %-26s %12llu\n", opNames[op], (unsigned long long)stats.opCounts[op]);
+	}
+}
+
+bool CommandTraceAnalyzer::WriteJson(const std::string& path) const
+{
+	FILE* file = 0;
+#if defined(_MSC_VER)
+	fopen_s(&file, path.c_str(), "w");
+#else
+	file = fopen(path.c_str(), "w");
+#endif
+	if (!file)
+		return false;
+
+	auto number = [&](const char* name, double value, bool last = false)
+	{
+		fprintf(file, "\t\"%s\": %.10g%s\n", name, value, last ? "" : ",");
+	};
+
+	fprintf(file, "{\n");
+	number("frames", stats.frames);
+	number("submits", stats.submits);
+	number("lists", stats.lists);
+	number("bytes", (double)stats.bytes);
+	number("commands", (double)stats.commands);
+	number("draws", (double)stats.draws);
+	number("dispatches", (double)stats.dispatches);
+	number("redundantPercent", GetRedundantPercent());
+	number("changesPerDraw", stats.draws ? (double)stats.drawChanges / stats.draws : 0.0);
+	number("maxChangesPerDraw", stats.maxDrawChanges);
+	number("changesPerDispatch", stats.dispatches ? (double)stats.dispatchChanges / stats.dispatches : 0.0);
+	number("barrierCalls", (double)stats.barrierCalls);
+	number("barriers", (double)stats.barriers);
+	number("transitions", (double)stats.transitions);
+	number("aliasingBarriers", (double)stats.aliasingBarriers);
+	number("uavBarriers", (double)stats.uavBarriers);
+	number("splitBarriers", (double)stats.splitBarriers);
+	number("adjacentBarrierCalls", (double)stats.adjacentBarrierCalls);
+
+	fprintf(file, "\t\"stateSets\": {\n");
+	for (int i = 0; i < TRACE_STATE_COUNT; i++)
+	{
+		fprintf(file, "\t\t\"%s\": { \"total\": %llu, \"redundant\": %llu }%s\n", stateNames[i],
+			(unsigned long long)stats.stateSets[i], (unsigned long long)stats.redundantSets[i],
+			i + 1 < TRACE_STATE_COUNT ? "," : "");
+	}
+	fprintf(file, "\t},\n");
+
+	fprintf(file, "\t\"commandCounts\": {\n");
+	bool first = true;
+	for (unsigned int op = TRACE_RESET; op < TRACE_OP_COUNT; op++)
+	{
+		if (!stats.opCounts[op])
+			continue;
+		fprintf(file, "%s\t\t\"%s\": %llu", first ? "" : ",\n", opNames[op], (unsigned long long)stats.opCounts[op]);
+		first = false;
+	}
+	fprintf(file, "\n\t},\n");
+
+	fprintf(file, "\t\"largestBatches\": [\n");
+	for (size_t i = 0; i < stats.largestBatches.size(); i++)
+	{
+		const CommandTraceBatch& batch = stats.largestBatches[i];
+		fprintf(file, "\t\t{ \"draws\": %u, \"instances\": %llu, \"primitives\": %llu, \"frame\": %u, \"list\": %u, \"command\": %u }%s\n",
+			batch.draws, (unsigned long long)batch.instances, (unsigned long long)batch.primitives,
+			batch.frame, batch.list, batch.firstCommand, i + 1 < stats.largestBatches.size() ? "," : "");
+	}
+	fprintf(file, "\t]\n}\n");
+
+	bool written = !ferror(file);
+	fclose(file);
+	return written;
+}
+
+// --------------------------------------------------------
+// Self test
+// --------------------------------------------------------
+bool CommandTraceAnalyzer::SelfTest(std::string* error)
+{
+	auto fail = [&](const char* message)
+	{
+		if (error) *error = message;
+		return false;
+	};
+
+	// Two lists, recorded the way TracedCommandList would
+	CommandTraceBuffer trace;
+	trace.WriteHeader();
+	trace.Record(TRACE_FRAME, 7u);
+	trace.Record(TRACE_SUBMIT, 2u);
+
+	const uint64_t pipelineA = 0x1000, pipelineB = 0x2000, rootSignature = 0x3000;
+	trace.Record(TRACE_LIST, 0u);
+	trace.Record(TRACE_RESET, 0x10u, 0u);
+	trace.Record(TRACE_ROOT_SIGNATURE, 0u, rootSignature);
+	trace.Record(TRACE_TOPOLOGY, 4u);
+	trace.Record(TRACE_PIPELINE, pipelineA);
+	trace.Record(TRACE_PIPELINE, pipelineA);				// Redundant
+	trace.Record(TRACE_ROOT_TABLE, 0u, 2u, 0x500u);
+	trace.Record(TRACE_VERTEX_BUFFERS, 0u, 2u, 0xA00u, 96u, 32u, 0xB00u, 64u, 16u);
+	trace.Record(TRACE_DRAW_INDEXED, 36u, 2u, 0u);
+	trace.PutSigned(-5);
+	trace.Put(0u);
+	trace.Record(TRACE_ROOT_TABLE, 0u, 2u, 0x500u);		// Redundant
+	trace.Record(TRACE_VERTEX_BUFFERS, 1u, 1u, 0xB00u, 64u, 16u); // Redundant
+	trace.Record(TRACE_DRAW, 3u, 1u, 0u, 0u);
+	trace.Record(TRACE_ROOT_TABLE, 0u, 2u, 0x540u);
+	trace.Record(TRACE_DRAW, 6u, 1u, 0u, 0u);
+	trace.Record(TRACE_BARRIERS, 2u, 0u, 0u, 0x77u, 0u, 4u, 8u, 2u, 0u, 0x78u);
+	trace.Record(TRACE_BARRIERS, 1u, 0u, 1u, 0x77u, 0u, 8u, 4u);	// Could've gone with the last one, and is split
+	trace.Record(TRACE_PIPELINE, pipelineB);
+	trace.Record(TRACE_DRAW, 3u, 1u, 0u, 0u);
+	trace.Record(TRACE_CLOSE);
+
+	// A new list starts over, so nothing here is redundant
+	trace.Record(TRACE_LIST, 1u);
+	trace.Record(TRACE_PIPELINE, pipelineA);
+	trace.Record(TRACE_ROOT_SIGNATURE, 1u, rootSignature);
+	trace.Record(TRACE_ROOT_VIEW, 1u, 2u, 0u, 0x9000u);
+	trace.Record(TRACE_DISPATCH, 4u, 1u, 1u);
+	trace.Record(TRACE_CLOSE);
+
+	CommandTraceAnalyzer analyzer;
+	std::string analyzeError;
+	if (!analyzer.Analyze(trace.data, &analyzeError))
+		return fail("Couldn't read a trace it just made");
+
+	const CommandTraceStats& stats = analyzer.GetStats();
+	if (stats.frames != 1 || stats.submits != 1 || stats.lists != 2 || stats.draws != 4 || stats.dispatches != 1)
+		return fail("Wrong frame, list or draw counts");
+	if (stats.stateSets[TRACE_STATE_PIPELINE] != 4 || stats.redundantSets[TRACE_STATE_PIPELINE] != 1 ||
+		stats.redundantSets[TRACE_STATE_ROOT_TABLE] != 1 || stats.redundantSets[TRACE_STATE_VERTEX_BUFFERS] != 1 ||
+		stats.redundantSets[TRACE_STATE_ROOT_SIGNATURE] != 0 || stats.redundantSets[TRACE_STATE_ROOT_VIEW] != 0)
+		return fail("Wrong redundant state counts");
+
+	// Root signature, topology, pipeline, table, buffers before the first draw; nothing before
+	// the second; the table before the third; the pipeline before the fourth
+	if (stats.drawChanges != 7 || stats.maxDrawChanges != 5 || stats.drawChangeHistogram[0] != 1 ||
+		stats.drawChangeHistogram[1] != 2 || stats.drawChangeHistogram[4] != 1 || stats.dispatchChanges != 3)
+		return fail("Wrong binding churn");
+
+	if (stats.barrierCalls != 2 || stats.barriers != 3 || stats.transitions != 2 || stats.uavBarriers != 1 ||
+		stats.splitBarriers != 1 || stats.adjacentBarrierCalls != 1)
+		return fail("Wrong barrier counts");
+
+	// 12 * 2 + 1 + 2 triangles with pipeline A, then 1 with pipeline B
+	if (stats.largestBatches.size() != 2 || stats.largestBatches[0].draws != 3 ||
+		stats.largestBatches[0].instances != 4 || stats.largestBatches[0].primitives != 27 ||
+		stats.largestBatches[0].pipeline != pipelineA || stats.largestBatches[1].pipeline != pipelineB)
+		return fail("Wrong draw batches");
+
+	// Cut short or not a trace at all
+	std::vector<unsigned char> cut(trace.data.begin(), trace.data.end() - 3);
+	if (analyzer.Analyze(cut, 0))
+		return fail("Read a trace that was cut short");
+	std::vector<unsigned char> junk(32, 0xEE);
+	if (analyzer.Analyze(junk, 0))
+		return fail("Read something that isn't a trace");
+
+	return true;
+}
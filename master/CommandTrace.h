@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// Command traces: every call made on a command list during
+// a capture, written out as a compact binary file that can
+// be picked apart later (see Tools/CommandTraceAnalyzer.cpp).
+//
+// No D3D12 in here, so the analyzer builds anywhere. Objects
+// (pipelines, resources, heaps...) are just their pointer
+// values - only ever compared, never followed.
+//
+// The file is "CTRC" and a version byte, then records: one
+// op byte followed by its values as varints. A frame is
+// TRACE_FRAME, then every ExecuteCommandLists call in it
+// (TRACE_SUBMIT, then each list as TRACE_LIST followed by
+// what was recorded into it).
+// --------------------------------------------------------
+enum CommandTraceOp
+{
+	TRACE_FRAME = 1,		// frame
+	TRACE_SUBMIT,			// list count
+	TRACE_LIST,				// list id
+
+	TRACE_RESET,			// allocator, pipeline
+	TRACE_CLOSE,
+	TRACE_CLEAR_STATE,		// pipeline
+
+	TRACE_DRAW,				// vertices, instances, start vertex, start instance
+	TRACE_DRAW_INDEXED,		// indices, instances, start index, base vertex (signed), start instance
+	TRACE_DISPATCH,			// x, y, z
+	TRACE_EXECUTE_INDIRECT,	// signature, max commands, arguments, offset, count buffer, offset
+	TRACE_EXECUTE_BUNDLE,	// bundle
+
+	TRACE_COPY_BUFFER,		// destination, offset, source, offset, bytes
+	TRACE_COPY_TEXTURE,		// destination, source
+	TRACE_COPY_RESOURCE,	// destination, source
+	TRACE_COPY_TILES,		// tiled resource, buffer
+	TRACE_RESOLVE,			// destination, source
+	TRACE_DISCARD,			// resource
+
+	TRACE_TOPOLOGY,			// topology
+	TRACE_VIEWPORTS,		// count, hash
+	TRACE_SCISSORS,			// count, hash
+	TRACE_BLEND_FACTOR,		// hash
+	TRACE_STENCIL_REF,		// value
+	TRACE_PIPELINE,			// pipeline
+	TRACE_BARRIERS,			// count, then per barrier: type, flags, and
+							//  transition: resource, subresource, before, after
+							//  aliasing: before, after
+							//  UAV: resource
+	TRACE_DESCRIPTOR_HEAPS,	// count, heaps
+	TRACE_ROOT_SIGNATURE,	// compute, root signature
+	TRACE_ROOT_TABLE,		// compute, parameter, GPU handle
+	TRACE_ROOT_CONSTANTS,	// compute, parameter, offset, count, hash
+	TRACE_ROOT_VIEW,		// compute, kind (CBV/SRV/UAV), parameter, address
+	TRACE_INDEX_BUFFER,		// address, size, format
+	TRACE_VERTEX_BUFFERS,	// first slot, count, then per slot: address, size, stride
+	TRACE_STREAM_OUTPUT,	// first slot, count, hash
+	TRACE_RENDER_TARGETS,	// count, single range, handles, depth handle (0 for none)
+
+	TRACE_CLEAR_RTV,		// handle
+	TRACE_CLEAR_DSV,		// handle, flags
+	TRACE_CLEAR_UAV,		// resource
+
+	TRACE_BEGIN_QUERY,		// heap, type, index
+	TRACE_END_QUERY,		// heap, type, index
+	TRACE_RESOLVE_QUERY,	// heap, type, first, count, destination
+	TRACE_PREDICATION,		// buffer, offset, operation
+	TRACE_MARKER,			// size
+	TRACE_BEGIN_EVENT,		// size
+	TRACE_END_EVENT,
+
+	TRACE_OP_COUNT
+};
+
+// Names as they show up in reports
+const char* GetCommandTraceOpName(unsigned int op);
+
+// --------------------------------------------------------
+// Where a command list's records go while it's recorded.
+// One per list, only ever touched by whichever thread is
+// recording that list.
+// --------------------------------------------------------
+class CommandTraceBuffer
+{
+public:
+	std::vector<unsigned char> data;
+
+	void Clear() { data.clear(); }
+
+	// Op followed by any number of values
+	template<typename... Values>
+	void Record(CommandTraceOp op, Values... values)
+	{
+		data.push_back((unsigned char)op);
+		(Put(values), ...);
+	}
+
+	void Put(uint64_t value);
+	template<typename T>
+	void Put(T* object) { Put((uint64_t)(uintptr_t)object); }
+	void PutSigned(int64_t value);
+
+	// The file's first bytes
+	void WriteHeader();
+};
+
+// Frequently set state, for counting redundant sets
+enum CommandTraceState
+{
+	TRACE_STATE_PIPELINE,
+	TRACE_STATE_ROOT_SIGNATURE,
+	TRACE_STATE_ROOT_TABLE,
+	TRACE_STATE_ROOT_CONSTANTS,
+	TRACE_STATE_ROOT_VIEW,
+	TRACE_STATE_DESCRIPTOR_HEAPS,
+	TRACE_STATE_TOPOLOGY,
+	TRACE_STATE_VIEWPORTS,
+	TRACE_STATE_SCISSORS,
+	TRACE_STATE_VERTEX_BUFFERS,
+	TRACE_STATE_INDEX_BUFFER,
+	TRACE_STATE_RENDER_TARGETS,
+	TRACE_STATE_BLEND_FACTOR,
+	TRACE_STATE_STENCIL_REF,
+
+	TRACE_STATE_COUNT
+};
+
+// A run of draws with the same pipeline and root signature
+struct CommandTraceBatch
+{
+	unsigned int frame;
+	unsigned int list;
+	unsigned int firstCommand;	// Within the list
+	unsigned int draws;
+	uint64_t instances;
+	uint64_t primitives;		// Triangles for triangle lists (indirect draws count 0)
+	uint64_t pipeline;
+};
+
+struct CommandTraceStats
+{
+	unsigned int frames;
+	unsigned int submits;
+	unsigned int lists;
+	uint64_t bytes;
+	uint64_t commands;
+	uint64_t opCounts[TRACE_OP_COUNT];
+
+	uint64_t stateSets[TRACE_STATE_COUNT];
+	uint64_t redundantSets[TRACE_STATE_COUNT];	// Set to what was already there
+
+	// Binding churn: state that actually changed between one draw
+	// (or dispatch) and the one before it in the same list
+	uint64_t draws;				// Including indirect
+	uint64_t dispatches;
+	uint64_t drawChanges;
+	unsigned int maxDrawChanges;
+	uint64_t drawChangeHistogram[6];	// 0, 1, 2, 3-4, 5-8, 9+
+	uint64_t dispatchChanges;
+
+	// Barriers
+	uint64_t barrierCalls;
+	uint64_t barriers;
+	uint64_t transitions;
+	uint64_t aliasingBarriers;
+	uint64_t uavBarriers;
+	uint64_t splitBarriers;		// Begin or end only
+	uint64_t adjacentBarrierCalls; // Right after another barrier call - could've been one
+
+	std::vector<CommandTraceBatch> largestBatches; // Most draws first
+};
+
+// --------------------------------------------------------
+// Reads a whole trace and sums it up. Every list starts
+// from D3D12's default state, so redundancy is only ever
+// counted within a list.
+// --------------------------------------------------------
+class CommandTraceAnalyzer
+{
+public:
+	static bool LoadFile(const std::string& path, std::vector<unsigned char>& trace);
+
+	// Fails (and says where) on anything that isn't a complete trace
+	bool Analyze(const std::vector<unsigned char>& trace, std::string* error, unsigned int batchesToKeep = 10);
+
+	const CommandTraceStats& GetStats() const { return stats; }
+
+	// Human readable, and the same numbers as JSON for scripts
+	void WriteText(FILE* file) const;
+	bool WriteJson(const std::string& path) const;
+
+	// Percentage of state sets that didn't change anything
+	double GetRedundantPercent() const;
+
+	// Builds a small trace by hand and checks the numbers
+	static bool SelfTest(std::string* error);
+
+private:
+	CommandTraceStats stats;
+};
@@ -1,6 +1,129 @@
+// The fluid solver's stages (see FluidFunctions.hlsli and
+// FluidSolver.h). Every dispatch runs one stage, picked by mode,
+// over the whole grid - 8x8 cells of one slice per group, so 2D
+// grids (a depth of 1) don't waste any threads.
 #include "FluidFunctions.hlsli"
 
-[numthreads(1, 1, 1)]
-void main( uint3 DTid : SV_DispatchThreadID )
+// Must match FluidSolver.cpp
+#define MODE_CLEAR 0
+#define MODE_ADVECT 1
+#define MODE_FORCES 2
+#define MODE_DIFFUSE 3
+#define MODE_DIVERGENCE 4
+#define MODE_PRESSURE 5
+#define MODE_PROJECT 6
+
+Texture3D<float4> velocityIn : register(t0);
+Texture3D<float> densityIn : register(t1);
+Texture3D<float4> velocityStart : register(t2);	// Before diffusion started
+RWTexture3D<float4> velocityOut : register(u0);
+RWTexture3D<float> densityOut : register(u1);
+RWTexture3D<float> divergence : register(u2);
+RWTexture3D<float> pressure : register(u3);
+SamplerState linearClamp : register(s0);
+
+bool Inside(int3 cell)
+{
+	return all(cell >= 0) && all(cell < (int3)gridSize);
+}
+
+// Walls don't move
+float3 LoadVelocity(int3 cell)
+{
+	return Inside(cell) ? velocityIn.Load(int4(cell, 0)).xyz : float3(0, 0, 0);
+}
+
+// Walls have the same pressure as the cell next to them
+float LoadPressure(int3 cell, float center)
 {
-}
\ No newline at end of file
+	return Inside(cell) ? pressure[cell] : center;
+}
+
+static const int3 neighborOffsets[6] =
+{
+	int3(-1, 0, 0), int3(1, 0, 0),
+	int3(0, -1, 0), int3(0, 1, 0),
+	int3(0, 0, -1), int3(0, 0, 1)
+};
+
+[numthreads(8, 8, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	// Red-black passes only cover one color, so they're half as wide
+	uint3 cell = id;
+	if (mode == MODE_PRESSURE)
+		cell.x = id.x * 2 + ((id.y + id.z + parity) & 1);
+	if (any(cell >= gridSize))
+		return;
+	int3 c = (int3)cell;
+
+	if (mode == MODE_CLEAR)
+	{
+		velocityOut[cell] = float4(0, 0, 0, 0);
+		densityOut[cell] = 0;
+		divergence[cell] = 0;
+		pressure[cell] = 0;
+	}
+	else if (mode == MODE_ADVECT)
+	{
+		float3 from = Advection(cell, velocityIn.Load(int4(c, 0)).xyz);
+		velocityOut[cell] = float4(velocityIn.SampleLevel(linearClamp, from, 0).xyz * velocityDecay, 0);
+		densityOut[cell] = densityIn.SampleLevel(linearClamp, from, 0) * densityDecay;
+	}
+	else if (mode == MODE_FORCES)
+	{
+		// A soft splat of force and dye, plus buoyancy wherever there's dye
+		float3 offset = (float3)cell + 0.5f - forcePosition;
+		float falloff = exp(-dot(offset, offset) / (forceRadius * forceRadius));
+		float density = densityIn.Load(int4(c, 0));
+
+		float3 velocity = velocityIn.Load(int4(c, 0)).xyz;
+		velocity += deltaTime * (force * falloff + float3(0, buoyancy * density, 0));
+		velocityOut[cell] = float4(velocity, 0);
+		densityOut[cell] = density + deltaTime * dyeAmount * falloff;
+	}
+	else if (mode == MODE_DIFFUSE)
+	{
+		float3 neighbors = 0;
+		[unroll]
+		for (uint i = 0; i < 6; i++)
+			neighbors += LoadVelocity(c + neighborOffsets[i]);
+		velocityOut[cell] = float4(Diffusion(velocityStart.Load(int4(c, 0)).xyz, neighbors), 0);
+	}
+	else if (mode == MODE_DIVERGENCE)
+	{
+		divergence[cell] = Divergence(
+			LoadVelocity(c + neighborOffsets[0]), LoadVelocity(c + neighborOffsets[1]),
+			LoadVelocity(c + neighborOffsets[2]), LoadVelocity(c + neighborOffsets[3]),
+			LoadVelocity(c + neighborOffsets[4]), LoadVelocity(c + neighborOffsets[5]));
+	}
+	else if (mode == MODE_PRESSURE)
+	{
+		// In place - every neighbor is the other color, so nothing
+		// this pass reads is written by it
+		float neighbors = 0;
+		float neighborCount = 0;
+		[unroll]
+		for (uint i = 0; i < 6; i++)
+		{
+			int3 neighbor = c + neighborOffsets[i];
+			if (Inside(neighbor))
+			{
+				neighbors += pressure[neighbor];
+				neighborCount += 1;
+			}
+		}
+		if (neighborCount > 0)
+			pressure[cell] = Pressure(pressure[cell], neighbors, neighborCount, divergence[cell]);
+	}
+	else if (mode == MODE_PROJECT)
+	{
+		// Take the pressure gradient away, leaving a divergence free velocity
+		float center = pressure[cell];
+		float3 gradient = 0.5f * float3(
+			LoadPressure(c + neighborOffsets[1], center) - LoadPressure(c + neighborOffsets[0], center),
+			LoadPressure(c + neighborOffsets[3], center) - LoadPressure(c + neighborOffsets[2], center),
+			LoadPressure(c + neighborOffsets[5], center) - LoadPressure(c + neighborOffsets[4], center));
+		velocityOut[cell] = float4(velocityIn.Load(int4(c, 0)).xyz - gradient, 0);
+	}
+}
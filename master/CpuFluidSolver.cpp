@@ -0,0 +1,1023 @@
+#include "CpuFluidSolver.h"
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+
+#include <immintrin.h>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#include <cpuid.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// --------------------------------------------------------
+// CPU feature detection, done once and cached
+// --------------------------------------------------------
+static bool CheckAVX2Support()
+{
+	int info[4] = {};
+#if defined(_MSC_VER)
+	__cpuid(info, 0);
+#else
+	__cpuid(0, info[0], info[1], info[2], info[3]);
+#endif
+	if (info[0] < 7)
+		return false;
+
+#if defined(_MSC_VER)
+	__cpuid(info, 1);
+#else
+	__cpuid(1, info[0], info[1], info[2], info[3]);
+#endif
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+
+	// The OS also has to save the upper halves of the YMM registers
+#if defined(_MSC_VER)
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+	if ((xcr0 & 0x6) != 0x6)
+		return false;
+
+#if defined(_MSC_VER)
+	__cpuidex(info, 7, 0);
+#else
+	__cpuid_count(7, 0, info[0], info[1], info[2], info[3]);
+#endif
+	return (info[1] & (1 << 5)) != 0;
+}
+
+static const bool avx2Supported = CheckAVX2Support();
+
+bool CpuFluidSolver::IsPathSupported(Path path)
+{
+	return path == Path::Scalar || avx2Supported;
+}
+
+CpuFluidSolver::Path CpuFluidSolver::GetBestPath()
+{
+	return avx2Supported ? Path::AVX2 : Path::Scalar;
+}
+
+const char* CpuFluidSolver::GetPathName(Path path)
+{
+	switch (path)
+	{
+	case Path::Scalar: return "Scalar";
+	case Path::AVX2: return "AVX2";
+	}
+	return "Unknown";
+}
+
+// --------------------------------------------------------
+// Kernels
+//
+// Each stage has a scalar version that does a range of cells
+// in a row, and an AVX2 version that does as many blocks of
+// eight as fit in a range and returns where it stopped. The
+// AVX2 ones only ever get cells whose neighbors along x are
+// all inside the grid, the scalar ones take care of the ends.
+//
+// Both do the same operations in the same order (down to
+// adding a zero for a wall) so they round the same way.
+// --------------------------------------------------------
+
+// One row of cells along x, and which of its neighboring rows exist
+struct FluidRow
+{
+	size_t index;	// The row's first cell
+	size_t strideY;	// To the rows below and above
+	size_t strideZ;	// To the rows behind and in front
+	bool down;
+	bool up;
+	bool back;
+	bool front;
+};
+
+static FluidRow MakeRow(unsigned int y, unsigned int z, unsigned int rowLength, unsigned int height, unsigned int depth)
+{
+	FluidRow row;
+	row.index = (size_t)rowLength * (y + (size_t)height * z);
+	row.strideY = rowLength;
+	row.strideZ = (size_t)rowLength * height;
+	row.down = y > 0;
+	row.up = y + 1 < height;
+	row.back = z > 0;
+	row.front = z + 1 < depth;
+	return row;
+}
+
+static inline float Lerp(float a, float b, float t)
+{
+	return a + t * (b - a);
+}
+
+// Same as _mm256_max_ps then _mm256_min_ps, NaN included (it ends up at lo)
+static inline float Clamp(float value, float lo, float hi)
+{
+	value = value > lo ? value : lo;
+	return value < hi ? value : hi;
+}
+
+static inline int ClampIndex(int index, int last)
+{
+	index = index > 0 ? index : 0;
+	return index < last ? index : last;
+}
+
+// ---- Advection ----
+
+struct AdvectArgs
+{
+	const float* velocityIn[3];
+	const float* densityIn;
+	float* velocityOut[3];
+	float* densityOut;
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	float deltaTime;
+	float velocityDecay;
+	float densityDecay;
+};
+
+// Trilinear, x then y then z, between the eight corners
+static inline float Sample(const float* field, const size_t corners[8], float tx, float ty, float tz)
+{
+	float c00 = Lerp(field[corners[0]], field[corners[1]], tx);
+	float c10 = Lerp(field[corners[2]], field[corners[3]], tx);
+	float c01 = Lerp(field[corners[4]], field[corners[5]], tx);
+	float c11 = Lerp(field[corners[6]], field[corners[7]], tx);
+	return Lerp(Lerp(c00, c10, ty), Lerp(c01, c11, ty), tz);
+}
+
+// Follows the velocity back a step from each cell and samples there,
+// clamped to the edge cells like the GPU's linearClamp sampler. The
+// position is clamped to just past the edges first - further out
+// samples the same thing, and it keeps the floats convertible to ints.
+static void AdvectCells(const AdvectArgs& a, unsigned int y, unsigned int z, size_t row, unsigned int begin, unsigned int end)
+{
+	for (unsigned int x = begin; x < end; x++)
+	{
+		size_t i = row + x;
+		float px = Clamp((float)x - a.velocityIn[0][i] * a.deltaTime, -1.0f, (float)a.width);
+		float py = Clamp((float)y - a.velocityIn[1][i] * a.deltaTime, -1.0f, (float)a.height);
+		float pz = Clamp((float)z - a.velocityIn[2][i] * a.deltaTime, -1.0f, (float)a.depth);
+		float fx = floorf(px);
+		float fy = floorf(py);
+		float fz = floorf(pz);
+
+		int x0 = ClampIndex((int)fx, (int)a.width - 1), x1 = ClampIndex((int)fx + 1, (int)a.width - 1);
+		int y0 = ClampIndex((int)fy, (int)a.height - 1), y1 = ClampIndex((int)fy + 1, (int)a.height - 1);
+		int z0 = ClampIndex((int)fz, (int)a.depth - 1), z1 = ClampIndex((int)fz + 1, (int)a.depth - 1);
+		size_t rows[4] =
+		{
+			(size_t)a.width * (y0 + a.height * z0), (size_t)a.width * (y1 + a.height * z0),
+			(size_t)a.width * (y0 + a.height * z1), (size_t)a.width * (y1 + a.height * z1)
+		};
+		size_t corners[8];
+		for (int c = 0; c < 4; c++)
+		{
+			corners[c * 2] = rows[c] + x0;
+			corners[c * 2 + 1] = rows[c] + x1;
+		}
+
+		float tx = px - fx;
+		float ty = py - fy;
+		float tz = pz - fz;
+		for (int axis = 0; axis < 3; axis++)
+			a.velocityOut[axis][i] = Sample(a.velocityIn[axis], corners, tx, ty, tz) * a.velocityDecay;
+		a.densityOut[i] = Sample(a.densityIn, corners, tx, ty, tz) * a.densityDecay;
+	}
+}
+
+AVX2_TARGET static inline __m256 LerpAVX2(__m256 a, __m256 b, __m256 t)
+{
+	return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+AVX2_TARGET static inline __m256 SampleAVX2(const float* field, const __m256i corners[8], __m256 tx, __m256 ty, __m256 tz)
+{
+	__m256 c00 = LerpAVX2(_mm256_i32gather_ps(field, corners[0], 4), _mm256_i32gather_ps(field, corners[1], 4), tx);
+	__m256 c10 = LerpAVX2(_mm256_i32gather_ps(field, corners[2], 4), _mm256_i32gather_ps(field, corners[3], 4), tx);
+	__m256 c01 = LerpAVX2(_mm256_i32gather_ps(field, corners[4], 4), _mm256_i32gather_ps(field, corners[5], 4), tx);
+	__m256 c11 = LerpAVX2(_mm256_i32gather_ps(field, corners[6], 4), _mm256_i32gather_ps(field, corners[7], 4), tx);
+	return LerpAVX2(LerpAVX2(c00, c10, ty), LerpAVX2(c01, c11, ty), tz);
+}
+
+AVX2_TARGET static unsigned int AdvectCellsAVX2(const AdvectArgs& a, unsigned int y, unsigned int z, size_t row, unsigned int begin, unsigned int end)
+{
+	const __m256 deltaTime = _mm256_set1_ps(a.deltaTime);
+	const __m256 minusOne = _mm256_set1_ps(-1.0f);
+	const __m256 maxX = _mm256_set1_ps((float)a.width);
+	const __m256 maxY = _mm256_set1_ps((float)a.height);
+	const __m256 maxZ = _mm256_set1_ps((float)a.depth);
+	const __m256 cellY = _mm256_set1_ps((float)y);
+	const __m256 cellZ = _mm256_set1_ps((float)z);
+	const __m256 velocityDecay = _mm256_set1_ps(a.velocityDecay);
+	const __m256 densityDecay = _mm256_set1_ps(a.densityDecay);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i lastX = _mm256_set1_epi32(a.width - 1);
+	const __m256i lastY = _mm256_set1_epi32(a.height - 1);
+	const __m256i lastZ = _mm256_set1_epi32(a.depth - 1);
+	const __m256i width = _mm256_set1_epi32(a.width);
+	const __m256i height = _mm256_set1_epi32(a.height);
+
+	unsigned int x = begin;
+	for (; x + 8 <= end; x += 8)
+	{
+		size_t i = row + x;
+		__m256 cellX = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), lanes));
+		__m256 px = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(cellX, _mm256_mul_ps(_mm256_loadu_ps(a.velocityIn[0] + i), deltaTime)), minusOne), maxX);
+		__m256 py = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(cellY, _mm256_mul_ps(_mm256_loadu_ps(a.velocityIn[1] + i), deltaTime)), minusOne), maxY);
+		__m256 pz = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(cellZ, _mm256_mul_ps(_mm256_loadu_ps(a.velocityIn[2] + i), deltaTime)), minusOne), maxZ);
+		__m256 fx = _mm256_floor_ps(px);
+		__m256 fy = _mm256_floor_ps(py);
+		__m256 fz = _mm256_floor_ps(pz);
+
+		__m256i ix = _mm256_cvttps_epi32(fx);
+		__m256i iy = _mm256_cvttps_epi32(fy);
+		__m256i iz = _mm256_cvttps_epi32(fz);
+		__m256i x0 = _mm256_min_epi32(_mm256_max_epi32(ix, zero), lastX);
+		__m256i x1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(ix, one), zero), lastX);
+		__m256i y0 = _mm256_min_epi32(_mm256_max_epi32(iy, zero), lastY);
+		__m256i y1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(iy, one), zero), lastY);
+		__m256i z0 = _mm256_min_epi32(_mm256_max_epi32(iz, zero), lastZ);
+		__m256i z1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(iz, one), zero), lastZ);
+
+		__m256i slice0 = _mm256_mullo_epi32(height, z0);
+		__m256i slice1 = _mm256_mullo_epi32(height, z1);
+		__m256i rows[4] =
+		{
+			_mm256_mullo_epi32(width, _mm256_add_epi32(y0, slice0)), _mm256_mullo_epi32(width, _mm256_add_epi32(y1, slice0)),
+			_mm256_mullo_epi32(width, _mm256_add_epi32(y0, slice1)), _mm256_mullo_epi32(width, _mm256_add_epi32(y1, slice1))
+		};
+		__m256i corners[8];
+		for (int c = 0; c < 4; c++)
+		{
+			corners[c * 2] = _mm256_add_epi32(rows[c], x0);
+			corners[c * 2 + 1] = _mm256_add_epi32(rows[c], x1);
+		}
+
+		__m256 tx = _mm256_sub_ps(px, fx);
+		__m256 ty = _mm256_sub_ps(py, fy);
+		__m256 tz = _mm256_sub_ps(pz, fz);
+		for (int axis = 0; axis < 3; axis++)
+			_mm256_storeu_ps(a.velocityOut[axis] + i, _mm256_mul_ps(SampleAVX2(a.velocityIn[axis], corners, tx, ty, tz), velocityDecay));
+		_mm256_storeu_ps(a.densityOut + i, _mm256_mul_ps(SampleAVX2(a.densityIn, corners, tx, ty, tz), densityDecay));
+	}
+
+	// Avoid AVX -> SSE transition penalties in whatever runs next
+	_mm256_zeroupper();
+	return x;
+}
+
+// ---- Forces ----
+
+// In place - a cell only reads itself
+struct ForceArgs
+{
+	float* velocity[3];
+	float* density;
+	const float* falloffX;
+	float falloffYZ;	// Falloff along y times along z, for the whole row
+	float force[3];
+	float deltaTime;
+	float buoyancy;
+	float dyeStep;		// deltaTime * dyeAmount
+};
+
+static void ForceCells(const ForceArgs& a, size_t row, unsigned int begin, unsigned int end)
+{
+	for (unsigned int x = begin; x < end; x++)
+	{
+		size_t i = row + x;
+		float falloff = a.falloffX[x] * a.falloffYZ;
+		float density = a.density[i];
+		a.velocity[0][i] = a.velocity[0][i] + a.deltaTime * (a.force[0] * falloff);
+		a.velocity[1][i] = a.velocity[1][i] + a.deltaTime * (a.force[1] * falloff + a.buoyancy * density);
+		a.velocity[2][i] = a.velocity[2][i] + a.deltaTime * (a.force[2] * falloff);
+		a.density[i] = density + a.dyeStep * falloff;
+	}
+}
+
+AVX2_TARGET static unsigned int ForceCellsAVX2(const ForceArgs& a, size_t row, unsigned int begin, unsigned int end)
+{
+	const __m256 falloffYZ = _mm256_set1_ps(a.falloffYZ);
+	const __m256 forceX = _mm256_set1_ps(a.force[0]);
+	const __m256 forceY = _mm256_set1_ps(a.force[1]);
+	const __m256 forceZ = _mm256_set1_ps(a.force[2]);
+	const __m256 deltaTime = _mm256_set1_ps(a.deltaTime);
+	const __m256 buoyancy = _mm256_set1_ps(a.buoyancy);
+	const __m256 dyeStep = _mm256_set1_ps(a.dyeStep);
+
+	unsigned int x = begin;
+	for (; x + 8 <= end; x += 8)
+	{
+		size_t i = row + x;
+		__m256 falloff = _mm256_mul_ps(_mm256_loadu_ps(a.falloffX + x), falloffYZ);
+		__m256 density = _mm256_loadu_ps(a.density + i);
+		_mm256_storeu_ps(a.velocity[0] + i, _mm256_add_ps(_mm256_loadu_ps(a.velocity[0] + i),
+			_mm256_mul_ps(deltaTime, _mm256_mul_ps(forceX, falloff))));
+		_mm256_storeu_ps(a.velocity[1] + i, _mm256_add_ps(_mm256_loadu_ps(a.velocity[1] + i),
+			_mm256_mul_ps(deltaTime, _mm256_add_ps(_mm256_mul_ps(forceY, falloff), _mm256_mul_ps(buoyancy, density)))));
+		_mm256_storeu_ps(a.velocity[2] + i, _mm256_add_ps(_mm256_loadu_ps(a.velocity[2] + i),
+			_mm256_mul_ps(deltaTime, _mm256_mul_ps(forceZ, falloff))));
+		_mm256_storeu_ps(a.density + i, _mm256_add_ps(density, _mm256_mul_ps(dyeStep, falloff)));
+	}
+
+	_mm256_zeroupper();
+	return x;
+}
+
+// ---- Diffusion ----
+
+// One Jacobi iteration for one axis of velocity. Walls don't move (zeros).
+static void DiffuseCells(const FluidRow& row, unsigned int width, unsigned int begin, unsigned int end,
+	const float* in, const float* start, float* out, float alpha, float denominator)
+{
+	for (unsigned int x = begin; x < end; x++)
+	{
+		size_t i = row.index + x;
+		float neighbors = 0.0f;
+		neighbors += x > 0 ? in[i - 1] : 0.0f;
+		neighbors += x + 1 < width ? in[i + 1] : 0.0f;
+		neighbors += row.down ? in[i - row.strideY] : 0.0f;
+		neighbors += row.up ? in[i + row.strideY] : 0.0f;
+		neighbors += row.back ? in[i - row.strideZ] : 0.0f;
+		neighbors += row.front ? in[i + row.strideZ] : 0.0f;
+		out[i] = (start[i] + alpha * neighbors) / denominator;
+	}
+}
+
+AVX2_TARGET static unsigned int DiffuseCellsAVX2(const FluidRow& row, unsigned int begin, unsigned int end,
+	const float* in, const float* start, float* out, float alpha, float denominator)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 alphas = _mm256_set1_ps(alpha);
+	const __m256 denominators = _mm256_set1_ps(denominator);
+
+	unsigned int x = begin;
+	for (; x + 8 <= end; x += 8)
+	{
+		size_t i = row.index + x;
+		__m256 neighbors = zero;
+		neighbors = _mm256_add_ps(neighbors, _mm256_loadu_ps(in + i - 1));
+		neighbors = _mm256_add_ps(neighbors, _mm256_loadu_ps(in + i + 1));
+		neighbors = _mm256_add_ps(neighbors, row.down ? _mm256_loadu_ps(in + i - row.strideY) : zero);
+		neighbors = _mm256_add_ps(neighbors, row.up ? _mm256_loadu_ps(in + i + row.strideY) : zero);
+		neighbors = _mm256_add_ps(neighbors, row.back ? _mm256_loadu_ps(in + i - row.strideZ) : zero);
+		neighbors = _mm256_add_ps(neighbors, row.front ? _mm256_loadu_ps(in + i + row.strideZ) : zero);
+		_mm256_storeu_ps(out + i, _mm256_div_ps(_mm256_add_ps(_mm256_loadu_ps(start + i), _mm256_mul_ps(alphas, neighbors)), denominators));
+	}
+
+	_mm256_zeroupper();
+	return x;
+}
+
+// ---- Divergence ----
+
+static void DivergenceCells(const FluidRow& row, unsigned int width, unsigned int begin, unsigned int end,
+	const float* const velocity[3], float* divergence)
+{
+	const float* u = velocity[0];
+	const float* v = velocity[1];
+	const float* w = velocity[2];
+	for (unsigned int x = begin; x < end; x++)
+	{
+		size_t i = row.index + x;
+		float left = x > 0 ? u[i - 1] : 0.0f;
+		float right = x + 1 < width ? u[i + 1] : 0.0f;
+		float down = row.down ? v[i - row.strideY] : 0.0f;
+		float up = row.up ? v[i + row.strideY] : 0.0f;
+		float back = row.back ? w[i - row.strideZ] : 0.0f;
+		float front = row.front ? w[i + row.strideZ] : 0.0f;
+		divergence[i] = 0.5f * (((right - left) + (up - down)) + (front - back));
+	}
+}
+
+AVX2_TARGET static unsigned int DivergenceCellsAVX2(const FluidRow& row, unsigned int begin, unsigned int end,
+	const float* const velocity[3], float* divergence)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const float* u = velocity[0];
+	const float* v = velocity[1];
+	const float* w = velocity[2];
+
+	unsigned int x = begin;
+	for (; x + 8 <= end; x += 8)
+	{
+		size_t i = row.index + x;
+		__m256 left = _mm256_loadu_ps(u + i - 1);
+		__m256 right = _mm256_loadu_ps(u + i + 1);
+		__m256 down = row.down ? _mm256_loadu_ps(v + i - row.strideY) : zero;
+		__m256 up = row.up ? _mm256_loadu_ps(v + i + row.strideY) : zero;
+		__m256 back = row.back ? _mm256_loadu_ps(w + i - row.strideZ) : zero;
+		__m256 front = row.front ? _mm256_loadu_ps(w + i + row.strideZ) : zero;
+		__m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(right, left), _mm256_sub_ps(up, down)), _mm256_sub_ps(front, back));
+		_mm256_storeu_ps(divergence + i, _mm256_mul_ps(half, sum));
+	}
+
+	_mm256_zeroupper();
+	return x;
+}
+
+// ---- Pressure ----
+
+// One color of one row, in the red-black arrays: cell k of the row
+// is at x = 2k + offset. Every neighbor is the other color, and sits
+// at k - 1 + offset (left), k + offset (right) or k (any other row).
+// Walls don't count as neighbors, same as ComputeShader.hlsl.
+struct PressureArgs
+{
+	float* pressure;				// This color
+	const float* otherPressure;		// The other color
+	const float* divergence;		// This color
+	unsigned int width;
+	unsigned int offset;
+	float overRelaxation;
+};
+
+static void PressureCells(const PressureArgs& a, const FluidRow& row, unsigned int begin, unsigned int end)
+{
+	for (unsigned int k = begin; k < end; k++)
+	{
+		size_t i = row.index + k;
+		unsigned int x = k * 2 + a.offset;
+		float neighbors = 0.0f;
+		float neighborCount = 0.0f;
+		if (x > 0) { neighbors += a.otherPressure[i - 1 + a.offset]; neighborCount += 1.0f; }
+		if (x + 1 < a.width) { neighbors += a.otherPressure[i + a.offset]; neighborCount += 1.0f; }
+		if (row.down) { neighbors += a.otherPressure[i - row.strideY]; neighborCount += 1.0f; }
+		if (row.up) { neighbors += a.otherPressure[i + row.strideY]; neighborCount += 1.0f; }
+		if (row.back) { neighbors += a.otherPressure[i - row.strideZ]; neighborCount += 1.0f; }
+		if (row.front) { neighbors += a.otherPressure[i + row.strideZ]; neighborCount += 1.0f; }
+		if (neighborCount > 0.0f)
+		{
+			float solved = (neighbors - a.divergence[i]) / neighborCount;
+			a.pressure[i] = Lerp(a.pressure[i], solved, a.overRelaxation);
+		}
+	}
+}
+
+// Cells with both x neighbors, so only the other rows can be walls
+AVX2_TARGET static unsigned int PressureCellsAVX2(const PressureArgs& a, const FluidRow& row, unsigned int begin, unsigned int end)
+{
+	float count = 0.0f;
+	count += 1.0f;
+	count += 1.0f;
+	if (row.down) count += 1.0f;
+	if (row.up) count += 1.0f;
+	if (row.back) count += 1.0f;
+	if (row.front) count += 1.0f;
+	const __m256 neighborCount = _mm256_set1_ps(count);
+	const __m256 overRelaxation = _mm256_set1_ps(a.overRelaxation);
+
+	unsigned int k = begin;
+	for (; k + 8 <= end; k += 8)
+	{
+		size_t i = row.index + k;
+		__m256 neighbors = _mm256_setzero_ps();
+		neighbors = _mm256_add_ps(neighbors, _mm256_loadu_ps(a.otherPressure + i - 1 + a.offset));
+		neighbors = _mm256_add_ps(neighbors, _mm256_loadu_ps(a.otherPressure + i + a.offset));
+		if (row.down) neighbors = _mm256_add_ps(neighbors, _mm256_loadu_ps(a.otherPressure + i - row.strideY));
+		if (row.up) neighbors = _mm256_add_ps(neighbors, _mm256_loadu_ps(a.otherPressure + i + row.strideY));
+		if (row.back) neighbors = _mm256_add_ps(neighbors, _mm256_loadu_ps(a.otherPressure + i - row.strideZ));
+		if (row.front) neighbors = _mm256_add_ps(neighbors, _mm256_loadu_ps(a.otherPressure + i + row.strideZ));
+
+		__m256 current = _mm256_loadu_ps(a.pressure + i);
+		__m256 solved = _mm256_div_ps(_mm256_sub_ps(neighbors, _mm256_loadu_ps(a.divergence + i)), neighborCount);
+		_mm256_storeu_ps(a.pressure + i, LerpAVX2(current, solved, overRelaxation));
+	}
+
+	_mm256_zeroupper();
+	return k;
+}
+
+// ---- Projection ----
+
+// In place - subtracts the pressure gradient. Walls have the same
+// pressure as the cell next to them.
+static void ProjectCells(const FluidRow& row, unsigned int width, unsigned int begin, unsigned int end,
+	const float* pressure, float* const velocity[3])
+{
+	for (unsigned int x = begin; x < end; x++)
+	{
+		size_t i = row.index + x;
+		float center = pressure[i];
+		float left = x > 0 ? pressure[i - 1] : center;
+		float right = x + 1 < width ? pressure[i + 1] : center;
+		float down = row.down ? pressure[i - row.strideY] : center;
+		float up = row.up ? pressure[i + row.strideY] : center;
+		float back = row.back ? pressure[i - row.strideZ] : center;
+		float front = row.front ? pressure[i + row.strideZ] : center;
+		velocity[0][i] = velocity[0][i] - 0.5f * (right - left);
+		velocity[1][i] = velocity[1][i] - 0.5f * (up - down);
+		velocity[2][i] = velocity[2][i] - 0.5f * (front - back);
+	}
+}
+
+AVX2_TARGET static unsigned int ProjectCellsAVX2(const FluidRow& row, unsigned int begin, unsigned int end,
+	const float* pressure, float* const velocity[3])
+{
+	const __m256 half = _mm256_set1_ps(0.5f);
+
+	unsigned int x = begin;
+	for (; x + 8 <= end; x += 8)
+	{
+		size_t i = row.index + x;
+		__m256 center = _mm256_loadu_ps(pressure + i);
+		__m256 left = _mm256_loadu_ps(pressure + i - 1);
+		__m256 right = _mm256_loadu_ps(pressure + i + 1);
+		__m256 down = row.down ? _mm256_loadu_ps(pressure + i - row.strideY) : center;
+		__m256 up = row.up ? _mm256_loadu_ps(pressure + i + row.strideY) : center;
+		__m256 back = row.back ? _mm256_loadu_ps(pressure + i - row.strideZ) : center;
+		__m256 front = row.front ? _mm256_loadu_ps(pressure + i + row.strideZ) : center;
+		_mm256_storeu_ps(velocity[0] + i, _mm256_sub_ps(_mm256_loadu_ps(velocity[0] + i), _mm256_mul_ps(half, _mm256_sub_ps(right, left))));
+		_mm256_storeu_ps(velocity[1] + i, _mm256_sub_ps(_mm256_loadu_ps(velocity[1] + i), _mm256_mul_ps(half, _mm256_sub_ps(up, down))));
+		_mm256_storeu_ps(velocity[2] + i, _mm256_sub_ps(_mm256_loadu_ps(velocity[2] + i), _mm256_mul_ps(half, _mm256_sub_ps(front, back))));
+	}
+
+	_mm256_zeroupper();
+	return x;
+}
+
+// --------------------------------------------------------
+// Solver
+// --------------------------------------------------------
+CpuFluidSolver::CpuFluidSolver() :
+	path(GetBestPath()),
+	parallel(true),
+	tileSize(8),
+	width(0),
+	height(0),
+	depth(0),
+	halfWidth(0),
+	currentVelocity(0),
+	currentDensity(0)
+{
+}
+
+void CpuFluidSolver::SetThreading(bool parallel, unsigned int tileSize)
+{
+	this->parallel = parallel;
+	this->tileSize = tileSize > 0 ? tileSize : 1;
+}
+
+bool CpuFluidSolver::UseAVX2() const
+{
+	return path == Path::AVX2 && avx2Supported;
+}
+
+void CpuFluidSolver::Resize(unsigned int width, unsigned int height, unsigned int depth)
+{
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	halfWidth = (width + 1) / 2;
+
+	size_t cells = (size_t)width * height * depth;
+	size_t halfCells = (size_t)halfWidth * height * depth;
+	for (VelocityField& field : velocity)
+		for (std::vector<float>& axis : field.axis)
+			axis.assign(cells, 0.0f);
+	for (std::vector<float>& field : density)
+		field.assign(cells, 0.0f);
+	divergence.assign(cells, 0.0f);
+	pressure.assign(cells, 0.0f);
+	for (unsigned int color = 0; color < 2; color++)
+	{
+		divergenceRedBlack[color].assign(halfCells, 0.0f);
+		pressureRedBlack[color].assign(halfCells, 0.0f);
+	}
+	falloff[0].resize(width);
+	falloff[1].resize(height);
+	falloff[2].resize(depth);
+
+	currentVelocity = 0;
+	currentDensity = 0;
+}
+
+void CpuFluidSolver::Reset()
+{
+	Resize(width, height, depth);
+}
+
+template <typename RowFunction>
+void CpuFluidSolver::ForEachRow(const RowFunction& function)
+{
+	// Square tiles of rows (in y and z), walked a slice at a time, so the
+	// rows above, below, behind and in front of each one were just used
+	// and are still in cache. Tiles never share a row, and nothing reads
+	// what a stage is writing, so any split gives the same answer.
+	unsigned int tilesY = (height + tileSize - 1) / tileSize;
+	unsigned int tilesZ = (depth + tileSize - 1) / tileSize;
+	auto runTiles = [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int tile = begin; tile < end; tile++)
+		{
+			unsigned int startY = (tile % tilesY) * tileSize;
+			unsigned int startZ = (tile / tilesY) * tileSize;
+			unsigned int endY = startY + tileSize < height ? startY + tileSize : height;
+			unsigned int endZ = startZ + tileSize < depth ? startZ + tileSize : depth;
+			for (unsigned int z = startZ; z < endZ; z++)
+				for (unsigned int y = startY; y < endY; y++)
+					function(y, z);
+		}
+	};
+
+	if (parallel)
+		JobSystem::GetInstance().ParallelFor(tilesY * tilesZ, 1, runTiles);
+	else
+		runTiles(0, tilesY * tilesZ);
+}
+
+void CpuFluidSolver::Step(const FluidSettings& settings, unsigned int steps, float stepSeconds, double stepTime)
+{
+	if (settings.gridSize == 0 || steps == 0)
+		return;
+
+	PROFILE_FUNCTION();
+
+	// New grid size?
+	unsigned int wantDepth = settings.twoDimensional ? 1 : settings.gridSize;
+	if (width != settings.gridSize || height != settings.gridSize || depth != wantDepth)
+		Resize(settings.gridSize, settings.gridSize, wantDepth);
+
+	for (unsigned int i = 0; i < steps; i++)
+	{
+		// Same order as FluidSolver::RecordStep()
+		FluidStepParameters step(settings, width, height, depth, stepSeconds, stepTime + i * (double)stepSeconds);
+		Advect(step);
+		AddForces(step);
+		if (settings.viscosity > 0.0f && settings.diffusionIterations > 0)
+			Diffuse(step, settings.diffusionIterations);
+		ComputeDivergence();
+		SolvePressure(step.overRelaxation, settings.pressureIterations);
+		Project();
+	}
+}
+
+void CpuFluidSolver::Advect(const FluidStepParameters& step)
+{
+	unsigned int nextVelocity = (currentVelocity + 1) % 3;
+	AdvectArgs a;
+	for (unsigned int axis = 0; axis < 3; axis++)
+	{
+		a.velocityIn[axis] = velocity[currentVelocity].axis[axis].data();
+		a.velocityOut[axis] = velocity[nextVelocity].axis[axis].data();
+	}
+	a.densityIn = density[currentDensity].data();
+	a.densityOut = density[1 - currentDensity].data();
+	a.width = width;
+	a.height = height;
+	a.depth = depth;
+	a.deltaTime = step.deltaTime;
+	a.velocityDecay = step.velocityDecay;
+	a.densityDecay = step.densityDecay;
+
+	bool avx2 = UseAVX2();
+	ForEachRow([&](unsigned int y, unsigned int z)
+	{
+		size_t row = (size_t)width * (y + (size_t)height * z);
+		unsigned int x = avx2 ? AdvectCellsAVX2(a, y, z, row, 0, width) : 0;
+		AdvectCells(a, y, z, row, x, width);
+	});
+
+	currentVelocity = nextVelocity;
+	currentDensity = 1 - currentDensity;
+}
+
+void CpuFluidSolver::AddForces(const FluidStepParameters& step)
+{
+	// exp(-distance^2 / radius^2) splits into one exp per axis, multiplied -
+	// a few hundred exps a step instead of one per cell
+	float radiusSquared = step.forceRadius * step.forceRadius;
+	for (unsigned int axis = 0; axis < 3; axis++)
+	{
+		for (size_t i = 0; i < falloff[axis].size(); i++)
+		{
+			float offset = ((float)i + 0.5f) - step.forcePosition[axis];
+			falloff[axis][i] = expf(-(offset * offset) / radiusSquared);
+		}
+	}
+
+	ForceArgs a;
+	for (unsigned int axis = 0; axis < 3; axis++)
+	{
+		a.velocity[axis] = velocity[currentVelocity].axis[axis].data();
+		a.force[axis] = step.force[axis];
+	}
+	a.density = density[currentDensity].data();
+	a.falloffX = falloff[0].data();
+	a.deltaTime = step.deltaTime;
+	a.buoyancy = step.buoyancy;
+	a.dyeStep = step.deltaTime * step.dyeAmount;
+
+	bool avx2 = UseAVX2();
+	ForEachRow([&](unsigned int y, unsigned int z)
+	{
+		ForceArgs rowArgs = a;
+		rowArgs.falloffYZ = falloff[1][y] * falloff[2][z];
+		size_t row = (size_t)width * (y + (size_t)height * z);
+		unsigned int x = avx2 ? ForceCellsAVX2(rowArgs, row, 0, width) : 0;
+		ForceCells(rowArgs, row, x, width);
+	});
+}
+
+void CpuFluidSolver::Diffuse(const FluidStepParameters& step, unsigned int iterations)
+{
+	// Velocity fields other than these two
+	auto other = [](unsigned int a, unsigned int b)
+	{
+		for (unsigned int i = 0; i < 3; i++)
+			if (i != a && i != b)
+				return i;
+		return 0u;
+	};
+
+	float alpha = step.diffusionAlpha;
+	float denominator = 1.0f + 6.0f * alpha;
+	bool avx2 = UseAVX2() && width > 2;
+
+	unsigned int start = currentVelocity;
+	unsigned int guess = start;
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		unsigned int next = other(start, guess);
+		ForEachRow([&](unsigned int y, unsigned int z)
+		{
+			FluidRow row = MakeRow(y, z, width, height, depth);
+			for (unsigned int axis = 0; axis < 3; axis++)
+			{
+				const float* in = velocity[guess].axis[axis].data();
+				const float* from = velocity[start].axis[axis].data();
+				float* out = velocity[next].axis[axis].data();
+				unsigned int x = 0;
+				if (avx2)
+				{
+					DiffuseCells(row, width, 0, 1, in, from, out, alpha, denominator);
+					x = DiffuseCellsAVX2(row, 1, width - 1, in, from, out, alpha, denominator);
+				}
+				DiffuseCells(row, width, x, width, in, from, out, alpha, denominator);
+			}
+		});
+		guess = next;
+	}
+	currentVelocity = guess;
+}
+
+void CpuFluidSolver::ComputeDivergence()
+{
+	const float* in[3];
+	for (unsigned int axis = 0; axis < 3; axis++)
+		in[axis] = velocity[currentVelocity].axis[axis].data();
+
+	bool avx2 = UseAVX2() && width > 2;
+	ForEachRow([&](unsigned int y, unsigned int z)
+	{
+		FluidRow row = MakeRow(y, z, width, height, depth);
+		unsigned int x = 0;
+		if (avx2)
+		{
+			DivergenceCells(row, width, 0, 1, in, divergence.data());
+			x = DivergenceCellsAVX2(row, 1, width - 1, in, divergence.data());
+		}
+		DivergenceCells(row, width, x, width, in, divergence.data());
+
+		// The pressure solve wants it split by color
+		size_t redBlackRow = (size_t)halfWidth * (y + (size_t)height * z);
+		for (unsigned int cell = 0; cell < width; cell++)
+			divergenceRedBlack[(cell + y + z) & 1][redBlackRow + cell / 2] = divergence[row.index + cell];
+	});
+}
+
+void CpuFluidSolver::SolvePressure(float overRelaxation, unsigned int iterations)
+{
+	bool avx2 = UseAVX2();
+	for (unsigned int i = 0; i < iterations * 2; i++)
+	{
+		unsigned int color = i % 2;
+		PressureArgs a;
+		a.pressure = pressureRedBlack[color].data();
+		a.otherPressure = pressureRedBlack[1 - color].data();
+		a.divergence = divergenceRedBlack[color].data();
+		a.width = width;
+		a.overRelaxation = overRelaxation;
+
+		ForEachRow([&](unsigned int y, unsigned int z)
+		{
+			FluidRow row = MakeRow(y, z, halfWidth, height, depth);
+			PressureArgs rowArgs = a;
+			rowArgs.offset = (y + z + color) & 1;
+
+			// This color's cells in the row, and the ones with both x neighbors
+			unsigned int count = (width - rowArgs.offset + 1) / 2;
+			unsigned int interiorBegin = 1 - rowArgs.offset;
+			unsigned int interiorEnd = width >= 2 + rowArgs.offset ? (width - 2 - rowArgs.offset) / 2 + 1 : 0;
+
+			unsigned int k = 0;
+			if (avx2 && interiorEnd > interiorBegin)
+			{
+				PressureCells(rowArgs, row, 0, interiorBegin);
+				k = PressureCellsAVX2(rowArgs, row, interiorBegin, interiorEnd);
+			}
+			PressureCells(rowArgs, row, k, count);
+		});
+	}
+
+	// Back to one grid for projection
+	ForEachRow([&](unsigned int y, unsigned int z)
+	{
+		size_t row = (size_t)width * (y + (size_t)height * z);
+		size_t redBlackRow = (size_t)halfWidth * (y + (size_t)height * z);
+		for (unsigned int x = 0; x < width; x++)
+			pressure[row + x] = pressureRedBlack[(x + y + z) & 1][redBlackRow + x / 2];
+	});
+}
+
+void CpuFluidSolver::Project()
+{
+	float* out[3];
+	for (unsigned int axis = 0; axis < 3; axis++)
+		out[axis] = velocity[currentVelocity].axis[axis].data();
+
+	bool avx2 = UseAVX2() && width > 2;
+	ForEachRow([&](unsigned int y, unsigned int z)
+	{
+		FluidRow row = MakeRow(y, z, width, height, depth);
+		unsigned int x = 0;
+		if (avx2)
+		{
+			ProjectCells(row, width, 0, 1, pressure.data(), out);
+			x = ProjectCellsAVX2(row, 1, width - 1, pressure.data(), out);
+		}
+		ProjectCells(row, width, x, width, pressure.data(), out);
+	});
+}
+
+// --------------------------------------------------------
+// Self test and benchmark
+// --------------------------------------------------------
+
+// Sum of squares, in doubles so it doesn't depend on anything but the values
+static double SumOfSquares(const float* values, unsigned int count)
+{
+	double sum = 0.0;
+	for (unsigned int i = 0; i < count; i++)
+		sum += (double)values[i] * values[i];
+	return sum;
+}
+
+bool CpuFluidSolver::SelfTest(std::string* error)
+{
+	auto fail = [&](const std::string& message)
+	{
+		if (error) *error = message;
+		return false;
+	};
+
+	// Every field, bit for bit
+	auto same = [](const CpuFluidSolver& a, const CpuFluidSolver& b)
+	{
+		size_t bytes = sizeof(float) * a.GetCellCount();
+		if (a.GetCellCount() != b.GetCellCount())
+			return false;
+		for (unsigned int axis = 0; axis < 3; axis++)
+			if (memcmp(a.GetVelocity(axis), b.GetVelocity(axis), bytes) != 0)
+				return false;
+		return memcmp(a.GetDensity(), b.GetDensity(), bytes) == 0 &&
+			memcmp(a.GetPressure(), b.GetPressure(), bytes) == 0;
+	};
+
+	// Odd sizes, so rows end partway through a block of eight and
+	// the red and black halves of a row aren't the same length.
+	// Power of two step so split up runs add up to the same times.
+	FluidSettings settings;
+	settings.enabled = true;
+	settings.gridSize = 21;
+	const float stepSeconds = 1.0f / 64.0f;
+	const unsigned int steps = 6;
+
+	for (int twoDimensional = 0; twoDimensional < 2; twoDimensional++)
+	{
+		settings.twoDimensional = twoDimensional == 1;
+		std::string grid = twoDimensional ? "2D: " : "3D: ";
+
+		// One thread, one row at a time, no SIMD
+		CpuFluidSolver reference;
+		reference.SetPath(Path::Scalar);
+		reference.SetThreading(false, 1);
+		reference.Step(settings, steps, stepSeconds, 0.0);
+
+		CpuFluidSolver tiled;
+		tiled.SetPath(Path::Scalar);
+		tiled.SetThreading(true, 4);
+		tiled.Step(settings, steps, stepSeconds, 0.0);
+		if (!same(reference, tiled))
+			return fail(grid + "tiled and threaded results differ from serial ones");
+
+		if (IsPathSupported(Path::AVX2))
+		{
+			CpuFluidSolver simd;
+			simd.SetPath(Path::AVX2);
+			simd.SetThreading(true, 3);
+			simd.Step(settings, steps, stepSeconds, 0.0);
+			if (!same(reference, simd))
+				return fail(grid + "AVX2 results differ from scalar ones");
+		}
+
+		// However the fixed steps were spread over frames
+		CpuFluidSolver split;
+		split.Step(settings, 2, stepSeconds, 0.0);
+		split.Step(settings, steps - 2, stepSeconds, 2 * (double)stepSeconds);
+		if (!same(reference, split))
+			return fail(grid + "splitting steps across calls changes the results");
+
+		// Dye went in, and the projection took divergence out
+		double dye = 0.0;
+		for (unsigned int i = 0; i < reference.GetCellCount(); i++)
+			dye += reference.GetDensity()[i];
+		if (!(dye > 0.0))
+			return fail(grid + "no dye was added");
+
+		double before = SumOfSquares(reference.GetDivergence(), reference.GetCellCount());
+		reference.ComputeDivergence();
+		double after = SumOfSquares(reference.GetDivergence(), reference.GetCellCount());
+		if (!(before > 0.0) || !(after < before * 0.5))
+			return fail(grid + "projection didn't reduce divergence");
+	}
+
+	// Nothing pushing, nothing moves
+	settings.twoDimensional = false;
+	settings.forceStrength = 0.0f;
+	settings.dyeAmount = 0.0f;
+	CpuFluidSolver still;
+	still.Step(settings, steps, stepSeconds, 0.0);
+	for (unsigned int i = 0; i < still.GetCellCount(); i++)
+	{
+		if (still.GetVelocity(0)[i] != 0.0f || still.GetVelocity(1)[i] != 0.0f || still.GetVelocity(2)[i] != 0.0f ||
+			still.GetDensity()[i] != 0.0f || still.GetPressure()[i] != 0.0f)
+			return fail("an empty grid didn't stay empty");
+	}
+
+	if (error) error->clear();
+	return true;
+}
+
+CpuFluidSolver::BenchmarkResult CpuFluidSolver::RunBenchmark(unsigned int gridSize, unsigned int steps)
+{
+	FluidSettings settings;
+	settings.enabled = true;
+	settings.gridSize = gridSize;
+	const float stepSeconds = 1.0f / 60.0f;
+
+	BenchmarkResult result = {};
+	result.workerCount = JobSystem::GetInstance().GetWorkerCount();
+	result.steps = steps;
+
+	Path paths[] = { Path::Scalar, Path::AVX2 };
+	for (Path path : paths)
+	{
+		if (!IsPathSupported(path))
+			continue;
+
+		for (int parallel = 0; parallel < 2; parallel++)
+		{
+			CpuFluidSolver solver;
+			solver.SetPath(path);
+			solver.SetThreading(parallel == 1);
+
+			// One warm up step, which also allocates the grid
+			solver.Step(settings, 1, stepSeconds, 0.0);
+			result.cellCount = solver.GetCellCount();
+
+			auto start = std::chrono::high_resolution_clock::now();
+			solver.Step(settings, steps, stepSeconds, stepSeconds);
+			auto end = std::chrono::high_resolution_clock::now();
+
+			double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+			double cellsPerSecond = seconds > 0.0 ? (double)result.cellCount * steps / seconds : 0.0;
+			if (parallel)
+				result.cellsPerSecond[(int)path] = cellsPerSecond;
+			else
+				result.serialCellsPerSecond[(int)path] = cellsPerSecond;
+		}
+	}
+
+	return result;
+}
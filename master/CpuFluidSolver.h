@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "FluidSettings.h"
+
+// --------------------------------------------------------
+// The same stable fluids steps as FluidSolver (and
+// FluidFunctions.hlsli), on the CPU - for checking the GPU
+// version against, and for running simulations headless.
+// Nothing in here needs Windows or D3D.
+//
+// Every field is its own flat array of floats (structure of
+// arrays, x + width * (y + height * z)), so a row of cells is
+// a row of floats and the stencils load eight neighbors at a
+// time with AVX2. Pressure lives split into red and black
+// halves, so each red-black pass reads one array and writes
+// the other with every lane doing useful work.
+//
+// Work is split into tiles of rows across the job system.
+// Every stage either writes a different array than it reads
+// or (red-black) only reads cells nobody is writing, so the
+// results don't depend on how the rows were split up, how
+// many threads ran them or the order they ran in. The AVX2
+// kernels do the exact same math in the same order as the
+// scalar ones, so both paths are bit-for-bit identical too.
+// (That needs a build without FMA contraction - MSVC's
+// default, -ffp-contract=off on GCC/Clang.)
+//
+// The GPU stores velocity as halfs and samples with 8 bit
+// filter weights, so the two agree closely, not exactly.
+// --------------------------------------------------------
+class CpuFluidSolver
+{
+public:
+	enum class Path
+	{
+		Scalar,
+		AVX2
+	};
+
+	// Cells stepped per second, over a few steps of the default settings
+	struct BenchmarkResult
+	{
+		unsigned int cellCount;
+		unsigned int workerCount;
+		unsigned int steps;
+		double cellsPerSecond[2];		// Indexed by Path, across every worker (0 if the CPU can't run AVX2)
+		double serialCellsPerSecond[2];	// Same, but everything on the calling thread
+	};
+
+	CpuFluidSolver();
+
+	// Runs the given number of steps, resizing (and emptying) the grid first
+	// if the settings' size changed. stepTime is the simulated time at the
+	// start of the first step, same as FluidSolver::Step(). The settings'
+	// enabled flag is ignored - calling this is enabling it.
+	void Step(const FluidSettings& settings, unsigned int steps, float stepSeconds, double stepTime);
+
+	// Empties the grid
+	void Reset();
+
+	// Which kernels run (AVX2 falls back to scalar on CPUs without it),
+	// and how the work is split: parallel runs tiles of tileSize x tileSize
+	// rows across the job system, otherwise it's all on the calling thread
+	void SetPath(Path path) { this->path = path; }
+	Path GetPath() const { return path; }
+	void SetThreading(bool parallel, unsigned int tileSize = 8);
+
+	unsigned int GetWidth() const { return width; }
+	unsigned int GetHeight() const { return height; }
+	unsigned int GetDepth() const { return depth; }
+	unsigned int GetCellCount() const { return width * height * depth; }
+
+	// Whole grids, x + width * (y + height * z)
+	const float* GetVelocity(unsigned int axis) const { return velocity[currentVelocity].axis[axis].data(); }
+	const float* GetDensity() const { return density[currentDensity].data(); }
+	const float* GetDivergence() const { return divergence.data(); }	// Before the last projection
+	const float* GetPressure() const { return pressure.data(); }
+
+	static Path GetBestPath();
+	static bool IsPathSupported(Path path);
+	static const char* GetPathName(Path path);
+
+	// Scalar vs AVX2 and serial vs parallel give identical results, an empty
+	// grid stays empty, dye goes in and projection takes divergence out
+	static bool SelfTest(std::string* error = 0);
+
+	// Times every supported path on a gridSize^3 grid
+	static BenchmarkResult RunBenchmark(unsigned int gridSize = 64, unsigned int steps = 4);
+
+private:
+	struct VelocityField
+	{
+		std::vector<float> axis[3];
+	};
+
+	Path path;
+	bool parallel;
+	unsigned int tileSize;
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	unsigned int halfWidth; // Cells of one color per row in the red-black arrays (rounded up)
+
+	// Three velocities so diffusion has a fixed starting field to iterate against
+	VelocityField velocity[3];
+	std::vector<float> density[2];
+	unsigned int currentVelocity;
+	unsigned int currentDensity;
+
+	std::vector<float> divergence;
+	std::vector<float> pressure;
+
+	// Red (0) and black (1) cells, halfWidth per row. Pressure stays in
+	// here between steps (it's the next solve's first guess) and gets
+	// copied out to the whole grid for projection.
+	std::vector<float> divergenceRedBlack[2];
+	std::vector<float> pressureRedBlack[2];
+
+	// Force splat falloff along each axis for the current step
+	std::vector<float> falloff[3];
+
+	void Resize(unsigned int width, unsigned int height, unsigned int depth);
+	bool UseAVX2() const;
+
+	// Calls function(y, z) for every row, a tile at a time
+	template <typename RowFunction>
+	void ForEachRow(const RowFunction& function);
+
+	void Advect(const FluidStepParameters& step);
+	void AddForces(const FluidStepParameters& step);
+	void Diffuse(const FluidStepParameters& step, unsigned int iterations);
+	void ComputeDivergence();
+	void SolvePressure(float overRelaxation, unsigned int iterations);
+	void Project();
+};
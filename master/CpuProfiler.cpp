@@ -0,0 +1,230 @@
+#include "CpuProfiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+//Singleton requirement
+CpuProfiler* CpuProfiler::instance;
+
+// Each thread's buffer, found without any locking after the first event
+static thread_local void* currentThreadBuffer = 0;
+
+CpuProfiler::~CpuProfiler()
+{
+	for (ThreadBuffer* buffer : threads)
+		delete buffer;
+}
+
+uint64_t CpuProfiler::Now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() + 1;
+}
+
+CpuProfiler::ThreadBuffer* CpuProfiler::GetThreadBuffer()
+{
+	if (currentThreadBuffer)
+		return (ThreadBuffer*)currentThreadBuffer;
+
+	ThreadBuffer* buffer = new ThreadBuffer();
+	buffer->events.resize(eventsPerThread);
+	buffer->writeIndex = 0;
+	buffer->recordingGeneration = 0;
+	buffer->captureFrom = 0; // Anything it records belongs to the current capture, if there is one
+	buffer->captureEnd = 0;
+
+	std::lock_guard<std::mutex> lock(threadsMutex);
+	buffer->threadId = (unsigned int)threads.size() + 1;
+	buffer->name = "Thread " + std::to_string(buffer->threadId);
+	threads.push_back(buffer);
+
+	currentThreadBuffer = buffer;
+	return buffer;
+}
+
+void CpuProfiler::Record(const char* name, uint32_t generation, uint64_t start, uint64_t end)
+{
+	ThreadBuffer* buffer = GetThreadBuffer();
+
+	// Say which capture we're writing for, then check it's still running.
+	// EndFrame() does the opposite (bump the generation, then check), so
+	// either we see it ended or it sees us and waits for us to finish.
+	buffer->recordingGeneration.store(generation, std::memory_order_seq_cst);
+	if (this->generation.load(std::memory_order_seq_cst) != generation)
+	{
+		buffer->recordingGeneration.store(0, std::memory_order_release);
+		return;
+	}
+
+	uint32_t index = buffer->writeIndex.load(std::memory_order_relaxed);
+
+	Event& event = buffer->events[index & (eventsPerThread - 1)];
+	event.name = name;
+	event.start = start;
+	event.end = end;
+
+	// The main thread reads up to here once the capture is over
+	buffer->writeIndex.store(index + 1, std::memory_order_release);
+	buffer->recordingGeneration.store(0, std::memory_order_release);
+}
+
+void CpuProfiler::SetThreadName(const char* name)
+{
+	ThreadBuffer* buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex> lock(threadsMutex);
+	buffer->name = name;
+}
+
+void CpuProfiler::RequestCapture(unsigned int frameCount, const std::string& path)
+{
+	if (IsCapturing() || frameCount == 0)
+		return;
+
+	pending = true;
+	requestedFrames = frameCount;
+	capturePath = path;
+}
+
+void CpuProfiler::EndFrame()
+{
+	uint64_t now = Now();
+
+	if (IsCapturing())
+	{
+		frameStarts.push_back(now);
+		if (--framesLeft > 0)
+			return;
+
+		// Markers still open keep going and are just left out. Anyone
+		// already writing an event for this capture gets to finish first,
+		// after that every buffer stays put until the next capture.
+		uint32_t ended = generation.load(std::memory_order_relaxed);
+		generation.store(ended + 1, std::memory_order_seq_cst);
+		{
+			std::lock_guard<std::mutex> lock(threadsMutex);
+			for (ThreadBuffer* buffer : threads)
+			{
+				while (buffer->recordingGeneration.load(std::memory_order_seq_cst) == ended)
+					std::this_thread::yield();
+				buffer->captureEnd = buffer->writeIndex.load(std::memory_order_acquire);
+			}
+		}
+		WriteCapture();
+		return;
+	}
+
+	if (!pending)
+		return;
+
+	// Everything recorded from here on is part of the capture
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		for (ThreadBuffer* buffer : threads)
+			buffer->captureFrom = buffer->writeIndex.load(std::memory_order_acquire);
+	}
+
+	pending = false;
+	framesLeft = requestedFrames;
+	captureStart = now;
+	frameStarts.clear();
+	frameStarts.push_back(now);
+	generation.fetch_add(1, std::memory_order_seq_cst);
+}
+
+CpuCaptureStatus CpuProfiler::GetStatus()
+{
+	CpuCaptureStatus status;
+	status.capturing = IsCapturing();
+	status.pending = pending;
+	status.framesLeft = framesLeft;
+	status.lastFile = lastFile;
+	status.lastEventCount = lastEventCount;
+	status.lastDroppedEvents = lastDroppedEvents;
+	return status;
+}
+
+// Names are usually plain literals, but quotes and backslashes would break the JSON
+static void WriteEscaped(std::ofstream& file, const char* text)
+{
+	for (const char* c = text; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')
+			file << '\\';
+		if ((unsigned char)*c >= 0x20)
+			file << *c;
+	}
+}
+
+// --------------------------------------------------------
+// Chrome's trace event format: complete ("X") events with
+// microsecond timestamps, thread names as metadata and the
+// frame boundaries as global instant events.
+// --------------------------------------------------------
+void CpuProfiler::WriteCapture()
+{
+	std::ofstream file(capturePath, std::ios::out | std::ios::trunc);
+	lastEventCount = 0;
+	lastDroppedEvents = 0;
+	if (!file.is_open())
+	{
+		lastFile = "";
+		return;
+	}
+
+	char number[64];
+	auto microseconds = [&](uint64_t time)
+	{
+		double us = time >= captureStart ? (double)(time - captureStart) / 1000.0 : -(double)(captureStart - time) / 1000.0;
+		snprintf(number, sizeof(number), "%.3f", us);
+		return number;
+	};
+
+	file << "{\"traceEvents\":[\n";
+	bool first = true;
+	auto separator = [&]()
+	{
+		if (!first) file << ",\n";
+		first = false;
+	};
+
+	std::lock_guard<std::mutex> lock(threadsMutex);
+	for (ThreadBuffer* buffer : threads)
+	{
+		separator();
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId << ",\"args\":{\"name\":\"";
+		WriteEscaped(file, buffer->name.c_str());
+		file << "\"}}";
+
+		// Only what's still in the ring - anything older got overwritten
+		uint32_t end = buffer->captureEnd;
+		uint32_t begin = buffer->captureFrom;
+		if (end - begin > eventsPerThread)
+		{
+			lastDroppedEvents += (end - begin) - eventsPerThread;
+			begin = end - eventsPerThread;
+		}
+
+		for (uint32_t i = begin; i != end; i++)
+		{
+			const Event& event = buffer->events[i & (eventsPerThread - 1)];
+			separator();
+			file << "{\"name\":\"";
+			WriteEscaped(file, event.name);
+			file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId << ",\"ts\":" << microseconds(event.start);
+			snprintf(number, sizeof(number), "%.3f", (double)(event.end - event.start) / 1000.0);
+			file << ",\"dur\":" << number << "}";
+			lastEventCount++;
+		}
+	}
+
+	for (size_t i = 0; i < frameStarts.size(); i++)
+	{
+		separator();
+		file << "{\"name\":\"Frame " << i << "\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":" << microseconds(frameStarts[i]) << "}";
+	}
+
+	file << "\n]}\n";
+	lastFile = capturePath;
+}
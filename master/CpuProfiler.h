@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Set to 0 (in the project's preprocessor definitions) to compile every marker out
+#ifndef CPU_PROFILING_ENABLED
+#define CPU_PROFILING_ENABLED 1
+#endif
+
+// --------------------------------------------------------
+// Markers. Names have to be string literals (or otherwise
+// live forever) - only the pointer is stored.
+//
+//  PROFILE_SCOPE("Name")  times the rest of the block
+//  PROFILE_FUNCTION()     same, named after the function
+//  PROFILE_FRAME()        once per frame, main thread
+//  PROFILE_THREAD("Name") names the calling thread
+// --------------------------------------------------------
+#if CPU_PROFILING_ENABLED
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) CpuProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#define PROFILE_FRAME() CpuProfiler::GetInstance().EndFrame()
+#define PROFILE_THREAD(name) CpuProfiler::GetInstance().SetThreadName(name)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FUNCTION()
+#define PROFILE_FRAME()
+#define PROFILE_THREAD(name)
+#endif
+
+// Where a capture is at, for the UI
+struct CpuCaptureStatus
+{
+	bool capturing;
+	bool pending;				// Requested, starts next frame
+	unsigned int framesLeft;
+	std::string lastFile;		// Empty until something's been written
+	unsigned int lastEventCount;
+	unsigned int lastDroppedEvents; // Overwritten before they could be written out
+};
+
+// --------------------------------------------------------
+// Records CPU markers from every thread and writes them out
+// as a Chrome trace (chrome://tracing or ui.perfetto.dev).
+//
+// Each thread writes into a ring buffer of its own that only
+// it ever writes to, publishing each event with an atomic
+// index - no locks, no shared cache lines. Outside a capture
+// a marker is one relaxed load and a branch.
+//
+// A capture covers the next N frames (between PROFILE_FRAME
+// calls). Every capture gets its own generation, and a marker
+// only records into the generation it started in. When the
+// capture ends, the main thread bumps the generation, waits out
+// anyone halfway through writing an event, and then reads every
+// thread's events between where they were at the start and the
+// end. Markers that close later are just dropped, so nothing
+// writes to a buffer while it's being read.
+// --------------------------------------------------------
+class CpuProfiler
+{
+#pragma region Singleton
+public:
+	// Gets the one and only instance of this class
+	static CpuProfiler& GetInstance()
+	{
+		if (!instance)
+		{
+			instance = new CpuProfiler();
+		}
+
+		return *instance;
+	}
+
+	// Remove these functions (C++ 11 version)
+	CpuProfiler(CpuProfiler const&) = delete;
+	void operator=(CpuProfiler const&) = delete;
+
+private:
+	static CpuProfiler* instance;
+	CpuProfiler() :
+		generation(0),
+		pending(false),
+		requestedFrames(0),
+		framesLeft(0),
+		captureStart(0),
+		lastEventCount(0),
+		lastDroppedEvents(0)
+	{ };
+#pragma endregion
+
+public:
+	~CpuProfiler();
+
+	bool IsCapturing() { return (generation.load(std::memory_order_relaxed) & 1) != 0; }
+
+	// The running capture's generation, 0 if there's none
+	uint32_t GetCaptureGeneration()
+	{
+		uint32_t current = generation.load(std::memory_order_relaxed);
+		return (current & 1) ? current : 0;
+	}
+
+	// Nanoseconds on a steady clock, never 0
+	static uint64_t Now();
+
+	// Any thread. Called by CpuProfileScope, with the generation it started in.
+	void Record(const char* name, uint32_t generation, uint64_t start, uint64_t end);
+	void SetThreadName(const char* name);
+
+	// Captures the next frameCount frames into path
+	void RequestCapture(unsigned int frameCount, const std::string& path);
+	void EndFrame();
+
+	CpuCaptureStatus GetStatus();
+
+private:
+	static const unsigned int eventsPerThread = 1 << 16; // Power of 2
+
+	struct Event
+	{
+		const char* name;
+		uint64_t start;
+		uint64_t end;
+	};
+
+	// Written by its thread only
+	struct ThreadBuffer
+	{
+		std::vector<Event> events;
+		std::atomic<uint32_t> writeIndex;
+		std::atomic<uint32_t> recordingGeneration; // While writing an event, 0 otherwise
+		uint32_t captureFrom; // writeIndex when the capture started
+		uint32_t captureEnd;  // And when it ended
+		unsigned int threadId;
+		std::string name;
+	};
+
+	std::mutex threadsMutex; // Registration and captures only, never recording
+	std::vector<ThreadBuffer*> threads;
+	ThreadBuffer* GetThreadBuffer();
+
+	std::atomic<uint32_t> generation; // Odd while a capture's running
+	bool pending;
+	unsigned int requestedFrames;
+	unsigned int framesLeft;
+	std::string capturePath;
+	uint64_t captureStart;
+	std::vector<uint64_t> frameStarts;
+
+	std::string lastFile;
+	unsigned int lastEventCount;
+	unsigned int lastDroppedEvents;
+
+	void WriteCapture();
+};
+
+// Times its own lifetime while a capture is running
+class CpuProfileScope
+{
+public:
+	CpuProfileScope(const char* name) :
+		name(name),
+		generation(CpuProfiler::GetInstance().GetCaptureGeneration()),
+		start(generation ? CpuProfiler::Now() : 0)
+	{ }
+
+	~CpuProfileScope()
+	{
+		if (generation)
+			CpuProfiler::GetInstance().Record(name, generation, start, CpuProfiler::Now());
+	}
+
+private:
+	const char* name;
+	uint32_t generation;
+	uint64_t start;
+};
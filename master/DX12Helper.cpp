@@ -1,4 +1,6 @@
 #include "DX12Helper.h"
+#include "CpuProfiler.h"
+#include "Logger.h"
 
 #include "WICTextureLoader.h"
 #include "ResourceUploadBatch.h"
@@ -11,21 +13,27 @@ DX12Helper* DX12Helper::instance;
 //Not much to do since we use ComPtr objects
 DX12Helper::~DX12Helper(){}
 
-void DX12Helper::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList, Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue, Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator)
+void DX12Helper::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList, Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue, Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator, unsigned int framesInFlight)
 {
 	// Save objects
 	this->device = device;
 	this->commandList = commandList;
 	this->commandQueue = commandQueue;
-	this->commandAllocator = commandAllocator;
 
-	// Create the fence for basic synchronization
-	device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(waitFence.GetAddressOf()));
-	waitFenceEvent = CreateEventEx(0, 0, 0, EVENT_ALL_ACCESS);
-	waitFenceCounter = 0;
+	// The list starts out on the allocator we were given, that's frame 0's
+	frames.assign(framesInFlight > 0 ? framesInFlight : 1, FrameSlot());
+	frames[0].commandAllocator = commandAllocator;
+	for (size_t i = 1; i < frames.size(); i++)
+	{
+		device->CreateCommandAllocator(
+			D3D12_COMMAND_LIST_TYPE_DIRECT,
+			IID_PPV_ARGS(frames[i].commandAllocator.GetAddressOf()));
+	}
+	currentFrame = 0;
 
-	// Create the constant buffer upload heap
+	// Create the constant buffer and instance upload heaps
 	CreateConstantBufferUploadHeap();
+	CreateInstanceUploadHeap();
 	CreateCBVSRVDescriptorHeap();
 }
 
@@ -61,46 +69,132 @@ void DX12Helper::LoadImGui()
 
 D3D12_CPU_DESCRIPTOR_HANDLE DX12Helper::LoadTexture(const wchar_t* file, bool generateMips)
 {
+	PROFILE_SCOPE("Texture load");
+
+	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = {};
+	DecodedTexture decoded;
+	DecodeTexture(file, decoded, generateMips);
+	UploadTextures(&decoded, 1, &cpuHandle);
+	return cpuHandle;
+}
+
+//Reads and decodes the file, and creates the (empty) texture to go with it.
+//Same as what CreateWICTextureFromFile does before it uploads.
+bool DX12Helper::DecodeTexture(const wchar_t* file, DecodedTexture& decoded, bool generateMips)
+{
+	PROFILE_SCOPE("Texture decode");
+
+	//WIC needs COM on whichever thread this is. Job system workers never
+	//start it themselves, so join the process wide MTA (and stay there).
+	static thread_local bool comInitialized = false;
+	if (!comInitialized)
+	{
+		CoInitializeEx(0, COINIT_MULTITHREADED);
+		comInitialized = true;
+	}
+
+	decoded.generateMips = generateMips;
+	decoded.subresource = {};
+	HRESULT hr = LoadWICTextureFromFileEx(
+		device.Get(),
+		file,
+		0,
+		D3D12_RESOURCE_FLAG_NONE,
+		generateMips ? WIC_LOADER_MIP_AUTOGEN : WIC_LOADER_DEFAULT, // Autogen leaves room for the mips
+		decoded.texture.ReleaseAndGetAddressOf(),
+		decoded.pixels,
+		decoded.subresource);
+	if (FAILED(hr))
+	{
+		LOG_ERROR("Couldn't load texture %ls (0x%08x)", file, (unsigned int)hr);
+		decoded.texture.Reset();
+		return false;
+	}
+	return true;
+}
+
+//Uploads every decoded texture in one batch, waits for it once, then makes
+//a non-shader visible descriptor heap for each (handles gets the CPU handles)
+void DX12Helper::UploadTextures(DecodedTexture* decoded, unsigned int count, D3D12_CPU_DESCRIPTOR_HANDLE* handles)
+{
+	PROFILE_SCOPE("Texture upload");
+
 	//Helper function from toolkit that uploads a resource to appropriate GPU memory
 	ResourceUploadBatch upload(device.Get());
 	upload.Begin();
 
-	// Attempt to create the texture
-	Microsoft::WRL::ComPtr<ID3D12Resource> texture;
-	CreateWICTextureFromFile(device.Get(), upload, file, texture.GetAddressOf(), generateMips);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		ID3D12Resource* texture = decoded[i].texture.Get();
+		if (!texture)
+			continue;
+
+		upload.Upload(texture, 0, &decoded[i].subresource, 1);
+		upload.Transition(texture, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+		if (decoded[i].generateMips)
+			upload.GenerateMips(texture);
+	}
 
-	//Make sure upload is finished before we return texture.
+	//Make sure upload is finished before we return the textures.
 	auto finish = upload.End(commandQueue.Get());
 	finish.wait();
 
-	//Add texture to our list and then make a CPU-side descriptor heap for this texture's SRV
-	//Possible Improvement: Find a way to reallocate all descriptors into the same heap after all SRVs are loaded.
-	textures.push_back(texture);
-
-	//Descriptor heap definition (CPU-SIDE)
-	D3D12_DESCRIPTOR_HEAP_DESC dhDesc = {};
-	dhDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE; //Non-shader visible for CPU-side-only descriptor heap (useful where?)
-	dhDesc.NodeMask = 0;
-	dhDesc.NumDescriptors = 1;
-	dhDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-	
-	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> descHeap;
-	device->CreateDescriptorHeap(&dhDesc, IID_PPV_ARGS(descHeap.GetAddressOf()));
-	cpuSideTextureDescriptorHeaps.push_back(descHeap);
-
-	// Create the SRV on this descriptor heap
-	// Note: Using a null description results in the "default" SRV (same format, all mips, all array slices, etc.)
-	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = descHeap->GetCPUDescriptorHandleForHeapStart();
-	device->CreateShaderResourceView(texture.Get(), 0, cpuHandle);
-
-	// Return the CPU descriptor handle, which can be used to
-	// copy the descriptor to a shader-visible heap later
-	return cpuHandle;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		//The upload's done with the CPU copy
+		decoded[i].pixels.reset();
+
+		//Add texture to our list and then make a CPU-side descriptor heap for this texture's SRV
+		//Possible Improvement: Find a way to reallocate all descriptors into the same heap after all SRVs are loaded.
+		Microsoft::WRL::ComPtr<ID3D12Resource> texture = decoded[i].texture;
+		textures.push_back(texture);
+
+		//The upload batch leaves every mip ready for pixel shaders
+		if (texture)
+			stateTracker.Register(texture.Get(), D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+
+		//Descriptor heap definition (CPU-SIDE)
+		D3D12_DESCRIPTOR_HEAP_DESC dhDesc = {};
+		dhDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE; //Non-shader visible for CPU-side-only descriptor heap (useful where?)
+		dhDesc.NodeMask = 0;
+		dhDesc.NumDescriptors = 1;
+		dhDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+
+		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> descHeap;
+		device->CreateDescriptorHeap(&dhDesc, IID_PPV_ARGS(descHeap.GetAddressOf()));
+		cpuSideTextureDescriptorHeaps.push_back(descHeap);
+
+		// Create the SRV on this descriptor heap
+		// Note: Using a null description results in the "default" SRV (same format, all mips, all array slices, etc.)
+		D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = descHeap->GetCPUDescriptorHandleForHeapStart();
+		if (texture)
+		{
+			device->CreateShaderResourceView(texture.Get(), 0, cpuHandle);
+		}
+		else
+		{
+			// Didn't decode (already logged). A null resource needs a description,
+			// and gives a null view - the handle stays usable and reads as black.
+			D3D12_SHADER_RESOURCE_VIEW_DESC nullDesc = {};
+			nullDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+			nullDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+			nullDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+			nullDesc.Texture2D.MipLevels = 1;
+			device->CreateShaderResourceView(0, &nullDesc, cpuHandle);
+			LOG_WARNING("Texture %u of the upload batch is missing, using a null view", i);
+		}
+
+		// Return the CPU descriptor handle, which can be used to
+		// copy the descriptor to a shader-visible heap later
+		handles[i] = cpuHandle;
+	}
 }
 
 
 Microsoft::WRL::ComPtr<ID3D12Resource> DX12Helper::CreateStaticBuffer(unsigned int dataStride, unsigned int dataCount, void* data)
 {
+	PROFILE_SCOPE("Static buffer upload");
+
 	// Buffer we are creating
 	Microsoft::WRL::ComPtr<ID3D12Resource> buffer;
 
@@ -156,25 +250,70 @@ Microsoft::WRL::ComPtr<ID3D12Resource> DX12Helper::CreateStaticBuffer(unsigned i
 	memcpy(gpuAddress, data, dataStride * dataCount);
 	uploadHeap->Unmap(0, 0);
 
+	// In a batch, the copy goes to the copy queue and the direct queue picks
+	// the buffer up from there (see EndUploadBatch)
+	if (uploadBatchOpen)
+	{
+		if (!uploadBatchList)
+			uploadBatchList = GpuQueues::GetInstance().OpenList(GPU_QUEUE_COPY);
+		uploadBatchList->CopyResource(buffer.Get(), uploadHeap.Get());
+		pendingUploadHeaps.push_back(uploadHeap);
+
+		// Anything the copy queue touched is back in COMMON once it's done
+		stateTracker.Register(buffer.Get(), D3D12_RESOURCE_STATE_COMMON);
+		stateTracker.Transition(buffer.Get(), D3D12_RESOURCE_STATE_GENERIC_READ);
+		return buffer;
+	}
+
 	// Copy the whole buffer from uploadheap to vert buffer
 	commandList->CopyResource(buffer.Get(), uploadHeap.Get());
 
 	// Transition the buffer to generic read for the rest of the app lifetime (presumable)
 	// Allows us to change how our resource is being used after it is set up and good to go. 
-	D3D12_RESOURCE_BARRIER rb = {};
-	rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-	rb.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-	rb.Transition.pResource = buffer.Get();
-	rb.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-	rb.Transition.StateAfter = D3D12_RESOURCE_STATE_GENERIC_READ;
-	rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-	commandList->ResourceBarrier(1, &rb);
+	stateTracker.Register(buffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST);
+	stateTracker.Transition(buffer.Get(), D3D12_RESOURCE_STATE_GENERIC_READ);
+	stateTracker.Flush(commandList.Get());
 
 	// Execute the command list and report success
 	CloseExecuteAndResetCommandList(); //Causes us to wait again.
 	return buffer;
 }
 
+void DX12Helper::BeginUploadBatch()
+{
+	uploadBatchOpen = true;
+}
+
+void DX12Helper::EndUploadBatch()
+{
+	PROFILE_SCOPE("Upload batch");
+
+	uploadBatchOpen = false;
+	if (!uploadBatchList)
+		return;
+
+	// Every copy since BeginUploadBatch() in one submission. The direct queue
+	// waits for it before anything submitted from now on, and the transitions
+	// to GENERIC_READ go at the front of the main list, after that wait.
+	GpuQueues& queues = GpuQueues::GetInstance();
+	uploadBatchList->Close();
+	ID3D12CommandList* lists[] = { uploadBatchList };
+	uploadBatchDone = queues.Submit(GPU_QUEUE_COPY, lists, 1);
+	queues.Wait(GPU_QUEUE_DIRECT, uploadBatchDone);
+	stateTracker.Flush(commandList.Get());
+	uploadBatchList = 0;
+
+	// The upload heaps stay alive until the copy queue's done with them
+	submittedUploadHeaps.insert(submittedUploadHeaps.end(), pendingUploadHeaps.begin(), pendingUploadHeaps.end());
+	pendingUploadHeaps.clear();
+}
+
+void DX12Helper::ReleaseFinishedUploads()
+{
+	if (!submittedUploadHeaps.empty() && GpuQueues::GetInstance().IsComplete(uploadBatchDone))
+		submittedUploadHeaps.clear();
+}
+
 //Return CBV heap for drawing.
 Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> DX12Helper::GetConstantBufferDescriptorHeap()
 {
@@ -195,8 +334,29 @@ D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::FillNextConstantBufferAndGetGPUDescripto
 	reservationSize = (reservationSize + 255); //Adds 255 to drop the last few bits
 	reservationSize = (reservationSize & ~255); //Flip it so it can be used to mask
 
-	if(cbUploadHeapOffsetInBytes + reservationSize >= cbUploadHeapSizeInBytes)
-	{ cbUploadHeapOffsetInBytes = 0; }
+	//Wrapping skips whatever's left at the end of the heap,
+	//which counts as used until the GPU catches up
+	UINT64 skipped = 0;
+	if (cbUploadHeapOffsetInBytes + reservationSize > cbUploadHeapSizeInBytes)
+		skipped = cbUploadHeapSizeInBytes - cbUploadHeapOffsetInBytes;
+
+	//Earlier frames may still be reading what's ahead of us, so wait for the
+	//oldest ones until there's room. Every CB takes at least 256 bytes and one
+	//descriptor, so that keeps the descriptors below safe too. If this frame
+	//alone fills the heap, its oldest CBs get overwritten - a bug, so say so.
+	while (cbUploadHeapBytesInFlight + skipped + reservationSize > cbUploadHeapSizeInBytes && RetireOldestFrame()) {}
+	if (cbUploadHeapBytesInFlight + skipped + reservationSize > cbUploadHeapSizeInBytes)
+	{
+		LOG_ERROR("Constant buffer upload heap is full: %llu bytes wanted, %llu of %llu used this frame",
+			(unsigned long long)reservationSize,
+			(unsigned long long)cbUploadHeapBytesInFlight,
+			(unsigned long long)cbUploadHeapSizeInBytes);
+	}
+
+	if (skipped > 0)
+		cbUploadHeapOffsetInBytes = 0;
+	cbUploadHeapBytesInFlight += skipped + reservationSize;
+	frames[currentFrame].constantBufferBytes += skipped + reservationSize;
 
 	// Where in the upload heap will this data go?
 	D3D12_GPU_VIRTUAL_ADDRESS virtualGPUAddress =
@@ -239,6 +399,63 @@ D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::FillNextConstantBufferAndGetGPUDescripto
 	}
 }
 
+//Copies per-instance data into the instance upload heap.
+//Works just like the constant buffer version above (ring buffer),
+//but no descriptor is needed since vertex buffers are bound by address.
+//Returns a vertex buffer view covering exactly this data
+//
+// data - The instance data to copy to the GPU
+// strideInBytes - The byte size of one instance
+// instanceCount - How many instances are in data
+D3D12_VERTEX_BUFFER_VIEW DX12Helper::FillNextInstanceBufferAndGetView(void* data, unsigned int strideInBytes, unsigned int instanceCount)
+{
+	PROFILE_SCOPE("Instance upload");
+
+	//Keep each chunk 16 byte aligned
+	SIZE_T dataSize = (SIZE_T)strideInBytes * instanceCount;
+	SIZE_T reservationSize = (dataSize + 15) & ~15;
+
+	//Wrapping skips whatever's left at the end of the heap,
+	//which counts as used until the GPU catches up
+	UINT64 skipped = 0;
+	if (instanceUploadHeapOffsetInBytes + reservationSize > instanceUploadHeapSizeInBytes)
+		skipped = instanceUploadHeapSizeInBytes - instanceUploadHeapOffsetInBytes;
+
+	//Earlier frames may still be reading what's ahead of us, so never wrap
+	//onto them - wait for the oldest ones to finish instead. Too much for one
+	//frame is a bug - draw nothing (an empty view reads as zeros) rather than
+	//overwrite live data.
+	while (instanceUploadHeapBytesInFlight + skipped + reservationSize > instanceUploadHeapSizeInBytes && RetireOldestFrame()) {}
+
+	D3D12_VERTEX_BUFFER_VIEW view = {};
+	if (instanceUploadHeapBytesInFlight + skipped + reservationSize > instanceUploadHeapSizeInBytes)
+	{
+		LOG_ERROR("Instance upload heap is full: %llu bytes wanted, %llu of %llu already used this frame",
+			(unsigned long long)reservationSize,
+			(unsigned long long)instanceUploadHeapBytesInFlight,
+			(unsigned long long)instanceUploadHeapSizeInBytes);
+		return view;
+	}
+
+	if (skipped > 0)
+		instanceUploadHeapOffsetInBytes = 0;
+	instanceUploadHeapBytesInFlight += skipped + reservationSize;
+	frames[currentFrame].instanceBytes += skipped + reservationSize;
+
+	view.BufferLocation = instanceUploadHeap->GetGPUVirtualAddress() + instanceUploadHeapOffsetInBytes;
+	view.SizeInBytes = (UINT)dataSize;
+	view.StrideInBytes = strideInBytes;
+
+	void* uploadAddress = reinterpret_cast<void*>((SIZE_T)instanceUploadHeapStartAddress + instanceUploadHeapOffsetInBytes);
+	memcpy(uploadAddress, data, dataSize);
+
+	instanceUploadHeapOffsetInBytes += reservationSize;
+	if (instanceUploadHeapOffsetInBytes >= instanceUploadHeapSizeInBytes)
+		instanceUploadHeapOffsetInBytes = 0;
+
+	return view;
+}
+
 D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::CopySRVsToDescriptorHeapAndGetGPUDescriptorHandle(D3D12_CPU_DESCRIPTOR_HANDLE firstDescriptorToCopy, unsigned int numDescriptorsToCopy)
 {
 	// Grab the actual heap start on both sides and offset to the next open SRV portion
@@ -257,6 +474,25 @@ D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::CopySRVsToDescriptorHeapAndGetGPUDescrip
 	return gpuHandle;
 }
 
+D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::ReserveDescriptors(unsigned int count, D3D12_CPU_DESCRIPTOR_HANDLE* cpuHandle)
+{
+	// Same portion of the heap the SRVs come from
+	D3D12_CPU_DESCRIPTOR_HANDLE cpu = cbvSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
+	D3D12_GPU_DESCRIPTOR_HANDLE gpu = cbvSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
+	cpu.ptr += (SIZE_T)srvDescriptorOffset * cbvSrvDescriptorHeapIncrementSize;
+	gpu.ptr += (SIZE_T)srvDescriptorOffset * cbvSrvDescriptorHeapIncrementSize;
+	srvDescriptorOffset += count;
+
+	if (cpuHandle)
+		*cpuHandle = cpu;
+	return gpu;
+}
+
+SIZE_T DX12Helper::GetDescriptorIncrementSize()
+{
+	return cbvSrvDescriptorHeapIncrementSize;
+}
+
 D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::CreateImGuiGPUHandle(D3D12_CPU_DESCRIPTOR_HANDLE firstDescriptorToCopy)
 {
 	D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle = cbvSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
@@ -266,36 +502,89 @@ D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::CreateImGuiGPUHandle(D3D12_CPU_DESCRIPTO
 	return gpuHandle;
 }
 
+ResourceStateTracker& DX12Helper::GetStateTracker()
+{
+	return stateTracker;
+}
+
 void DX12Helper::CloseExecuteAndResetCommandList()
 {
-	// Close the current list and execute it as our only list
+	// Once this is done everything before it on the direct queue is
+	// too, so every frame's allocator and ring space is free again
+	GpuSyncPoint done = SubmitCommandList(0, 0);
+	frames[currentFrame].done = done;
+	GpuQueues::GetInstance().WaitOnCpu(done);
+	for (unsigned int i = 0; i < frames.size(); i++)
+		RetireFrame(i);
+	ReleaseFinishedUploads();
+
+	frames[currentFrame].commandAllocator->Reset();
+	commandList->Reset(frames[currentFrame].commandAllocator.Get(), 0);
+}
+
+void DX12Helper::CloseExecuteAndResetCommandList(ID3D12CommandList* const* additionalLists, unsigned int additionalListCount)
+{
+	frames[currentFrame].done = SubmitCommandList(additionalLists, additionalListCount);
+
+	// On to the next frame's allocator. It can't be reset while the GPU may
+	// still be reading it, so wait for the frame that used it last - and only
+	// that one, everything since can keep going. Its ring space is free after.
+	currentFrame = (currentFrame + 1) % (unsigned int)frames.size();
+	RetireFrame(currentFrame);
+	ReleaseFinishedUploads();
+
+	frames[currentFrame].commandAllocator->Reset();
+	commandList->Reset(frames[currentFrame].commandAllocator.Get(), 0);
+}
+
+// Close the current list and execute it first, followed by any
+// lists recorded elsewhere (e.g. on other threads), all in one go
+GpuSyncPoint DX12Helper::SubmitCommandList(ID3D12CommandList* const* additionalLists, unsigned int additionalListCount)
+{
 	commandList->Close();
-	ID3D12CommandList* lists[] = { commandList.Get() };
-	commandQueue->ExecuteCommandLists(1, lists); //Set it up to be executed now.
-
-	// Always wait before reseting command allocator, as it should not
-	// be reset while the GPU is processing a command list
-	WaitForGPU();
-	commandAllocator->Reset(); //Don't reset until GPU has caught up. It'd be more desirable to have multiple allocators to be able to que up commandLists for additional frames. 
-	commandList->Reset(commandAllocator.Get(), 0); //Once allocator is rest, then reset commandList.
+	std::vector<ID3D12CommandList*> lists;
+	lists.push_back(commandList.Get());
+	for (unsigned int i = 0; i < additionalListCount; i++)
+		lists.push_back(additionalLists[i]);
+
+	// Through the direct queue, which traces them too
+	return GpuQueues::GetInstance().Submit(GPU_QUEUE_DIRECT, lists.data(), (unsigned int)lists.size());
 }
 
-void DX12Helper::WaitForGPU()
+void DX12Helper::RetireFrame(unsigned int frame)
+{
+	FrameSlot& slot = frames[frame];
+	GpuQueues::GetInstance().WaitOnCpu(slot.done);
+
+	cbUploadHeapBytesInFlight -= slot.constantBufferBytes;
+	instanceUploadHeapBytesInFlight -= slot.instanceBytes;
+	slot.constantBufferBytes = 0;
+	slot.instanceBytes = 0;
+	slot.done = GpuSyncPoint();
+}
+
+bool DX12Helper::RetireOldestFrame()
 {
-	//Create value for ongoing fence (index of "stop sign")
-	//and pass to the GPU's command queue
-	waitFenceCounter++;
-	commandQueue->Signal(waitFence.Get(), waitFenceCounter);
-
-	// Check to see if the most recently completed fence value
-	// is less than the one we just set.
-	if (waitFence->GetCompletedValue() < waitFenceCounter)
+	// Frames after the current one (wrapping around) are the oldest
+	for (unsigned int i = 1; i < frames.size(); i++)
 	{
-		// Tell the fence to let us know when it's hit, and then
-		// sit an wait until that fence is hit.
-		waitFence->SetEventOnCompletion(waitFenceCounter, waitFenceEvent);
-		WaitForSingleObject(waitFenceEvent, INFINITE);
+		unsigned int frame = (currentFrame + i) % (unsigned int)frames.size();
+		if (frames[frame].done.value != 0)
+		{
+			RetireFrame(frame);
+			return true;
+		}
 	}
+	return false;
+}
+
+void DX12Helper::WaitForGPU()
+{
+	//Every queue, not just ours - nothing's in flight anywhere after this
+	GpuQueues::GetInstance().WaitForIdle();
+	for (unsigned int i = 0; i < frames.size(); i++)
+		RetireFrame(i);
+	ReleaseFinishedUploads();
 }
 
 //Creates a single constant buffer which will store
@@ -310,6 +599,7 @@ void DX12Helper::CreateConstantBufferUploadHeap()
 	//Beginning offset, will change as we use more CBs
 	//and eventually wraps around 
 	cbUploadHeapOffsetInBytes = 0;
+	cbUploadHeapBytesInFlight = 0;
 
 	//Creating upload heap for our constant buffer
 	D3D12_HEAP_PROPERTIES heapProps = {};
@@ -342,11 +632,56 @@ void DX12Helper::CreateConstantBufferUploadHeap()
 		0,
 		IID_PPV_ARGS(cbUploadHeap.GetAddressOf()));
 
+	stateTracker.Register(cbUploadHeap.Get(), D3D12_RESOURCE_STATE_GENERIC_READ);
+
 	// Keep mapped!
 	D3D12_RANGE range{ 0, 0 };
 	cbUploadHeap->Map(0, &range, &cbUploadHeapStartAddress);
 }
 
+//Creates the upload heap that per-instance vertex data
+//is copied into each frame. Stays mapped like the CB heap.
+void DX12Helper::CreateInstanceUploadHeap()
+{
+	instanceUploadHeapSizeInBytes = (UINT64)maxInstances * 192;
+	instanceUploadHeapOffsetInBytes = 0;
+	instanceUploadHeapBytesInFlight = 0;
+
+	D3D12_HEAP_PROPERTIES heapProps = {};
+	heapProps.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+	heapProps.CreationNodeMask = 1;
+	heapProps.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+	heapProps.Type = D3D12_HEAP_TYPE_UPLOAD;
+	heapProps.VisibleNodeMask = 1;
+
+	D3D12_RESOURCE_DESC resDesc = {};
+	resDesc.Alignment = 0;
+	resDesc.DepthOrArraySize = 1;
+	resDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+	resDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
+	resDesc.Format = DXGI_FORMAT_UNKNOWN;
+	resDesc.Height = 1;
+	resDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+	resDesc.MipLevels = 1;
+	resDesc.SampleDesc.Count = 1;
+	resDesc.SampleDesc.Quality = 0;
+	resDesc.Width = instanceUploadHeapSizeInBytes;
+
+	device->CreateCommittedResource(
+		&heapProps,
+		D3D12_HEAP_FLAG_NONE,
+		&resDesc,
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		0,
+		IID_PPV_ARGS(instanceUploadHeap.GetAddressOf()));
+
+	stateTracker.Register(instanceUploadHeap.Get(), D3D12_RESOURCE_STATE_GENERIC_READ);
+
+	// Keep mapped!
+	D3D12_RANGE range{ 0, 0 };
+	instanceUploadHeap->Map(0, &range, &instanceUploadHeapStartAddress);
+}
+
 //Create a single CBV descriptor heap which holds all 
 //CBVs for the entire program and allows re-use of memory.
 void DX12Helper::CreateCBVSRVDescriptorHeap()
@@ -4,6 +4,20 @@
 #include <DirectXMath.h>
 #include <wrl/client.h>
 #include <vector>
+#include <memory>
+
+#include "ResourceStateTracker.h"
+#include "GpuQueues.h"
+
+//A texture that's been read and decoded, but not uploaded yet.
+//The resource exists (in COPY_DEST), pixels holds its top mip.
+struct DecodedTexture
+{
+	Microsoft::WRL::ComPtr<ID3D12Resource> texture;
+	std::unique_ptr<uint8_t[]> pixels;
+	D3D12_SUBRESOURCE_DATA subresource;
+	bool generateMips;
+};
 
 class DX12Helper
 {
@@ -27,15 +41,21 @@ public:
 private:
 	static DX12Helper* instance;
 	DX12Helper() :
+		currentFrame(0),
 		cbUploadHeapOffsetInBytes(0),
+		cbUploadHeapBytesInFlight(0),
 		cbUploadHeapSizeInBytes(0),
 		cbUploadHeapStartAddress(0),
+		instanceUploadHeapOffsetInBytes(0),
+		instanceUploadHeapBytesInFlight(0),
+		instanceUploadHeapSizeInBytes(0),
+		instanceUploadHeapStartAddress(0),
 		cbvDescriptorOffset(0),
 		cbvSrvDescriptorHeapIncrementSize(0),
 		srvDescriptorOffset(0),
-		waitFenceCounter(0),
-		waitFenceEvent(0),
-		waitFence(0)
+		uploadBatchOpen(false),
+		uploadBatchList(0),
+		uploadBatchDone()
 	{ };
 #pragma endregion
 
@@ -43,11 +63,13 @@ public:
 	~DX12Helper();
 
 	//Intialization for singleton
+	//(commandAllocator is the first frame's, the rest are made here)
 	void Initialize(
 		Microsoft::WRL::ComPtr<ID3D12Device> device,
 		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList,
 		Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue,
-		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator,
+		unsigned int framesInFlight
 	);
 
 	//Getter for CBV/SRV descriptor heap
@@ -56,6 +78,13 @@ public:
 	//Function for general static buffer (aka resource creation)
 	Microsoft::WRL::ComPtr<ID3D12Resource> CreateStaticBuffer(unsigned int dataStride, unsigned int dataCount, void* data);
 
+	//Static buffers created between these two are copied all at once on
+	//the copy queue, and the direct queue waits for it (on the GPU) before
+	//anything submitted after EndUploadBatch(). The CPU doesn't wait at all.
+	//Nothing may use them before EndUploadBatch() returns.
+	void BeginUploadBatch();
+	void EndUploadBatch();
+
 	//Create Descriptor entry for ImGui
 	void LoadImGui();
 	//Getter for said descriptor ^
@@ -64,21 +93,50 @@ public:
 	//More resource creation, load textures
 	D3D12_CPU_DESCRIPTOR_HANDLE LoadTexture(const wchar_t* file, bool generateMips = true);
 
+	//LoadTexture() in two halves. Decoding only needs the device, so
+	//it's safe on any thread (job system workers included). Uploading
+	//happens on the main thread, any number of textures in one batch.
+	bool DecodeTexture(const wchar_t* file, DecodedTexture& decoded, bool generateMips = true);
+	void UploadTextures(DecodedTexture* decoded, unsigned int count, D3D12_CPU_DESCRIPTOR_HANDLE* handles);
+
 	//Create fields for dynamic resources
 	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> GetConstantBufferDescriptorHeap();
 	D3D12_GPU_DESCRIPTOR_HANDLE FillNextConstantBufferAndGetGPUDescriptorHandle(
 		void* data,
 		unsigned int dataSizeInBytes);
 
+	//Per-instance vertex data, same ring buffer idea as the constant buffers.
+	//Returns a vertex buffer view for slot 1 of the input assembler
+	D3D12_VERTEX_BUFFER_VIEW FillNextInstanceBufferAndGetView(
+		void* data,
+		unsigned int strideInBytes,
+		unsigned int instanceCount);
+
 	D3D12_GPU_DESCRIPTOR_HANDLE CopySRVsToDescriptorHeapAndGetGPUDescriptorHandle(
 		D3D12_CPU_DESCRIPTOR_HANDLE firstDescriptorToCopy, unsigned int numDescriptorsToCopy
 	);
 
+	//Sets aside descriptors in the CBV/SRV heap for views that get (re)created
+	//in place later on, like ones for resources that are rebuilt on resize.
+	//cpuHandle gets the CPU side of the same slots.
+	D3D12_GPU_DESCRIPTOR_HANDLE ReserveDescriptors(unsigned int count, D3D12_CPU_DESCRIPTOR_HANDLE* cpuHandle);
+	SIZE_T GetDescriptorIncrementSize();
+
 	//Handle for ImGui descriptor
 	D3D12_GPU_DESCRIPTOR_HANDLE CreateImGuiGPUHandle(D3D12_CPU_DESCRIPTOR_HANDLE firstDescriptorToCopy);
 
+	//Knows the state of every resource made here (plus the back buffers),
+	//use it instead of recording transitions by hand
+	ResourceStateTracker& GetStateTracker();
+
 	// Command list & synchronization
+	//Executes the main list and waits for the GPU to finish it (loading, one-off uploads)
 	void CloseExecuteAndResetCommandList();
+	//Once a frame: the (already closed) lists passed in are submitted right
+	//after the main list in the same ExecuteCommandLists call, and the main
+	//list moves on to the next frame's allocator. The CPU only waits if the
+	//GPU isn't done with the frame that last used that allocator.
+	void CloseExecuteAndResetCommandList(ID3D12CommandList* const* additionalLists, unsigned int additionalListCount);
 	void WaitForGPU();
 
 private:
@@ -96,18 +154,31 @@ private:
 	//Not immediate, just a list of commands that will be sent to GPU
 	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList;
 
-	//Need memory for commands that will be sent to GPU
-	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator;
+	//Need memory for commands that will be sent to GPU - one allocator per
+	//frame in flight, along with how much of each upload ring that frame used,
+	//all free again once the GPU gets past done
+	struct FrameSlot
+	{
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator;
+		GpuSyncPoint done;
+		UINT64 constantBufferBytes;
+		UINT64 instanceBytes;
+	};
+	std::vector<FrameSlot> frames;
+	unsigned int currentFrame;
+
+	//Waits for the GPU to finish with a frame and frees its ring space
+	void RetireFrame(unsigned int frame);
+	//Retires the oldest frame still in flight (not the current one).
+	//False if there isn't one.
+	bool RetireOldestFrame();
+	GpuSyncPoint SubmitCommandList(ID3D12CommandList* const* additionalLists, unsigned int additionalListCount);
 
 	//Will execute the set(s) of commands from commandLists, 
 	//and set them to be executed on the GPU
+	//(the direct queue from GpuQueues, which also does the waiting)
 	Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue;
 
-	//CPU/GPU synchronization
-	Microsoft::WRL::ComPtr<ID3D12Fence> waitFence;
-	HANDLE								waitFenceEvent;
-	unsigned long						waitFenceCounter;
-
 	//Max number of constant buffers.
 	//Assumes that each buffer is 256 bytes or less.
 	//Larger buffers are possible, 
@@ -127,8 +198,20 @@ private:
 	Microsoft::WRL::ComPtr<ID3D12Resource> cbUploadHeap;
 	UINT64 cbUploadHeapSizeInBytes;
 	UINT64 cbUploadHeapOffsetInBytes;
+	UINT64 cbUploadHeapBytesInFlight; //Handed out to frames the GPU may not be done with
 	void* cbUploadHeapStartAddress;
 
+	//Max number of instances that can be uploaded in a single frame.
+	//Assumes each instance is 192 bytes (3 matrices) or less.
+	const unsigned int maxInstances = 65536;
+
+	//GPU-side per-instance data upload heap (used directly as a vertex buffer)
+	Microsoft::WRL::ComPtr<ID3D12Resource> instanceUploadHeap;
+	UINT64 instanceUploadHeapSizeInBytes;
+	UINT64 instanceUploadHeapOffsetInBytes;
+	UINT64 instanceUploadHeapBytesInFlight; //Handed out to frames the GPU may not be done with
+	void* instanceUploadHeapStartAddress;
+
 	//GPU-side CBV/SRV descriptor heap
 	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> cbvSrvDescriptorHeap;
 	SIZE_T cbvSrvDescriptorHeapIncrementSize;
@@ -136,11 +219,24 @@ private:
 	unsigned int srvDescriptorOffset;
 
 	void CreateConstantBufferUploadHeap();
+	void CreateInstanceUploadHeap();
 	void CreateCBVSRVDescriptorHeap();
 
 	//Tried making ImGui use a unique descriptorHeap, but that didn't solve issue.
 	void CreateImGuiDescriptorHeap();
 
+	//Resource states
+	ResourceStateTracker stateTracker;
+
+	//Upload heaps for static buffers waiting on EndUploadBatch(), then
+	//on the copy queue to be done with them (uploadBatchDone)
+	bool uploadBatchOpen;
+	ID3D12GraphicsCommandList* uploadBatchList; //Copy queue list
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> pendingUploadHeaps;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> submittedUploadHeaps;
+	GpuSyncPoint uploadBatchDone;
+	void ReleaseFinishedUploads();
+
 	//Texture fields
 	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> textures;
 	std::vector<Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>> cpuSideTextureDescriptorHeaps;
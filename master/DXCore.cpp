@@ -3,6 +3,13 @@
 #include "DXCore.h"
 #include "Input.h"
 #include "DX12Helper.h"
+#include "GpuQueues.h"
+#include "JobSystem.h"
+#include "PipelineCache.h"
+#include "CpuProfiler.h"
+#include "StartupProfiler.h"
+#include "TracedCommandList.h"
+#include "Logger.h"
 
 #include <WindowsX.h>
 #include <sstream>
@@ -57,6 +64,9 @@ DXCore::DXCore(
 
 	// Initialize fields
 	this->hasFocus = true; 
+	this->headless = false;
+	this->fixedTimestep = 0.0f;
+	this->fixedFrameCount = 0;
 	
 	this->fpsFrameCount = 0;
 	this->fpsTimeElapsed = 0.0f;
@@ -84,6 +94,15 @@ DXCore::~DXCore()
 	// Delete input manager singleton
 	delete& Input::GetInstance();
 	delete& DX12Helper::GetInstance();
+	delete& GpuQueues::GetInstance();
+	delete& PipelineCache::GetInstance();
+	delete& JobSystem::GetInstance();
+	delete& CpuProfiler::GetInstance();	// After the workers, which record into it
+	delete& CommandTracer::GetInstance();
+	delete& StartupProfiler::GetInstance();
+
+	// Last, so everything above can still log on the way out
+	delete& Logger::GetInstance();
 }
 
 // --------------------------------------------------------
@@ -157,7 +176,9 @@ HRESULT DXCore::InitWindow()
 
 	// The window exists but is not visible yet
 	// We need to tell Windows to show it, and how to show it
-	ShowWindow(hWnd, SW_SHOW);
+	// (headless runs keep it hidden - it's only there for messages and input)
+	if (!headless)
+		ShowWindow(hWnd, SW_SHOW);
 
 	// Initialize the input manager now that we definitely have a window
 	Input::GetInstance().Initialize(hWnd);
@@ -223,11 +244,11 @@ HRESULT DXCore::InitDirectX()
 			D3D12_COMMAND_LIST_TYPE_DIRECT,
 			IID_PPV_ARGS(commandAllocator.GetAddressOf()));
 
-		// Command queue
-		D3D12_COMMAND_QUEUE_DESC qDesc = {};
-		qDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
-		qDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
-		device->CreateCommandQueue(&qDesc, IID_PPV_ARGS(commandQueue.GetAddressOf()));
+		// Command queues - direct, async compute and copy (see GpuQueues.h).
+		// The direct one is the queue everything used to go through.
+		hr = GpuQueues::GetInstance().Initialize(device, numBackBuffers);
+		if (FAILED(hr)) return hr;
+		commandQueue = GpuQueues::GetInstance().GetQueue(GPU_QUEUE_DIRECT);
 
 		// Command list
 		device->CreateCommandList(
@@ -236,6 +257,9 @@ HRESULT DXCore::InitDirectX()
 			commandAllocator.Get(), // The allocator for this list
 			0, // Initial pipeline state - none for now
 			IID_PPV_ARGS(commandList.GetAddressOf()));
+
+		// Everything gets the traced version, so command traces can be captured any time
+		CommandTracer::GetInstance().Wrap(commandList);
 	}
 
 	// Now that we have a device and a command list stuff,
@@ -245,34 +269,23 @@ HRESULT DXCore::InitDirectX()
 			device,
 			commandList,
 			commandQueue,
-			commandAllocator);
+			commandAllocator,
+			numBackBuffers);
 	}
 
-	// Swap chain creation
+	// Swap chain creation (headless runs go without one)
+	if (!headless)
 	{
-		// Create a description of how our swap chain should work
-		DXGI_SWAP_CHAIN_DESC swapDesc = {};
-		swapDesc.BufferCount = numBackBuffers;
-		swapDesc.BufferDesc.Width = width;
-		swapDesc.BufferDesc.Height = height;
-		swapDesc.BufferDesc.RefreshRate.Numerator = 60;
-		//swapDesc.BufferDesc.RefreshRate.Numerator = 144; Ask Chris?
-		swapDesc.BufferDesc.RefreshRate.Denominator = 1;
-		swapDesc.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-		swapDesc.BufferDesc.ScanlineOrdering = DXGI_MODE_SCANLINE_ORDER_UNSPECIFIED;
-		swapDesc.BufferDesc.Scaling = DXGI_MODE_SCALING_UNSPECIFIED;
-		swapDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-		swapDesc.Flags = 0;
-		swapDesc.OutputWindow = hWnd;
-		swapDesc.SampleDesc.Count = 1;
-		swapDesc.SampleDesc.Quality = 0;
-		swapDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
-		swapDesc.Windowed = true;
-
-		// Create a DXGI factory, which is what we use to create a swap chain
-		Microsoft::WRL::ComPtr<IDXGIFactory> dxgiFactory;
-		CreateDXGIFactory(IID_PPV_ARGS(dxgiFactory.GetAddressOf()));
-		hr = dxgiFactory->CreateSwapChain(commandQueue.Get(), &swapDesc, swapChain.GetAddressOf());
+		// Flip model, with a waitable object for pacing (see FramePacer.h)
+		hr = framePacer.CreateSwapChain(
+			commandQueue.Get(),
+			hWnd,
+			width,
+			height,
+			numBackBuffers,
+			DXGI_FORMAT_R8G8B8A8_UNORM,
+			swapChain);
+		if (FAILED(hr)) return hr;
 	}
 
 	// Create back buffers
@@ -291,8 +304,8 @@ HRESULT DXCore::InitDirectX()
 		// Now create the RTV handles for each buffer (buffers were created by the swap chain)
 		for (unsigned int i = 0; i < numBackBuffers; i++)
 		{
-			// Grab this buffer from the swap chain
-			swapChain->GetBuffer(i, IID_PPV_ARGS(backBuffers[i].GetAddressOf()));
+			// Grab this buffer from the swap chain (or make one)
+			CreateBackBuffer(i);
 
 			// Make a handle for it
 			rtvHandles[i] = rtvHeap->GetCPUDescriptorHandleForHeapStart();
@@ -300,6 +313,9 @@ HRESULT DXCore::InitDirectX()
 
 			// Create the render target view
 			device->CreateRenderTargetView(backBuffers[i].Get(), 0, rtvHandles[i]);
+
+			// Swap chain buffers start out ready to present
+			DX12Helper::GetInstance().GetStateTracker().Register(backBuffers[i].Get(), D3D12_RESOURCE_STATE_PRESENT);
 		}
 	}
 
@@ -317,7 +333,7 @@ HRESULT DXCore::InitDirectX()
 		depthBufferDesc.DepthOrArraySize = 1;
 		depthBufferDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
 		depthBufferDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
-		depthBufferDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT; //(S8) A stencil buffer is used to mask pixels in an image, we have not implemented this.
+		depthBufferDesc.Format = DXGI_FORMAT_R24G8_TYPELESS; //(S8) A stencil buffer is used to mask pixels in an image, we have not implemented this. Typeless so it can be read as a texture too.
 		depthBufferDesc.Height = height;
 		depthBufferDesc.Width = width;
 		depthBufferDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
@@ -350,6 +366,7 @@ HRESULT DXCore::InitDirectX()
 			D3D12_RESOURCE_STATE_DEPTH_WRITE, //Only allows writing of Depth information.
 			&clear,
 			IID_PPV_ARGS(depthStencilBuffer.GetAddressOf())); //Gets it into GPU memory for usage
+		DX12Helper::GetInstance().GetStateTracker().Register(depthStencilBuffer.Get(), D3D12_RESOURCE_STATE_DEPTH_WRITE);
 
 		// Get the handle to the Depth Stencil View that we'll
 		// be using for the depth buffer.  The DSV is stored in
@@ -357,9 +374,12 @@ HRESULT DXCore::InitDirectX()
 		dsvHandle = dsvHeap->GetCPUDescriptorHandleForHeapStart(); //Use this to swap on runtime.
 
 		// Actually make the DSV
+		D3D12_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+		dsvDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT; // Resource is typeless, so the view has to say
+		dsvDesc.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
 		device->CreateDepthStencilView(
 			depthStencilBuffer.Get(),
-			0, // Default view (first mip)
+			&dsvDesc, // First mip
 			dsvHandle);
 	}
 
@@ -391,6 +411,50 @@ HRESULT DXCore::InitDirectX()
 	return S_OK;
 }
 
+// --------------------------------------------------------
+// Fills in backBuffers[index]: the swap chain's buffer, or
+// for headless runs a plain texture of the same size and
+// format. Those start out in COMMON, which is the same state
+// as PRESENT, so the rest of the frame can't tell the difference.
+// --------------------------------------------------------
+void DXCore::CreateBackBuffer(unsigned int index)
+{
+	if (swapChain)
+	{
+		swapChain->GetBuffer(index, IID_PPV_ARGS(backBuffers[index].GetAddressOf()));
+		return;
+	}
+
+	D3D12_RESOURCE_DESC desc = {};
+	desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	desc.Width = width;
+	desc.Height = height;
+	desc.DepthOrArraySize = 1;
+	desc.MipLevels = 1;
+	desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	desc.SampleDesc.Count = 1;
+	desc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+
+	D3D12_HEAP_PROPERTIES props = {};
+	props.Type = D3D12_HEAP_TYPE_DEFAULT;
+	props.CreationNodeMask = 1;
+	props.VisibleNodeMask = 1;
+
+	// Same clear color as the scene pass, so clears stay on the fast path
+	D3D12_CLEAR_VALUE clear = {};
+	clear.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	clear.Color[3] = 1.0f;
+
+	device->CreateCommittedResource(
+		&props,
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		D3D12_RESOURCE_STATE_PRESENT,
+		&clear,
+		IID_PPV_ARGS(backBuffers[index].ReleaseAndGetAddressOf()));
+}
+
 // --------------------------------------------------------
 // When the window is resized, the underlying 
 // buffers (textures) must also be resized to match.
@@ -408,19 +472,23 @@ void DXCore::OnResize()
 	dx12Helper.WaitForGPU();
 
 	// Release the back buffers using ComPtr's Reset()
+	// (and stop tracking them, the new ones may reuse the same addresses)
 	for (unsigned int i = 0; i < numBackBuffers; i++)
+	{
+		dx12Helper.GetStateTracker().Unregister(backBuffers[i].Get());
 		backBuffers[i].Reset();
+	}
 
-	// Resize the swap chain (assuming a basic color format here)
-	swapChain->ResizeBuffers(numBackBuffers, width, height, DXGI_FORMAT_R8G8B8A8_UNORM, 0);
+	// Resize the swap chain (same format and flags it was made with)
+	framePacer.ResizeBuffers(width, height);
 
 	// Go through the steps to setup the back buffers again
 	// Note: This assumes the descriptor heap already exists
 	// and that the rtvDescriptorSize was previously set
 	for (unsigned int i = 0; i < numBackBuffers; i++)
 	{
-		// Grab this buffer from the swap chain
-		swapChain->GetBuffer(i, IID_PPV_ARGS(backBuffers[i].GetAddressOf()));
+		// Grab this buffer from the swap chain (or make one)
+		CreateBackBuffer(i);
 
 		// Make a handle for it
 		rtvHandles[i] = rtvHeap->GetCPUDescriptorHandleForHeapStart();
@@ -428,13 +496,15 @@ void DXCore::OnResize()
 
 		// Create the render target view
 		device->CreateRenderTargetView(backBuffers[i].Get(), 0, rtvHandles[i]);
+		dx12Helper.GetStateTracker().Register(backBuffers[i].Get(), D3D12_RESOURCE_STATE_PRESENT);
 	}
 
-	// Reset back to the first back buffer
-	currentSwapBuffer = 0;
+	// Back to whichever buffer the swap chain starts on
+	currentSwapBuffer = swapChain ? swapChain->GetCurrentBackBufferIndex() : 0;
 
 	// Reset the depth buffer and create it again
 	{
+		dx12Helper.GetStateTracker().Unregister(depthStencilBuffer.Get());
 		depthStencilBuffer.Reset();
 		// Describe the depth stencil buffer resource
 		D3D12_RESOURCE_DESC depthBufferDesc = {};
@@ -442,7 +512,7 @@ void DXCore::OnResize()
 		depthBufferDesc.DepthOrArraySize = 1;
 		depthBufferDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
 		depthBufferDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
-		depthBufferDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+		depthBufferDesc.Format = DXGI_FORMAT_R24G8_TYPELESS;
 		depthBufferDesc.Height = height;
 		depthBufferDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
 		depthBufferDesc.MipLevels = 1;
@@ -474,12 +544,16 @@ void DXCore::OnResize()
 			D3D12_RESOURCE_STATE_DEPTH_WRITE,
 			&clear,
 			IID_PPV_ARGS(depthStencilBuffer.GetAddressOf()));
+		dx12Helper.GetStateTracker().Register(depthStencilBuffer.Get(), D3D12_RESOURCE_STATE_DEPTH_WRITE);
 
 		// Now recreate the depth stencil view
 		dsvHandle = dsvHeap->GetCPUDescriptorHandleForHeapStart();
+		D3D12_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+		dsvDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT; // Resource is typeless, so the view has to say
+		dsvDesc.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
 		device->CreateDepthStencilView(
 			depthStencilBuffer.Get(),
-			0, // Default view (first mip)
+			&dsvDesc, // First mip
 			dsvHandle);
 	}
 
@@ -570,8 +644,25 @@ HRESULT DXCore::Run()
 	currentTime = now;
 	previousTime = now;
 
+	// Log to the console (if there is one) and a file next to the exe
+	{
+		STARTUP_PHASE("Logger");
+		Logger::GetInstance().Initialize(true, GetFullPathTo("Log.txt"));
+		Logger::GetInstance().SetLevel(LOG_MIN_LEVEL);
+	}
+
+	// Spin up the job system's workers (one per core)
+	// before the subclass wants to use them
+	{
+		STARTUP_PHASE("Job system");
+		JobSystem::GetInstance().Initialize();
+	}
+
 	// Give subclass a chance to initialize
-	Init();
+	{
+		STARTUP_PHASE("Init");
+		Init();
+	}
 
 	// Our overall game and message loop
 	MSG msg = {};
@@ -587,20 +678,47 @@ HRESULT DXCore::Run()
 		}
 		else
 		{
-			// Update timer and title bar (if necessary)
-			UpdateTimer();
-			if(titleBarStats)
-				UpdateTitleBarStats();
+			// Nothing starts (not even reading input) until the swap chain
+			// can take another frame, so the input is as fresh as it gets
+			framePacer.WaitForFrame();
+
+			{
+				PROFILE_SCOPE("DXCore::Run");
+
+				// Update timer and title bar (if necessary)
+				UpdateTimer();
+				if(titleBarStats)
+					UpdateTitleBarStats();
+
+				// Update the input manager (replays swap in the
+				// recorded input and time step here)
+				Input& input = Input::GetInstance();
+				input.Update();
+				input.RecordOrReplayTime(deltaTime, totalTime);
 
-			// Update the input manager
-			Input::GetInstance().Update();
+				// The game loop
+				Update(deltaTime, totalTime);
+				Draw(deltaTime, totalTime);
 
-			// The game loop
-			Update(deltaTime, totalTime);
-			Draw(deltaTime, totalTime);
+				// Frame is over, notify the input manager
+				input.EndOfFrame();
+
+				// The first frame being done is the end of startup
+				StartupProfiler::GetInstance().EndFrame();
+
+				// A replay is the whole session - stop once it runs out
+				if (input.ReplayFinished())
+					Quit();
+
+				// One frame = one window of job system utilization stats
+				JobSystem::GetInstance().EndStatsWindow();
+
+				// Everything's been submitted, so a command trace can start or end here
+				CommandTracer::GetInstance().EndFrame();
+			}
 
-			// Frame is over, notify the input manager
-			Input::GetInstance().EndOfFrame();
+			// After the frame's scope closes, so a capture's last frame is complete
+			PROFILE_FRAME();
 		}
 	}
 
@@ -639,6 +757,14 @@ void DXCore::UpdateTimer()
 	// Calculate the total time from start to now
 	totalTime = (float)((currentTime - startTime) * perfCounterSeconds);
 
+	// Or pretend every frame took exactly the same time
+	if (fixedTimestep > 0.0f)
+	{
+		deltaTime = fixedTimestep;
+		fixedFrameCount++;
+		totalTime = (float)((double)fixedTimestep * fixedFrameCount);
+	}
+
 	// Save current time for next frame
 	previousTime = currentTime;
 }
@@ -802,6 +928,16 @@ std::string DXCore::GetFullPathTo(std::string relativeFilePath)
 	return GetExePath() + "\\" + relativeFilePath;
 }
 
+// ----------------------------------------------------
+//  For paths from the command line: absolute ones are
+//  left alone, anything else goes next to the exe
+// ----------------------------------------------------
+std::string DXCore::ResolvePath(const std::string& path)
+{
+	bool absolute = path.find(':') != std::string::npos || (!path.empty() && (path[0] == '\\' || path[0] == '/'));
+	return absolute ? path : GetFullPathTo(path);
+}
+
 
 
 // ----------------------------------------------------
@@ -853,6 +989,11 @@ LRESULT DXCore::ProcessMessage(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPara
 		// and that doesn't play well with the GPU
 		if (wParam == SIZE_MINIMIZED)
 			return 0;
+
+		// Offscreen buffers stay the size they were asked to be,
+		// whatever the (hidden) window ends up as
+		if (headless)
+			return 0;
 		
 		// Save the new client area dimensions.
 		width = LOWORD(lParam);
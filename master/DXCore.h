@@ -6,6 +6,8 @@
 #include <string>
 #include <wrl/client.h> // Used for ComPtr - a smart pointer for COM objects
 
+#include "FramePacer.h"
+
 // We can include the correct library files here
 // instead of in Visual Studio settings if we want
 #pragma comment(lib, "d3d12.lib")
@@ -56,6 +58,14 @@ protected:
 	unsigned int width;
 	unsigned int height;
 
+	// No visible window and no swap chain - frames go to offscreen
+	// back buffers instead (benchmarks, machines without a display)
+	bool headless;
+
+	// Seconds per frame when it's not 0, instead of the real time
+	// between frames - every run then steps through the same times
+	float fixedTimestep;
+
 	// Does our window currently have focus?
 	// Helpful if we want to pause while not the active window
 	bool hasFocus;
@@ -63,7 +73,11 @@ protected:
 	// DirectX related objects and variables
 	D3D_FEATURE_LEVEL		dxFeatureLevel;
 	Microsoft::WRL::ComPtr<ID3D12Device> device;
-	Microsoft::WRL::ComPtr<IDXGISwapChain> swapChain; ///<---Doesn't handle buffers for us anymore and we have to TRACK them
+	Microsoft::WRL::ComPtr<IDXGISwapChain3> swapChain; ///<---Doesn't handle buffers for us anymore and we have to TRACK them
+
+	// Made the swap chain, and presents through it: waits for the swap
+	// chain before each frame, tears when vsync is off, measures latency
+	FramePacer framePacer;
 	
 	Microsoft::WRL::ComPtr<ID3D12CommandAllocator>		commandAllocator;
 	Microsoft::WRL::ComPtr<ID3D12CommandQueue>			commandQueue;
@@ -89,6 +103,9 @@ protected:
 	//HANDLE fenceEvent;
 	//unsigned long currentFence = 0; //Tracks which current fence we are at in the commandQueue.
 
+	// Swap chain buffer, or an offscreen one when headless
+	void CreateBackBuffer(unsigned int index);
+
 	// Helper function for allocating a console window
 	void CreateConsoleWindow(int bufferLines, int bufferColumns, int windowLines, int windowColumns);
 
@@ -97,6 +114,7 @@ protected:
 	std::wstring GetExePath_Wide();
 
 	std::string GetFullPathTo(std::string relativeFilePath);
+	std::string ResolvePath(const std::string& path);
 	std::wstring GetFullPathTo_Wide(std::wstring relativeFilePath);
 	std::wstring GetLatestWinPixGpuCapturerPath_Cpp17();
 
@@ -110,6 +128,8 @@ private:
 	__int64 currentTime;
 	__int64 previousTime;
 
+	unsigned int fixedFrameCount; // Frames stepped with fixedTimestep
+
 	// FPS calculation
 	int fpsFrameCount;
 	float fpsTimeElapsed;
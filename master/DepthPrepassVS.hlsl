@@ -0,0 +1,21 @@
+// Depth only version of VertexShader.hlsl, for the depth prepass.
+// Only needs the position and the world view projection matrix,
+// so the input layout skips everything else.
+struct VertexShaderInput
+{
+	float3 localPosition	: POSITION;
+
+	// Rows of the instance's world view projection matrix (match InstanceData!)
+	float4 wvp0				: WVP0;
+	float4 wvp1				: WVP1;
+	float4 wvp2				: WVP2;
+	float4 wvp3				: WVP3;
+};
+
+// Has to come out bit for bit the same as VertexShader.hlsl's position,
+// since the main pass tests against this depth with EQUAL (hence precise)
+precise float4 main(VertexShaderInput input) : SV_POSITION
+{
+	float4x4 worldViewProjection = float4x4(input.wvp0, input.wvp1, input.wvp2, input.wvp3);
+	return mul(float4(input.localPosition, 1.0f), worldViewProjection);
+}
@@ -1,34 +1,64 @@
-//Include Equations to make fluid simulation work. Work in Progress.
+// Stable fluids (Stam '99) on a grid of cells, one cell per thread.
+//
+// Velocities are in cells per second, so the grid spacing is
+// always 1. Each step goes: advect -> forces -> diffuse ->
+// divergence -> pressure -> project, the last three being what
+// keeps the flow incompressible (divergence free).
+//
+// Shared by ComputeShader.hlsl's stages, which pick one of these
+// per dispatch.
 
-//Navier-Stokes equations for incompressible flow
-//Returns rate of velocity field change over time
-float NavierStokes(float3 velocity, float pressure, float rateOfVelocity, float2 externalForces)
+cbuffer FluidConstants : register(b0)
 {
-	float fluidState = 0;
+	uint3 gridSize;
+	uint mode;				// Which stage this dispatch runs
 
-	//Compute W
+	float deltaTime;
+	float velocityDecay;	// Multipliers for this step, from the dissipation rates
+	float densityDecay;
+	float diffusionAlpha;	// Viscosity * deltaTime
 
+	float3 forcePosition;	// In cells
+	float forceRadius;
 
-	// rate of u = 0
-	// u/t = -(0)u
-	//fluid = 
+	float3 force;			// Cells per second per second, at the center of the splat
+	float dyeAmount;		// Density per second, at the center of the splat
 
-	//return state of fluid over time
-	return fluidState;
+	float buoyancy;			// Upward acceleration per unit of density
+	float overRelaxation;	// Pressure solve: 1 is plain Gauss-Seidel, up to 2
+	uint parity;			// Pressure solve: red (0) or black (1) cells
+	float padding;
+};
+
+// Semi-Lagrangian advection: follow the velocity backwards for a
+// step from the cell's center, and return where that lands in
+// texture coordinates - whatever's there now is what gets here.
+float3 Advection(uint3 cell, float3 velocity)
+{
+	float3 from = (float3)cell + 0.5f - velocity * deltaTime;
+	return from / (float3)gridSize;
 }
 
-float Advection()
+// One Jacobi iteration of implicit diffusion, (I - a*Laplacian) x = b:
+// start is b (the field before diffusion), neighbors the sum of the
+// six neighbors' current guesses
+float3 Diffusion(float3 start, float3 neighbors)
 {
-	//-(u * change)v
-	return 0.0f;
+	return (start + diffusionAlpha * neighbors) / (1.0f + 6.0f * diffusionAlpha);
 }
 
-float Pressure()
+// Central differences, to match the gradient in Project
+float Divergence(float3 left, float3 right, float3 down, float3 up, float3 back, float3 front)
 {
-	return 0.0f;
+	return 0.5f * ((right.x - left.x) + (up.y - down.y) + (front.z - back.z));
 }
 
-float Diffusion()
+// One Gauss-Seidel update of the pressure Poisson equation,
+// Laplacian(p) = divergence. Walls don't count as neighbors
+// (zero pressure gradient into them), so neighborCount is 6 in
+// the middle, fewer along the edges - and 4 in a 2D grid.
+float Pressure(float current, float neighbors, float neighborCount, float divergence)
 {
-	return 0.0f;
-}
\ No newline at end of file
+	float solved = (neighbors - divergence) / neighborCount;
+	return lerp(current, solved, overRelaxation);
+}
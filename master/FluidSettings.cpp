@@ -0,0 +1,42 @@
+#include "FluidSettings.h"
+
+#include <cmath>
+
+FluidSettings::FluidSettings() :
+	enabled(false),
+	gridSize(64),
+	twoDimensional(false),
+	velocityDissipation(0.2f),
+	densityDissipation(0.5f),
+	viscosity(0.5f),
+	diffusionIterations(4),
+	pressureIterations(20),
+	overRelaxation(1.6f),
+	forceStrength(200.0f),
+	forceRadius(4.0f),
+	dyeAmount(10.0f),
+	buoyancy(2.0f)
+{
+}
+
+FluidStepParameters::FluidStepParameters(const FluidSettings& settings, unsigned int width, unsigned int height, unsigned int depth, float stepSeconds, double time) :
+	deltaTime(stepSeconds),
+	velocityDecay(expf(-settings.velocityDissipation * stepSeconds)),
+	densityDecay(expf(-settings.densityDissipation * stepSeconds)),
+	diffusionAlpha(settings.viscosity * stepSeconds),
+	forceRadius(settings.forceRadius),
+	dyeAmount(settings.dyeAmount),
+	buoyancy(settings.buoyancy),
+	overRelaxation(settings.overRelaxation)
+{
+	// The splat circles the bottom of the grid, pushing up and around
+	float angle = (float)time;
+	float c = cosf(angle);
+	float s = sinf(angle);
+	forcePosition[0] = width * (0.5f + 0.25f * c);
+	forcePosition[1] = height * 0.2f;
+	forcePosition[2] = depth == 1 ? 0.5f : depth * (0.5f + 0.25f * s);
+	force[0] = -s * settings.forceStrength * 0.5f;
+	force[1] = settings.forceStrength;
+	force[2] = depth == 1 ? 0.0f : c * settings.forceStrength * 0.5f;
+}
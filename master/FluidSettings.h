@@ -0,0 +1,41 @@
+#pragma once
+
+// What the Fluid Window can change. Rates are per second, distances in cells.
+struct FluidSettings
+{
+	bool enabled;
+	unsigned int gridSize;			// Cells along each side, 16 - 128
+	bool twoDimensional;			// One cell deep
+	float velocityDissipation;		// Fraction lost per second (roughly)
+	float densityDissipation;
+	float viscosity;				// 0 skips diffusion
+	unsigned int diffusionIterations;
+	unsigned int pressureIterations;	// Red-black pairs
+	float overRelaxation;			// 1 - 1.9, higher converges faster
+	float forceStrength;
+	float forceRadius;
+	float dyeAmount;
+	float buoyancy;
+
+	FluidSettings();
+};
+
+// One step's constants: the settings' per second rates turned into
+// per step multipliers, and where the force splat is at that step's
+// (simulated) time. Both solvers build theirs here, so the GPU and
+// CPU versions push the fluid around the same way.
+struct FluidStepParameters
+{
+	float deltaTime;
+	float velocityDecay;
+	float densityDecay;
+	float diffusionAlpha;
+	float forcePosition[3];
+	float forceRadius;
+	float force[3];
+	float dyeAmount;
+	float buoyancy;
+	float overRelaxation;
+
+	FluidStepParameters(const FluidSettings& settings, unsigned int width, unsigned int height, unsigned int depth, float stepSeconds, double time);
+};
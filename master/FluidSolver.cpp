@@ -0,0 +1,356 @@
+#include "FluidSolver.h"
+#include "DX12Helper.h"
+#include "CpuProfiler.h"
+#include "Logger.h"
+
+#include <d3dcompiler.h>
+#include <cstring>
+
+FluidSolver::FluidSolver() :
+	descriptorsCPU(),
+	descriptorsGPU(),
+	descriptorSize(0),
+	width(0),
+	height(0),
+	depth(0),
+	currentVelocity(0),
+	currentDensity(0),
+	clearPending(true),
+	lastSubmit(),
+	lastSteps(0)
+{
+}
+
+void FluidSolver::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, const std::wstring& shaderPath, unsigned int framesInFlight)
+{
+	this->device = device;
+
+	// Root signature: constants, then a one descriptor table per texture slot
+	// so any stage can bind any combination. Advection samples through s0.
+	{
+		D3D12_DESCRIPTOR_RANGE ranges[ROOT_PARAMETER_COUNT - 1] = {};
+		D3D12_ROOT_PARAMETER rootParams[ROOT_PARAMETER_COUNT] = {};
+		for (D3D12_ROOT_PARAMETER& param : rootParams)
+			param.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+		rootParams[ROOT_CONSTANTS].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+		rootParams[ROOT_CONSTANTS].Constants.Num32BitValues = sizeof(FluidConstants) / 4;
+		rootParams[ROOT_CONSTANTS].Constants.ShaderRegister = 0;
+
+		for (unsigned int i = 0; i < ROOT_PARAMETER_COUNT - 1; i++)
+		{
+			bool srv = ROOT_VELOCITY_IN + i <= ROOT_VELOCITY_START;
+			ranges[i].RangeType = srv ? D3D12_DESCRIPTOR_RANGE_TYPE_SRV : D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
+			ranges[i].NumDescriptors = 1;
+			ranges[i].BaseShaderRegister = srv ? i : i - 3;
+			ranges[i].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
+			D3D12_ROOT_PARAMETER& param = rootParams[ROOT_VELOCITY_IN + i];
+			param.ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+			param.DescriptorTable.NumDescriptorRanges = 1;
+			param.DescriptorTable.pDescriptorRanges = &ranges[i];
+		}
+
+		D3D12_STATIC_SAMPLER_DESC sampler = {};
+		sampler.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+		sampler.AddressU = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+		sampler.AddressV = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+		sampler.AddressW = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+		sampler.MaxLOD = D3D12_FLOAT32_MAX;
+		sampler.ShaderRegister = 0;
+		sampler.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+		D3D12_ROOT_SIGNATURE_DESC rootSig = {};
+		rootSig.NumParameters = ROOT_PARAMETER_COUNT;
+		rootSig.pParameters = rootParams;
+		rootSig.NumStaticSamplers = 1;
+		rootSig.pStaticSamplers = &sampler;
+
+		Microsoft::WRL::ComPtr<ID3DBlob> serializedRootSig;
+		Microsoft::WRL::ComPtr<ID3DBlob> errors;
+		D3D12SerializeRootSignature(&rootSig, D3D_ROOT_SIGNATURE_VERSION_1, serializedRootSig.GetAddressOf(), errors.GetAddressOf());
+		if (errors)
+		{
+			OutputDebugStringA((char*)errors->GetBufferPointer());
+			LOG_ERROR("Fluid root signature: %s", (char*)errors->GetBufferPointer());
+		}
+
+		device->CreateRootSignature(0, serializedRootSig->GetBufferPointer(), serializedRootSig->GetBufferSize(), IID_PPV_ARGS(rootSignature.GetAddressOf()));
+	}
+
+	// One pipeline for every stage
+	{
+		Microsoft::WRL::ComPtr<ID3DBlob> shader;
+		if (FAILED(D3DReadFileToBlob(shaderPath.c_str(), shader.GetAddressOf())))
+		{
+			LOG_ERROR("Fluid: couldn't read %ls, the solver won't run", shaderPath.c_str());
+			return;
+		}
+
+		D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+		psoDesc.pRootSignature = rootSignature.Get();
+		psoDesc.CS.pShaderBytecode = shader->GetBufferPointer();
+		psoDesc.CS.BytecodeLength = shader->GetBufferSize();
+		device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(pipeline.GetAddressOf()));
+	}
+
+	profiler.Initialize(device, GpuQueues::GetInstance().GetQueue(GPU_QUEUE_COMPUTE).Get(), framesInFlight);
+
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	descriptorsGPU = dx12Helper.ReserveDescriptors(DESCRIPTOR_COUNT, &descriptorsCPU);
+	descriptorSize = dx12Helper.GetDescriptorIncrementSize();
+}
+
+void FluidSolver::CreateGrid()
+{
+	// Whatever's still running on the old grid has to finish first
+	GpuQueues::GetInstance().WaitOnCpu(lastSubmit);
+
+	width = height = settings.gridSize;
+	depth = settings.twoDimensional ? 1 : settings.gridSize;
+
+	D3D12_HEAP_PROPERTIES props = {};
+	props.Type = D3D12_HEAP_TYPE_DEFAULT;
+	props.CreationNodeMask = 1;
+	props.VisibleNodeMask = 1;
+
+	D3D12_RESOURCE_DESC desc = {};
+	desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE3D;
+	desc.Width = width;
+	desc.Height = height;
+	desc.DepthOrArraySize = (UINT16)depth;
+	desc.MipLevels = 1;
+	desc.SampleDesc.Count = 1;
+	desc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+	auto create = [&](Microsoft::WRL::ComPtr<ID3D12Resource>& texture, DXGI_FORMAT format)
+	{
+		if (texture)
+			stateTracker.Unregister(texture.Get());
+		texture.Reset();
+
+		desc.Format = format;
+		device->CreateCommittedResource(&props, D3D12_HEAP_FLAG_NONE, &desc,
+			D3D12_RESOURCE_STATE_COMMON, 0, IID_PPV_ARGS(texture.GetAddressOf()));
+		stateTracker.Register(texture.Get(), D3D12_RESOURCE_STATE_COMMON);
+	};
+
+	// Velocity needs float4 for typed stores (there's no RGB16)
+	for (auto& texture : velocity)
+		create(texture, DXGI_FORMAT_R16G16B16A16_FLOAT);
+	for (auto& texture : density)
+		create(texture, DXGI_FORMAT_R16_FLOAT);
+
+	// Read and written through the same UAV, which only R32 is sure to allow
+	create(divergence, DXGI_FORMAT_R32_FLOAT);
+	create(pressure, DXGI_FORMAT_R32_FLOAT);
+
+	auto handle = [&](unsigned int index)
+	{
+		D3D12_CPU_DESCRIPTOR_HANDLE h = descriptorsCPU;
+		h.ptr += index * descriptorSize;
+		return h;
+	};
+	auto createViews = [&](ID3D12Resource* texture, DXGI_FORMAT format, int srvIndex, unsigned int uavIndex)
+	{
+		if (srvIndex >= 0)
+		{
+			D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+			srvDesc.Format = format;
+			srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE3D;
+			srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+			srvDesc.Texture3D.MipLevels = 1;
+			device->CreateShaderResourceView(texture, &srvDesc, handle(srvIndex));
+		}
+
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = format;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE3D;
+		uavDesc.Texture3D.WSize = depth;
+		device->CreateUnorderedAccessView(texture, 0, &uavDesc, handle(uavIndex));
+	};
+
+	for (unsigned int i = 0; i < 3; i++)
+		createViews(velocity[i].Get(), DXGI_FORMAT_R16G16B16A16_FLOAT, DESCRIPTOR_VELOCITY_SRV + i, DESCRIPTOR_VELOCITY_UAV + i);
+	for (unsigned int i = 0; i < 2; i++)
+		createViews(density[i].Get(), DXGI_FORMAT_R16_FLOAT, DESCRIPTOR_DENSITY_SRV + i, DESCRIPTOR_DENSITY_UAV + i);
+	createViews(divergence.Get(), DXGI_FORMAT_R32_FLOAT, -1, DESCRIPTOR_DIVERGENCE_UAV);
+	createViews(pressure.Get(), DXGI_FORMAT_R32_FLOAT, -1, DESCRIPTOR_PRESSURE_UAV);
+
+	currentVelocity = 0;
+	currentDensity = 0;
+	clearPending = true;
+}
+
+void FluidSolver::Step(unsigned int steps, float stepSeconds, double stepTime, unsigned int frameIndex)
+{
+	// This slot's compute work is done (GpuQueues::BeginFrame waited for it)
+	profiler.BeginFrame(frameIndex);
+	stateTracker.EndFrame();
+	lastSteps = 0;
+
+	if (!settings.enabled || !pipeline || steps == 0)
+		return;
+
+	PROFILE_FUNCTION();
+
+	// New grid size?
+	unsigned int wantDepth = settings.twoDimensional ? 1 : settings.gridSize;
+	if (width != settings.gridSize || depth != wantDepth)
+		CreateGrid();
+
+	GpuQueues& queues = GpuQueues::GetInstance();
+	ID3D12GraphicsCommandList* commandList = queues.OpenList(GPU_QUEUE_COMPUTE);
+
+	ID3D12DescriptorHeap* heap = DX12Helper::GetInstance().GetCBVSRVDescriptorHeap().Get();
+	commandList->SetDescriptorHeaps(1, &heap);
+	commandList->SetComputeRootSignature(rootSignature.Get());
+	commandList->SetPipelineState(pipeline.Get());
+
+	FluidConstants constants = {};
+	constants.gridSize[0] = width;
+	constants.gridSize[1] = height;
+	constants.gridSize[2] = depth;
+
+	// Every velocity and density texture (the divergence and pressure go along each time)
+	if (clearPending)
+	{
+		for (unsigned int i = 0; i < 3; i++)
+			Dispatch(commandList, constants, MODE_CLEAR, unused, unused, unused, i, i % 2);
+		clearPending = false;
+	}
+
+	for (unsigned int i = 0; i < steps; i++)
+	{
+		// Simulated time, so the same steps always push the same way
+		FluidStepParameters step(settings, width, height, depth, stepSeconds, stepTime + i * (double)stepSeconds);
+		constants.deltaTime = step.deltaTime;
+		constants.velocityDecay = step.velocityDecay;
+		constants.densityDecay = step.densityDecay;
+		constants.diffusionAlpha = step.diffusionAlpha;
+		memcpy(constants.forcePosition, step.forcePosition, sizeof(constants.forcePosition));
+		constants.forceRadius = step.forceRadius;
+		memcpy(constants.force, step.force, sizeof(constants.force));
+		constants.dyeAmount = step.dyeAmount;
+		constants.buoyancy = step.buoyancy;
+		constants.overRelaxation = step.overRelaxation;
+
+		RecordStep(commandList, constants);
+	}
+
+	profiler.Resolve(commandList);
+	commandList->Close();
+
+	// Nothing in the frame reads the grid, so nothing waits on this
+	ID3D12CommandList* lists[] = { commandList };
+	lastSubmit = queues.Submit(GPU_QUEUE_COMPUTE, lists, 1);
+	lastSteps = steps;
+}
+
+void FluidSolver::RecordStep(ID3D12GraphicsCommandList* commandList, FluidConstants& constants)
+{
+	// Velocity textures other than these two
+	auto other = [](unsigned int a, unsigned int b)
+	{
+		for (unsigned int i = 0; i < 3; i++)
+			if (i != a && i != b)
+				return i;
+		return 0u;
+	};
+
+	int scope = profiler.BeginScope(commandList, "Advect");
+	unsigned int nextVelocity = other(currentVelocity, currentVelocity);
+	Dispatch(commandList, constants, MODE_ADVECT, currentVelocity, currentDensity, unused, nextVelocity, 1 - currentDensity);
+	currentVelocity = nextVelocity;
+	currentDensity = 1 - currentDensity;
+	profiler.EndScope(commandList, scope);
+
+	scope = profiler.BeginScope(commandList, "Forces");
+	nextVelocity = other(currentVelocity, currentVelocity);
+	Dispatch(commandList, constants, MODE_FORCES, currentVelocity, currentDensity, unused, nextVelocity, 1 - currentDensity);
+	currentVelocity = nextVelocity;
+	currentDensity = 1 - currentDensity;
+	profiler.EndScope(commandList, scope);
+
+	// Jacobi iterations against the field as it was before diffusion
+	if (settings.viscosity > 0.0f && settings.diffusionIterations > 0)
+	{
+		scope = profiler.BeginScope(commandList, "Diffuse");
+		unsigned int start = currentVelocity;
+		unsigned int guess = start;
+		for (unsigned int i = 0; i < settings.diffusionIterations; i++)
+		{
+			nextVelocity = other(start, guess);
+			Dispatch(commandList, constants, MODE_DIFFUSE, guess, unused, start, nextVelocity, unused);
+			guess = nextVelocity;
+		}
+		currentVelocity = guess;
+		profiler.EndScope(commandList, scope);
+	}
+
+	scope = profiler.BeginScope(commandList, "Divergence");
+	Dispatch(commandList, constants, MODE_DIVERGENCE, currentVelocity, unused, unused, unused, unused);
+	profiler.EndScope(commandList, scope);
+
+	scope = profiler.BeginScope(commandList, "Pressure");
+	for (unsigned int i = 0; i < settings.pressureIterations * 2; i++)
+	{
+		constants.parity = i % 2;
+		Dispatch(commandList, constants, MODE_PRESSURE, unused, unused, unused, unused, unused);
+	}
+	profiler.EndScope(commandList, scope);
+
+	scope = profiler.BeginScope(commandList, "Project");
+	nextVelocity = other(currentVelocity, currentVelocity);
+	Dispatch(commandList, constants, MODE_PROJECT, currentVelocity, unused, unused, nextVelocity, unused);
+	currentVelocity = nextVelocity;
+	profiler.EndScope(commandList, scope);
+}
+
+void FluidSolver::Dispatch(ID3D12GraphicsCommandList* commandList, FluidConstants& constants, Mode mode,
+	int velocityIn, int densityIn, int velocityStart, int velocityOut, int densityOut)
+{
+	auto table = [&](unsigned int descriptor)
+	{
+		D3D12_GPU_DESCRIPTOR_HANDLE h = descriptorsGPU;
+		h.ptr += descriptor * descriptorSize;
+		return h;
+	};
+
+	// Slots the stage doesn't touch still need a descriptor of the
+	// right kind, but their textures are left in whatever state they're in
+	auto bind = [&](RootParameter param, int index, ID3D12Resource* texture, unsigned int firstDescriptor, D3D12_RESOURCE_STATES state)
+	{
+		commandList->SetComputeRootDescriptorTable(param, table(firstDescriptor + (index == unused ? 0 : index)));
+		if (index != unused)
+			stateTracker.Transition(texture, state);
+	};
+	const D3D12_RESOURCE_STATES read = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+	const D3D12_RESOURCE_STATES write = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	bind(ROOT_VELOCITY_IN, velocityIn, velocityIn == unused ? 0 : velocity[velocityIn].Get(), DESCRIPTOR_VELOCITY_SRV, read);
+	bind(ROOT_DENSITY_IN, densityIn, densityIn == unused ? 0 : density[densityIn].Get(), DESCRIPTOR_DENSITY_SRV, read);
+	bind(ROOT_VELOCITY_START, velocityStart, velocityStart == unused ? 0 : velocity[velocityStart].Get(), DESCRIPTOR_VELOCITY_SRV, read);
+	bind(ROOT_VELOCITY_OUT, velocityOut, velocityOut == unused ? 0 : velocity[velocityOut].Get(), DESCRIPTOR_VELOCITY_UAV, write);
+	bind(ROOT_DENSITY_OUT, densityOut, densityOut == unused ? 0 : density[densityOut].Get(), DESCRIPTOR_DENSITY_UAV, write);
+	commandList->SetComputeRootDescriptorTable(ROOT_DIVERGENCE, table(DESCRIPTOR_DIVERGENCE_UAV));
+	commandList->SetComputeRootDescriptorTable(ROOT_PRESSURE, table(DESCRIPTOR_PRESSURE_UAV));
+
+	// Divergence and pressure stay UAVs the whole time - every stage that
+	// touches them depends on the last one that did
+	stateTracker.Transition(divergence.Get(), write);
+	stateTracker.Transition(pressure.Get(), write);
+	if (mode == MODE_DIVERGENCE || mode == MODE_PRESSURE || mode == MODE_PROJECT || mode == MODE_CLEAR)
+	{
+		stateTracker.UAVBarrier(divergence.Get());
+		stateTracker.UAVBarrier(pressure.Get());
+	}
+	stateTracker.Flush(commandList);
+
+	constants.mode = mode;
+	commandList->SetComputeRoot32BitConstants(ROOT_CONSTANTS, sizeof(FluidConstants) / 4, &constants, 0);
+
+	// 8x8x1 groups; red-black passes only need half the width
+	unsigned int groupWidth = mode == MODE_PRESSURE ? (width + 1) / 2 : width;
+	commandList->Dispatch((groupWidth + 7) / 8, (height + 7) / 8, depth);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <d3d12.h>
+#include <wrl/client.h>
+#include <string>
+#include <vector>
+
+#include "FluidSettings.h"
+#include "GpuProfiler.h"
+#include "GpuQueues.h"
+#include "ResourceStateTracker.h"
+
+// --------------------------------------------------------
+// Stable fluids on the GPU, as compute dispatches on the
+// async compute queue (see GpuQueues.h) - nothing in the frame
+// waits for it, so it runs alongside the graphics work.
+//
+// The grid lives in 3D textures: velocity (three of them, so
+// diffusion has a fixed starting field to iterate against)
+// and dye density ping-pong between dispatches, reading
+// through SRVs with a linear sampler and writing through UAVs.
+// Pressure is solved in place with red-black Gauss-Seidel
+// (over-relaxed), and keeps last step's answer as its first
+// guess. Each stage is one mode of ComputeShader.hlsl.
+//
+// Step() records however many fixed simulation steps the
+// frame ran (see SimulationClock.h) into one compute list,
+// with a GPU timing per stage.
+// --------------------------------------------------------
+class FluidSolver
+{
+public:
+	FluidSolver();
+
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, const std::wstring& shaderPath, unsigned int framesInFlight);
+
+	// Once a frame, after GpuQueues::BeginFrame(). Picks up last time's
+	// timings for the slot, applies settings changes and submits steps
+	// (if any, and if enabled). stepTime is the simulated time at the
+	// start of the first step.
+	void Step(unsigned int steps, float stepSeconds, double stepTime, unsigned int frameIndex);
+
+	// Empties the grid before the next step
+	void Reset() { clearPending = true; }
+
+	FluidSettings& GetSettings() { return settings; }
+	std::vector<GpuScopeTiming> GetStageTimings() const { return profiler.GetScopeTimings(); }
+	unsigned int GetCellCount() const { return width * height * depth; }
+	unsigned int GetLastSteps() const { return lastSteps; }
+
+private:
+	// Must match ComputeShader.hlsl
+	enum Mode
+	{
+		MODE_CLEAR,
+		MODE_ADVECT,
+		MODE_FORCES,
+		MODE_DIFFUSE,
+		MODE_DIVERGENCE,
+		MODE_PRESSURE,
+		MODE_PROJECT
+	};
+
+	enum RootParameter
+	{
+		ROOT_CONSTANTS,
+		ROOT_VELOCITY_IN,		// t0
+		ROOT_DENSITY_IN,		// t1
+		ROOT_VELOCITY_START,	// t2
+		ROOT_VELOCITY_OUT,		// u0
+		ROOT_DENSITY_OUT,		// u1
+		ROOT_DIVERGENCE,		// u2
+		ROOT_PRESSURE,			// u3
+		ROOT_PARAMETER_COUNT
+	};
+
+	// Same layout as FluidFunctions.hlsli's cbuffer
+	struct FluidConstants
+	{
+		unsigned int gridSize[3];
+		unsigned int mode;
+		float deltaTime;
+		float velocityDecay;
+		float densityDecay;
+		float diffusionAlpha;
+		float forcePosition[3];
+		float forceRadius;
+		float force[3];
+		float dyeAmount;
+		float buoyancy;
+		float overRelaxation;
+		unsigned int parity;
+		float padding;
+	};
+
+	// Descriptors, in the order they're reserved
+	enum Descriptor
+	{
+		DESCRIPTOR_VELOCITY_SRV = 0,	// Three
+		DESCRIPTOR_VELOCITY_UAV = 3,	// Three
+		DESCRIPTOR_DENSITY_SRV = 6,		// Two
+		DESCRIPTOR_DENSITY_UAV = 8,		// Two
+		DESCRIPTOR_DIVERGENCE_UAV = 10,
+		DESCRIPTOR_PRESSURE_UAV = 11,
+		DESCRIPTOR_COUNT = 12
+	};
+
+	// Not bound - any texture slot that the stage doesn't use
+	static const int unused = -1;
+
+	Microsoft::WRL::ComPtr<ID3D12Device> device;
+	Microsoft::WRL::ComPtr<ID3D12RootSignature> rootSignature;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> pipeline;
+	D3D12_CPU_DESCRIPTOR_HANDLE descriptorsCPU;
+	D3D12_GPU_DESCRIPTOR_HANDLE descriptorsGPU;
+	SIZE_T descriptorSize;
+
+	FluidSettings settings;
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	Microsoft::WRL::ComPtr<ID3D12Resource> velocity[3];
+	Microsoft::WRL::ComPtr<ID3D12Resource> density[2];
+	Microsoft::WRL::ComPtr<ID3D12Resource> divergence;
+	Microsoft::WRL::ComPtr<ID3D12Resource> pressure;
+	unsigned int currentVelocity;
+	unsigned int currentDensity;
+	bool clearPending;
+
+	// Only compute lists ever touch the grid, so it has a tracker of its
+	// own instead of sharing the direct queue's
+	ResourceStateTracker stateTracker;
+
+	// Timestamps on the compute queue (its own frequency)
+	GpuProfiler profiler;
+	GpuSyncPoint lastSubmit;
+	unsigned int lastSteps;
+
+	// (Re)makes the textures and their descriptors for the settings' grid
+	void CreateGrid();
+	void RecordStep(ID3D12GraphicsCommandList* commandList, FluidConstants& constants);
+
+	// Binds the textures (by index, or unused), transitions them and dispatches over the grid
+	void Dispatch(ID3D12GraphicsCommandList* commandList, FluidConstants& constants, Mode mode,
+		int velocityIn, int densityIn, int velocityStart, int velocityOut, int densityOut);
+};
@@ -0,0 +1,212 @@
+#include "FramePacer.h"
+#include "CpuProfiler.h"
+
+#include <cstring>
+
+FramePacer::FramePacer() :
+	frameLatencyWaitableObject(0),
+	maxLatency(1),
+	bufferCount(0),
+	format(DXGI_FORMAT_UNKNOWN),
+	swapChainFlags(0),
+	tearingSupported(false),
+	nextPendingPresent(0),
+	qpcToMs(0.0),
+	lastStatsPresentCount(0),
+	lastStatsRefreshCount(0),
+	lastPresentVsync(false),
+	displayStatsAvailable(false),
+	repeatedRefreshes(0)
+{
+	memset(pendingPresents, 0, sizeof(pendingPresents));
+	frameStart.QuadPart = 0;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	qpcToMs = 1000.0 / (double)frequency.QuadPart;
+}
+
+FramePacer::~FramePacer()
+{
+	if (frameLatencyWaitableObject)
+		CloseHandle(frameLatencyWaitableObject);
+}
+
+HRESULT FramePacer::CreateSwapChain(
+	ID3D12CommandQueue* commandQueue,
+	HWND hWnd,
+	unsigned int width,
+	unsigned int height,
+	unsigned int bufferCount,
+	DXGI_FORMAT format,
+	Microsoft::WRL::ComPtr<IDXGISwapChain3>& swapChain)
+{
+	this->bufferCount = bufferCount;
+	this->format = format;
+
+	// Create a DXGI factory, which is what we use to create a swap chain
+	Microsoft::WRL::ComPtr<IDXGIFactory2> dxgiFactory;
+	HRESULT hr = CreateDXGIFactory1(IID_PPV_ARGS(dxgiFactory.GetAddressOf()));
+	if (FAILED(hr)) return hr;
+
+	// Tearing needs a new enough DXGI, and a display and driver that can do it
+	BOOL allowTearing = FALSE;
+	Microsoft::WRL::ComPtr<IDXGIFactory5> dxgiFactory5;
+	if (SUCCEEDED(dxgiFactory.As(&dxgiFactory5)) &&
+		FAILED(dxgiFactory5->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING, &allowTearing, sizeof(allowTearing))))
+		allowTearing = FALSE;
+	tearingSupported = allowTearing == TRUE;
+
+	swapChainFlags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+	if (tearingSupported)
+		swapChainFlags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+
+	// Create a description of how our swap chain should work
+	DXGI_SWAP_CHAIN_DESC1 swapDesc = {};
+	swapDesc.Width = width;
+	swapDesc.Height = height;
+	swapDesc.Format = format;
+	swapDesc.SampleDesc.Count = 1;
+	swapDesc.SampleDesc.Quality = 0;
+	swapDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+	swapDesc.BufferCount = bufferCount;
+	swapDesc.Scaling = DXGI_SCALING_STRETCH;
+	swapDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+	swapDesc.AlphaMode = DXGI_ALPHA_MODE_UNSPECIFIED;
+	swapDesc.Flags = swapChainFlags;
+
+	Microsoft::WRL::ComPtr<IDXGISwapChain1> swapChain1;
+	hr = dxgiFactory->CreateSwapChainForHwnd(commandQueue, hWnd, &swapDesc, 0, 0, swapChain1.GetAddressOf());
+	if (FAILED(hr)) return hr;
+	hr = swapChain1.As(&this->swapChain);
+	if (FAILED(hr)) return hr;
+
+	// No exclusive fullscreen (Alt+Enter) - tearing and the waitable
+	// object are both about windowed flip model presents
+	dxgiFactory->MakeWindowAssociation(hWnd, DXGI_MWA_NO_ALT_ENTER);
+
+	this->swapChain->SetMaximumFrameLatency(maxLatency);
+	frameLatencyWaitableObject = this->swapChain->GetFrameLatencyWaitableObject();
+
+	swapChain = this->swapChain;
+	return S_OK;
+}
+
+HRESULT FramePacer::ResizeBuffers(unsigned int width, unsigned int height)
+{
+	if (!swapChain)
+		return S_OK;
+
+	return swapChain->ResizeBuffers(bufferCount, width, height, format, swapChainFlags);
+}
+
+void FramePacer::SetMaxLatency(unsigned int frames)
+{
+	maxLatency = frames < 1 ? 1 : frames > 16 ? 16 : frames;
+	if (swapChain)
+		swapChain->SetMaximumFrameLatency(maxLatency);
+}
+
+void FramePacer::WaitForFrame()
+{
+	if (!frameLatencyWaitableObject)
+		return;
+
+	PROFILE_SCOPE("Frame latency wait");
+
+	// A second at most, so a lost device can't hang the loop for good
+	LARGE_INTEGER before;
+	QueryPerformanceCounter(&before);
+	WaitForSingleObjectEx(frameLatencyWaitableObject, 1000, TRUE);
+	QueryPerformanceCounter(&frameStart);
+
+	frameWait.Add((float)((frameStart.QuadPart - before.QuadPart) * qpcToMs));
+}
+
+HRESULT FramePacer::Present(bool vsync)
+{
+	if (!swapChain)
+		return S_OK;
+
+	// Tearing is only allowed along with a sync interval of 0
+	UINT flags = (!vsync && tearingSupported) ? DXGI_PRESENT_ALLOW_TEARING : 0;
+
+	LARGE_INTEGER presentTime;
+	QueryPerformanceCounter(&presentTime);
+	HRESULT hr = swapChain->Present(vsync ? 1 : 0, flags);
+	if (FAILED(hr))
+		return hr;
+
+	if (frameStart.QuadPart)
+		inputToPresent.Add((float)((presentTime.QuadPart - frameStart.QuadPart) * qpcToMs));
+
+	// Remember when this one's input was read, for once it's on screen
+	UINT presentCount = 0;
+	if (SUCCEEDED(swapChain->GetLastPresentCount(&presentCount)) && frameStart.QuadPart)
+	{
+		PendingPresent& pending = pendingPresents[nextPendingPresent];
+		pending.presentCount = presentCount;
+		pending.inputTime = frameStart;
+		pending.presentTime = presentTime;
+		nextPendingPresent = (nextPendingPresent + 1) % pendingPresentCount;
+	}
+	lastPresentVsync = vsync;
+
+	ReadFrameStatistics();
+	return hr;
+}
+
+// --------------------------------------------------------
+// Statistics are about the last present that made it to the
+// screen (usually one or two behind the one just made)
+// --------------------------------------------------------
+void FramePacer::ReadFrameStatistics()
+{
+	// Fails until something's been displayed, and whenever the
+	// presentation mode doesn't keep track (some composed modes)
+	DXGI_FRAME_STATISTICS stats = {};
+	if (FAILED(swapChain->GetFrameStatistics(&stats)))
+		return;
+	displayStatsAvailable = true;
+
+	// Nothing new on screen since last time
+	if (stats.PresentCount == lastStatsPresentCount)
+		return;
+
+	// With vsync every present gets a refresh of its own - any more
+	// refreshes than presents means some showed an old frame again
+	if (lastStatsPresentCount && lastPresentVsync)
+	{
+		UINT presents = stats.PresentCount - lastStatsPresentCount;
+		UINT refreshes = stats.SyncRefreshCount - lastStatsRefreshCount;
+		if (refreshes > presents)
+			repeatedRefreshes += refreshes - presents;
+	}
+	lastStatsPresentCount = stats.PresentCount;
+	lastStatsRefreshCount = stats.SyncRefreshCount;
+
+	for (PendingPresent& pending : pendingPresents)
+	{
+		if (pending.presentCount != stats.PresentCount || !pending.inputTime.QuadPart)
+			continue;
+
+		inputToDisplay.Add((float)((stats.SyncQPCTime.QuadPart - pending.inputTime.QuadPart) * qpcToMs));
+		presentToDisplay.Add((float)((stats.SyncQPCTime.QuadPart - pending.presentTime.QuadPart) * qpcToMs));
+		pending.presentCount = 0;
+		break;
+	}
+}
+
+FramePacingStats FramePacer::GetStats()
+{
+	FramePacingStats stats = {};
+	stats.frameWait = frameWait.GetSummary();
+	stats.inputToPresent = inputToPresent.GetSummary();
+	stats.inputToDisplay = inputToDisplay.GetSummary();
+	stats.presentToDisplay = presentToDisplay.GetSummary();
+	stats.displayStatsAvailable = displayStatsAvailable;
+	stats.repeatedRefreshes = repeatedRefreshes;
+	stats.maxLatency = maxLatency;
+	stats.tearingSupported = tearingSupported;
+	return stats;
+}
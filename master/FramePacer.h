@@ -0,0 +1,107 @@
+#pragma once
+
+#include <d3d12.h>
+#include <dxgi1_6.h>
+#include <wrl/client.h>
+
+#include "GpuProfiler.h" // TimingHistory
+
+// Where presents are at, for the UI
+struct FramePacingStats
+{
+	TimingSummary frameWait;		// Blocked on the waitable object
+	TimingSummary inputToPresent;	// Input sampled to Present() called, CPU side
+	TimingSummary inputToDisplay;	// Input sampled to the vblank it showed up on
+	TimingSummary presentToDisplay;
+	bool displayStatsAvailable;		// DXGI only has them for some presentation modes
+	unsigned int repeatedRefreshes;	// With vsync: refreshes that showed an old frame again
+	unsigned int maxLatency;
+	bool tearingSupported;
+};
+
+// --------------------------------------------------------
+// Owns the swap chain's side of frame pacing.
+//
+// The swap chain is flip model with a frame latency waitable
+// object: WaitForFrame() blocks until the swap chain can take
+// another frame (at most maxLatency queued), and the frame -
+// input included - starts right after. Waiting here instead
+// of inside Present() means input is sampled as late as it
+// can be, and frames start evenly spaced.
+//
+// With vsync off, presents tear when the system allows it
+// (DXGI_FEATURE_PRESENT_ALLOW_TEARING) - the only way to get
+// an uncapped frame rate out of a windowed flip model swap
+// chain.
+//
+// Latency: each frame's input time is matched up with when
+// its present reached the screen, from GetFrameStatistics().
+// --------------------------------------------------------
+class FramePacer
+{
+public:
+	FramePacer();
+	~FramePacer();
+
+	// Makes the swap chain (swapChain gets it)
+	HRESULT CreateSwapChain(
+		ID3D12CommandQueue* commandQueue,
+		HWND hWnd,
+		unsigned int width,
+		unsigned int height,
+		unsigned int bufferCount,
+		DXGI_FORMAT format,
+		Microsoft::WRL::ComPtr<IDXGISwapChain3>& swapChain);
+	HRESULT ResizeBuffers(unsigned int width, unsigned int height);
+
+	// 1 - 16 frames queued up before WaitForFrame() blocks. Fine to
+	// call before the swap chain exists (it starts out with this).
+	void SetMaxLatency(unsigned int frames);
+	unsigned int GetMaxLatency() { return maxLatency; }
+
+	// Once per frame, before input is read. Does nothing without a swap chain.
+	void WaitForFrame();
+
+	// Presents, tearing when vsync is off and that's allowed. Does
+	// nothing without a swap chain (headless).
+	HRESULT Present(bool vsync);
+
+	FramePacingStats GetStats();
+
+private:
+	Microsoft::WRL::ComPtr<IDXGISwapChain3> swapChain;
+	HANDLE frameLatencyWaitableObject;
+	unsigned int maxLatency;
+	unsigned int bufferCount;
+	DXGI_FORMAT format;
+	UINT swapChainFlags;	// Have to be the same again for ResizeBuffers()
+	bool tearingSupported;
+
+	// Each present's times, until its statistics come in
+	struct PendingPresent
+	{
+		UINT presentCount;
+		LARGE_INTEGER inputTime;
+		LARGE_INTEGER presentTime;
+	};
+	static const unsigned int pendingPresentCount = 16;
+	PendingPresent pendingPresents[pendingPresentCount];
+	unsigned int nextPendingPresent;
+
+	LARGE_INTEGER frameStart;		// After the wait, when input gets sampled
+	double qpcToMs;
+
+	// Last statistics read, to only count each displayed present once
+	UINT lastStatsPresentCount;
+	UINT lastStatsRefreshCount;
+	bool lastPresentVsync;
+
+	TimingHistory frameWait;
+	TimingHistory inputToPresent;
+	TimingHistory inputToDisplay;
+	TimingHistory presentToDisplay;
+	bool displayStatsAvailable;
+	unsigned int repeatedRefreshes;
+
+	void ReadFrameStatistics();
+};
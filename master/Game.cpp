@@ -3,7 +3,15 @@
 #include "Input.h"
 #include "BufferStructs.h"
 #include "DX12Helper.h"
-#include <iostream>
+#include "RenderQueue.h"
+#include "JobSystem.h"
+#include "GpuQueues.h"
+#include "CpuProfiler.h"
+#include "StartupProfiler.h"
+#include "TracedCommandList.h"
+#include "Logger.h"
+#include <chrono>
+#include <psapi.h>
 //#include "Material.h" ? already in Entity class
 
 #include <stdlib.h> //Seeding random and rand()
@@ -25,6 +33,28 @@ using namespace std;
 
 #define RandomRange(min, max) (float)rand() / RAND_MAX * (max - min) + min
 int frameCount;
+
+// Same order as Game::CpuStage
+static const char* cpuStageNames[] = { "Update", "UI", "Render queue", "Recording", "Submit" };
+
+// --------------------------------------------------------
+// What Init() loads on the job system while the main thread
+// gets on with the rest: shader blobs (joined before the root
+// signature) and textures and meshes (joined once the opaque
+// pipeline's ready). Only the file reading, decoding and
+// parsing happen on the jobs - GPU uploads are left for the
+// main thread, all at once at the end.
+// --------------------------------------------------------
+struct StartupAssets
+{
+	JobCounter shaders;
+	JobCounter geometry;	// Textures and meshes
+
+	DecodedTexture textures[4];	// Albedo, normals, roughness, metal
+	std::vector<std::vector<Vertex>> meshVertices;
+	std::vector<std::vector<unsigned int>> meshIndices;
+};
+
 // --------------------------------------------------------
 // Constructor
 //
@@ -33,15 +63,36 @@ int frameCount;
 //
 // hInstance - the application's OS-level handle (unique ID)
 // --------------------------------------------------------
-Game::Game(HINSTANCE hInstance)
+Game::Game(HINSTANCE hInstance, const BenchmarkSettings& benchmarkSettings)
 	: DXCore(
 		hInstance,		   // The application's handle
 		"DirectX Game",	   // Text for the window's title bar
-		1280,			   // Width of the window's client area
-		720,			   // Height of the window's client area
-		true),			   // Show extra stats (fps) in title bar?
-	vsync(false)
+		benchmarkSettings.enabled ? benchmarkSettings.width : 1280,	// Width of the window's client area
+		benchmarkSettings.enabled ? benchmarkSettings.height : 720,	// Height of the window's client area
+		!benchmarkSettings.enabled),	// Show extra stats (fps) in title bar? (Nobody sees it in a benchmark)
+	vsync(false),
+	softwareOcclusionPending(false),
+	fluidSteps(0),
+	fluidStepTime(0.0),
+	submittedTriangles(0),
+	benchmark(benchmarkSettings),
+	benchmarkState(BENCHMARK_WARMING_UP),
+	benchmarkFrame(0),
+	benchmarkExtent(0.0f),
+	benchmarkTriangles(0.0),
+	benchmarkDrawCalls(0.0)
 {
+	// Benchmarks draw offscreen behind a hidden window,
+	// and every frame steps the same amount of time
+	headless = benchmark.enabled;
+	fixedTimestep = benchmark.enabled ? benchmark.timestep : 0.0f;
+
+	// How many frames can queue up for the swap chain (--max-latency)
+	framePacer.SetMaxLatency(benchmark.maxFrameLatency);
+
+	// How often the simulation steps, whatever the frame rate (--sim-rate)
+	simulationClock.SetRate(benchmark.simulationRate);
+
 #if defined(DEBUG) || defined(_DEBUG)
 	// Do we want a console window?  Probably only in debug mode
 	CreateConsoleWindow(500, 120, 32, 120);
@@ -59,6 +110,12 @@ Game::~Game()
 	//Need to wait until GPU is done with its work otherwise we will get errors
 	DX12Helper::GetInstance().WaitForGPU();
 
+	//The occlusion job reads the scene, so it has to be done too
+	JobSystem::GetInstance().Wait(&softwareOcclusionCounter);
+
+	//Save out whatever pipelines got compiled this run
+	PipelineCache::GetInstance().Shutdown();
+
 	//ImGui Cleanup
 	ImGui_ImplDX12_Shutdown();
 	ImGui_ImplWin32_Shutdown();
@@ -71,61 +128,235 @@ Game::~Game()
 // --------------------------------------------------------
 void Game::Init()
 {
-	//Enable ImGui
-	IMGUI_CHECKVERSION();
-	ImGui::CreateContext();
-	ImGuiIO& io = ImGui::GetIO();
-	
-	ImGui::StyleColorsDark();
-	io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard; //Enable keyboard options
-	
-	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	// Files start loading on the job system first thing
+	StartupAssets assets;
+	LoadStartupAssets(assets);
 
-	ImGui_ImplWin32_Init(hWnd);
-	ImGui_ImplDX12_Init(device.Get(), NUM_FRAMES_IN_FLIGHT, DXGI_FORMAT_R8G8B8A8_UNORM,
-		dx12Helper.GetCBVSRVDescriptorHeap().Get(),
-		dx12Helper.GetCBVSRVDescriptorHeap().Get()->GetCPUDescriptorHandleForHeapStart(),
-		dx12Helper.GetCBVSRVDescriptorHeap().Get()->GetGPUDescriptorHandleForHeapStart());
+	//Enable ImGui
+	{
+		STARTUP_PHASE("ImGui");
+		IMGUI_CHECKVERSION();
+		ImGui::CreateContext();
+		ImGuiIO& io = ImGui::GetIO();
+		
+		ImGui::StyleColorsDark();
+		io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard; //Enable keyboard options
+		
+		DX12Helper& dx12Helper = DX12Helper::GetInstance();
+
+		//The font texture gets a slot of its own - the start of the heap
+		//belongs to the constant buffer ring, which would overwrite it
+		D3D12_CPU_DESCRIPTOR_HANDLE fontCPUHandle;
+		D3D12_GPU_DESCRIPTOR_HANDLE fontGPUHandle = dx12Helper.ReserveDescriptors(1, &fontCPUHandle);
+
+		ImGui_ImplWin32_Init(hWnd);
+		ImGui_ImplDX12_Init(device.Get(), NUM_FRAMES_IN_FLIGHT, DXGI_FORMAT_R8G8B8A8_UNORM,
+			dx12Helper.GetCBVSRVDescriptorHeap().Get(),
+			fontCPUHandle,
+			fontGPUHandle);
+	}
 
 	//default window state
-	showDemoWindow = true;
+	showDemoWindow = !benchmark.enabled;
 	showFluidWindow = false;
+	showPerformanceWindow = true;
+	cpuCaptureFrames = 30;
+	commandTraceFrames = 10;
 
-	//Random time!
-	srand((unsigned int)time(0));
+	//Random time! (Unless this is a benchmark, which has to be the same every run)
+	srand(benchmark.enabled ? benchmark.seed : (unsigned int)time(0));
 	lightCount = 0;
+
+	{
+		STARTUP_PHASE("Pipeline cache");
+
+		// Pipelines compiled in earlier runs are loaded from here instead
+		PipelineCache::GetInstance().Initialize(device,
+			GetFullPathTo_Wide(L"PipelineCache.bin"),
+			GetFullPathTo_Wide(L"PipelineManifest.txt"));
+
+		// Shader sources live with the project, compiled variants next to the exe
+		shaderPermutations.Initialize(GetFullPathTo_Wide(L"../../"), GetFullPathTo_Wide(L"ShaderCache/"));
+	}
+
 	// Helper methods for loading shaders, creating some basic
 	// geometry to draw and some simple camera matrices.
 	//  - You'll be expanding and/or replacing these later
-	CreateRootSigAndPipelineState();
-	CreateBasicGeometry();
-	GenerateLights();
+	CreateRootSigAndPipelineState(assets);
+	CreateBasicGeometry(assets);
+	{
+		STARTUP_PHASE("Lights");
+		GenerateLights();
+	}
+	{
+		STARTUP_PHASE("Shader permutations");
+		SelectShaderPermutations();
+	}
+
+	// One set of allocators per back buffer, one list per core
+	STARTUP_PHASE("Renderer");
+	commandListPool.Initialize(device, numBackBuffers);
+	overdrawEstimator.Initialize(device, numBackBuffers);
+	occlusionCuller.Initialize(device,
+		GetFullPathTo_Wide(L"HiZDownsampleCS.cso"),
+		GetFullPathTo_Wide(L"OcclusionCullCS.cso"),
+		numBackBuffers);
+	occlusionCuller.Resize(depthStencilBuffer.Get(), width, height);
+	occlusionMode = OCCLUSION_MODE_OFF; // Culling is opt-in, from the UI
+	renderGraphExecutor.Initialize(device, &DX12Helper::GetInstance().GetStateTracker());
+	gpuProfiler.Initialize(device, commandQueue.Get(), numBackBuffers);
+	renderGraphExecutor.SetProfiler(&gpuProfiler);
+	fluidSolver.Initialize(device, GetFullPathTo_Wide(L"ComputeShader.cso"), numBackBuffers);
 	
 	//camera = std::make_shared<Camera>(0.0f, 0.0f, -5.0, 1.0f, XM_PIDIV4, width / (float)height);
 	camera = std::make_shared<Camera>(0.0f, 0.0f, -5.0, width / (float)height);
+
+	// Input recording and replay, from the command line
+	Input& input = Input::GetInstance();
+	if (!benchmark.replayPath.empty())
+	{
+		std::string path = ResolvePath(benchmark.replayPath);
+		if (input.StartReplay(path))
+			LOG_INFO("Replaying input from %s", path.c_str());
+		else
+			LOG_ERROR("Couldn't replay input from %s", path.c_str());
+	}
+	if (!benchmark.recordPath.empty())
+	{
+		std::string path = ResolvePath(benchmark.recordPath);
+		if (input.StartRecording(path))
+			LOG_INFO("Recording input to %s", path.c_str());
+		else
+			LOG_ERROR("Couldn't record input to %s", path.c_str());
+	}
+
+	// Benchmarks trace their first measured frames instead, once they get there
+	if (!benchmark.commandTracePath.empty() && !benchmark.enabled)
+		RequestCommandTrace(ResolvePath(benchmark.commandTracePath));
+
+	// The scene's in place - that's where the simulation starts from
+	ResetSimulationState();
+
+	if (benchmark.enabled)
+	{
+		LOG_INFO("Benchmark: seed %u, %u entities, %u meshes, %u materials, %d lights, %ux%u, %u frames after %u+ warm up",
+			benchmark.seed, (unsigned int)entities.size(), benchmark.meshCount, benchmark.materialCount, lightCount,
+			width, height, benchmark.frameCount, benchmark.warmupFrames);
+		benchmarkFrameEnd = std::chrono::high_resolution_clock::now();
+	}
 }
 
 // --------------------------------------------------------
-// Loads the two basic shaders, then creates the root signature 
-// and pipeline state object for our very basic demo.
+// Starts reading and decoding everything startup needs from
+// disk on the job system - one job per file (or procedural
+// mesh). Nothing in here touches the command list, so it all
+// runs alongside the main thread's D3D setup.
 // --------------------------------------------------------
-void Game::CreateRootSigAndPipelineState()
+void Game::LoadStartupAssets(StartupAssets& assets)
 {
-	// Blobs to hold raw shader byte code used in several steps below
-	Microsoft::WRL::ComPtr<ID3DBlob> vertexShaderByteCode;
-	Microsoft::WRL::ComPtr<ID3DBlob> pixelShaderByteCode;
+	STARTUP_PHASE("Schedule asset loads");
+
+	// --serial-startup runs every job right here instead, one
+	// after the other, to see what the job system is worth
+	JobSystem& jobSystem = JobSystem::GetInstance();
+	auto schedule = [&](const JobFunction& job, JobCounter* counter)
+	{
+		if (benchmark.serialStartup)
+			job();
+		else
+			jobSystem.Schedule(job, counter);
+	};
+
+	// Read our compiled shader code into blobs
+	// - Essentially just "open the file and plop its contents here"
+	struct { const wchar_t* file; Microsoft::WRL::ComPtr<ID3DBlob>* blob; } shaders[] =
+	{
+		{ L"VertexShader.cso", &vertexShaderByteCode },
+		{ L"PixelShader.cso", &pixelShaderByteCode },
+		{ L"DepthPrepassVS.cso", &depthPrepassShaderByteCode },
+	};
+	for (auto& shader : shaders)
+	{
+		std::wstring path = GetFullPathTo_Wide(shader.file);
+		Microsoft::WRL::ComPtr<ID3DBlob>* blob = shader.blob;
+		schedule([path, blob]()
+		{
+			STARTUP_PHASE("Shader blob read");
+			if (FAILED(D3DReadFileToBlob(path.c_str(), blob->ReleaseAndGetAddressOf())))
+				LOG_ERROR("Couldn't read shader %ls", path.c_str());
+		}, &assets.shaders);
+	}
+
+	// Texture decodes, uploaded later by CreateBasicGeometry()
+	const wchar_t* textureFiles[4] =
+	{
+		L"../../Assets/Textures/bronze_albedo.png",
+		L"../../Assets/Textures/bronze_normals.png",
+		L"../../Assets/Textures/bronze_roughness.png",
+		L"../../Assets/Textures/bronze_metal.png",
+	};
+	for (int i = 0; i < 4; i++)
+	{
+		std::wstring path = GetFullPathTo_Wide(textureFiles[i]);
+		DecodedTexture* decoded = &assets.textures[i];
+		schedule([path, decoded]()
+		{
+			STARTUP_PHASE("Texture decode");
+			DX12Helper::GetInstance().DecodeTexture(path.c_str(), *decoded);
+		}, &assets.geometry);
+	}
+
+	// Benchmarks generate their meshes from their index, so any
+	// number of them can be made at once and still come out the
+	// same. Strided over a few jobs, in case there are thousands.
+	if (benchmark.enabled)
+	{
+		unsigned int meshCount = benchmark.meshCount;
+		assets.meshVertices.resize(meshCount);
+		assets.meshIndices.resize(meshCount);
+
+		unsigned int jobCount = min(meshCount, jobSystem.GetWorkerCount() * 4);
+		for (unsigned int job = 0; job < jobCount; job++)
+		{
+			StartupAssets* meshes = &assets;
+			schedule([meshes, job, jobCount, meshCount]()
+			{
+				STARTUP_PHASE("Mesh generation");
+				for (unsigned int i = job; i < meshCount; i += jobCount)
+					GenerateBenchmarkMesh(i, meshes->meshVertices[i], meshes->meshIndices[i]);
+			}, &assets.geometry);
+		}
+		return;
+	}
 
-	// Load shaders
+	// Everything else is just the cube
+	assets.meshVertices.resize(1);
+	assets.meshIndices.resize(1);
+	std::string cubePath = GetFullPathTo("../../Assets/Models/cube.obj");
+	StartupAssets* meshes = &assets;
+	schedule([cubePath, meshes]()
 	{
-		// Read our compiled vertex shader code into a blob
-		// - Essentially just "open the file and plop its contents here"
-		D3DReadFileToBlob(GetFullPathTo_Wide(L"VertexShader.cso").c_str(), vertexShaderByteCode.GetAddressOf());
-		D3DReadFileToBlob(GetFullPathTo_Wide(L"PixelShader.cso").c_str(), pixelShaderByteCode.GetAddressOf());
+		STARTUP_PHASE("OBJ parse");
+		if (!Mesh::LoadObj(cubePath.c_str(), meshes->meshVertices[0], meshes->meshIndices[0]))
+			LOG_ERROR("Couldn't load mesh %s", cubePath.c_str());
+	}, &assets.geometry);
+}
+
+// --------------------------------------------------------
+// Creates the root signature and pipeline state object for
+// our very basic demo, once the shader blobs are loaded.
+// --------------------------------------------------------
+void Game::CreateRootSigAndPipelineState(StartupAssets& assets)
+{
+	// Shader blobs come from LoadStartupAssets()
+	{
+		STARTUP_PHASE("Wait for shader blobs");
+		JobSystem::GetInstance().Wait(&assets.shaders);
 	}
+	STARTUP_PHASE("Root signature and pipeline");
 
 	// Input layout
-	const unsigned int inputElementCount = 4;
-	D3D12_INPUT_ELEMENT_DESC inputElements[inputElementCount] = {};
+	inputElements.assign(16, D3D12_INPUT_ELEMENT_DESC());
 	{
 		// Create an input layout that describes the vertex format
 		// used by the vertex shader we're using
@@ -155,17 +386,41 @@ void Game::CreateRootSigAndPipelineState()
 		inputElements[3].Format = DXGI_FORMAT_R32G32B32_FLOAT;		// 3x 32-bit floats
 		inputElements[3].SemanticName = "TANGENT";					// Match our vertex shader input!
 		inputElements[3].SemanticIndex = 0;							// This is the 0th tangent (there could be more)
+
+		// The rest come from the second vertex buffer (slot 1) and advance once per instance
+		// instead of once per vertex - 3 matrices (world, world inverse transpose and
+		// world view projection) of 4 rows each. Match InstanceData and the vertex shader!
+		const char* instanceSemantics[] = { "WORLD", "WORLDIT", "WVP" };
+		for (unsigned int m = 0; m < 3; m++)
+		{
+			for (unsigned int row = 0; row < 4; row++)
+			{
+				D3D12_INPUT_ELEMENT_DESC& element = inputElements[4 + m * 4 + row];
+				element.AlignedByteOffset = D3D12_APPEND_ALIGNED_ELEMENT;
+				element.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;	// One row of a matrix
+				element.SemanticName = instanceSemantics[m];
+				element.SemanticIndex = row;
+				element.InputSlot = 1;
+				element.InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA;
+				element.InstanceDataStepRate = 1;
+			}
+		}
+
+		// The depth prepass only needs the position, and the WVP matrix
+		// from the instance data (which comes after world and worldIT)
+		depthPrepassInputElements.push_back(inputElements[0]);
+		for (unsigned int row = 0; row < 4; row++)
+		{
+			D3D12_INPUT_ELEMENT_DESC element = inputElements[12 + row];
+			element.AlignedByteOffset = (UINT)(offsetof(InstanceData, worldViewProjection) + row * sizeof(XMFLOAT4));
+			depthPrepassInputElements.push_back(element);
+		}
 	}
 
 	// Root Signature
 	{
-		// Describe the range of CBVs needed for the vertex shader
-		D3D12_DESCRIPTOR_RANGE cbvRangeVS = {};
-		cbvRangeVS.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_CBV;
-		cbvRangeVS.NumDescriptors = 1;
-		cbvRangeVS.BaseShaderRegister = 0;
-		cbvRangeVS.RegisterSpace = 0;
-		cbvRangeVS.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+		// Note: The vertex shader has no constant buffer anymore,
+		//       everything it needs comes in as per-instance data
 
 		// Describe the range of CBVs needed for the pixel shader
 		D3D12_DESCRIPTOR_RANGE cbvRangePS = {};
@@ -192,25 +447,19 @@ void Game::CreateRootSigAndPipelineState()
 		imGuiRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
 
 		// Create the root parameters
-		D3D12_ROOT_PARAMETER rootParams[3] = {};
+		D3D12_ROOT_PARAMETER rootParams[2] = {};
 
-		// CBV table param for vertex shader
+		// CBV table param for pixel shader
 		rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
-		rootParams[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX;
+		rootParams[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
 		rootParams[0].DescriptorTable.NumDescriptorRanges = 1;
-		rootParams[0].DescriptorTable.pDescriptorRanges = &cbvRangeVS;
+		rootParams[0].DescriptorTable.pDescriptorRanges = &cbvRangePS;
 
-		// CBV table param for vertex shader
+		// SRV table param
 		rootParams[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
 		rootParams[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
 		rootParams[1].DescriptorTable.NumDescriptorRanges = 1;
-		rootParams[1].DescriptorTable.pDescriptorRanges = &cbvRangePS;
-
-		// SRV table param
-		rootParams[2].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
-		rootParams[2].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
-		rootParams[2].DescriptorTable.NumDescriptorRanges = 1;
-		rootParams[2].DescriptorTable.pDescriptorRanges = &srvRange;
+		rootParams[1].DescriptorTable.pDescriptorRanges = &srvRange;
 
 		//Tried putting ImGui in it's own rootParam that didn't work.
 		//rootParams[3].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
@@ -253,6 +502,7 @@ void Game::CreateRootSigAndPipelineState()
 		if (errors != 0)
 		{
 			OutputDebugString((char*)errors->GetBufferPointer());
+			LOG_ERROR("Root signature: %s", (char*)errors->GetBufferPointer());
 		}
 
 		// Actually create the root sig
@@ -261,98 +511,335 @@ void Game::CreateRootSigAndPipelineState()
 			serializedRootSig->GetBufferPointer(),
 			serializedRootSig->GetBufferSize(),
 			IID_PPV_ARGS(rootSignature.GetAddressOf()));
+
+		// Pipeline hashes need to know what's in it
+		PipelineCache::GetInstance().RegisterRootSignature(rootSignature.Get(), serializedRootSig);
 	}
 
-	// Pipeline state
-	{
-		// Describe the pipeline state
-		D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
+	// Pipeline state - nothing to fall back on for this one, so wait for it
+	// (helping with the asset jobs in the meantime)
+	PipelineCache& pipelineCache = PipelineCache::GetInstance();
+	opaquePipeline = RequestPipeline("Opaque");
+	pipelineCache.Wait(opaquePipeline);
+	pipelineState = opaquePipeline->Get();
+}
 
-		// -- Input assembler related ---
-		psoDesc.InputLayout.NumElements = inputElementCount;
-		psoDesc.InputLayout.pInputElementDescs = inputElements;
-		psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
-		// Overall primitive topology type (triangle, line, etc.) is set here 
-		// IASetPrimTop() is still used to set list/strip/adj options
-		// See: https://docs.microsoft.com/en-us/windows/desktop/direct3d12/managing-graphics-pipeline-state-in-direct3d-12
+// --------------------------------------------------------
+// Starts getting the pipeline state for a key ready through the
+// pipeline cache (compiled on a worker, or loaded from disk).
+// Keys end up in the cache's manifest, so they have to be
+// something this function understands next run too. Returns
+// null for keys it doesn't know, or shaders that failed to build.
+// --------------------------------------------------------
+std::shared_ptr<CachedPipeline> Game::RequestPipeline(const std::string& key)
+{
+	// Anything ending in +EqualDepth is the same pipeline, but
+	// for drawing after a depth prepass: tests EQUAL, writes no depth
+	static const std::string equalDepthSuffix = "+EqualDepth";
+	std::string baseKey = key;
+	bool equalDepth = false;
+	if (key.size() > equalDepthSuffix.size() &&
+		key.compare(key.size() - equalDepthSuffix.size(), equalDepthSuffix.size(), equalDepthSuffix) == 0)
+	{
+		baseKey = key.substr(0, key.size() - equalDepthSuffix.size());
+		equalDepth = true;
+	}
 
-		// Root sig
-		psoDesc.pRootSignature = rootSignature.Get();
+	// "Opaque" is the generic shader pair built with the project,
+	// "Opaque/xxxxxxxx" a ShaderPermutations variant (key in hex).
+	// "DepthPrepass" is the depth only pipeline to go with the generic
+	// shaders, "DepthPrepass/dxil" the one to go with the variants.
+	D3D12_SHADER_BYTECODE vs = {};
+	D3D12_SHADER_BYTECODE ps = {};
+	bool depthOnly = false;
+	if (baseKey == "Opaque")
+	{
+		vs.pShaderBytecode = vertexShaderByteCode->GetBufferPointer();
+		vs.BytecodeLength = vertexShaderByteCode->GetBufferSize();
+		ps.pShaderBytecode = pixelShaderByteCode->GetBufferPointer();
+		ps.BytecodeLength = pixelShaderByteCode->GetBufferSize();
+	}
+	else if (baseKey.compare(0, 7, "Opaque/") == 0)
+	{
+		uint32_t shaderKey = (uint32_t)strtoul(baseKey.c_str() + 7, 0, 16);
+		const std::vector<char>& vsCode = shaderPermutations.GetVertexShader();
+		const std::vector<char>& psCode = shaderPermutations.GetPixelShader(shaderKey);
+		if (vsCode.empty() || psCode.empty())
+			return 0;
+
+		vs.pShaderBytecode = vsCode.data();
+		vs.BytecodeLength = vsCode.size();
+		ps.pShaderBytecode = psCode.data();
+		ps.BytecodeLength = psCode.size();
+	}
+	else if (baseKey == "DepthPrepass" && !equalDepth)
+	{
+		vs.pShaderBytecode = depthPrepassShaderByteCode->GetBufferPointer();
+		vs.BytecodeLength = depthPrepassShaderByteCode->GetBufferSize();
+		depthOnly = true;
+	}
+	else if (baseKey == "DepthPrepass/dxil" && !equalDepth)
+	{
+		const std::vector<char>& vsCode = shaderPermutations.GetVertexShader(L"DepthPrepassVS.hlsl");
+		if (vsCode.empty())
+			return 0;
 
-		// -- Shaders (VS/PS) --- 
-		psoDesc.VS.pShaderBytecode = vertexShaderByteCode->GetBufferPointer();
-		psoDesc.VS.BytecodeLength = vertexShaderByteCode->GetBufferSize();
-		psoDesc.PS.pShaderBytecode = pixelShaderByteCode->GetBufferPointer();
-		psoDesc.PS.BytecodeLength = pixelShaderByteCode->GetBufferSize();
+		vs.pShaderBytecode = vsCode.data();
+		vs.BytecodeLength = vsCode.size();
+		depthOnly = true;
+	}
+	else
+	{
+		return 0;
+	}
 
-		// -- Render targets ---
-		psoDesc.NumRenderTargets = 1;
-		psoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
-		psoDesc.DSVFormat = DXGI_FORMAT_D24_UNORM_S8_UINT;
-		psoDesc.SampleDesc.Count = 1;
-		psoDesc.SampleDesc.Quality = 0;
+	// Describe the pipeline state
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
+
+	// -- Input assembler related ---
+	psoDesc.InputLayout.NumElements = (UINT)inputElements.size();
+	psoDesc.InputLayout.pInputElementDescs = inputElements.data();
+	psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+	// Overall primitive topology type (triangle, line, etc.) is set here 
+	// IASetPrimTop() is still used to set list/strip/adj options
+	// See: https://docs.microsoft.com/en-us/windows/desktop/direct3d12/managing-graphics-pipeline-state-in-direct3d-12
+
+	// Root sig
+	psoDesc.pRootSignature = rootSignature.Get();
+
+	// -- Shaders (VS/PS) --- 
+	psoDesc.VS = vs;
+	psoDesc.PS = ps;
+
+	// -- Render targets ---
+	psoDesc.NumRenderTargets = 1;
+	psoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
+	psoDesc.DSVFormat = DXGI_FORMAT_D24_UNORM_S8_UINT;
+	psoDesc.SampleDesc.Count = 1;
+	psoDesc.SampleDesc.Quality = 0;
+
+	// -- States ---
+	psoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_SOLID;
+	psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_BACK;
+	psoDesc.RasterizerState.DepthClipEnable = true;
+
+	psoDesc.DepthStencilState.DepthEnable = true;
+	psoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_LESS;
+	psoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ALL;
+	if (equalDepth)
+	{
+		// Depth is already final, only the exact surface that wrote it passes
+		psoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_EQUAL;
+		psoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+	}
 
-		// -- States ---
-		psoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_SOLID;
-		psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_BACK;
-		psoDesc.RasterizerState.DepthClipEnable = true;
+	psoDesc.BlendState.RenderTarget[0].SrcBlend = D3D12_BLEND_ONE;
+	psoDesc.BlendState.RenderTarget[0].DestBlend = D3D12_BLEND_ZERO;
+	psoDesc.BlendState.RenderTarget[0].BlendOp = D3D12_BLEND_OP_ADD;
+	psoDesc.BlendState.RenderTarget[0].RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
 
-		psoDesc.DepthStencilState.DepthEnable = true;
-		psoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_LESS;
-		psoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ALL;
+	// -- Misc ---
+	psoDesc.SampleMask = 0xffffffff;
 
-		psoDesc.BlendState.RenderTarget[0].SrcBlend = D3D12_BLEND_ONE;
-		psoDesc.BlendState.RenderTarget[0].DestBlend = D3D12_BLEND_ZERO;
-		psoDesc.BlendState.RenderTarget[0].BlendOp = D3D12_BLEND_OP_ADD;
-		psoDesc.BlendState.RenderTarget[0].RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+	// Depth only: no pixel shader, no render target, a lot less input
+	if (depthOnly)
+	{
+		psoDesc.InputLayout.NumElements = (UINT)depthPrepassInputElements.size();
+		psoDesc.InputLayout.pInputElementDescs = depthPrepassInputElements.data();
+		psoDesc.NumRenderTargets = 0;
+		psoDesc.RTVFormats[0] = DXGI_FORMAT_UNKNOWN;
+		psoDesc.BlendState.RenderTarget[0].RenderTargetWriteMask = 0;
+	}
 
-		// -- Misc ---
-		psoDesc.SampleMask = 0xffffffff;
+	// Compiles in the background, the opaque pipeline stands in until then.
+	// Prepass pipelines have no stand in - they're only used once ready.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> fallback;
+	if (!equalDepth && !depthOnly && opaquePipeline)
+		fallback = opaquePipeline->Get();
+	return PipelineCache::GetInstance().Request(key, psoDesc, fallback);
+}
 
-		// Create the pipe state object
-		device->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(pipelineState.GetAddressOf()));
-	}
+// --------------------------------------------------------
+// Points a material at the pipeline for a key, along with the
+// depth prepass pipelines that go with it. The prepass has to
+// come from the same compiler as the main vertex shader, or
+// the depths might not match exactly.
+// --------------------------------------------------------
+bool Game::AssignPipelines(std::shared_ptr<Material> material, const std::string& key)
+{
+	std::shared_ptr<CachedPipeline> pipeline = RequestPipeline(key);
+	if (!pipeline)
+		return false;
+
+	material->SetCachedPipeline(pipeline);
+	material->SetDepthPrepassPipelines(
+		RequestPipeline(key == "Opaque" ? "DepthPrepass" : "DepthPrepass/dxil"),
+		RequestPipeline(key + "+EqualDepth"));
+	return true;
 }
 
 
 // --------------------------------------------------------
 // Creates the geometry we're going to draw - a single triangle for now
+// (uploads whatever LoadStartupAssets() has read in)
 // --------------------------------------------------------
-void Game::CreateBasicGeometry()
+void Game::CreateBasicGeometry(StartupAssets& assets)
 {
-	//Macro for texture loading
-#define LoadTexture(x) DX12Helper::GetInstance().LoadTexture(GetFullPathTo_Wide(x).c_str())
+	PROFILE_FUNCTION();
+
+	// Everything still loading is needed from here on
+	{
+		STARTUP_PHASE("Wait for textures and meshes");
+		JobSystem::GetInstance().Wait(&assets.geometry);
+	}
+
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+
+	//Upload Texture(s), all in one go
+	D3D12_CPU_DESCRIPTOR_HANDLE textures[4] = {};
+	{
+		STARTUP_PHASE("Texture upload");
+		dx12Helper.UploadTextures(assets.textures, 4, textures);
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE bronzeAlbedo = textures[0];
+	D3D12_CPU_DESCRIPTOR_HANDLE bronzeNormal = textures[1];
+	D3D12_CPU_DESCRIPTOR_HANDLE bronzeRoughness = textures[2];
+	D3D12_CPU_DESCRIPTOR_HANDLE bronzeMetal = textures[3];
 
-	//Load Texture(s)
-	D3D12_CPU_DESCRIPTOR_HANDLE bronzeAlbedo = LoadTexture(L"../../Assets/Textures/bronze_albedo.png");
-	D3D12_CPU_DESCRIPTOR_HANDLE bronzeNormal = LoadTexture(L"../../Assets/Textures/bronze_normals.png");
-	D3D12_CPU_DESCRIPTOR_HANDLE bronzeRoughness = LoadTexture(L"../../Assets/Textures/bronze_roughness.png");
-	D3D12_CPU_DESCRIPTOR_HANDLE bronzeMetal = LoadTexture(L"../../Assets/Textures/bronze_metal.png");
+	dx12Helper.LoadImGui();
 
-	DX12Helper::GetInstance().LoadImGui();
+	// Every mesh's buffers are copied together, with a single wait at the end
+	std::vector<std::shared_ptr<Mesh>> meshes;
+	{
+		STARTUP_PHASE("Mesh upload");
+		dx12Helper.BeginUploadBatch();
+		for (size_t i = 0; i < assets.meshVertices.size(); i++)
+		{
+			std::vector<Vertex>& vertices = assets.meshVertices[i];
+			std::vector<unsigned int>& indices = assets.meshIndices[i];
+			meshes.push_back(std::make_shared<Mesh>(vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size()));
+		}
+		dx12Helper.EndUploadBatch();
+	}
+
+	// Benchmarks build a scene of their own from the seed
+	if (benchmark.enabled)
+	{
+		STARTUP_PHASE("Benchmark scene");
+		CreateBenchmarkScene(textures, meshes);
+		return;
+	}
 
 	//Create material(s)
 	//Samplers are a single static one in root sampler
 	//Not per material yet.
-	std::shared_ptr<Material> bronze = std::make_shared<Material>(pipelineState, XMFLOAT3(1, 1, 1));
+	std::shared_ptr<Material> bronze = std::make_shared<Material>(opaquePipeline, XMFLOAT3(1, 1, 1));
+	AssignPipelines(bronze, "Opaque");
 	bronze->AddTexture(bronzeAlbedo, 0);
 	bronze->AddTexture(bronzeNormal, 1);
 	bronze->AddTexture(bronzeRoughness, 2);
 	bronze->AddTexture(bronzeMetal, 3);
 	bronze->FinalizeTextures();
 
-	std::shared_ptr<Mesh> cube = std::make_shared<Mesh>(GetFullPathTo("../../Assets/Models/cube.obj").c_str());
+	std::shared_ptr<Mesh> cube = meshes[0];
 	std::shared_ptr<Entity> entity = std::make_shared<Entity>(cube, bronze);
 	entity.get()->GetTransform()->Scale(2, 2, 2);
 	entity.get()->GetTransform()->SetPosition(0, 0, 5);
+	animatedEntities.push_back((unsigned int)entities.size());
 	entities.push_back(entity);
 }
 
+// --------------------------------------------------------
+// The benchmark's scene: procedural meshes (already made by
+// LoadStartupAssets) and variations on the one set of
+// textures, with entities scattered over a slab that grows
+// with how many there are. Everything comes from the seed, in
+// a fixed order, so the same settings give the same scene on
+// every machine.
+// --------------------------------------------------------
+void Game::CreateBenchmarkScene(const D3D12_CPU_DESCRIPTOR_HANDLE textures[4], const std::vector<std::shared_ptr<Mesh>>& meshes)
+{
+	PROFILE_FUNCTION();
+
+	// One instance upload per frame, and four texture descriptors per material
+	const unsigned int maxEntities = 65536;
+	const unsigned int maxMaterials = 128;
+	if (benchmark.entityCount > maxEntities)
+	{
+		LOG_WARNING("Benchmark: %u entities is too many, using %u", benchmark.entityCount, maxEntities);
+		benchmark.entityCount = maxEntities;
+	}
+	if (benchmark.materialCount > maxMaterials)
+	{
+		LOG_WARNING("Benchmark: %u materials is too many, using %u", benchmark.materialCount, maxMaterials);
+		benchmark.materialCount = maxMaterials;
+	}
+
+	BenchmarkRandom random(benchmark.seed);
+
+	std::vector<std::shared_ptr<Material>> materials;
+	for (unsigned int i = 0; i < benchmark.materialCount; i++)
+	{
+		XMFLOAT3 tint(random.Range(0.4f, 1.0f), random.Range(0.4f, 1.0f), random.Range(0.4f, 1.0f));
+		float uvScale = random.Range(0.5f, 3.0f);
+		std::shared_ptr<Material> material = std::make_shared<Material>(opaquePipeline, tint, XMFLOAT2(uvScale, uvScale));
+		AssignPipelines(material, "Opaque");
+		for (int slot = 0; slot < 4; slot++)
+			material->AddTexture(textures[slot], slot);
+		material->FinalizeTextures();
+		materials.push_back(material);
+	}
+
+	// Roughly the same density whatever the count, but always inside the far clip plane
+	benchmarkExtent = 2.5f * cbrtf((float)benchmark.entityCount);
+	benchmarkExtent = max(6.0f, min(benchmarkExtent, 40.0f));
+
+	for (unsigned int i = 0; i < benchmark.entityCount; i++)
+	{
+		std::shared_ptr<Mesh> mesh = meshes[random.Below((unsigned int)meshes.size())];
+		std::shared_ptr<Material> material = materials[random.Below((unsigned int)materials.size())];
+		std::shared_ptr<Entity> entity = std::make_shared<Entity>(mesh, material);
+
+		// Separate statements, so the order the numbers come out in is fixed
+		float x = random.Range(-benchmarkExtent, benchmarkExtent);
+		float y = random.Range(-benchmarkExtent * 0.25f, benchmarkExtent * 0.25f);
+		float z = random.Range(-benchmarkExtent, benchmarkExtent);
+		float scale = random.Range(0.5f, 2.5f);
+		float pitch = random.Range(0.0f, XM_2PI);
+		float yaw = random.Range(0.0f, XM_2PI);
+
+		Transform* transform = entity->GetTransform();
+		transform->SetPosition(x, y, z);
+		transform->SetScale(scale, scale, scale);
+		transform->SetRotation(pitch, yaw, 0);
+
+		// Only some of them spin, the rest keep their matrices from frame to frame
+		if (i % 8 == 0)
+			animatedEntities.push_back((unsigned int)entities.size());
+		entities.push_back(entity);
+	}
+}
+
 void Game::GenerateLights()
 {
 	// Reset
 	lights.clear();
 
+	// Benchmarks take as many as they're told (up to MAX_LIGHTS)
+	// from their own seed, spread over the whole scene
+	lightCount = MAX_LIGHTS;
+	float spread = 15.0f;
+	BenchmarkRandom benchmarkRandom(benchmark.seed + 1);
+	if (benchmark.enabled)
+	{
+		lightCount = benchmark.lightCount < MAX_LIGHTS ? (int)benchmark.lightCount : MAX_LIGHTS;
+		spread = benchmarkExtent;
+	}
+	auto range = [&](float low, float high)
+	{
+		return benchmark.enabled ? benchmarkRandom.Range(low, high) : RandomRange(low, high);
+	};
+
 	// Setup directional lights
 	Light dir1 = {};
 	dir1.Type = LIGHT_TYPE_DIRECTIONAL;
@@ -364,23 +851,88 @@ void Game::GenerateLights()
 	lights.push_back(dir1);
 
 	// Create the rest of the lights
-	while (lights.size() < MAX_LIGHTS)
+	// (one at a time, so the benchmark's numbers come out in a fixed order)
+	while ((int)lights.size() < lightCount)
 	{
 		Light point = {};
 		point.Type = LIGHT_TYPE_POINT;
-		point.Position = XMFLOAT3(RandomRange(-15.0f, 15.0f), RandomRange(-2.0f, 5.0f), RandomRange(-15.0f, 15.0f));
-		point.Color = XMFLOAT3(RandomRange(0, 1), RandomRange(0, 1), RandomRange(0, 1));
-		point.Range = RandomRange(5.0f, 10.0f);
-		point.Intensity = RandomRange(0.1f, 3.0f);
+		point.Position.x = range(-spread, spread);
+		point.Position.y = range(-2.0f, 5.0f);
+		point.Position.z = range(-spread, spread);
+		point.Color.x = range(0, 1);
+		point.Color.y = range(0, 1);
+		point.Color.z = range(0, 1);
+		point.Range = range(5.0f, 10.0f);
+		point.Intensity = range(0.1f, 3.0f);
 
 		// Add to the list
 		lights.push_back(point);
 	}
 
-	// Make sure we're exactly MAX_LIGHTS big
+	// Make sure we're exactly MAX_LIGHTS big (anything past lightCount is never read)
+	// Note: shader permutations need these grouped by type (directional,
+	//       point, then spot), which is the order they're made in above
 	lights.resize(MAX_LIGHTS);
 }
 
+// --------------------------------------------------------
+// Gives every material a pixel shader variant specialized for
+// its maps and the scene's lights, instead of the generic one.
+// Everything gets compiled (or loaded from the DXIL cache) here
+// while loading, in parallel, so nothing compiles mid-frame.
+// --------------------------------------------------------
+void Game::SelectShaderPermutations()
+{
+	// How many lights of each type (they're grouped by type already)
+	unsigned int typeCounts[3] = {};
+	for (int i = 0; i < lightCount; i++)
+		typeCounts[lights[i].Type]++;
+
+	// Whatever the last run used, plus every material's own variant
+	std::vector<std::string> pipelineKeys;
+	PipelineCache::GetInstance().Prewarm([&](const std::string& key) { pipelineKeys.push_back(key); });
+
+	std::vector<uint32_t> shaderKeys;
+	for (auto& entity : entities)
+	{
+		std::shared_ptr<Material> material = entity->GetMaterial();
+		uint32_t shaderKey = ShaderPermutations::MakeKey(material->GetShaderFeatures(),
+			typeCounts[LIGHT_TYPE_DIRECTIONAL], typeCounts[LIGHT_TYPE_POINT], typeCounts[LIGHT_TYPE_SPOT]);
+		shaderKeys.push_back(shaderKey);
+	}
+	for (const std::string& key : pipelineKeys)
+	{
+		if (key.compare(0, 7, "Opaque/") == 0)
+			shaderKeys.push_back((uint32_t)strtoul(key.c_str() + 7, 0, 16)); // Stops at any +EqualDepth
+	}
+
+	// Only compile each variant once
+	std::vector<uint32_t> uniqueKeys;
+	for (uint32_t shaderKey : shaderKeys)
+	{
+		bool seen = false;
+		for (uint32_t existing : uniqueKeys)
+			seen |= existing == shaderKey;
+		if (!seen) uniqueKeys.push_back(shaderKey);
+	}
+
+	// The vertex shaders build with them, the depth prepass one included,
+	// so nothing compiles on its own when the pipelines are requested
+	std::vector<std::wstring> vertexShaders = { L"VertexShader.hlsl", L"DepthPrepassVS.hlsl" };
+	shaderPermutations.Precompile(uniqueKeys, vertexShaders);
+
+	// Pipelines build in the background, the generic one is used until then
+	for (const std::string& key : pipelineKeys)
+		RequestPipeline(key);
+
+	for (size_t i = 0; i < entities.size(); i++)
+	{
+		char key[32];
+		sprintf_s(key, "Opaque/%08x", shaderKeys[i]);
+		AssignPipelines(entities[i]->GetMaterial(), key);
+	}
+}
+
 // --------------------------------------------------------
 // Handle resizing DirectX "stuff" to match the new window size.
 // For instance, updating our projection matrix's aspect ratio.
@@ -390,6 +942,9 @@ void Game::OnResize()
 	// Handle base-level DX resize stuff
 	DXCore::OnResize();
 
+	// The Hi-Z pyramid follows the depth buffer
+	occlusionCuller.Resize(depthStencilBuffer.Get(), width, height);
+
 	//// Update the camera's projection to match the new size
 	//if (camera)
 	//{
@@ -402,18 +957,251 @@ void Game::OnResize()
 // --------------------------------------------------------
 void Game::Update(float deltaTime, float totalTime)
 {
+	PROFILE_FUNCTION();
+	auto updateStart = std::chrono::high_resolution_clock::now();
+
 	// Example input checking: Quit if the escape key is pressed
 	if (Input::GetInstance().KeyDown(VK_ESCAPE))
 		Quit();
 
-	// Spin entities
+	// F9 captures the next few frames' CPU markers to a trace file
+	if (Input::GetInstance().KeyPress(VK_F9))
+		RequestCpuCapture();
+
+	JobSystem& jobSystem = JobSystem::GetInstance();
+
+	// Entities only move in fixed steps - as many as fit in this frame (maybe
+	// none), then they're drawn however far along the next step this frame is.
+	// deltaTime is already the fixed/replayed one, when there is one, so those
+	// runs step the same every time.
+	if (currentSimulation.size() != entities.size())
+		ResetSimulationState();
+	unsigned int steps = simulationClock.Advance(deltaTime);
+	for (unsigned int i = 0; i < steps; i++)
+		Simulate((float)simulationClock.GetStep());
+	InterpolateEntities((float)simulationClock.GetAlpha());
+
+	// The fluid takes the same steps, once Draw() gets to it
+	fluidSteps = steps;
+	fluidStepTime = simulationClock.GetTime() - steps * simulationClock.GetStep();
+
+	// Bring the matrices up to date now, so the renderer's jobs only ever read them.
+	// Root transforms can go in parallel. Children chain off their parent's
+	// matrices (and would race on refreshing them), so they go after, in order.
+	jobSystem.ParallelFor((unsigned int)entities.size(), 256, [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Transform* transform = entities[i]->GetTransform();
+				if (!transform->GetParent())
+					transform->GetWorldMatrix();
+			}
+		});
 	for (auto& e : entities)
 	{
-		e->GetTransform()->Rotate(0, deltaTime * 0.5f, 0);
+		if (e->GetTransform()->GetParent())
+			e->GetTransform()->GetWorldMatrix();
 	}
 
 	// Other updates
-	camera->Update(deltaTime, hWnd);
+	// (benchmarks fly a fixed path instead of listening to the mouse and keyboard,
+	// unless they're replaying a recording)
+	if (benchmark.enabled && !Input::GetInstance().IsReplaying())
+	{
+		float position[3], target[3];
+		GetBenchmarkCameraPose(totalTime, benchmarkExtent, position, target);
+		camera->LookAt(XMFLOAT3(position[0], position[1], position[2]), XMFLOAT3(target[0], target[1], target[2]));
+	}
+	else
+	{
+		camera->Update(deltaTime);
+	}
+
+	// Software occlusion gets going now, with this frame's camera, and
+	// runs alongside the rest of the main thread's work until Draw()
+	// needs the answers
+	if (occlusionMode == OCCLUSION_MODE_CPU && !entities.empty())
+	{
+		XMFLOAT4X4 view = camera->GetViewMatrix();
+		XMFLOAT4X4 proj = camera->GetProjectionMatrix();
+		XMStoreFloat4x4(&occlusionViewProj, XMMatrixMultiply(XMLoadFloat4x4(&view), XMLoadFloat4x4(&proj)));
+		occlusionEye = camera->GetPosition();
+
+		softwareOcclusionPending = true;
+		jobSystem.Schedule([this]() { RunSoftwareOcclusion(); }, &softwareOcclusionCounter);
+	}
+
+	cpuStageTimes[CPU_STAGE_UPDATE].Add(std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - updateStart).count());
+}
+
+// --------------------------------------------------------
+// Starts the simulation over from wherever the entities are now
+// --------------------------------------------------------
+void Game::ResetSimulationState()
+{
+	currentSimulation.resize(entities.size());
+	for (size_t i = 0; i < entities.size(); i++)
+	{
+		Transform* transform = entities[i]->GetTransform();
+		SimulationState& state = currentSimulation[i];
+		state.position = transform->GetPosition();
+		state.pitchYawRoll = transform->GetRotation();
+		state.rotation = transform->GetRotationQuaternion();
+		state.scale = transform->GetScale();
+	}
+	previousSimulation = currentSimulation;
+	simulationClock.Reset();
+}
+
+// --------------------------------------------------------
+// One fixed step of the simulation. Only touches the simulation
+// state - the transforms catch up in InterpolateEntities().
+// Entities that don't animate keep the same state forever.
+// --------------------------------------------------------
+void Game::Simulate(float step)
+{
+	PROFILE_FUNCTION();
+	previousSimulation.swap(currentSimulation);
+
+	// Spin the entities that animate
+	JobSystem::GetInstance().ParallelFor((unsigned int)animatedEntities.size(), 256, [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int a = begin; a < end; a++)
+			{
+				unsigned int i = animatedEntities[a];
+				SimulationState& state = currentSimulation[i];
+				state = previousSimulation[i];
+				state.pitchYawRoll.y += step * 0.5f;
+				XMStoreFloat4(&state.rotation, XMQuaternionRotationRollPitchYaw(
+					state.pitchYawRoll.x, state.pitchYawRoll.y, state.pitchYawRoll.z));
+			}
+		});
+}
+
+// --------------------------------------------------------
+// Puts every animated entity's transform alpha of the way from
+// its previous simulation state to its current one. Everything
+// else is left alone, so its matrices stay clean.
+// --------------------------------------------------------
+void Game::InterpolateEntities(float alpha)
+{
+	PROFILE_FUNCTION();
+	auto interpolate = [&](unsigned int i)
+	{
+		const SimulationState& from = previousSimulation[i];
+		const SimulationState& to = currentSimulation[i];
+		Transform* transform = entities[i]->GetTransform();
+
+		XMFLOAT3 position, scale;
+		XMFLOAT4 rotation;
+		XMStoreFloat3(&position, XMVectorLerp(XMLoadFloat3(&from.position), XMLoadFloat3(&to.position), alpha));
+		XMStoreFloat3(&scale, XMVectorLerp(XMLoadFloat3(&from.scale), XMLoadFloat3(&to.scale), alpha));
+		XMStoreFloat4(&rotation, XMQuaternionSlerp(XMLoadFloat4(&from.rotation), XMLoadFloat4(&to.rotation), alpha));
+
+		transform->SetPosition(position.x, position.y, position.z);
+		transform->SetScale(scale.x, scale.y, scale.z);
+		transform->SetRotation(rotation);
+	};
+
+	// Setting a transform marks its children dirty, which would race with
+	// whoever's setting those children. So only transforms without children
+	// go in parallel (they only write to themselves), the rest go after.
+	JobSystem::GetInstance().ParallelFor((unsigned int)animatedEntities.size(), 256, [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int a = begin; a < end; a++)
+			{
+				unsigned int i = animatedEntities[a];
+				if (entities[i]->GetTransform()->GetChildCount() == 0)
+					interpolate(i);
+			}
+		});
+	for (unsigned int i : animatedEntities)
+	{
+		if (entities[i]->GetTransform()->GetChildCount() != 0)
+			interpolate(i);
+	}
+}
+
+// --------------------------------------------------------
+// Runs as a job: picks the best occluders, rasterizes them
+// and tests every entity's bounds against the result.
+// Only reads the scene - Update() is done with it by now.
+// --------------------------------------------------------
+void Game::RunSoftwareOcclusion()
+{
+	PROFILE_FUNCTION();
+
+	// Big and near makes a good occluder, lots of triangles makes a slow one
+	const unsigned int maxOccluders = 16;
+	const unsigned int maxOccluderTriangles = 2000;
+	const float minOccluderScore = 0.05f;
+
+	JobSystem& jobSystem = JobSystem::GetInstance();
+	unsigned int count = (unsigned int)entities.size();
+	occlusionSpheres.resize(count);
+	occluderScores.resize(count);
+	entityVisible.resize(count);
+
+	XMVECTOR eye = XMLoadFloat3(&occlusionEye);
+	jobSystem.ParallelFor(count, 256, [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Entity* entity = entities[i].get();
+				Mesh* mesh = entity->GetMesh().get();
+				XMFLOAT4X4 world = entity->GetTransform()->GetWorldMatrix();
+				XMMATRIX worldMatrix = XMLoadFloat4x4(&world);
+
+				// World space sphere, scaled by the largest axis
+				XMFLOAT3 localCenter = mesh->GetBoundsCenter();
+				XMVECTOR center = XMVector3Transform(XMLoadFloat3(&localCenter), worldMatrix);
+				float scale = sqrtf(max(max(
+					XMVectorGetX(XMVector3LengthSq(worldMatrix.r[0])),
+					XMVectorGetX(XMVector3LengthSq(worldMatrix.r[1]))),
+					XMVectorGetX(XMVector3LengthSq(worldMatrix.r[2]))));
+
+				OcclusionSphere& sphere = occlusionSpheres[i];
+				XMStoreFloat3((XMFLOAT3*)sphere.center, center);
+				sphere.radius = mesh->GetBoundsRadius() * scale;
+
+				float distance = max(XMVectorGetX(XMVector3Length(XMVectorSubtract(center, eye))), 0.1f);
+				unsigned int triangles = (unsigned int)mesh->GetIndexCount() / 3;
+				bool usable = !entity->GetMaterial()->GetTransparent() && triangles > 0 && triangles <= maxOccluderTriangles;
+				occluderScores[i] = usable ? sphere.radius / distance : 0.0f;
+			}
+		});
+
+	// Best few, kept sorted by score
+	unsigned int chosen[maxOccluders];
+	unsigned int chosenCount = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		float score = occluderScores[i];
+		if (score < minOccluderScore || (chosenCount == maxOccluders && score <= occluderScores[chosen[chosenCount - 1]]))
+			continue;
+
+		unsigned int slot = chosenCount < maxOccluders ? chosenCount++ : maxOccluders - 1;
+		while (slot > 0 && occluderScores[chosen[slot - 1]] < score)
+		{
+			chosen[slot] = chosen[slot - 1];
+			slot--;
+		}
+		chosen[slot] = i;
+	}
+
+	softwareOcclusion.BeginFrame(&occlusionViewProj._11);
+	for (unsigned int i = 0; i < chosenCount; i++)
+	{
+		Entity* entity = entities[chosen[i]].get();
+		Mesh* mesh = entity->GetMesh().get();
+		XMFLOAT4X4 world = entity->GetTransform()->GetWorldMatrix();
+		softwareOcclusion.AddOccluder(
+			&mesh->GetPositions()[0].x, (unsigned int)mesh->GetPositions().size(),
+			mesh->GetIndices().data(), (unsigned int)mesh->GetIndices().size(),
+			&world._11);
+	}
+	softwareOcclusion.Rasterize();
+	softwareOcclusion.TestBatch(occlusionSpheres.data(), count, entityVisible.data());
 }
 
 // --------------------------------------------------------
@@ -421,38 +1209,22 @@ void Game::Update(float deltaTime, float totalTime)
 // --------------------------------------------------------
 void Game::Draw(float deltaTime, float totalTime)
 {
+	PROFILE_FUNCTION();
 	DX12Helper& dx12Helper = DX12Helper::GetInstance();
 
-	std::cout << "Step: Clear and Grab Buffers" << std::endl;
+	// Each stage's time goes into its history as the frame moves along
+	auto stageStart = std::chrono::high_resolution_clock::now();
+	auto endStage = [&](CpuStage stage)
+	{
+		auto now = std::chrono::high_resolution_clock::now();
+		cpuStageTimes[stage].Add(std::chrono::duration<float, std::milli>(now - stageStart).count());
+		stageStart = now;
+	};
+
+	LOG_TRACE("Step: Clear and Grab Buffers");
 
 	// Grab the current back buffer for this frame
 	Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer = backBuffers[currentSwapBuffer];
-	// Clearing the render target
-	{
-		// Transition the back buffer from present to render target
-		D3D12_RESOURCE_BARRIER rb = {};
-		rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-		rb.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-		rb.Transition.pResource = currentBackBuffer.Get();
-		rb.Transition.StateBefore = D3D12_RESOURCE_STATE_PRESENT;
-		rb.Transition.StateAfter = D3D12_RESOURCE_STATE_RENDER_TARGET;
-		rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-		commandList->ResourceBarrier(1, &rb);
-		// Background color (Cornflower Blue in this case) for clearing
-		float color[] = { 0, 0, 0, 1.0f }; //Remember to set this to black once we have moved on past the first step.
-		// Clear the RTV
-		commandList->ClearRenderTargetView(
-			rtvHandles[currentSwapBuffer],
-			color,
-			0, 0); // No scissor rectangles
-			// Clear the depth buffer, too
-		commandList->ClearDepthStencilView(
-			dsvHandle,
-			D3D12_CLEAR_FLAG_DEPTH,
-			1.0f, // Max depth = 1.0f
-			0, // Not clearing stencil, but need a value
-			0, 0); // No scissor rects
-	}
 
 	
 	//Add ImGui to Render Queue
@@ -478,7 +1250,8 @@ void Game::Draw(float deltaTime, float totalTime)
 
 				ImGui::Text("This is some useful text.");               // Display some text (you can use a format strings too)
 				ImGui::Checkbox("Demo Window", &showDemoWindow);      // Edit bools storing our window open/close state
-				ImGui::Checkbox("Another Window", &showFluidWindow);
+				ImGui::Checkbox("Fluid Window", &showFluidWindow);
+				ImGui::Checkbox("Performance", &showPerformanceWindow);
 
 				ImGui::SliderFloat("float", &f, 0.0f, 1.0f);            // Edit 1 float using a slider from 0.0f to 1.0f
 				//ImGui::ColorEdit3("clear color", (float*)&clear_color); // Edit 3 floats representing a color
@@ -489,143 +1262,959 @@ void Game::Draw(float deltaTime, float totalTime)
 				ImGui::Text("counter = %d", counter);
 
 				ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+
+				// Draw sorting results from last frame
+				const RenderStats& stats = renderQueue.GetStats();
+				ImGui::Text("Entities: %u  Draw calls: %u  Sort passes: %u", stats.entityCount, stats.drawCalls, stats.sortPasses);
+				ImGui::Text("PSO changes: %u (%u avoided)", stats.pipelineChanges, stats.pipelineChangesAvoided);
+				ImGui::Text("Material changes: %u (%u avoided)", stats.materialChanges, stats.materialChangesAvoided);
+				ImGui::Text("Mesh changes: %u (%u avoided)", stats.meshChanges, stats.meshChangesAvoided);
+				ImGui::Text("Recording: %.3f ms into up to %u lists", commandListPool.GetLastRecordTimeMs(), commandListPool.GetListCount());
+
+				const RGStats& graphStats = renderGraph.GetStats();
+				ImGui::Text("Render graph: %u passes (%u culled), %u barriers (%u split)",
+					graphStats.passCount, graphStats.culledPasses, graphStats.barriers, graphStats.splitBarriers);
+
+				const BarrierStats& barrierStats = dx12Helper.GetStateTracker().GetLastFrameStats();
+				ImGui::Text("Barriers: %u issued in %u calls, %u elided, %u split",
+					barrierStats.issued, barrierStats.flushes, barrierStats.elided, barrierStats.split);
+				ImGui::Text("Transients: %u in %.1f MB (%.1f MB without aliasing)", graphStats.transientCount,
+					graphStats.transientHeapSize / (1024.0f * 1024.0f), graphStats.transientUnaliasedSize / (1024.0f * 1024.0f));
+
+				PipelineCacheStats pipelineStats = PipelineCache::GetInstance().GetStats();
+				ImGui::Text("Pipelines: %u (%u from disk, %u compiled, %u pending) in %.1f ms%s",
+					pipelineStats.requests, pipelineStats.libraryHits, pipelineStats.compiles, pipelineStats.pending,
+					pipelineStats.compileMs, pipelineStats.libraryAvailable ? "" : " - no pipeline library");
+
+				// Depth prepass: on, off, or up to the overdraw estimate
+				int prepassMode = (int)overdrawEstimator.GetMode();
+				ImGui::Combo("Depth prepass", &prepassMode, "Auto\0On\0Off\0");
+				overdrawEstimator.SetMode((DepthPrepassMode)prepassMode);
+				ImGui::Text("Overdraw estimate: %s%.2fx, prepass %s", overdrawEstimator.IsEstimateLowerBound() ? "at least " : "",
+					overdrawEstimator.GetEstimate(), overdrawEstimator.UsePrepass() ? "on" : "off");
+
+				// GPU culling counts are a few frames old (read back from the GPU),
+				// the software ones are from last frame
+				int mode = (int)occlusionMode;
+				ImGui::Combo("Occlusion culling", &mode, "Off\0GPU Hi-Z\0CPU raster\0");
+				occlusionMode = (OcclusionMode)mode;
+				if (occlusionMode == OCCLUSION_MODE_GPU)
+				{
+					const OcclusionCullStats& cullStats = occlusionCuller.GetStats();
+					ImGui::Text("Occlusion: %u instances, %u drawn in phase one, %u in phase two, %u culled",
+						cullStats.instances, cullStats.phaseOneDrawn, cullStats.phaseTwoDrawn,
+						cullStats.instances - cullStats.phaseOneDrawn - cullStats.phaseTwoDrawn);
+				}
+				else if (occlusionMode == OCCLUSION_MODE_CPU)
+				{
+					const SoftwareOcclusionStats& cpuStats = softwareOcclusionStats;
+					ImGui::Text("Occluders: %u, %u of %u triangles drawn (%u tile bins) in %.3f ms",
+						cpuStats.occluders, cpuStats.trianglesRasterized, cpuStats.trianglesSubmitted, cpuStats.binEntries, cpuStats.rasterMs);
+					ImGui::Text("Occlusion: %u tested, %u occluded, %u outside the frustum in %.3f ms",
+						cpuStats.tested, cpuStats.occluded, cpuStats.outsideFrustum, cpuStats.testMs);
+				}
+
+				ShaderPermutationStats shaderStats = shaderPermutations.GetStats();
+				ImGui::Text("Shader variants: %u (%u cached, %u compiled, %u failed) in %.1f ms%s",
+					shaderStats.variants, shaderStats.cacheHits, shaderStats.compiles, shaderStats.failures,
+					shaderStats.compileMs, shaderStats.compilerAvailable ? "" : " - no dxcompiler.dll");
+
+				// How busy each job system worker was last frame
+				const std::vector<JobWorkerStats>& workerStats = JobSystem::GetInstance().GetWorkerStats();
+				if (!workerStats.empty())
+				{
+					float utilization[256] = {};
+					unsigned int jobsRun = 0;
+					unsigned int jobsStolen = 0;
+					float average = 0.0f;
+					unsigned int shown = (unsigned int)workerStats.size() < 256 ? (unsigned int)workerStats.size() : 256;
+					for (unsigned int i = 0; i < shown; i++)
+					{
+						utilization[i] = workerStats[i].utilization;
+						average += workerStats[i].utilization;
+						jobsRun += workerStats[i].jobsRun;
+						jobsStolen += workerStats[i].jobsStolen;
+					}
+					average /= shown;
+
+					ImGui::Text("Workers: %u  Jobs: %u (%u stolen)  Avg utilization: %.0f%%", shown, jobsRun, jobsStolen, average * 100.0f);
+					ImGui::PlotHistogram("Utilization", utilization, shown, 0, 0, 0.0f, 1.0f, ImVec2(0, 60));
+				}
 				ImGui::End();
 			}
 
 			//Window #2
 			if (showFluidWindow)
 			{
-				ImGui::Begin("Fluid Window", &showFluidWindow);   // Pass a pointer to our bool variable (the window will have a closing button that will clear the bool when clicked)
-				ImGui::Text("Adjust Fluid Parameters here.");
-				if (ImGui::Button("Close Me"))
-					showFluidWindow = false;
-				ImGui::End();
+				DrawFluidWindow();
+			}
+
+			if (showPerformanceWindow)
+			{
+				DrawPerformanceWindow();
 			}
 
 			//Rendering
 			ImGui::Render();
 		}
 	}
+	endStage(CPU_STAGE_UI);
 
-	std::cout << "Step: Render" << std::endl;
+	LOG_TRACE("Step: Render");
 
 	//Rendering here!
 
 	//Main Rendering Step
 	{
-		// Root sig (must happen before root descriptor table)
-		commandList->SetGraphicsRootSignature(rootSignature.Get());
-
-		// Set constant buffer
-		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> descriptorHeap = dx12Helper.GetCBVSRVDescriptorHeap();
-		commandList->SetDescriptorHeaps(1, descriptorHeap.GetAddressOf());
+		// This frame's per-thread allocators are ours once the GPU is done with them
+		commandListPool.BeginFrame(currentSwapBuffer);
+		GpuQueues::GetInstance().BeginFrame(currentSwapBuffer);
+
+		// Goes off to the compute queue right away, and runs alongside everything below
+		fluidSolver.Step(fluidSteps, (float)simulationClock.GetStep(), fluidStepTime, currentSwapBuffer);
+
+		// Which also means last time's queries for this slot are done, so
+		// decide on the prepass based on how much overdraw they measured
+		overdrawEstimator.BeginFrame(currentSwapBuffer, width * height);
+		gpuProfiler.BeginFrame(currentSwapBuffer);
+
+		// Culling already draws most of the depth first (phase one), so the
+		// two don't stack - the prepass sits out while culling is on
+		bool cullThisFrame = occlusionMode == OCCLUSION_MODE_GPU && !entities.empty();
+		bool usePrepass = overdrawEstimator.UsePrepass() && !cullThisFrame;
+
+		// Sort the entities by state and depth, group them into instanced draws
+		// (one per pipeline/material/mesh run) and multiply every world matrix by
+		// this frame's view-projection in one batch up front, rather than twice
+		// per vertex in the shader
+		XMFLOAT4X4 viewProj;
+		{
+			XMFLOAT4X4 view = camera->GetViewMatrix();
+			XMFLOAT4X4 proj = camera->GetProjectionMatrix();
+			XMStoreFloat4x4(&viewProj, XMMatrixMultiply(XMLoadFloat4x4(&view), XMLoadFloat4x4(&proj)));
 
-		// Set up other commands for rendering
-		commandList->OMSetRenderTargets(1, &rtvHandles[currentSwapBuffer], true, &dsvHandle);
-		commandList->RSSetViewports(1, &viewport);
-		commandList->RSSetScissorRects(1, &scissorRect);
-		commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+			// Software occlusion ran since Update() - only what survived gets queued
+			const std::vector<std::shared_ptr<Entity>>* queued = &entities;
+			if (softwareOcclusionPending)
+			{
+				JobSystem::GetInstance().Wait(&softwareOcclusionCounter);
+				softwareOcclusionPending = false;
+				softwareOcclusionStats = softwareOcclusion.GetStats();
+
+				if (occlusionMode == OCCLUSION_MODE_CPU)
+				{
+					visibleEntities.clear();
+					for (size_t i = 0; i < entities.size(); i++)
+					{
+						if (entityVisible[i])
+							visibleEntities.push_back(entities[i]);
+					}
+					queued = &visibleEntities;
+				}
+			}
 
-		////Add ImGui to Render Queue
-		//{
-		//  //Backend is deprecated as of newest version which causes issues with this call normally without having to rewrite.
-		//	ImGui_ImplDX12_RenderDrawData(ImGui::GetDrawData(), commandList.Get());
-		//}
+			renderQueue.Build(*queued, viewProj);
+		}
+		endStage(CPU_STAGE_QUEUE);
 
-		for (auto& e : entities)
+		// Upload every instance for the frame at once.
+		// Each batch then picks out its own range with StartInstanceLocation.
+		const std::vector<InstanceData>& instances = renderQueue.GetInstances();
+		D3D12_VERTEX_BUFFER_VIEW instanceView = {};
+		if (!instances.empty())
 		{
-			// Grab the material for this entity
-			std::shared_ptr<Material> mat = e->GetMaterial();
-
-			// Set the pipeline state for this material
-			commandList->SetPipelineState(mat->GetPipelineState().Get());
+			instanceView = dx12Helper.FillNextInstanceBufferAndGetView(
+				(void*)instances.data(), sizeof(InstanceData), (unsigned int)instances.size());
+		}
 
-			// Set up the vertex shader data we intend to use for drawing this entity
+		// The constant buffer ring isn't thread safe, so fill every material's
+		// pixel shader data here first. The recording threads only read handles.
+		const std::vector<DrawBatch>& batches = renderQueue.GetBatches();
+		batchConstantBuffers.resize(batches.size());
+		submittedTriangles = 0;
+		for (const DrawBatch& batch : batches)
+			submittedTriangles += batch.mesh->GetIndexCount() / 3 * batch.instanceCount;
+		for (size_t i = 0; i < batches.size(); i++)
+		{
+			// Same material as last batch? Reuse its buffer
+			if (i > 0 && !batches[i].materialChanged)
 			{
-				VertexShaderExternalData vsData = {};
-				vsData.world = e->GetTransform()->GetWorldMatrix();
-				vsData.worldInverseTranspose = e->GetTransform()->GetWorldITMatrix();
-				vsData.view = camera->GetViewMatrix();
-				vsData.projection = camera->GetProjectionMatrix();
-
-				// Send this to a chunk of the constant buffer heap
-				// and grab the GPU handle for it so we can set it for this draw
-				D3D12_GPU_DESCRIPTOR_HANDLE cbHandleVS = dx12Helper.FillNextConstantBufferAndGetGPUDescriptorHandle(
-					(void*)(&vsData), sizeof(VertexShaderExternalData));
-
-				// Set this constant buffer handle
-				// Note: This assumes that descriptor table 0 is the
-				//       place to put this particular descriptor.  This
-				//       is based on how we set up our root signature.
-				commandList->SetGraphicsRootDescriptorTable(0, cbHandleVS);
+				batchConstantBuffers[i] = batchConstantBuffers[i - 1];
+				continue;
 			}
 
-			// Pixel shader data and cbuffer setup
+			Material* mat = batches[i].material;
+			PixelShaderExternalData psData = {};
+			psData.uvScale = mat->GetUVScale();
+			psData.uvOffset = mat->GetUVOffset();
+			psData.cameraPosition = camera->GetPosition();
+			psData.lightCount = lightCount;
+			psData.roughness = mat->GetRoughness();
+			psData.metal = mat->GetMetal();
+			memcpy(psData.lights, &lights[0], sizeof(Light) * MAX_LIGHTS);
+
+			// Send this to a chunk of the constant buffer heap
+			// and grab the GPU handle for it so we can set it for this draw
+			batchConstantBuffers[i] = dx12Helper.FillNextConstantBufferAndGetGPUDescriptorHandle(
+				(void*)(&psData), sizeof(PixelShaderExternalData));
+		}
+
+		// The culling shaders pick their inputs up from the GPU copies
+		if (cullThisFrame)
+		{
+			occlusionCuller.Prepare(batches, instances, renderQueue.GetInstanceEntities(),
+				(unsigned int)entities.size(), viewProj, instanceView.BufferLocation, currentSwapBuffer);
+		}
+
+		// Which batches go through the depth prepass: opaque ones whose prepass
+		// and EQUAL pipelines are both compiled. The rest draw as usual
+		// in the main pass and write their own depth.
+		batchInPrepass.assign(batches.size(), 0);
+		bool anyInPrepass = false;
+		if (usePrepass)
+		{
+			for (size_t i = 0; i < batches.size(); i++)
 			{
-				PixelShaderExternalData psData = {};
-				psData.uvScale = mat->GetUVScale();
-				psData.uvOffset = mat->GetUVOffset();
-				psData.cameraPosition = camera->GetPosition();
-				psData.lightCount = MAX_LIGHTS;//lightCount;
-				memcpy(psData.lights, &lights[0], sizeof(Light) * MAX_LIGHTS);
-
-				// Send this to a chunk of the constant buffer heap
-				// and grab the GPU handle for it so we can set it for this draw
-				D3D12_GPU_DESCRIPTOR_HANDLE cbHandlePS = dx12Helper.FillNextConstantBufferAndGetGPUDescriptorHandle(
-					(void*)(&psData), sizeof(PixelShaderExternalData));
-
-				// Set this constant buffer handle
-				// Note: This assumes that descriptor table 1 is the
-				//       place to put this particular descriptor.  This
-				//       is based on how we set up our root signature.
-				commandList->SetGraphicsRootDescriptorTable(1, cbHandlePS);
+				Material* mat = batches[i].material;
+				CachedPipeline* prepass = mat->GetDepthPrepassPipeline();
+				CachedPipeline* equalDepth = mat->GetEqualDepthPipeline();
+				batchInPrepass[i] = !mat->GetTransparent() && prepass && equalDepth && prepass->IsReady() && equalDepth->IsReady();
+				anyInPrepass |= batchInPrepass[i] != 0;
 			}
+		}
 
-			// Set the SRV descriptor handle for this material's textures
-			// Note: This assumes that descriptor table 2 is for textures (as per our root sig)
-			commandList->SetGraphicsRootDescriptorTable(2, mat->GetFinalGPUHandleForTextures());
+		// Record the batches across threads, each into its own command list.
+		// Command lists don't inherit state, so every list sets everything up
+		// and its first batch sends all of its state, changed or not.
+		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> descriptorHeap = dx12Helper.GetCBVSRVDescriptorHeap();
+		D3D12_CPU_DESCRIPTOR_HANDLE rtvHandle = rtvHandles[currentSwapBuffer];
+		auto recordPrepass = [&]()
+		{
+			commandListPool.Record((unsigned int)batches.size(), 64,
+				[&](ID3D12GraphicsCommandList* list, unsigned int begin, unsigned int end)
+				{
+					// Depth only - no render target, no textures or constant buffers
+					list->SetGraphicsRootSignature(rootSignature.Get());
+					list->OMSetRenderTargets(0, 0, false, &dsvHandle);
+					list->RSSetViewports(1, &viewport);
+					list->RSSetScissorRects(1, &scissorRect);
+					list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+					list->IASetVertexBuffers(1, 1, &instanceView);
+
+					int query = overdrawEstimator.BeginQuery(list, OVERDRAW_QUERY_PREPASS);
+					ID3D12PipelineState* currentPipeline = 0;
+					Mesh* currentMesh = 0;
+					for (unsigned int i = begin; i < end; i++)
+					{
+						if (!batchInPrepass[i])
+							continue;
+
+						// Most materials share a prepass pipeline, so there's
+						// far less to switch here than in the main pass
+						const DrawBatch& batch = batches[i];
+						ID3D12PipelineState* pipeline = batch.material->GetDepthPrepassPipeline()->Get().Get();
+						if (pipeline != currentPipeline)
+						{
+							list->SetPipelineState(pipeline);
+							currentPipeline = pipeline;
+						}
+
+						Mesh* mesh = batch.mesh;
+						if (mesh != currentMesh)
+						{
+							D3D12_VERTEX_BUFFER_VIEW vbv = mesh->GetVB();
+							D3D12_INDEX_BUFFER_VIEW  ibv = mesh->GetIB();
+							list->IASetVertexBuffers(0, 1, &vbv);
+							list->IASetIndexBuffer(&ibv);
+							currentMesh = mesh;
+						}
+
+						list->DrawIndexedInstanced(mesh->GetIndexCount(), batch.instanceCount, 0, 0, batch.firstInstance);
+					}
+					overdrawEstimator.EndQuery(list, query);
+				});
+		};
+
+		// cullPhase is -1 for plain draws, otherwise which occlusion culling
+		// phase's indirect draws to record
+		auto recordScene = [&](int cullPhase)
+		{
+			D3D12_VERTEX_BUFFER_VIEW sceneInstanceView = cullPhase < 0 ? instanceView : occlusionCuller.GetInstanceView();
+			commandListPool.Record((unsigned int)batches.size(), 64,
+				[&](ID3D12GraphicsCommandList* list, unsigned int begin, unsigned int end)
+				{
+					// Root sig (must happen before root descriptor table)
+					list->SetGraphicsRootSignature(rootSignature.Get());
+					list->SetDescriptorHeaps(1, descriptorHeap.GetAddressOf());
+
+					// Set up other commands for rendering
+					list->OMSetRenderTargets(1, &rtvHandle, true, &dsvHandle);
+					list->RSSetViewports(1, &viewport);
+					list->RSSetScissorRects(1, &scissorRect);
+					list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+					list->IASetVertexBuffers(1, 1, &sceneInstanceView);
+
+					int query = overdrawEstimator.BeginQuery(list, OVERDRAW_QUERY_MAIN);
+					ID3D12PipelineState* currentPipeline = 0;
+					for (unsigned int i = begin; i < end; i++)
+					{
+						const DrawBatch& batch = batches[i];
+						bool first = (i == begin);
+
+						// Only send the state that actually changed since the last batch.
+						// The sort put identical state next to each other, so most of these are skipped.
+						// Batches that were in the prepass swap in their EQUAL pipeline, which
+						// pipelineChanged doesn't know about, so this tracks the pipeline itself.
+						ID3D12PipelineState* pipeline = batchInPrepass[i] ?
+							batch.material->GetEqualDepthPipeline()->Get().Get() : batch.pipelineState;
+						if (pipeline != currentPipeline)
+						{
+							list->SetPipelineState(pipeline);
+							currentPipeline = pipeline;
+						}
+
+						if (first || batch.materialChanged)
+						{
+							// Note: This assumes that descriptor table 0 is the
+							//       place to put this particular descriptor.  This
+							//       is based on how we set up our root signature.
+							list->SetGraphicsRootDescriptorTable(0, batchConstantBuffers[i]);
+
+							// Set the SRV descriptor handle for this material's textures
+							// Note: This assumes that descriptor table 1 is for textures (as per our root sig)
+							list->SetGraphicsRootDescriptorTable(1, batch.material->GetFinalGPUHandleForTextures());
+						}
+
+						// Grab the mesh and its buffer views
+						Mesh* mesh = batch.mesh;
+						if (first || batch.meshChanged)
+						{
+							D3D12_VERTEX_BUFFER_VIEW vbv = mesh->GetVB();
+							D3D12_INDEX_BUFFER_VIEW  ibv = mesh->GetIB();
+
+							// Set the geometry
+							list->IASetVertexBuffers(0, 1, &vbv);
+							list->IASetIndexBuffer(&ibv);
+						}
+
+						// Draw every instance in this batch (or every one that survived culling)
+						if (cullPhase < 0)
+							list->DrawIndexedInstanced(mesh->GetIndexCount(), batch.instanceCount, 0, 0, batch.firstInstance);
+						else
+							occlusionCuller.DrawIndirect(list, i, (unsigned int)cullPhase);
+					}
+					overdrawEstimator.EndQuery(list, query);
+				});
+		};
+
+		// Build this frame's graph. Passes only say what they touch -
+		// the transitions between them (and back to present) come from the graph.
+		renderGraph.Reset();
+
+		// Imported resources start wherever the state tracker says they are
+		ResourceStateTracker& stateTracker = dx12Helper.GetStateTracker();
+		RGResource backBuffer = renderGraph.Import("Back buffer", currentBackBuffer.Get(),
+			(RGStates)stateTracker.GetState(currentBackBuffer.Get()), RGState::Present);
+		RGResource depthBuffer = renderGraph.Import("Depth buffer", depthStencilBuffer.Get(),
+			(RGStates)stateTracker.GetState(depthStencilBuffer.Get()), RGState::DepthWrite);
+
+		// Occlusion culling's buffers and pyramid, left where their last use needs them
+		RGResource drawArguments = RG_INVALID_RESOURCE;
+		RGResource visibleInstances = RG_INVALID_RESOURCE;
+		RGResource visibility = RG_INVALID_RESOURCE;
+		RGResource hiZ = RG_INVALID_RESOURCE;
+		RGResource hiZCounter = RG_INVALID_RESOURCE;
+		if (cullThisFrame)
+		{
+			auto importResource = [&](const char* name, ID3D12Resource* resource, RGStates finalState)
+			{
+				return renderGraph.Import(name, resource, (RGStates)stateTracker.GetState(resource), finalState);
+			};
+			drawArguments = importResource("Draw arguments", occlusionCuller.GetDrawArguments(), RGState::CopySource);
+			visibleInstances = importResource("Visible instances", occlusionCuller.GetVisibleInstances(), RGState::VertexAndConstantBuffer);
+			visibility = importResource("Visibility", occlusionCuller.GetVisibility(), RGState::UnorderedAccess);
+			hiZ = importResource("Hi-Z", occlusionCuller.GetHiZ(), RGState::NonPixelShaderResource);
+			hiZCounter = importResource("Hi-Z counter", occlusionCuller.GetHiZCounter(), RGState::UnorderedAccess);
+
+			// Phase one: what was visible last frame
+			renderGraph.AddPass("Occlusion cull (phase one)",
+				[&](RenderGraphBuilder& builder)
+				{
+					builder.Write(drawArguments, RGState::UnorderedAccess);
+					builder.Write(visibleInstances, RGState::UnorderedAccess);
+					builder.Read(visibility, RGState::UnorderedAccess);
+				},
+				[&](RenderGraphContext& context)
+				{
+					occlusionCuller.RecordCull(context.commandList, 0);
+				});
+		}
 
-			// Grab the mesh and its buffer views
-			std::shared_ptr<Mesh> mesh = e->GetMesh();
-			D3D12_VERTEX_BUFFER_VIEW vbv = mesh->GetVB();
-			D3D12_INDEX_BUFFER_VIEW  ibv = mesh->GetIB();
+		// Lay down final depth first, so the main pass only shades what's visible
+		if (anyInPrepass)
+		{
+			renderGraph.AddPass("Depth prepass",
+				[&](RenderGraphBuilder& builder)
+				{
+					builder.Write(depthBuffer, RGState::DepthWrite);
+				},
+				[&](RenderGraphContext& context)
+				{
+					context.commandList->ClearDepthStencilView(dsvHandle, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, 0);
+					recordPrepass();
+					context.EndCurrentList();
+				});
+		}
 
-			// Set the geometry
-			commandList->IASetVertexBuffers(0, 1, &vbv);
-			commandList->IASetIndexBuffer(&ibv);
+		renderGraph.AddPass("Scene",
+			[&](RenderGraphBuilder& builder)
+			{
+				builder.Write(backBuffer, RGState::RenderTarget);
+				builder.Write(depthBuffer, RGState::DepthWrite);
+				if (cullThisFrame)
+				{
+					builder.Read(drawArguments, RGState::IndirectArgument);
+					builder.Read(visibleInstances, RGState::VertexAndConstantBuffer);
+				}
+			},
+			[&](RenderGraphContext& context)
+			{
+				// Background color for clearing
+				float color[] = { 0, 0, 0, 1.0f };
+				context.commandList->ClearRenderTargetView(rtvHandle, color, 0, 0); // No scissor rectangles
+
+				// The prepass already cleared (and filled) depth
+				if (!anyInPrepass)
+				{
+					context.commandList->ClearDepthStencilView(
+						dsvHandle,
+						D3D12_CLEAR_FLAG_DEPTH,
+						1.0f, // Max depth = 1.0f
+						0, // Not clearing stencil, but need a value
+						0, 0); // No scissor rects
+				}
+
+				// The draws themselves go into the pool's lists, which are submitted after this one.
+				// With culling on this is phase one.
+				recordScene(cullThisFrame ? 0 : -1);
+				context.EndCurrentList();
+			});
+
+		if (cullThisFrame)
+		{
+			renderGraph.AddPass("Hi-Z",
+				[&](RenderGraphBuilder& builder)
+				{
+					builder.Read(depthBuffer, RGState::NonPixelShaderResource);
+					builder.Write(hiZ, RGState::UnorderedAccess);
+					builder.Write(hiZCounter, RGState::UnorderedAccess);
+				},
+				[&](RenderGraphContext& context)
+				{
+					occlusionCuller.RecordHiZ(context.commandList);
+				});
+
+			// Phase two: test everything against phase one's depth
+			renderGraph.AddPass("Occlusion cull (phase two)",
+				[&](RenderGraphBuilder& builder)
+				{
+					builder.Read(hiZ, RGState::NonPixelShaderResource);
+					builder.Write(drawArguments, RGState::UnorderedAccess);
+					builder.Write(visibleInstances, RGState::UnorderedAccess);
+					builder.Write(visibility, RGState::UnorderedAccess);
+				},
+				[&](RenderGraphContext& context)
+				{
+					occlusionCuller.RecordCull(context.commandList, 1);
+				});
+
+			renderGraph.AddPass("Scene (phase two)",
+				[&](RenderGraphBuilder& builder)
+				{
+					builder.Write(backBuffer, RGState::RenderTarget);
+					builder.Write(depthBuffer, RGState::DepthWrite);
+					builder.Read(drawArguments, RGState::IndirectArgument);
+					builder.Read(visibleInstances, RGState::VertexAndConstantBuffer);
+				},
+				[&](RenderGraphContext& context)
+				{
+					recordScene(1);
+					context.EndCurrentList();
+				});
+
+			renderGraph.AddPass("Occlusion stats",
+				[&](RenderGraphBuilder& builder)
+				{
+					builder.Read(drawArguments, RGState::CopySource);
+					builder.NeverCull();
+				},
+				[&](RenderGraphContext& context)
+				{
+					occlusionCuller.RecordStatsReadback(context.commandList);
+				});
+		}
 
-			// Draw
-			commandList->DrawIndexedInstanced(mesh->GetIndexCount(), 1, 0, 0, 0);
+		// UI goes on top of everything else
+		auto addImGuiPass = [&]()
+		{
+			renderGraph.AddPass("ImGui",
+				[&](RenderGraphBuilder& builder)
+				{
+					builder.Write(backBuffer, RGState::RenderTarget);
+				},
+				[&](RenderGraphContext& context)
+				{
+					context.commandList->SetDescriptorHeaps(1, descriptorHeap.GetAddressOf());
+					context.commandList->OMSetRenderTargets(1, &rtvHandle, true, 0);
+					ImGui_ImplDX12_RenderDrawData(ImGui::GetDrawData(), context.commandList);
+				});
+		};
+		addImGuiPass();
+
+		if (!renderGraph.Compile())
+		{
+			// Only happens when a pass above reads a transient nothing wrote,
+			// and a half compiled graph would leave resources in the wrong
+			// states. Just clear and draw the UI this frame, so it still presents.
+			LOG_ERROR("Render graph didn't compile, drawing only the UI this frame");
+			renderGraph.Reset();
+			backBuffer = renderGraph.Import("Back buffer", currentBackBuffer.Get(),
+				(RGStates)stateTracker.GetState(currentBackBuffer.Get()), RGState::Present);
+			renderGraph.AddPass("Clear",
+				[&](RenderGraphBuilder& builder)
+				{
+					builder.Write(backBuffer, RGState::RenderTarget);
+				},
+				[&](RenderGraphContext& context)
+				{
+					float color[] = { 0, 0, 0, 1.0f };
+					context.commandList->ClearRenderTargetView(rtvHandle, color, 0, 0);
+				});
+			addImGuiPass();
+			renderGraph.Compile(); // Imports only, can't fail
 		}
+
+		// Anything after the scene pass (like the transition back to present)
+		// continues in the pool's serial lists so it lands after the worker lists
+		int frameScope = gpuProfiler.BeginScope(commandList.Get(), "Frame");
+		ID3D12GraphicsCommandList* lastList = renderGraphExecutor.Execute(renderGraph, commandList.Get(), [&]() { return commandListPool.GetSerialList(); });
+		gpuProfiler.EndScope(lastList, frameScope);
+
+		// Every query has ended by now, the last list goes after all of them
+		overdrawEstimator.Resolve(lastList);
+		gpuProfiler.Resolve(lastList);
+		commandListPool.CloseSerialLists();
 	}
+	endStage(CPU_STAGE_RECORD);
 
-	std::cout << "Step: Present " << std::endl;
+	LOG_TRACE("Step: Present");
 
 	 //Present
 	{
-		// Transition back to present
-		D3D12_RESOURCE_BARRIER rb = {};
-		rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-		rb.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-		rb.Transition.pResource = currentBackBuffer.Get();
-		rb.Transition.StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET;
-		rb.Transition.StateAfter = D3D12_RESOURCE_STATE_PRESENT;
-		rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-		commandList->ResourceBarrier(1, &rb);
-
 		// Must occur BEFORE present
+		// Main list (graph barriers + clears) first, then every list from the pool in order
+		const std::vector<ID3D12CommandList*>& recordedLists = commandListPool.GetRecordedLists();
+		dx12Helper.CloseExecuteAndResetCommandList(recordedLists.data(), (unsigned int)recordedLists.size());
+		commandListPool.EndFrame(commandQueue.Get());
+		dx12Helper.GetStateTracker().EndFrame();
+
+		// Present the current back buffer (headless runs have nothing to present to)
+		HRESULT presentResult = framePacer.Present(vsync); //Vsync on or off? Tears when it's off (if allowed)
+		if (FAILED(presentResult))
+		{
+			// Nothing more will show up on screen after this (usually a removed device)
+			LOG_ERROR("Present failed (0x%08x, device removed reason 0x%08x)",
+				(unsigned int)presentResult, (unsigned int)device->GetDeviceRemovedReason());
+			Quit();
+		}
 
-		dx12Helper.CloseExecuteAndResetCommandList();
-
-		// Present the current back buffer
-		swapChain->Present(vsync ? 1 : 0, 0); //Vsync on or off? Simple computation
-
-		// Figure out which buffer is next
-		currentSwapBuffer++;
-		if (currentSwapBuffer >= numBackBuffers)
+		// Figure out which buffer is next (the swap chain knows best)
+		if (swapChain)
+			currentSwapBuffer = swapChain->GetCurrentBackBufferIndex();
+		else if (++currentSwapBuffer >= numBackBuffers)
 			currentSwapBuffer = 0;
 	}
+	endStage(CPU_STAGE_SUBMIT);
 	frameCount++;
-	std::cout << "Frame Count: ";
-	std::cout << frameCount << std::endl;
-}
\ No newline at end of file
+	LOG_TRACE("Frame Count: %d", frameCount);
+
+	if (benchmark.enabled)
+		EndBenchmarkFrame();
+}
+
+// --------------------------------------------------------
+// The fluid solver's settings, and how long each of its
+// stages takes on the GPU (per step)
+// --------------------------------------------------------
+void Game::DrawFluidWindow()
+{
+	ImGui::Begin("Fluid Window", &showFluidWindow);   // Pass a pointer to our bool variable (the window will have a closing button that will clear the bool when clicked)
+
+	FluidSettings& settings = fluidSolver.GetSettings();
+	ImGui::Checkbox("Simulate", &settings.enabled);
+	ImGui::SameLine();
+	if (ImGui::Button("Reset"))
+		fluidSolver.Reset();
+
+	// Grid changes start it over
+	int gridSize = (int)settings.gridSize;
+	if (ImGui::SliderInt("Grid size", &gridSize, 16, 128))
+		settings.gridSize = (unsigned int)gridSize;
+	ImGui::Checkbox("2D", &settings.twoDimensional);
+
+	ImGui::SliderFloat("Velocity dissipation", &settings.velocityDissipation, 0.0f, 2.0f);
+	ImGui::SliderFloat("Density dissipation", &settings.densityDissipation, 0.0f, 2.0f);
+	ImGui::SliderFloat("Viscosity", &settings.viscosity, 0.0f, 10.0f);
+	int diffusionIterations = (int)settings.diffusionIterations;
+	if (ImGui::SliderInt("Diffusion iterations", &diffusionIterations, 0, 40))
+		settings.diffusionIterations = (unsigned int)diffusionIterations;
+	int pressureIterations = (int)settings.pressureIterations;
+	if (ImGui::SliderInt("Pressure iterations", &pressureIterations, 1, 100))
+		settings.pressureIterations = (unsigned int)pressureIterations;
+	ImGui::SliderFloat("Over-relaxation", &settings.overRelaxation, 1.0f, 1.9f);
+	ImGui::SliderFloat("Force", &settings.forceStrength, 0.0f, 1000.0f);
+	ImGui::SliderFloat("Force radius", &settings.forceRadius, 1.0f, 16.0f);
+	ImGui::SliderFloat("Dye", &settings.dyeAmount, 0.0f, 50.0f);
+	ImGui::SliderFloat("Buoyancy", &settings.buoyancy, 0.0f, 20.0f);
+
+	// Milliseconds per step, from the compute queue's timestamps
+	ImGui::Separator();
+	std::vector<GpuScopeTiming> timings = fluidSolver.GetStageTimings();
+	float stepMs = 0.0f;
+	ImGui::Columns(4, "FluidTimings");
+	ImGui::Text("Stage"); ImGui::NextColumn();
+	ImGui::Text("last"); ImGui::NextColumn();
+	ImGui::Text("avg"); ImGui::NextColumn();
+	ImGui::Text("max"); ImGui::NextColumn();
+	ImGui::Separator();
+	for (auto& stage : timings)
+	{
+		ImGui::Text("%s", stage.name.c_str()); ImGui::NextColumn();
+		ImGui::Text("%.3f", stage.timing.last); ImGui::NextColumn();
+		ImGui::Text("%.3f", stage.timing.average); ImGui::NextColumn();
+		ImGui::Text("%.3f", stage.timing.max); ImGui::NextColumn();
+		stepMs += stage.timing.average;
+	}
+	ImGui::Columns(1);
+
+	unsigned int cells = fluidSolver.GetCellCount();
+	if (stepMs > 0.0f && cells > 0)
+	{
+		ImGui::Text("%u cells, %.3f ms per step (%.1f M cells/s), %u steps last frame",
+			cells, stepMs, cells / (stepMs * 1000.0f), fluidSolver.GetLastSteps());
+	}
+	ImGui::End();
+}
+
+// --------------------------------------------------------
+// GPU time per render graph pass, CPU time per stage of the
+// frame, plus what got drawn and how much memory it took
+// --------------------------------------------------------
+void Game::DrawPerformanceWindow()
+{
+	ImGui::Begin("Performance", &showPerformanceWindow);
+
+	auto header = [](const char* name)
+	{
+		ImGui::Text("%s", name); ImGui::NextColumn();
+		ImGui::Text("last"); ImGui::NextColumn();
+		ImGui::Text("min"); ImGui::NextColumn();
+		ImGui::Text("avg"); ImGui::NextColumn();
+		ImGui::Text("max"); ImGui::NextColumn();
+		ImGui::Text("p99"); ImGui::NextColumn();
+		ImGui::Separator();
+	};
+	auto row = [](const char* name, const TimingSummary& timing)
+	{
+		ImGui::Text("%s", name); ImGui::NextColumn();
+		ImGui::Text("%.3f", timing.last); ImGui::NextColumn();
+		ImGui::Text("%.3f", timing.min); ImGui::NextColumn();
+		ImGui::Text("%.3f", timing.average); ImGui::NextColumn();
+		ImGui::Text("%.3f", timing.max); ImGui::NextColumn();
+		ImGui::Text("%.3f", timing.p99); ImGui::NextColumn();
+	};
+
+	// Milliseconds over the last few seconds' worth of frames
+	ImGui::Columns(6, "Timings");
+	header("GPU");
+	std::vector<GpuScopeTiming> gpuTimings = gpuProfiler.GetScopeTimings();
+	for (auto& scope : gpuTimings)
+		row(scope.name.c_str(), scope.timing);
+
+	ImGui::Separator();
+	header("CPU");
+	for (int i = 0; i < CPU_STAGE_COUNT; i++)
+		row(cpuStageNames[i], cpuStageTimes[i].GetSummary());
+
+	// Frame pacing and latency, from the swap chain (so not when headless)
+	FramePacingStats pacing = framePacer.GetStats();
+	if (swapChain)
+	{
+		ImGui::Separator();
+		header("Latency");
+		row("Frame wait", pacing.frameWait);
+		row("Input to present", pacing.inputToPresent);
+		if (pacing.displayStatsAvailable)
+		{
+			row("Input to display", pacing.inputToDisplay);
+			row("Present to display", pacing.presentToDisplay);
+		}
+	}
+	ImGui::Columns(1);
+	ImGui::Separator();
+
+	if (swapChain)
+	{
+		ImGui::Checkbox("VSync", &vsync);
+		ImGui::SameLine();
+		int maxLatency = (int)pacing.maxLatency;
+		if (ImGui::SliderInt("Max frame latency", &maxLatency, 1, 16))
+			framePacer.SetMaxLatency((unsigned int)maxLatency);
+		ImGui::Text("Tearing: %s  Repeated refreshes: %u%s",
+			pacing.tearingSupported ? (vsync ? "off (vsync)" : "on") : "not supported",
+			pacing.repeatedRefreshes,
+			pacing.displayStatsAvailable ? "" : "  (no display statistics in this mode)");
+		ImGui::Separator();
+	}
+
+	// Fixed timestep simulation
+	int simulationRate = (int)(simulationClock.GetRate() + 0.5);
+	if (ImGui::SliderInt("Simulation rate (Hz)", &simulationRate, 10, 240))
+		simulationClock.SetRate(simulationRate);
+	int maxSteps = (int)simulationClock.GetMaxStepsPerFrame();
+	if (ImGui::SliderInt("Max steps per frame", &maxSteps, 1, 16))
+		simulationClock.SetMaxStepsPerFrame((unsigned int)maxSteps);
+	ImGui::Text("Steps this frame: %u  Alpha: %.2f  Dropped: %.3fs",
+		simulationClock.GetLastSteps(), simulationClock.GetAlpha(), simulationClock.GetDroppedSeconds());
+	ImGui::Separator();
+
+	const RenderStats& stats = renderQueue.GetStats();
+	ImGui::Text("Draw calls: %u  Triangles: %u", stats.drawCalls, submittedTriangles);
+
+	// Last frame's submissions per queue, and how often they waited on each other
+	GpuQueues& queues = GpuQueues::GetInstance();
+	for (int i = 0; i < GPU_QUEUE_COUNT; i++)
+	{
+		const GpuQueueStats& queueStats = queues.GetStats((GpuQueueType)i);
+		ImGui::Text("%s queue: %u submits, %u lists, %u waits",
+			GpuQueues::GetName((GpuQueueType)i), queueStats.submits, queueStats.lists, queueStats.waits);
+	}
+
+	// Anything below LOG_MIN_LEVEL isn't in the build at all
+	Logger& logger = Logger::GetInstance();
+	int logLevel = logger.GetLevel();
+	ImGui::Combo("Log level", &logLevel, "Trace\0Debug\0Info\0Warning\0Error\0");
+	logger.SetLevel(logLevel);
+	if (logger.GetDroppedCount() > 0)
+	{
+		ImGui::SameLine();
+		ImGui::Text("(%llu dropped)", (unsigned long long)logger.GetDroppedCount());
+	}
+
+#if CPU_PROFILING_ENABLED
+	// CPU markers, written out as a Chrome/Perfetto trace
+	ImGui::Separator();
+	ImGui::SliderInt("Frames", &cpuCaptureFrames, 1, 300);
+	ImGui::SameLine();
+	if (ImGui::Button("Capture CPU trace (F9)"))
+		RequestCpuCapture();
+
+	CpuCaptureStatus capture = CpuProfiler::GetInstance().GetStatus();
+	if (capture.capturing || capture.pending)
+		ImGui::Text("Capturing, %u frames to go", capture.framesLeft);
+	else if (!capture.lastFile.empty())
+		ImGui::Text("Wrote %u events to %s%s", capture.lastEventCount, capture.lastFile.c_str(),
+			capture.lastDroppedEvents ? " (some dropped)" : "");
+#endif
+
+#if COMMAND_TRACE_ENABLED
+	// Every command list call, for Tools/CommandTraceAnalyzer
+	ImGui::Separator();
+	ImGui::SliderInt("Trace frames", &commandTraceFrames, 1, 120);
+	ImGui::SameLine();
+	if (ImGui::Button("Capture command trace"))
+	{
+		char fileName[64];
+		sprintf_s(fileName, "CommandTrace_%lld.ctrace", (long long)time(0));
+		RequestCommandTrace(fileName);
+	}
+
+	CommandTraceStatus commandTrace = CommandTracer::GetInstance().GetStatus();
+	if (commandTrace.capturing || commandTrace.pending)
+		ImGui::Text("Tracing commands, %u frames to go", commandTrace.framesLeft);
+	else if (!commandTrace.lastFile.empty())
+		ImGui::Text("Wrote %.1f KB to %s", commandTrace.lastBytes / 1024.0f, commandTrace.lastFile.c_str());
+#endif
+
+	// Where startup's time went, phase by phase
+	ImGui::Separator();
+	StartupProfiler& startup = StartupProfiler::GetInstance();
+	if (startup.IsFinished() && ImGui::CollapsingHeader("Startup"))
+	{
+		ImGui::Text("%.1fms to first frame%s", startup.GetTimeToFirstFrameMs(),
+			benchmark.serialStartup ? " (serial startup)" : "");
+		ImGui::Columns(4, "Startup");
+		ImGui::Text("Phase"); ImGui::NextColumn();
+		ImGui::Text("Thread"); ImGui::NextColumn();
+		ImGui::Text("Start"); ImGui::NextColumn();
+		ImGui::Text("ms"); ImGui::NextColumn();
+		ImGui::Separator();
+		for (const StartupPhase& phase : startup.GetPhases())
+		{
+			bool mainThread = phase.worker == 0 || phase.worker == ~0u;
+			ImGui::Text("%*s%s", phase.depth * 2, "", phase.name); ImGui::NextColumn();
+			if (mainThread)
+				ImGui::Text("main");
+			else
+				ImGui::Text("worker %u", phase.worker);
+			ImGui::NextColumn();
+			ImGui::Text("%.2f", phase.startMs); ImGui::NextColumn();
+			ImGui::Text("%.2f", phase.ms); ImGui::NextColumn();
+		}
+		ImGui::Columns(1);
+	}
+
+	// Input recording (replays come from the command line: --replay=file.irec)
+	ImGui::Separator();
+	Input& input = Input::GetInstance();
+	if (input.IsReplaying())
+	{
+		ImGui::Text("Replaying input, frame %u", input.GetReplayedFrames());
+	}
+	else if (input.IsRecording())
+	{
+		if (ImGui::Button("Stop recording input"))
+			input.StopRecording();
+		ImGui::SameLine();
+		ImGui::Text("%u frames", input.GetRecordedFrames());
+	}
+	else if (ImGui::Button("Record input"))
+	{
+		char fileName[64];
+		sprintf_s(fileName, "InputRecording_%lld.irec", (long long)time(0));
+		std::string path = ResolvePath(fileName);
+		if (input.StartRecording(path))
+			LOG_INFO("Recording input to %s", path.c_str());
+		else
+			LOG_ERROR("Couldn't record input to %s", path.c_str());
+	}
+
+	const GpuMemoryInfo& gpuMemory = gpuProfiler.GetMemoryInfo();
+	const float megabyte = 1024.0f * 1024.0f;
+	ImGui::Text("Video memory: %.1f / %.1f MB local, %.1f / %.1f MB shared",
+		gpuMemory.localUsage / megabyte, gpuMemory.localBudget / megabyte,
+		gpuMemory.nonLocalUsage / megabyte, gpuMemory.nonLocalBudget / megabyte);
+
+	PROCESS_MEMORY_COUNTERS processMemory = {};
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &processMemory, sizeof(processMemory)))
+		ImGui::Text("Process: %.1f MB working set, %.1f MB peak", processMemory.WorkingSetSize / megabyte, processMemory.PeakWorkingSetSize / megabyte);
+
+	ImGui::End();
+}
+
+// --------------------------------------------------------
+// Starts a CPU trace capture into a new, time stamped file
+// --------------------------------------------------------
+void Game::RequestCpuCapture()
+{
+	char fileName[64];
+	sprintf_s(fileName, "CpuTrace_%lld.json", (long long)time(0));
+	CpuProfiler::GetInstance().RequestCapture((unsigned int)cpuCaptureFrames, fileName);
+}
+
+// --------------------------------------------------------
+// Records every command list call for the next few frames
+// --------------------------------------------------------
+void Game::RequestCommandTrace(const std::string& path)
+{
+	CommandTracer::GetInstance().RequestCapture((unsigned int)commandTraceFrames, path);
+}
+
+// --------------------------------------------------------
+// Benchmark bookkeeping, once every frame is done. Warms up
+// first (and until no pipelines are still compiling, within
+// reason, so every measured frame draws the same way), then
+// records the measured frames and writes the report.
+// --------------------------------------------------------
+void Game::EndBenchmarkFrame()
+{
+	auto now = std::chrono::high_resolution_clock::now();
+	float frameMs = std::chrono::duration<float, std::milli>(now - benchmarkFrameEnd).count();
+	benchmarkFrameEnd = now;
+	benchmarkFrame++;
+
+	if (benchmarkState == BENCHMARK_WARMING_UP)
+	{
+		bool pipelinesReady = PipelineCache::GetInstance().GetStats().pending == 0;
+		unsigned int warmupLimit = benchmark.warmupFrames * 10 + 600;
+		if (benchmarkFrame < benchmark.warmupFrames || (!pipelinesReady && benchmarkFrame < warmupLimit))
+			return;
+
+		if (Input::GetInstance().ReplayFinished())
+			LOG_ERROR("Benchmark: the input recording ended before warm up did");
+		if (!pipelinesReady)
+			LOG_WARNING("Benchmark: pipelines still compiling after %u frames, measuring anyway", benchmarkFrame);
+		LOG_INFO("Benchmark: warmed up after %u frames", benchmarkFrame);
+		benchmarkState = BENCHMARK_MEASURING;
+		if (!benchmark.commandTracePath.empty())
+			RequestCommandTrace(ResolvePath(benchmark.commandTracePath));
+		return;
+	}
+	if (benchmarkState != BENCHMARK_MEASURING)
+		return;
+
+	benchmarkReport.AddFrameTime(frameMs);
+	for (int i = 0; i < CPU_STAGE_COUNT; i++)
+		benchmarkReport.AddCpuStage(cpuStageNames[i], cpuStageTimes[i].GetLast());
+
+	// Whatever came back from the GPU this frame (from a couple of frames ago)
+	for (const GpuScopeSample& sample : gpuProfiler.GetLatestSamples())
+		benchmarkReport.AddGpuPass(gpuProfiler.GetScopeName(sample.scope), sample.ms);
+
+	benchmarkTriangles += submittedTriangles;
+	benchmarkDrawCalls += renderQueue.GetStats().drawCalls;
+
+	// A replay that runs out first ends the run early (DXCore quits once it's done)
+	if (benchmarkReport.GetFrameCount() >= benchmark.frameCount || Input::GetInstance().ReplayFinished())
+		FinishBenchmark();
+}
+
+// --------------------------------------------------------
+// Writes the report and quits - with exit code 1 if the
+// report couldn't be written, so scripts notice
+// --------------------------------------------------------
+void Game::FinishBenchmark()
+{
+	benchmarkState = BENCHMARK_DONE;
+	DX12Helper::GetInstance().WaitForGPU();
+
+	unsigned int frames = benchmarkReport.GetFrameCount();
+	benchmarkReport.SetInfo("adapter", gpuProfiler.GetAdapterName());
+	benchmarkReport.SetInfo("workerThreads", (double)JobSystem::GetInstance().GetWorkerCount());
+	benchmarkReport.SetInfo("entities", (double)entities.size());
+	benchmarkReport.SetInfo("lightsUsed", (double)lightCount);
+	benchmarkReport.SetInfo("warmupFramesRun", (double)(benchmarkFrame - frames));
+	benchmarkReport.SetInfo("occlusion", occlusionMode == OCCLUSION_MODE_GPU ? "gpu" : occlusionMode == OCCLUSION_MODE_CPU ? "cpu" : "off");
+	benchmarkReport.SetInfo("averageTriangles", benchmarkTriangles / frames);
+	benchmarkReport.SetInfo("averageDrawCalls", benchmarkDrawCalls / frames);
+	benchmarkReport.SetInfo("timeToFirstFrameMs", StartupProfiler::GetInstance().GetTimeToFirstFrameMs());
+	benchmarkReport.SetInfo("initMs", StartupProfiler::GetInstance().GetPhaseMs("Init"));
+	benchmarkReport.SetInfo("startup", benchmark.serialStartup ? "serial" : "jobs");
+	benchmarkReport.SetInfo("simulationSteps", (double)simulationClock.GetStepCount());
+	benchmarkReport.SetInfo("simulationDroppedSeconds", simulationClock.GetDroppedSeconds());
+
+	// Relative paths end up next to the exe, like everything else
+	std::string path = ResolvePath(benchmark.outputPath);
+
+	if (!benchmarkReport.Write(path, benchmark))
+	{
+		LOG_ERROR("Benchmark: couldn't write %s", path.c_str());
+		PostQuitMessage(1);
+		return;
+	}
+
+	BenchmarkStatistics frameTime = benchmarkReport.GetFrameTimeStatistics();
+	LOG_INFO("Benchmark: %u frames, %.3f ms average, %.3f ms p99 - written to %s",
+		frames, frameTime.mean, frameTime.p99, path.c_str());
+	Quit();
+}
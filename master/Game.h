@@ -6,18 +6,45 @@
 #include "Transform.h"
 #include "Camera.h"
 #include "Lights.h"
+#include "RenderQueue.h"
+#include "CommandListPool.h"
+#include "RenderGraph.h"
+#include "RenderGraphExecutor.h"
+#include "PipelineCache.h"
+#include "ShaderPermutations.h"
+#include "OverdrawEstimator.h"
+#include "OcclusionCuller.h"
+#include "SoftwareOcclusion.h"
+#include "GpuProfiler.h"
+#include "JobSystem.h"
+#include "Benchmark.h"
+#include "SimulationClock.h"
+#include "FluidSolver.h"
 
 #include <DirectXMath.h>
 #include <wrl/client.h> // Used for ComPtr - a smart pointer for COM objects
 #include <vector>
 #include <memory>
+#include <string>
+#include <chrono>
+
+// Everything Init() loads on the job system (see Game.cpp)
+struct StartupAssets;
+
+// Which occlusion culler runs, if any
+enum OcclusionMode
+{
+	OCCLUSION_MODE_OFF,
+	OCCLUSION_MODE_GPU,	// Two phase Hi-Z, indirect draws
+	OCCLUSION_MODE_CPU	// Software rasterized occluders, culled before the render queue
+};
 
 class Game 
 	: public DXCore
 {
 
 public:
-	Game(HINSTANCE hInstance);
+	Game(HINSTANCE hInstance, const BenchmarkSettings& benchmarkSettings = BenchmarkSettings());
 	~Game();
 
 	// Overridden setup and game loop methods, which
@@ -32,9 +59,14 @@ private:
 	// Initialization helper methods - feel free to customize, combine, etc.
 	// Should we use vsync to limit the frame rate?
 	bool vsync;
-	void CreateRootSigAndPipelineState();
-	void CreateBasicGeometry();
+	void LoadStartupAssets(StartupAssets& assets);
+	void CreateRootSigAndPipelineState(StartupAssets& assets);
+	std::shared_ptr<CachedPipeline> RequestPipeline(const std::string& key);
+	bool AssignPipelines(std::shared_ptr<Material> material, const std::string& key);
+	void CreateBasicGeometry(StartupAssets& assets);
+	void CreateBenchmarkScene(const D3D12_CPU_DESCRIPTOR_HANDLE textures[4], const std::vector<std::shared_ptr<Mesh>>& meshes);
 	void GenerateLights();
+	void SelectShaderPermutations();
 	//void LoadShaders(); <--Depricated from DX11
 	
 
@@ -53,6 +85,17 @@ private:
 	// Shaders and shader-related constructs now located in a PipelineState
 	Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState;
 	Microsoft::WRL::ComPtr<ID3D12RootSignature> rootSignature;
+
+	// Kept around so pipeline variants can be requested later on
+	Microsoft::WRL::ComPtr<ID3DBlob> vertexShaderByteCode;
+	Microsoft::WRL::ComPtr<ID3DBlob> pixelShaderByteCode;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> inputElements;
+	Microsoft::WRL::ComPtr<ID3DBlob> depthPrepassShaderByteCode;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> depthPrepassInputElements; // Just position and WVP
+	std::shared_ptr<CachedPipeline> opaquePipeline; // Every other pipeline falls back to this one
+
+	// Specialized pixel shaders per material & light setup
+	ShaderPermutations shaderPermutations;
 	
 	// Scene
 	int lightCount;
@@ -60,6 +103,106 @@ private:
 	std::shared_ptr<Camera> camera;
 	std::vector<std::shared_ptr<Entity>> entities;
 
+	// Fixed timestep simulation: entities step at the clock's rate, and each
+	// frame draws them blended between their last two steps
+	struct SimulationState
+	{
+		DirectX::XMFLOAT3 position;
+		DirectX::XMFLOAT3 pitchYawRoll;
+		DirectX::XMFLOAT4 rotation;
+		DirectX::XMFLOAT3 scale;
+	};
+	SimulationClock simulationClock;
+	std::vector<SimulationState> previousSimulation;	// One per entity
+	std::vector<SimulationState> currentSimulation;
+	std::vector<unsigned int> animatedEntities;		// Indices of the entities that move, the rest never do
+	void ResetSimulationState();
+	void Simulate(float step);
+	void InterpolateEntities(float alpha);
+
+	// Steps with the rest of the simulation, on the async compute queue.
+	// Update() decides how many steps, Draw() records them.
+	FluidSolver fluidSolver;
+	unsigned int fluidSteps;	// This frame
+	double fluidStepTime;		// Simulated time at the first of them
+	void DrawFluidWindow();
+
+	// Groups entities into instanced draws each frame
+	RenderQueue renderQueue;
+
+	// Per-thread command lists for recording the draws in parallel
+	CommandListPool commandListPool;
+	std::vector<D3D12_GPU_DESCRIPTOR_HANDLE> batchConstantBuffers; // Pixel shader cbuffer for each batch this frame
+
+	// Depth prepass, turned on and off by how much overdraw there is
+	OverdrawEstimator overdrawEstimator;
+	std::vector<unsigned char> batchInPrepass; // Was this batch drawn in this frame's prepass?
+
+	// Hi-Z occlusion culling, drawn in two phases through indirect draws
+	OcclusionCuller occlusionCuller;
+	OcclusionMode occlusionMode;
+
+	// Software occlusion, run as a job from Update() and waited on in Draw()
+	SoftwareOcclusion softwareOcclusion;
+	JobCounter softwareOcclusionCounter;
+	bool softwareOcclusionPending;
+	SoftwareOcclusionStats softwareOcclusionStats; // Copied out once the job's done
+	DirectX::XMFLOAT4X4 occlusionViewProj;
+	DirectX::XMFLOAT3 occlusionEye;
+	std::vector<OcclusionSphere> occlusionSpheres;	// World space bounds per entity
+	std::vector<float> occluderScores;				// How good an occluder each entity would make
+	std::vector<unsigned char> entityVisible;
+	std::vector<std::shared_ptr<Entity>> visibleEntities;
+	void RunSoftwareOcclusion();
+
+	// Rebuilt every frame, handles the transitions between passes
+	RenderGraph renderGraph;
+	RenderGraphExecutor renderGraphExecutor;
+
+	// Timings for the performance window: every graph pass on the
+	// GPU, and the main stages of the frame on the CPU
+	enum CpuStage
+	{
+		CPU_STAGE_UPDATE,
+		CPU_STAGE_UI,
+		CPU_STAGE_QUEUE,	// Occlusion wait, sorting and batching
+		CPU_STAGE_RECORD,	// Uploads and command list recording
+		CPU_STAGE_SUBMIT,	// Execute and present
+		CPU_STAGE_COUNT
+	};
+	GpuProfiler gpuProfiler;
+	TimingHistory cpuStageTimes[CPU_STAGE_COUNT];
+	unsigned int submittedTriangles; // Last frame, before any GPU culling
+	bool showPerformanceWindow;
+	void DrawPerformanceWindow();
+
+	// Frames per CPU trace capture
+	int cpuCaptureFrames;
+	void RequestCpuCapture();
+
+	// Frames per command trace capture (see TracedCommandList.h)
+	int commandTraceFrames;
+	void RequestCommandTrace(const std::string& path);
+
+	// Headless benchmark run (--benchmark): seeded scene, scripted
+	// camera, fixed timestep, results written out as JSON at the end
+	enum BenchmarkState
+	{
+		BENCHMARK_WARMING_UP,
+		BENCHMARK_MEASURING,
+		BENCHMARK_DONE
+	};
+	BenchmarkSettings benchmark;
+	BenchmarkReport benchmarkReport;
+	BenchmarkState benchmarkState;
+	unsigned int benchmarkFrame;	// Frames run so far, warm up included
+	float benchmarkExtent;			// Half the scene's size
+	double benchmarkTriangles;		// Totals over the measured frames
+	double benchmarkDrawCalls;
+	std::chrono::high_resolution_clock::time_point benchmarkFrameEnd;
+	void EndBenchmarkFrame();
+	void FinishBenchmark();
+
 	//ImGui Init data
 	static int const NUM_FRAMES_IN_FLIGHT = 3;
 	bool showDemoWindow;
@@ -0,0 +1,213 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <cstring>
+
+// --------------------------------------------------------
+// TimingHistory
+// --------------------------------------------------------
+TimingHistory::TimingHistory() :
+	count(0),
+	next(0)
+{
+	memset(samples, 0, sizeof(samples));
+}
+
+void TimingHistory::Add(float ms)
+{
+	samples[next] = ms;
+	next = (next + 1) % historySize;
+	if (count < historySize)
+		count++;
+}
+
+TimingSummary TimingHistory::GetSummary() const
+{
+	TimingSummary summary = {};
+	summary.sampleCount = count;
+	if (count == 0)
+		return summary;
+
+	summary.last = samples[(next + historySize - 1) % historySize];
+
+	// Sorted copy, for the percentile
+	float sorted[historySize];
+	memcpy(sorted, samples, sizeof(float) * count);
+	std::sort(sorted, sorted + count);
+
+	float total = 0.0f;
+	for (unsigned int i = 0; i < count; i++)
+		total += sorted[i];
+
+	summary.min = sorted[0];
+	summary.max = sorted[count - 1];
+	summary.average = total / count;
+	summary.p99 = sorted[(count * 99) / 100 < count ? (count * 99) / 100 : count - 1];
+	return summary;
+}
+
+// --------------------------------------------------------
+// GpuProfiler
+// --------------------------------------------------------
+GpuProfiler::GpuProfiler() :
+	readbackData(0),
+	frequency(1),
+	currentSlot(0),
+	scopeCount(0)
+{
+	memset(&memoryInfo, 0, sizeof(memoryInfo));
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	if (readbackBuffer && readbackData)
+		readbackBuffer->Unmap(0, 0);
+}
+
+void GpuProfiler::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, ID3D12CommandQueue* queue, unsigned int framesInFlight)
+{
+	slots.assign(framesInFlight, FrameSlot());
+	for (auto& slot : slots)
+	{
+		slot.scopeHistories.resize(maxScopes);
+		slot.resolvedCount = 0;
+	}
+
+	queue->GetTimestampFrequency(&frequency);
+
+	D3D12_QUERY_HEAP_DESC heapDesc = {};
+	heapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	heapDesc.Count = queriesPerFrame * framesInFlight;
+	device->CreateQueryHeap(&heapDesc, IID_PPV_ARGS(queryHeap.GetAddressOf()));
+
+	// One UINT64 per timestamp, read on the CPU
+	D3D12_HEAP_PROPERTIES heapProps = {};
+	heapProps.Type = D3D12_HEAP_TYPE_READBACK;
+	heapProps.CreationNodeMask = 1;
+	heapProps.VisibleNodeMask = 1;
+
+	D3D12_RESOURCE_DESC desc = {};
+	desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+	desc.Width = sizeof(UINT64) * heapDesc.Count;
+	desc.Height = 1;
+	desc.DepthOrArraySize = 1;
+	desc.MipLevels = 1;
+	desc.Format = DXGI_FORMAT_UNKNOWN;
+	desc.SampleDesc.Count = 1;
+	desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+
+	device->CreateCommittedResource(
+		&heapProps,
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		D3D12_RESOURCE_STATE_COPY_DEST, // Readback buffers never leave this state
+		0,
+		IID_PPV_ARGS(readbackBuffer.GetAddressOf()));
+
+	readbackBuffer->Map(0, 0, (void**)&readbackData);
+
+	// The adapter the device was made on, for its memory budget
+	Microsoft::WRL::ComPtr<IDXGIFactory4> factory;
+	if (SUCCEEDED(CreateDXGIFactory1(IID_PPV_ARGS(factory.GetAddressOf()))))
+		factory->EnumAdapterByLuid(device->GetAdapterLuid(), IID_PPV_ARGS(adapter.GetAddressOf()));
+}
+
+void GpuProfiler::BeginFrame(unsigned int frameIndex)
+{
+	currentSlot = frameIndex % slots.size();
+	FrameSlot& slot = slots[currentSlot];
+
+	// Last time's timestamps for this slot
+	const UINT64* results = readbackData + currentSlot * queriesPerFrame;
+	latestSamples.clear();
+	for (unsigned int i = 0; i < slot.resolvedCount; i++)
+	{
+		UINT64 begin = results[i * 2];
+		UINT64 end = results[i * 2 + 1];
+		if (end < begin)
+			continue;
+
+		float ms = (float)((double)(end - begin) * 1000.0 / (double)frequency);
+		histories[slot.scopeHistories[i]].history.Add(ms);
+		latestSamples.push_back({ slot.scopeHistories[i], ms });
+	}
+	slot.resolvedCount = 0;
+	scopeCount = 0;
+
+	if (adapter)
+	{
+		DXGI_QUERY_VIDEO_MEMORY_INFO local = {};
+		DXGI_QUERY_VIDEO_MEMORY_INFO nonLocal = {};
+		adapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &local);
+		adapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_NON_LOCAL, &nonLocal);
+		memoryInfo.localUsage = local.CurrentUsage;
+		memoryInfo.localBudget = local.Budget;
+		memoryInfo.nonLocalUsage = nonLocal.CurrentUsage;
+		memoryInfo.nonLocalBudget = nonLocal.Budget;
+	}
+}
+
+int GpuProfiler::BeginScope(ID3D12GraphicsCommandList* commandList, const char* name)
+{
+	if (scopeCount >= maxScopes)
+		return -1;
+
+	unsigned int scope = scopeCount++;
+	slots[currentSlot].scopeHistories[scope] = FindHistory(name);
+	commandList->EndQuery(queryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, currentSlot * queriesPerFrame + scope * 2);
+	return (int)scope;
+}
+
+void GpuProfiler::EndScope(ID3D12GraphicsCommandList* commandList, int scope)
+{
+	if (scope >= 0)
+		commandList->EndQuery(queryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, currentSlot * queriesPerFrame + scope * 2 + 1);
+}
+
+void GpuProfiler::Resolve(ID3D12GraphicsCommandList* commandList)
+{
+	FrameSlot& slot = slots[currentSlot];
+	slot.resolvedCount = scopeCount;
+	if (scopeCount == 0)
+		return;
+
+	unsigned int first = currentSlot * queriesPerFrame;
+	commandList->ResolveQueryData(queryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP,
+		first, scopeCount * 2, readbackBuffer.Get(), first * sizeof(UINT64));
+}
+
+std::vector<GpuScopeTiming> GpuProfiler::GetScopeTimings() const
+{
+	std::vector<GpuScopeTiming> timings(histories.size());
+	for (size_t i = 0; i < histories.size(); i++)
+	{
+		timings[i].name = histories[i].name;
+		timings[i].timing = histories[i].history.GetSummary();
+	}
+	return timings;
+}
+
+std::string GpuProfiler::GetAdapterName()
+{
+	DXGI_ADAPTER_DESC desc = {};
+	if (!adapter || FAILED(adapter->GetDesc(&desc)))
+		return "Unknown";
+
+	char name[256] = {};
+	WideCharToMultiByte(CP_UTF8, 0, desc.Description, -1, name, sizeof(name) - 1, 0, 0);
+	return name;
+}
+
+unsigned int GpuProfiler::FindHistory(const char* name)
+{
+	// Only ever a few dozen, a linear search is plenty
+	for (size_t i = 0; i < histories.size(); i++)
+	{
+		if (histories[i].name == name)
+			return (unsigned int)i;
+	}
+
+	histories.push_back(NamedHistory());
+	histories.back().name = name;
+	return (unsigned int)histories.size() - 1;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <d3d12.h>
+#include <dxgi1_4.h>
+#include <wrl/client.h>
+#include <string>
+#include <vector>
+
+// Sum-up of the last few hundred samples of some timing, in milliseconds
+struct TimingSummary
+{
+	float last;
+	float min;
+	float average;
+	float max;
+	float p99;
+	unsigned int sampleCount;
+};
+
+// --------------------------------------------------------
+// Keeps the last historySize samples of one timing around
+// so min/avg/max/p99 cover a window of recent frames
+// rather than the whole run.
+// --------------------------------------------------------
+class TimingHistory
+{
+public:
+	TimingHistory();
+
+	void Add(float ms);
+	TimingSummary GetSummary() const;
+	float GetLast() const { return count ? samples[(next + historySize - 1) % historySize] : 0.0f; }
+
+private:
+	static const unsigned int historySize = 240;
+	float samples[historySize];
+	unsigned int count;
+	unsigned int next;
+};
+
+// One pass's (or any other scope's) GPU time
+struct GpuScopeTiming
+{
+	std::string name;
+	TimingSummary timing;
+};
+
+// A single timing picked up by BeginFrame()
+struct GpuScopeSample
+{
+	unsigned int scope; // Same order as GetScopeTimings()
+	float ms;
+};
+
+// Video memory from DXGI, in bytes
+struct GpuMemoryInfo
+{
+	UINT64 localUsage;
+	UINT64 localBudget;
+	UINT64 nonLocalUsage;
+	UINT64 nonLocalBudget;
+};
+
+// --------------------------------------------------------
+// Times chunks of GPU work with timestamp queries.
+//
+// BeginScope()/EndScope() put a timestamp on either side of
+// whatever gets recorded in between - in the same list or
+// in lists submitted after it on the same queue. Scopes can
+// nest. Every frame slot has its own range of queries and
+// its own part of the readback buffer, so results are picked
+// up when the slot comes around again and nothing waits.
+//
+// Scopes are matched up across frames by name, each keeping
+// a history of its own.
+// --------------------------------------------------------
+class GpuProfiler
+{
+public:
+	GpuProfiler();
+	~GpuProfiler();
+
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, ID3D12CommandQueue* queue, unsigned int framesInFlight);
+
+	// Picks up this slot's timestamps from last time (the GPU has to be done with it)
+	void BeginFrame(unsigned int frameIndex);
+
+	// Main thread only. Returns the scope for EndScope(), or -1 once
+	// this frame runs out of queries.
+	int BeginScope(ID3D12GraphicsCommandList* commandList, const char* name);
+	void EndScope(ID3D12GraphicsCommandList* commandList, int scope);
+
+	// Copies this frame's timestamps to the readback buffer.
+	// Has to be recorded after every EndScope() of the frame.
+	void Resolve(ID3D12GraphicsCommandList* commandList);
+
+	// Every scope seen so far, in the order they first showed up
+	std::vector<GpuScopeTiming> GetScopeTimings() const;
+	const GpuMemoryInfo& GetMemoryInfo() { return memoryInfo; }
+
+	// Every timing the last BeginFrame() picked up, for anything
+	// that wants all of them rather than a recent summary
+	const std::vector<GpuScopeSample>& GetLatestSamples() const { return latestSamples; }
+	const std::string& GetScopeName(unsigned int scope) const { return histories[scope].name; }
+
+	// What DXGI calls the adapter the device is on
+	std::string GetAdapterName();
+
+private:
+	static const unsigned int maxScopes = 64; // Per frame
+	static const unsigned int queriesPerFrame = maxScopes * 2;
+
+	Microsoft::WRL::ComPtr<ID3D12QueryHeap> queryHeap;
+	Microsoft::WRL::ComPtr<ID3D12Resource> readbackBuffer;
+	UINT64* readbackData; // Stays mapped
+	UINT64 frequency;	  // Ticks per second
+
+	// What each slot's scopes were, so its results make sense later
+	struct FrameSlot
+	{
+		std::vector<unsigned int> scopeHistories; // Index into histories, per scope
+		unsigned int resolvedCount;
+	};
+	std::vector<FrameSlot> slots;
+	unsigned int currentSlot;
+	unsigned int scopeCount; // This frame so far
+
+	struct NamedHistory
+	{
+		std::string name;
+		TimingHistory history;
+	};
+	std::vector<NamedHistory> histories;
+	std::vector<GpuScopeSample> latestSamples;
+
+	// For the memory numbers
+	Microsoft::WRL::ComPtr<IDXGIAdapter3> adapter;
+	GpuMemoryInfo memoryInfo;
+
+	unsigned int FindHistory(const char* name);
+};
@@ -0,0 +1,194 @@
+#include "GpuQueues.h"
+#include "CpuProfiler.h"
+#include "TracedCommandList.h"
+
+//Singleton requirement
+GpuQueues* GpuQueues::instance;
+
+GpuQueues::~GpuQueues()
+{
+	for (Queue& q : queues)
+	{
+		if (q.fenceEvent)
+			CloseHandle(q.fenceEvent);
+	}
+}
+
+HRESULT GpuQueues::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, unsigned int framesInFlight)
+{
+	this->device = device;
+	this->framesInFlight = framesInFlight;
+	currentFrame = 0;
+
+	const D3D12_COMMAND_LIST_TYPE types[GPU_QUEUE_COUNT] =
+	{
+		D3D12_COMMAND_LIST_TYPE_DIRECT,
+		D3D12_COMMAND_LIST_TYPE_COMPUTE,
+		D3D12_COMMAND_LIST_TYPE_COPY
+	};
+	const wchar_t* names[GPU_QUEUE_COUNT] = { L"Direct queue", L"Compute queue", L"Copy queue" };
+
+	for (int i = 0; i < GPU_QUEUE_COUNT; i++)
+	{
+		Queue& q = queues[i];
+		q.type = types[i];
+
+		D3D12_COMMAND_QUEUE_DESC qDesc = {};
+		qDesc.Type = q.type;
+		qDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+		HRESULT hr = device->CreateCommandQueue(&qDesc, IID_PPV_ARGS(q.queue.ReleaseAndGetAddressOf()));
+		if (FAILED(hr)) return hr;
+		q.queue->SetName(names[i]);
+
+		hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(q.fence.ReleaseAndGetAddressOf()));
+		if (FAILED(hr)) return hr;
+		if (!q.fenceEvent)
+			q.fenceEvent = CreateEventEx(0, 0, 0, EVENT_ALL_ACCESS);
+		q.lastSignaled = 0;
+
+		// Lists get made the first time a frame needs them
+		q.allocators.clear();
+		q.allocators.resize(framesInFlight);
+		q.lists.clear();
+		q.listsUsed = 0;
+		q.frameValues.assign(framesInFlight, 0);
+		q.stats = {};
+		q.lastFrameStats = {};
+	}
+
+	return S_OK;
+}
+
+void GpuQueues::BeginFrame(unsigned int frameIndex)
+{
+	currentFrame = frameIndex % framesInFlight;
+
+	for (int i = 0; i < GPU_QUEUE_COUNT; i++)
+	{
+		// Allocators can't be reset while the GPU might still be using them
+		Queue& q = queues[i];
+		WaitOnCpu({ (GpuQueueType)i, q.frameValues[currentFrame] });
+
+		for (auto& allocator : q.allocators[currentFrame])
+			allocator->Reset();
+		q.listsUsed = 0;
+
+		q.lastFrameStats = q.stats;
+		q.stats = {};
+	}
+}
+
+ID3D12GraphicsCommandList* GpuQueues::OpenList(GpuQueueType type)
+{
+	Queue& q = queues[type];
+	unsigned int index = q.listsUsed++;
+
+	// One more allocator for every frame, and the list to go with them
+	if (index >= q.lists.size())
+	{
+		for (unsigned int f = 0; f < framesInFlight; f++)
+		{
+			q.allocators[f].emplace_back();
+			device->CreateCommandAllocator(q.type, IID_PPV_ARGS(q.allocators[f].back().GetAddressOf()));
+		}
+
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> list;
+		device->CreateCommandList(0, q.type, q.allocators[currentFrame][index].Get(), 0, IID_PPV_ARGS(list.GetAddressOf()));
+		list->Close();
+		CommandTracer::GetInstance().Wrap(list);
+		q.lists.push_back(list);
+	}
+
+	ID3D12GraphicsCommandList* list = q.lists[index].Get();
+	list->Reset(q.allocators[currentFrame][index].Get(), 0);
+	return list;
+}
+
+GpuSyncPoint GpuQueues::Submit(
+	GpuQueueType type,
+	ID3D12CommandList* const* lists,
+	unsigned int listCount,
+	const GpuSyncPoint* dependencies,
+	unsigned int dependencyCount)
+{
+	PROFILE_FUNCTION();
+	Queue& q = queues[type];
+
+	for (unsigned int i = 0; i < dependencyCount; i++)
+		Wait(type, dependencies[i]);
+
+	if (listCount > 0)
+	{
+		// Traced lists hand over what they recorded, and the runtime gets the real ones
+		std::vector<ID3D12CommandList*> submitted(lists, lists + listCount);
+		CommandTracer::GetInstance().Submit(submitted);
+		q.queue->ExecuteCommandLists((UINT)submitted.size(), submitted.data());
+
+		q.stats.submits++;
+		q.stats.lists += listCount;
+	}
+
+	// Whatever this frame's allocators hold is in flight until here
+	GpuSyncPoint point = Signal(type);
+	q.frameValues[currentFrame] = point.value;
+	return point;
+}
+
+GpuSyncPoint GpuQueues::Submit(GpuQueueType type, ID3D12CommandList* list, GpuSyncPoint dependency)
+{
+	return Submit(type, &list, 1, &dependency, 1);
+}
+
+GpuSyncPoint GpuQueues::Signal(GpuQueueType type)
+{
+	Queue& q = queues[type];
+	q.lastSignaled++;
+	q.queue->Signal(q.fence.Get(), q.lastSignaled);
+	return { type, q.lastSignaled };
+}
+
+void GpuQueues::Wait(GpuQueueType type, GpuSyncPoint point)
+{
+	// Same queue is already in order, and 0 is always reached
+	if (point.value == 0 || point.queue == type)
+		return;
+
+	queues[type].queue->Wait(queues[point.queue].fence.Get(), point.value);
+	queues[type].stats.waits++;
+}
+
+bool GpuQueues::IsComplete(GpuSyncPoint point)
+{
+	return point.value == 0 || queues[point.queue].fence->GetCompletedValue() >= point.value;
+}
+
+void GpuQueues::WaitOnCpu(GpuSyncPoint point)
+{
+	if (IsComplete(point))
+		return;
+
+	PROFILE_SCOPE("GPU queue wait");
+	Queue& q = queues[point.queue];
+	q.fence->SetEventOnCompletion(point.value, q.fenceEvent);
+	WaitForSingleObject(q.fenceEvent, INFINITE);
+}
+
+void GpuQueues::WaitForIdle()
+{
+	for (int i = 0; i < GPU_QUEUE_COUNT; i++)
+	{
+		if (queues[i].queue)
+			WaitOnCpu(Signal((GpuQueueType)i));
+	}
+}
+
+const char* GpuQueues::GetName(GpuQueueType type)
+{
+	switch (type)
+	{
+	case GPU_QUEUE_DIRECT: return "Direct";
+	case GPU_QUEUE_COMPUTE: return "Compute";
+	case GPU_QUEUE_COPY: return "Copy";
+	default: return "?";
+	}
+}
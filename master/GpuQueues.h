@@ -0,0 +1,149 @@
+#pragma once
+
+#include <d3d12.h>
+#include <wrl/client.h>
+#include <vector>
+
+// Which queue work goes to
+enum GpuQueueType
+{
+	GPU_QUEUE_DIRECT,	// Anything - the one that draws and presents
+	GPU_QUEUE_COMPUTE,	// Dispatches (and copies), alongside the direct queue
+	GPU_QUEUE_COPY,		// Copies only, on the copy engine
+	GPU_QUEUE_COUNT
+};
+
+// A point on one queue's timeline: reached once everything
+// submitted to that queue up to here has finished.
+// A value of 0 is "nothing" - always reached.
+struct GpuSyncPoint
+{
+	GpuQueueType queue;
+	UINT64 value;
+};
+
+// Per queue, over a frame (BeginFrame() to BeginFrame())
+struct GpuQueueStats
+{
+	unsigned int submits;
+	unsigned int lists;
+	unsigned int waits;	// On other queues
+};
+
+// --------------------------------------------------------
+// Owns the direct, compute and copy queues, a fence for each,
+// and a pool of command lists for each.
+//
+// Every Submit() signals its queue's fence and hands back the
+// sync point for it. Anything that depends on that work - on
+// another queue - waits for it on the GPU, either by passing
+// it to Submit() as a dependency or through Wait(). The CPU
+// only blocks when it asks to (WaitOnCpu(), WaitForIdle()).
+//
+// Lists: OpenList() hands out a reset list of the queue's type
+// on this frame's allocator, to Close() and Submit() as usual.
+// A frame's allocators are only reset once everything submitted
+// from them has finished, by BeginFrame() a few frames later.
+//
+// Resources that move between queues need care: compute and
+// copy lists can't do render target or depth transitions, and
+// anything a copy queue touches goes back to COMMON when its
+// lists finish (buffers get promoted from there implicitly).
+//
+// Main thread only - lists can be recorded anywhere, but
+// opening, submitting and waiting happen on one thread.
+// --------------------------------------------------------
+class GpuQueues
+{
+#pragma region Singleton
+public:
+	// Gets the one and only instance of this class
+	static GpuQueues& GetInstance()
+	{
+		if (!instance)
+		{
+			instance = new GpuQueues();
+		}
+
+		return *instance;
+	}
+
+	// Remove these functions (C++ 11 version)
+	GpuQueues(GpuQueues const&) = delete;
+	void operator=(GpuQueues const&) = delete;
+
+private:
+	static GpuQueues* instance;
+	GpuQueues() :
+		framesInFlight(0),
+		currentFrame(0),
+		queues()
+	{ };
+#pragma endregion
+
+public:
+	~GpuQueues();
+
+	// Makes the queues, their fences and the first lists
+	HRESULT Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, unsigned int framesInFlight);
+
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> GetQueue(GpuQueueType type) { return queues[type].queue; }
+
+	// Moves to this frame's allocators, waiting for the GPU to be done with them first
+	void BeginFrame(unsigned int frameIndex);
+
+	// A list of the queue's type, reset and ready to record into
+	ID3D12GraphicsCommandList* OpenList(GpuQueueType type);
+
+	// Executes (already closed) lists once every dependency has been reached,
+	// and returns the point where they've finished. Command traces see them
+	// the same as any other submission.
+	GpuSyncPoint Submit(
+		GpuQueueType type,
+		ID3D12CommandList* const* lists,
+		unsigned int listCount,
+		const GpuSyncPoint* dependencies = 0,
+		unsigned int dependencyCount = 0);
+	GpuSyncPoint Submit(GpuQueueType type, ID3D12CommandList* list, GpuSyncPoint dependency);
+
+	// A point after everything submitted to the queue so far
+	GpuSyncPoint Signal(GpuQueueType type);
+
+	// The queue doesn't go past here (on the GPU) until point's been reached.
+	// Nothing to wait for on the same queue - queues run in order.
+	void Wait(GpuQueueType type, GpuSyncPoint point);
+
+	bool IsComplete(GpuSyncPoint point);
+	void WaitOnCpu(GpuSyncPoint point);
+
+	// Everything submitted anywhere has finished
+	void WaitForIdle();
+
+	// The last whole frame's
+	const GpuQueueStats& GetStats(GpuQueueType type) { return queues[type].lastFrameStats; }
+	static const char* GetName(GpuQueueType type);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> device;
+	unsigned int framesInFlight;
+	unsigned int currentFrame;
+
+	struct Queue
+	{
+		D3D12_COMMAND_LIST_TYPE type;
+		Microsoft::WRL::ComPtr<ID3D12CommandQueue> queue;
+		Microsoft::WRL::ComPtr<ID3D12Fence> fence;
+		HANDLE fenceEvent;
+		UINT64 lastSignaled;
+
+		// [frame][list], the lists themselves are shared between frames
+		std::vector<std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>>> allocators;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> lists;
+		unsigned int listsUsed;			// This frame
+		std::vector<UINT64> frameValues;	// [frame] Last submission from its allocators
+
+		GpuQueueStats stats;			// This frame, so far
+		GpuQueueStats lastFrameStats;
+	};
+	Queue queues[GPU_QUEUE_COUNT];
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// --------------------------------------------------------
+// 64-bit FNV-1a. Not cryptographic, just good enough to key
+// caches by content (pipelines, compiled shaders).
+// Chain calls by passing the last result back in.
+// --------------------------------------------------------
+static const uint64_t HashStart = 14695981039346656037ull;
+
+inline uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Only for types without padding, or the padding gets hashed too
+template<typename T>
+inline uint64_t HashValue(uint64_t hash, const T& value)
+{
+	return HashBytes(hash, &value, sizeof(T));
+}
@@ -0,0 +1,144 @@
+// Builds the whole Hi-Z pyramid from the depth buffer in one dispatch.
+//
+// Every group takes a 64x64 block of depth and reduces it to
+// mips 0-5 (32x32 down to 1x1) in groupshared memory. The last
+// group to finish - found with a global atomic counter - then
+// reduces mip 5 the same way into mips 6-11.
+//
+// Each texel holds the FARTHEST depth under it, so anything
+// behind that value is definitely hidden.
+//
+// Mip 0 is half the depth buffer's size, rounded up, and so is
+// every mip after it. Reads past the edge are clamped, which
+// only ever pulls in more real depths - still conservative.
+
+#define MAX_HIZ_MIPS 12
+
+cbuffer HiZConstants : register(b0)
+{
+	uint2 depthSize;
+	uint mipCount;
+	uint groupCount;
+	uint2 mip5Size;	// Also the number of groups on each axis
+	uint2 padding;
+};
+
+Texture2D<float> depthBuffer : register(t3);
+globallycoherent RWTexture2D<float> hiZMips[MAX_HIZ_MIPS] : register(u3);
+globallycoherent RWStructuredBuffer<uint> groupCounter : register(u2);
+
+groupshared float reduced[32][32];
+groupshared uint groupsDone;
+
+float Farthest(float a, float b, float c, float d)
+{
+	return max(max(a, b), max(c, d));
+}
+
+uint2 MipSize(uint mip)
+{
+	// Every mip is half the last one, rounded up
+	uint2 size = depthSize;
+	for (uint i = 0; i <= mip; i++)
+		size = (size + 1) / 2;
+	return size;
+}
+
+float LoadSource(bool fromDepth, int2 texel, uint2 sourceSize)
+{
+	texel = min(texel, int2(sourceSize) - 1);
+	return fromDepth ? depthBuffer.Load(int3(texel, 0)) : hiZMips[5][texel];
+}
+
+// Reduces a 64x64 block of the source (depth, or mip 5) into
+// firstMip and the five mips after it (as many as exist)
+void ReduceBlock(uint2 block, uint groupIndex, bool fromDepth, uint firstMip)
+{
+	uint2 sourceSize = fromDepth ? depthSize : mip5Size;
+
+	// 32x32 texels of the first mip, four per thread
+	[unroll]
+	for (uint i = 0; i < 4; i++)
+	{
+		uint index = groupIndex + i * 256;
+		uint2 local = uint2(index % 32, index / 32);
+		int2 source = int2(block * 64 + local * 2);
+
+		float value = Farthest(
+			LoadSource(fromDepth, source, sourceSize),
+			LoadSource(fromDepth, source + int2(1, 0), sourceSize),
+			LoadSource(fromDepth, source + int2(0, 1), sourceSize),
+			LoadSource(fromDepth, source + int2(1, 1), sourceSize));
+
+		uint2 texel = block * 32 + local;
+		if (all(texel < MipSize(firstMip)))
+			hiZMips[firstMip][texel] = value;
+		reduced[local.y][local.x] = value;
+	}
+
+	// The rest of the block's mips come from groupshared memory
+	for (uint level = 1; level < 6 && firstMip + level < mipCount; level++)
+	{
+		GroupMemoryBarrierWithGroupSync();
+
+		uint size = 32 >> level;
+		uint2 local = uint2(groupIndex % size, groupIndex / size);
+		bool active = groupIndex < size * size;
+
+		float value = 0;
+		if (active)
+		{
+			value = Farthest(
+				reduced[local.y * 2][local.x * 2],
+				reduced[local.y * 2][local.x * 2 + 1],
+				reduced[local.y * 2 + 1][local.x * 2],
+				reduced[local.y * 2 + 1][local.x * 2 + 1]);
+		}
+
+		// Everyone has to be done reading before anything gets overwritten
+		GroupMemoryBarrierWithGroupSync();
+
+		if (active)
+		{
+			uint mip = firstMip + level;
+			uint2 texel = block * size + local;
+			if (all(texel < MipSize(mip)))
+				hiZMips[mip][texel] = value;
+			reduced[local.y][local.x] = value;
+		}
+	}
+}
+
+[numthreads(256, 1, 1)]
+void main(uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+	ReduceBlock(groupID.xy, groupIndex, true, 0);
+	if (mipCount <= 6)
+		return;
+
+	// Mip 5 writes have to be visible to whichever group goes last
+	AllMemoryBarrier();
+	if (groupIndex == 0)
+	{
+		uint previous;
+		InterlockedAdd(groupCounter[0], 1, previous);
+		groupsDone = previous;
+	}
+	GroupMemoryBarrierWithGroupSync();
+	if (groupsDone != groupCount - 1)
+		return;
+
+	// Last one here: every other group's mip 5 is in
+	for (uint y = 0; y < (mip5Size.y + 63) / 64; y++)
+	{
+		for (uint x = 0; x < (mip5Size.x + 63) / 64; x++)
+		{
+			GroupMemoryBarrierWithGroupSync();
+			ReduceBlock(uint2(x, y), groupIndex, false, 6);
+		}
+	}
+
+	// Ready for next frame
+	if (groupIndex == 0)
+		groupCounter[0] = 0;
+}
@@ -61,6 +61,7 @@ Input* Input::instance;
 // --------------------------
 Input::~Input()
 {
+	recorder.Close();
 	delete[] kbState;
 	delete[] prevKbState;
 }
@@ -95,10 +96,39 @@ void Input::Initialize(HWND windowHandle)
 // ----------------------------------------------------------
 void Input::Update()
 {
+	// Replays ignore the real keyboard and mouse (and ImGui) entirely -
+	// whatever ImGui let through was already baked into the recording
+	if (replaying)
+	{
+		memcpy(prevKbState, kbState, sizeof(unsigned char) * 256);
+		prevMouseX = mouseX;
+		prevMouseY = mouseY;
+
+		InputFrame frame;
+		if (player.Read(&frame))
+		{
+			memcpy(kbState, frame.keys, sizeof(unsigned char) * 256);
+			mouseX = frame.mouseX;
+			mouseY = frame.mouseY;
+			wheelDelta = frame.wheel;
+			frameDeltaTime = frame.deltaTime;
+		}
+		mouseXDelta = mouseX - prevMouseX;
+		mouseYDelta = mouseY - prevMouseY;
+		return;
+	}
+
 	if (ImGui::GetIO().WantCaptureMouse || ImGui::GetIO().WantCaptureKeyboard)
 	{
 		ImGui::CaptureMouseFromApp();
 		ImGui::CaptureKeyboardFromApp();
+
+		// The UI has the input, so as far as the game's concerned nothing's
+		// pressed and nothing's moving (instead of last frame's state sticking)
+		memcpy(prevKbState, kbState, sizeof(unsigned char) * 256);
+		memset(kbState, 0, sizeof(unsigned char) * 256);
+		mouseXDelta = 0;
+		mouseYDelta = 0;
 	}
 	else 
 	{
@@ -134,10 +164,81 @@ void Input::Update()
 // ----------------------------------------------------------
 void Input::EndOfFrame()
 {
+	// The frame's done, so everything it saw can go in the recording
+	if (recorder.IsOpen())
+	{
+		InputFrame frame;
+		frame.deltaTime = frameDeltaTime;
+		memcpy(frame.keys, kbState, sizeof(unsigned char) * 256);
+		frame.mouseX = mouseX;
+		frame.mouseY = mouseY;
+		frame.wheel = wheelDelta;
+		recorder.Write(frame);
+	}
+
 	// Reset wheel value
 	wheelDelta = 0;
 }
 
+// ----------------------------------------------------------
+//  Starts writing every frame's input to the given file
+//  (replacing it). Returns false if it can't be opened.
+// ----------------------------------------------------------
+bool Input::StartRecording(const std::string& path)
+{
+	if (!recorder.Open(path))
+		return false;
+
+	sessionTime = 0;
+	return true;
+}
+
+// ----------------------------------------------------------
+//  Finishes the recording and closes the file
+// ----------------------------------------------------------
+void Input::StopRecording()
+{
+	recorder.Close();
+}
+
+// ----------------------------------------------------------
+//  Loads a recording and plays it back from the next frame
+//  on, instead of the real keyboard and mouse. Returns false
+//  if the file can't be read or isn't a recording.
+// ----------------------------------------------------------
+bool Input::StartReplay(const std::string& path)
+{
+	if (!player.Open(path))
+		return false;
+
+	// Both sides start from nothing pressed
+	replaying = true;
+	sessionTime = 0;
+	memset(kbState, 0, sizeof(unsigned char) * 256);
+	memset(prevKbState, 0, sizeof(unsigned char) * 256);
+	mouseX = 0; mouseY = 0;
+	prevMouseX = 0; prevMouseY = 0;
+	wheelDelta = 0.0f;
+	return true;
+}
+
+// ----------------------------------------------------------
+//  Swaps in (or keeps) this frame's time step - see Input.h
+// ----------------------------------------------------------
+void Input::RecordOrReplayTime(float& deltaTime, float& totalTime)
+{
+	if (!replaying && !recorder.IsOpen())
+		return;
+
+	if (replaying)
+		deltaTime = frameDeltaTime;
+	else
+		frameDeltaTime = deltaTime;
+
+	sessionTime += deltaTime;
+	totalTime = (float)sessionTime;
+}
+
 // ----------------------------------------------------------
 //  Get the mouse's current position in pixels relative
 //  to the top left corner of the window.
@@ -169,7 +270,9 @@ float Input::GetMouseWheel() { return wheelDelta; }
 // ---------------------------------------------------------------
 void Input::SetWheelDelta(float delta)
 {
-	wheelDelta = delta;
+	// The real wheel doesn't count during a replay
+	if (!replaying)
+		wheelDelta = delta;
 }
 
 
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <Windows.h>
+#include <string>
+
+#include "InputRecording.h"
 
 class Input
 {
@@ -65,6 +68,24 @@ public:
 	bool MouseMiddlePress();
 	bool MouseMiddleRelease();
 
+	// Recording and replaying whole sessions. A recording keeps every
+	// frame's keys, mouse, wheel and time step (see InputRecording.h),
+	// a replay feeds them back in place of the real thing, so the same
+	// session plays out exactly the same way again.
+	bool StartRecording(const std::string& path);
+	void StopRecording();
+	bool StartReplay(const std::string& path);
+	bool IsRecording() { return recorder.IsOpen(); }
+	bool IsReplaying() { return replaying; }
+	bool ReplayFinished() { return replaying && player.AtEnd(); }
+	unsigned int GetRecordedFrames() { return recorder.GetFrameCount(); }
+	unsigned int GetReplayedFrames() { return player.GetFrameCount(); }
+
+	// Called by DXCore each frame, after Update(), with the measured time.
+	// Recordings keep it, replays swap in the recorded one. Either way
+	// total time is the sum of the time steps, so both sides agree on it.
+	void RecordOrReplayTime(float& deltaTime, float& totalTime);
+
 private:
 	// Arrays for the current and previous key states
 	unsigned char* kbState {0};
@@ -82,5 +103,12 @@ private:
 	// The window's handle (id) from the OS, so
 	// we can get the cursor's position
 	HWND windowHandle {0};
+
+	// Session recording / replay
+	InputRecordWriter recorder;
+	InputRecordReader player;
+	bool replaying {false};
+	float frameDeltaTime {0};	// Recorded, or about to be
+	double sessionTime {0};		// Sum of the time steps so far
 };
 
@@ -0,0 +1,391 @@
+#include "InputRecording.h"
+
+#include <cstring>
+
+// "IREC" and a version, in case the layout ever changes
+static const unsigned char recordMagic[4] = { 'I', 'R', 'E', 'C' };
+static const unsigned char recordVersion = 1;
+
+// Flag bits at the start of every frame
+static const unsigned char FRAME_KEYS = 1;
+static const unsigned char FRAME_MOUSE = 2;
+static const unsigned char FRAME_WHEEL = 4;
+static const unsigned char FRAME_TIME = 8;
+
+static const size_t flushSize = 64 * 1024;
+
+// --------------------------------------------------------
+// Encoding helpers
+// --------------------------------------------------------
+static void PutVarint(std::vector<unsigned char>& out, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char)value);
+}
+
+static void PutSigned(std::vector<unsigned char>& out, int32_t value)
+{
+	// Zigzag, so small moves either way stay small
+	PutVarint(out, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static void PutFloat(std::vector<unsigned char>& out, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	for (int i = 0; i < 4; i++)
+		out.push_back((unsigned char)(bits >> (i * 8)));
+}
+
+static bool GetVarint(const std::vector<unsigned char>& in, size_t& position, uint32_t* value)
+{
+	uint32_t result = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (position >= in.size())
+			return false;
+		unsigned char byte = in[position++];
+		result |= (uint32_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			*value = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool GetSigned(const std::vector<unsigned char>& in, size_t& position, int32_t* value)
+{
+	uint32_t zigzag;
+	if (!GetVarint(in, position, &zigzag))
+		return false;
+	*value = (int32_t)((zigzag >> 1) ^ (0u - (zigzag & 1)));
+	return true;
+}
+
+static bool GetFloat(const std::vector<unsigned char>& in, size_t& position, float* value)
+{
+	if (position + 4 > in.size())
+		return false;
+	uint32_t bits = 0;
+	for (int i = 0; i < 4; i++)
+		bits |= (uint32_t)in[position++] << (i * 8);
+	memcpy(value, &bits, sizeof(bits));
+	return true;
+}
+
+// Both sides start from nothing pressed, mouse in the corner, no time step
+static void ResetFrame(InputFrame* frame)
+{
+	memset(frame, 0, sizeof(InputFrame));
+}
+
+// --------------------------------------------------------
+// Writer
+// --------------------------------------------------------
+InputRecordWriter::InputRecordWriter() :
+	file(0),
+	frameCount(0),
+	byteCount(0)
+{
+	ResetFrame(&previous);
+}
+
+InputRecordWriter::~InputRecordWriter()
+{
+	Close();
+}
+
+bool InputRecordWriter::Open(const std::string& path)
+{
+	Close();
+
+#if defined(_MSC_VER)
+	fopen_s(&file, path.c_str(), "wb");
+#else
+	file = fopen(path.c_str(), "wb");
+#endif
+	if (!file)
+		return false;
+
+	ResetFrame(&previous);
+	frameCount = 0;
+	byteCount = 0;
+	buffer.clear();
+	WriteHeader(buffer);
+	return true;
+}
+
+void InputRecordWriter::WriteHeader(std::vector<unsigned char>& out)
+{
+	out.insert(out.end(), recordMagic, recordMagic + 4);
+	out.push_back(recordVersion);
+}
+
+void InputRecordWriter::Encode(const InputFrame& previous, const InputFrame& frame, std::vector<unsigned char>& out)
+{
+	size_t flagsAt = out.size();
+	out.push_back(0);
+	unsigned char flags = 0;
+
+	unsigned int changedKeys = 0;
+	for (int i = 0; i < 256; i++)
+		changedKeys += frame.keys[i] != previous.keys[i];
+	if (changedKeys)
+	{
+		flags |= FRAME_KEYS;
+		PutVarint(out, changedKeys);
+		for (int i = 0; i < 256; i++)
+		{
+			if (frame.keys[i] != previous.keys[i])
+			{
+				out.push_back((unsigned char)i);
+				out.push_back(frame.keys[i]);
+			}
+		}
+	}
+
+	if (frame.mouseX != previous.mouseX || frame.mouseY != previous.mouseY)
+	{
+		flags |= FRAME_MOUSE;
+		PutSigned(out, frame.mouseX - previous.mouseX);
+		PutSigned(out, frame.mouseY - previous.mouseY);
+	}
+
+	// Wheel is per frame, not a state - zero unless it moved this frame
+	if (frame.wheel != 0.0f)
+	{
+		flags |= FRAME_WHEEL;
+		PutFloat(out, frame.wheel);
+	}
+
+	// Bit for bit, so replays step exactly the same times
+	if (memcmp(&frame.deltaTime, &previous.deltaTime, sizeof(float)) != 0)
+	{
+		flags |= FRAME_TIME;
+		PutFloat(out, frame.deltaTime);
+	}
+
+	out[flagsAt] = flags;
+}
+
+void InputRecordWriter::Write(const InputFrame& frame)
+{
+	if (!file)
+		return;
+
+	Encode(previous, frame, buffer);
+	previous = frame;
+	frameCount++;
+
+	if (buffer.size() >= flushSize)
+		Flush();
+}
+
+void InputRecordWriter::Flush()
+{
+	if (!file || buffer.empty())
+		return;
+
+	fwrite(buffer.data(), 1, buffer.size(), file);
+	byteCount += buffer.size();
+	buffer.clear();
+}
+
+void InputRecordWriter::Close()
+{
+	if (!file)
+		return;
+
+	Flush();
+	fclose(file);
+	file = 0;
+}
+
+// --------------------------------------------------------
+// Reader
+// --------------------------------------------------------
+InputRecordReader::InputRecordReader() :
+	position(0),
+	frameCount(0)
+{
+	ResetFrame(&previous);
+}
+
+bool InputRecordReader::Open(const std::string& path)
+{
+	FILE* file = 0;
+#if defined(_MSC_VER)
+	fopen_s(&file, path.c_str(), "rb");
+#else
+	file = fopen(path.c_str(), "rb");
+#endif
+	if (!file)
+		return false;
+
+	std::vector<unsigned char> log;
+	unsigned char chunk[4096];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		log.insert(log.end(), chunk, chunk + read);
+	fclose(file);
+
+	return Open(log);
+}
+
+bool InputRecordReader::Open(const std::vector<unsigned char>& log)
+{
+	data.clear();
+	position = 0;
+	frameCount = 0;
+	ResetFrame(&previous);
+
+	if (log.size() < 5 || memcmp(log.data(), recordMagic, 4) != 0 || log[4] != recordVersion)
+		return false;
+
+	data = log;
+	position = 5;
+	return true;
+}
+
+bool InputRecordReader::Read(InputFrame* frame)
+{
+	if (AtEnd())
+		return false;
+
+	// Work on a copy, so a damaged frame doesn't leave half of itself behind
+	size_t at = position;
+	InputFrame next = previous;
+	next.wheel = 0.0f;
+
+	unsigned char flags = data[at++];
+	if (flags & ~(FRAME_KEYS | FRAME_MOUSE | FRAME_WHEEL | FRAME_TIME))
+		return false;
+
+	if (flags & FRAME_KEYS)
+	{
+		uint32_t count;
+		if (!GetVarint(data, at, &count) || count > 256 || at + count * 2 > data.size())
+			return false;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			unsigned char key = data[at++];
+			next.keys[key] = data[at++];
+		}
+	}
+
+	if (flags & FRAME_MOUSE)
+	{
+		int32_t dx, dy;
+		if (!GetSigned(data, at, &dx) || !GetSigned(data, at, &dy))
+			return false;
+		next.mouseX += dx;
+		next.mouseY += dy;
+	}
+
+	if ((flags & FRAME_WHEEL) && !GetFloat(data, at, &next.wheel))
+		return false;
+	if ((flags & FRAME_TIME) && !GetFloat(data, at, &next.deltaTime))
+		return false;
+
+	position = at;
+	previous = next;
+	*frame = next;
+	frameCount++;
+	return true;
+}
+
+// --------------------------------------------------------
+// Self test
+// --------------------------------------------------------
+bool InputRecordReader::SelfTest(std::string* error)
+{
+	auto fail = [&](const char* message)
+	{
+		if (error) *error = message;
+		return false;
+	};
+
+	// A few hundred frames of made up but awkward input: keys held
+	// and let go, big and negative mouse moves, wheel, odd time steps
+	std::vector<InputFrame> frames;
+	InputFrame frame;
+	ResetFrame(&frame);
+	uint32_t state = 12345;
+	auto next = [&]() { state = state * 1664525u + 1013904223u; return state >> 8; };
+	for (int i = 0; i < 500; i++)
+	{
+		if (next() % 4 == 0)
+			frame.keys[next() % 256] ^= 0x80;
+		if (next() % 8 == 0)
+			frame.keys[next() % 256] ^= 0x01; // Toggle bit (caps lock and friends)
+		if (next() % 3 == 0)
+		{
+			frame.mouseX += (int)(next() % 2001) - 1000;
+			frame.mouseY += (int)(next() % 200001) - 100000;
+		}
+		frame.wheel = next() % 10 == 0 ? ((int)(next() % 5) - 2) * 1.0f : 0.0f;
+		if (next() % 5 == 0)
+			frame.deltaTime = (next() % 100000) / 1.0e6f;
+		frames.push_back(frame);
+	}
+
+	std::vector<unsigned char> log;
+	InputRecordWriter::WriteHeader(log);
+	InputFrame previousFrame;
+	ResetFrame(&previousFrame);
+	for (const InputFrame& f : frames)
+	{
+		InputRecordWriter::Encode(previousFrame, f, log);
+		previousFrame = f;
+	}
+
+	InputRecordReader reader;
+	if (!reader.Open(log))
+		return fail("Couldn't open a log it just wrote");
+
+	for (const InputFrame& expected : frames)
+	{
+		InputFrame actual;
+		if (!reader.Read(&actual))
+			return fail("Log ended early");
+		if (memcmp(&actual, &expected, sizeof(InputFrame)) != 0)
+			return fail("Frame read back differently");
+	}
+	if (!reader.AtEnd() || reader.GetFrameCount() != frames.size())
+		return fail("Log didn't end where it should");
+
+	// An idle frame at the same time step costs one byte
+	{
+		std::vector<unsigned char> idle;
+		InputRecordWriter::Encode(frames.back(), frames.back(), idle);
+		if (idle.size() != 1 && frames.back().wheel == 0.0f)
+			return fail("Idle frame isn't a single byte");
+	}
+
+	// Truncated or foreign data fails cleanly
+	{
+		InputRecordReader truncated;
+		std::vector<unsigned char> cut(log.begin(), log.begin() + log.size() - 1);
+		if (!truncated.Open(cut))
+			return fail("Couldn't open a truncated log");
+		InputFrame ignored;
+		unsigned int readCount = 0;
+		while (truncated.Read(&ignored))
+			readCount++;
+		if (readCount >= frames.size())
+			return fail("Read past the end of a truncated log");
+
+		InputRecordReader foreign;
+		std::vector<unsigned char> junk(64, 0xFF);
+		if (foreign.Open(junk))
+			return fail("Opened something that isn't a log");
+	}
+
+	return true;
+}
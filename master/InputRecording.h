@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Everything Input knows about one frame, plus how long it was
+struct InputFrame
+{
+	float deltaTime;
+	unsigned char keys[256];	// As from GetKeyboardState (0x80 = down)
+	int mouseX;					// Relative to the window
+	int mouseY;
+	float wheel;
+};
+
+// --------------------------------------------------------
+// Writes frames out to a compact binary log. Each frame is
+// stored as the difference from the one before:
+//
+//  flags byte    which of the parts below are there
+//  keys          varint count, then (key, state) byte pairs
+//  mouse         zigzag varint x and y movement
+//  wheel         float, only when it moved
+//  time step     float, only when it changed
+//
+// so a frame where nothing happens at a fixed time step is a
+// single byte, and a typical one is a handful. Written in
+// chunks, not every frame.
+// --------------------------------------------------------
+class InputRecordWriter
+{
+public:
+	InputRecordWriter();
+	~InputRecordWriter();
+
+	bool Open(const std::string& path);
+	void Write(const InputFrame& frame);
+	void Close();
+
+	bool IsOpen() const { return file != 0; }
+	unsigned int GetFrameCount() const { return frameCount; }
+	uint64_t GetByteCount() const { return byteCount; }
+
+	// The log's first bytes, then one frame as it's stored
+	static void WriteHeader(std::vector<unsigned char>& out);
+	static void Encode(const InputFrame& previous, const InputFrame& frame, std::vector<unsigned char>& out);
+
+private:
+	FILE* file;
+	std::vector<unsigned char> buffer;
+	InputFrame previous;
+	unsigned int frameCount;
+	uint64_t byteCount;
+
+	void Flush();
+};
+
+// Reads a log back, one frame at a time
+class InputRecordReader
+{
+public:
+	InputRecordReader();
+
+	bool Open(const std::string& path);
+	bool Open(const std::vector<unsigned char>& log);
+
+	// False once there's nothing left (or the rest is damaged)
+	bool Read(InputFrame* frame);
+	bool AtEnd() const { return position >= data.size(); }
+
+	unsigned int GetFrameCount() const { return frameCount; }
+
+	// Writes a log into memory and reads it back, checking
+	// every frame comes out exactly as it went in
+	static bool SelfTest(std::string* error);
+
+private:
+	std::vector<unsigned char> data;
+	size_t position;
+	InputFrame previous;
+	unsigned int frameCount;
+};
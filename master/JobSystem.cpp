@@ -0,0 +1,500 @@
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+
+#include <cassert>
+
+//Singleton requirement
+JobSystem* JobSystem::instance;
+
+// Which worker this thread is, ~0u for threads we don't own
+static thread_local unsigned int currentWorkerIndex = ~0u;
+
+// --------------------------------------------------------
+// Deque
+// --------------------------------------------------------
+bool JobDeque::Push(Job* job)
+{
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= (int64_t)capacity)
+		return false;
+
+	// Release on bottom pairs with the acquire in Steal(), so a thief
+	// that sees the new bottom also sees the job (and what's in it)
+	jobs[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+	bottom.store(b + 1, std::memory_order_release);
+	return true;
+}
+
+Job* JobDeque::Pop()
+{
+	int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		// Empty, put bottom back
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = jobs[b & (capacity - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		// Last job - race any thieves for it
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			job = nullptr;
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+Job* JobDeque::Steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return nullptr;
+
+	Job* job = jobs[t & (capacity - 1)].load(std::memory_order_relaxed);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr; // Someone else got it first
+	return job;
+}
+
+// --------------------------------------------------------
+// Job system
+// --------------------------------------------------------
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		shuttingDown = true;
+	}
+	wakeUp.notify_all();
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	for (Worker* worker : workers)
+		delete worker;
+	for (Job* job : externalJobs)
+		delete job;
+}
+
+void JobSystem::Initialize(unsigned int workerCount)
+{
+	if (workerCount == 0)
+	{
+		workerCount = std::thread::hardware_concurrency();
+		if (workerCount == 0) workerCount = 1;
+	}
+	this->workerCount = workerCount;
+
+	for (unsigned int i = 0; i < workerCount; i++)
+	{
+		workers.push_back(new Worker());
+		workers[i]->randomState = i * 7919 + 1;
+	}
+	workerStats.resize(workerCount);
+	statsWindowStart = std::chrono::high_resolution_clock::now();
+
+	// The calling thread is worker 0
+	currentWorkerIndex = 0;
+	PROFILE_THREAD("Main");
+	for (unsigned int i = 1; i < workerCount; i++)
+	{
+		threads.push_back(std::thread(&JobSystem::WorkerLoop, this, i));
+	}
+}
+
+unsigned int JobSystem::GetCurrentWorkerIndex()
+{
+	return currentWorkerIndex;
+}
+
+Job* JobSystem::AllocateJob(unsigned int workerIndex)
+{
+	// Not one of ours - the rings are single producer, so it gets its own
+	if (workerIndex >= workerCount)
+	{
+		Job* job = new Job();
+		job->live.store(true, std::memory_order_relaxed);
+		return job;
+	}
+
+	// Still queued or running? Don't stomp on it, make a new one instead
+	// (waiting for it could deadlock, if it's parked on a dependency)
+	Worker* worker = workers[workerIndex];
+	Job* job = &worker->jobPool[worker->nextJob & (Worker::jobPoolSize - 1)];
+	worker->nextJob++;
+	if (job->live.load(std::memory_order_acquire))
+		job = new Job();
+	else
+		job->pooled = true;
+
+	job->live.store(true, std::memory_order_relaxed);
+	return job;
+}
+
+void JobSystem::PushJob(unsigned int workerIndex, Job* job)
+{
+	// Other threads can't touch the deques, they go through the shared queue
+	if (workerIndex >= workerCount)
+	{
+		std::lock_guard<std::mutex> lock(externalMutex);
+		externalJobs.push_back(job);
+		externalJobCount.fetch_add(1, std::memory_order_release);
+	}
+	// Deque full? Just do it now rather than losing it
+	else if (!workers[workerIndex]->deque.Push(job))
+	{
+		Execute(workerIndex, job, false);
+		return;
+	}
+
+	queuedJobs.fetch_add(1, std::memory_order_release);
+	if (sleepingWorkers.load(std::memory_order_acquire) > 0)
+		wakeUp.notify_one();
+}
+
+void JobSystem::Schedule(const JobFunction& function, JobCounter* counter, JobCounter* dependency)
+{
+	assert(workerCount > 0 && "JobSystem::Initialize() hasn't been called");
+	unsigned int workerIndex = currentWorkerIndex;
+
+	Job* job = AllocateJob(workerIndex);
+	job->function = function;
+	job->counter = counter;
+	if (counter)
+		counter->value.fetch_add(1, std::memory_order_acq_rel);
+
+	// Not ready yet? Park it on the dependency, whoever finishes it will push it
+	if (dependency)
+	{
+		std::lock_guard<std::mutex> lock(dependency->waitingMutex);
+		if (dependency->value.load(std::memory_order_acquire) > 0)
+		{
+			dependency->waiting.push_back(job);
+			return;
+		}
+	}
+
+	PushJob(workerIndex, job);
+}
+
+Job* JobSystem::FindJob(unsigned int workerIndex)
+{
+	Job* job = workers[workerIndex]->deque.Pop();
+	if (job)
+		return job;
+
+	// Nothing of our own, try everyone else starting from a random victim
+	Worker* self = workers[workerIndex];
+	self->randomState = self->randomState * 1664525 + 1013904223;
+	unsigned int start = (self->randomState >> 8) % workerCount;
+	for (unsigned int i = 0; i < workerCount; i++)
+	{
+		unsigned int victim = (start + i) % workerCount;
+		if (victim == workerIndex)
+			continue;
+
+		job = workers[victim]->deque.Steal();
+		if (job)
+		{
+			self->jobsStolen.fetch_add(1, std::memory_order_relaxed);
+			return job;
+		}
+	}
+
+	// Last, anything from outside the job system
+	if (externalJobCount.load(std::memory_order_acquire) > 0)
+	{
+		std::lock_guard<std::mutex> lock(externalMutex);
+		if (!externalJobs.empty())
+		{
+			job = externalJobs.back();
+			externalJobs.pop_back();
+			externalJobCount.fetch_sub(1, std::memory_order_relaxed);
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+void JobSystem::Execute(unsigned int workerIndex, Job* job, bool fromDeque)
+{
+	if (fromDeque)
+		queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+
+	// Copy out, the job slot can be reused once it's no longer live
+	JobCounter* counter = job->counter;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	{
+		PROFILE_SCOPE("Job");
+		job->function();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	if (job->pooled)
+		job->live.store(false, std::memory_order_release);
+	else
+		delete job;
+
+	Worker* worker = workers[workerIndex];
+	worker->busyNs.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), std::memory_order_relaxed);
+	worker->jobsRun.fetch_add(1, std::memory_order_relaxed);
+
+	if (counter)
+		Finish(workerIndex, counter);
+}
+
+void JobSystem::Finish(unsigned int workerIndex, JobCounter* counter)
+{
+	// Under the lock, so Wait() can't return (and its counter go away)
+	// until we're done touching the counter
+	std::vector<Job*> released;
+	{
+		std::lock_guard<std::mutex> lock(counter->waitingMutex);
+		if (counter->value.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+
+		// Hit zero - release anything that was waiting on this counter
+		released.swap(counter->waiting);
+	}
+	for (Job* job : released)
+		PushJob(workerIndex, job);
+}
+
+void JobSystem::Wait(JobCounter* counter)
+{
+	assert(workerCount > 0 && "JobSystem::Initialize() hasn't been called");
+	unsigned int workerIndex = currentWorkerIndex;
+	while (!counter->IsDone())
+	{
+		// Help out instead of blocking (threads that aren't workers can't)
+		Job* job = workerIndex < workerCount ? FindJob(workerIndex) : nullptr;
+		if (job)
+			Execute(workerIndex, job, true);
+		else
+			std::this_thread::yield();
+	}
+
+	// Whoever took it to zero may still be holding the lock
+	std::lock_guard<std::mutex> lock(counter->waitingMutex);
+}
+
+void JobSystem::ParallelFor(unsigned int count, unsigned int minChunkSize, const ParallelForFunction& function)
+{
+	if (count == 0)
+		return;
+
+	// A few chunks per worker so faster workers can steal the slack
+	if (minChunkSize == 0) minChunkSize = 1;
+	unsigned int chunkCount = (count + minChunkSize - 1) / minChunkSize;
+	unsigned int maxChunks = workerCount * 4;
+	if (chunkCount > maxChunks) chunkCount = maxChunks;
+
+	// Not worth the overhead
+	if (chunkCount <= 1)
+	{
+		function(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	unsigned int perChunk = count / chunkCount;
+	unsigned int leftover = count % chunkCount;
+	unsigned int begin = 0;
+	for (unsigned int chunk = 0; chunk < chunkCount; chunk++)
+	{
+		unsigned int end = begin + perChunk + (chunk < leftover ? 1 : 0);
+		Schedule([&function, begin, end]() { function(begin, end); }, &counter);
+		begin = end;
+	}
+
+	Wait(&counter);
+}
+
+void JobSystem::WorkerLoop(unsigned int workerIndex)
+{
+	currentWorkerIndex = workerIndex;
+#if CPU_PROFILING_ENABLED
+	std::string threadName = "Worker " + std::to_string(workerIndex);
+	PROFILE_THREAD(threadName.c_str());
+#endif
+
+	while (!shuttingDown.load(std::memory_order_acquire))
+	{
+		Job* job = FindJob(workerIndex);
+		if (job)
+		{
+			Execute(workerIndex, job, true);
+			continue;
+		}
+
+		// Spin a little before going to sleep, new work usually shows up soon
+		bool found = false;
+		for (int spin = 0; spin < 64 && !found; spin++)
+		{
+			std::this_thread::yield();
+			found = queuedJobs.load(std::memory_order_acquire) > 0;
+		}
+		if (found)
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleepingWorkers.fetch_add(1, std::memory_order_acq_rel);
+		wakeUp.wait_for(lock, std::chrono::milliseconds(1), [this]
+			{
+				return shuttingDown.load(std::memory_order_acquire) || queuedJobs.load(std::memory_order_acquire) > 0;
+			});
+		sleepingWorkers.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
+
+void JobSystem::EndStatsWindow()
+{
+	auto now = std::chrono::high_resolution_clock::now();
+	double windowMs = std::chrono::duration<double, std::milli>(now - statsWindowStart).count();
+	statsWindowStart = now;
+
+	for (unsigned int i = 0; i < workerCount; i++)
+	{
+		Worker* worker = workers[i];
+		JobWorkerStats& stats = workerStats[i];
+		stats.busyMs = worker->busyNs.exchange(0, std::memory_order_relaxed) / 1000000.0;
+		stats.jobsRun = worker->jobsRun.exchange(0, std::memory_order_relaxed);
+		stats.jobsStolen = worker->jobsStolen.exchange(0, std::memory_order_relaxed);
+		stats.utilization = windowMs > 0 ? (float)(stats.busyMs / windowMs) : 0.0f;
+		if (stats.utilization > 1.0f) stats.utilization = 1.0f;
+	}
+}
+
+bool JobSystem::SelfTest(std::string* error)
+{
+	auto fail = [&](const char* message)
+	{
+		if (error) *error = message;
+		return false;
+	};
+
+	JobSystem& jobs = GetInstance();
+	if (jobs.GetWorkerCount() == 0)
+		return fail("Job system isn't initialized");
+
+	// Lots of short ParallelFors back to back. Each one's counter is on
+	// the stack and gone the moment it returns, so if a worker is still
+	// touching it after Wait() the next round stomps on it.
+	for (unsigned int round = 0; round < 2000; round++)
+	{
+		unsigned int count = 1 + round % 257;
+		std::atomic<uint64_t> sum{ 0 };
+		jobs.ParallelFor(count, 1, [&](unsigned int begin, unsigned int end)
+			{
+				uint64_t local = 0;
+				for (unsigned int i = begin; i < end; i++)
+					local += i + 1;
+				sum.fetch_add(local, std::memory_order_relaxed);
+			});
+		if (sum.load() != (uint64_t)count * (count + 1) / 2)
+			return fail("ParallelFor missed or repeated part of the range");
+	}
+
+	// ParallelFor inside ParallelFor - the inner ones wait on workers
+	for (unsigned int round = 0; round < 200; round++)
+	{
+		const unsigned int outer = 16;
+		const unsigned int inner = 1 + round % 64;
+		std::atomic<uint64_t> sum{ 0 };
+		jobs.ParallelFor(outer, 1, [&](unsigned int begin, unsigned int end)
+			{
+				for (unsigned int o = begin; o < end; o++)
+				{
+					jobs.ParallelFor(inner, 1, [&](unsigned int innerBegin, unsigned int innerEnd)
+						{
+							sum.fetch_add(innerEnd - innerBegin, std::memory_order_relaxed);
+						});
+				}
+			});
+		if (sum.load() != (uint64_t)outer * inner)
+			return fail("Nested ParallelFor missed or repeated part of the range");
+	}
+
+	// Dependencies: the second batch can't start until the first is done
+	for (unsigned int round = 0; round < 500; round++)
+	{
+		const int batchSize = 32;
+		std::atomic<int> firstDone{ 0 };
+		std::atomic<int> startedEarly{ 0 };
+		JobCounter first;
+		JobCounter second;
+		for (int i = 0; i < batchSize; i++)
+			jobs.Schedule([&]() { firstDone.fetch_add(1, std::memory_order_relaxed); }, &first);
+		for (int i = 0; i < batchSize; i++)
+			jobs.Schedule([&]()
+				{
+					if (firstDone.load(std::memory_order_relaxed) != batchSize)
+						startedEarly.fetch_add(1, std::memory_order_relaxed);
+				}, &second, &first);
+		jobs.Wait(&second);
+		jobs.Wait(&first);
+		if (startedEarly.load() != 0)
+			return fail("A job ran before its dependency finished");
+	}
+
+	// More jobs alive at once than a worker's ring holds: all of them
+	// are parked behind a gate that only opens once they're scheduled
+	{
+		const unsigned int jobCount = Worker::jobPoolSize * 3;
+		std::atomic<bool> open{ false };
+		std::atomic<uint64_t> sum{ 0 };
+		JobCounter gate;
+		JobCounter parked;
+		jobs.Schedule([&]()
+			{
+				while (!open.load(std::memory_order_acquire))
+					std::this_thread::yield();
+			}, &gate);
+		for (unsigned int i = 0; i < jobCount; i++)
+			jobs.Schedule([&sum, i]() { sum.fetch_add(i + 1, std::memory_order_relaxed); }, &parked, &gate);
+		open.store(true, std::memory_order_release);
+		jobs.Wait(&parked);
+		if (sum.load() != (uint64_t)jobCount * (jobCount + 1) / 2)
+			return fail("Jobs still in flight were overwritten by new ones");
+	}
+
+	// Scheduling and waiting from threads the job system doesn't own
+	{
+		std::atomic<int> failures{ 0 };
+		std::vector<std::thread> outsiders;
+		for (int t = 0; t < 2; t++)
+		{
+			outsiders.push_back(std::thread([&]()
+				{
+					for (unsigned int round = 0; round < 200; round++)
+					{
+						unsigned int count = 1 + round % 97;
+						std::atomic<uint64_t> sum{ 0 };
+						jobs.ParallelFor(count, 1, [&](unsigned int begin, unsigned int end)
+							{
+								for (unsigned int i = begin; i < end; i++)
+									sum.fetch_add(i + 1, std::memory_order_relaxed);
+							});
+						if (sum.load() != (uint64_t)count * (count + 1) / 2)
+							failures.fetch_add(1, std::memory_order_relaxed);
+					}
+				}));
+		}
+		for (std::thread& outsider : outsiders)
+			outsider.join();
+		if (failures.load() != 0)
+			return fail("ParallelFor from another thread missed part of the range");
+	}
+
+	return true;
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <string>
+
+struct Job;
+
+// --------------------------------------------------------
+// Counts outstanding jobs. Every job scheduled with a counter
+// bumps it, and it drops back down as they finish. Wait() on
+// it to join, or pass it as another job's dependency to have
+// that job start only once this counter hits zero.
+// --------------------------------------------------------
+class JobCounter
+{
+public:
+	JobCounter() : value(0) {}
+	JobCounter(JobCounter const&) = delete;
+	void operator=(JobCounter const&) = delete;
+
+	bool IsDone() { return value.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+	std::atomic<int> value;
+
+	// Jobs waiting for this counter to reach zero
+	std::mutex waitingMutex;
+	std::vector<Job*> waiting;
+};
+
+typedef std::function<void()> JobFunction;
+typedef std::function<void(unsigned int begin, unsigned int end)> ParallelForFunction;
+
+// A unit of work, owned by the job system
+struct Job
+{
+	JobFunction function;
+	JobCounter* counter;
+	std::atomic<bool> live{ false };	// Scheduled and not done running yet
+	bool pooled = false;				// From a worker's ring (otherwise new'd, deleted once run)
+};
+
+// --------------------------------------------------------
+// Single-producer, multi-consumer work-stealing deque
+// (Chase-Lev). The owning worker pushes and pops at the
+// bottom, everyone else steals from the top, and only the
+// last job ever needs a CAS. Fixed size - Push() fails when
+// it's full and the caller just runs the job itself.
+// --------------------------------------------------------
+class JobDeque
+{
+public:
+	JobDeque() : top(0), bottom(0)
+	{
+		for (auto& job : jobs) job.store(nullptr, std::memory_order_relaxed);
+	}
+
+	bool Push(Job* job);
+	Job* Pop();
+	Job* Steal();
+
+	static const unsigned int capacity = 4096; // Must be a power of 2
+
+private:
+	// Each on its own cache line so thieves and the owner don't fight over them
+	alignas(64) std::atomic<int64_t> top;
+	alignas(64) std::atomic<int64_t> bottom;
+	alignas(64) std::atomic<Job*> jobs[capacity];
+};
+
+// What one worker did over the last stats window
+struct JobWorkerStats
+{
+	double busyMs;		 // Time spent inside jobs
+	float utilization;	 // busyMs over the window's length, 0 - 1
+	unsigned int jobsRun;
+	unsigned int jobsStolen; // Of those, how many came from another worker's deque
+};
+
+// --------------------------------------------------------
+// Work-stealing job scheduler.
+//
+// One worker per core, the main thread being worker 0 - so
+// the main thread has a deque of its own and helps out while
+// it waits. Idle workers steal from random victims, then
+// sleep once there's nothing left anywhere.
+//
+// Jobs scheduled from the main thread or from inside another
+// job come from that worker's own ring of jobs, no locks
+// needed. Any other thread can schedule and wait too, through
+// a shared queue the workers check once stealing comes up
+// empty - slower, but it works.
+// --------------------------------------------------------
+class JobSystem
+{
+#pragma region Singleton
+public:
+	// Gets the one and only instance of this class
+	static JobSystem& GetInstance()
+	{
+		if (!instance)
+		{
+			instance = new JobSystem();
+		}
+
+		return *instance;
+	}
+
+	// Remove these functions (C++ 11 version)
+	JobSystem(JobSystem const&) = delete;
+	void operator=(JobSystem const&) = delete;
+
+private:
+	static JobSystem* instance;
+	JobSystem() :
+		workerCount(0),
+		shuttingDown(false),
+		sleepingWorkers(0),
+		queuedJobs(0),
+		externalJobCount(0)
+	{ };
+#pragma endregion
+
+public:
+	~JobSystem();
+
+	// workerCount of 0 means one per core (including the main thread)
+	void Initialize(unsigned int workerCount = 0);
+
+	// Queues a job. counter (optional) is incremented now and decremented
+	// once the job is done. If dependency is given, the job won't start
+	// until that counter reaches zero.
+	void Schedule(const JobFunction& function, JobCounter* counter = 0, JobCounter* dependency = 0);
+
+	// Runs other jobs until the counter reaches zero
+	void Wait(JobCounter* counter);
+
+	// Splits [0, count) into chunks of at least minChunkSize, runs them
+	// across every worker and returns once they're all done
+	void ParallelFor(unsigned int count, unsigned int minChunkSize, const ParallelForFunction& function);
+
+	unsigned int GetWorkerCount() { return workerCount; }
+
+	// Which worker the calling thread is (0 is the main thread)
+	unsigned int GetCurrentWorkerIndex();
+
+	// Utilization stats: everything between two EndStatsWindow() calls
+	// (once per frame) is one window
+	void EndStatsWindow();
+	const std::vector<JobWorkerStats>& GetWorkerStats() { return workerStats; }
+
+	// Hammers ParallelFor, nested ParallelFor and dependency chains with
+	// counters on the stack, so counter lifetime bugs show up. Needs
+	// Initialize() first (and several workers to be worth anything).
+	static bool SelfTest(std::string* error);
+
+private:
+	unsigned int workerCount;
+
+	// Everything one worker owns, padded so workers don't share cache lines
+	struct alignas(64) Worker
+	{
+		JobDeque deque;
+
+		// Ring of jobs this worker hands out. If the next slot's job is
+		// still alive (more than jobPoolSize in flight) a new one is made.
+		static const unsigned int jobPoolSize = 4096;
+		Job jobPool[jobPoolSize];
+		unsigned int nextJob = 0;
+
+		// Stats, written by the worker, read and reset by the main thread
+		std::atomic<uint64_t> busyNs{ 0 };
+		std::atomic<unsigned int> jobsRun{ 0 };
+		std::atomic<unsigned int> jobsStolen{ 0 };
+
+		unsigned int randomState = 1;
+	};
+	std::vector<Worker*> workers;
+	std::vector<std::thread> threads;
+
+	Job* AllocateJob(unsigned int workerIndex);
+	void PushJob(unsigned int workerIndex, Job* job);
+
+	// Grab a job from our own deque, or steal one, or take one from a thread
+	// outside the job system. Null if there's nothing anywhere.
+	Job* FindJob(unsigned int workerIndex);
+	void Execute(unsigned int workerIndex, Job* job, bool fromDeque);
+	void Finish(unsigned int workerIndex, JobCounter* counter);
+
+	void WorkerLoop(unsigned int workerIndex);
+
+	// Sleeping when there's nothing to do
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	std::atomic<bool> shuttingDown;
+	std::atomic<int> sleepingWorkers;
+	std::atomic<int> queuedJobs; // Roughly how many jobs are sitting in deques
+
+	// Jobs scheduled by threads that aren't workers
+	std::mutex externalMutex;
+	std::vector<Job*> externalJobs;
+	std::atomic<int> externalJobCount;
+
+	// Stats
+	std::vector<JobWorkerStats> workerStats;
+	std::chrono::high_resolution_clock::time_point statsWindowStart;
+};
@@ -2,7 +2,10 @@
 #ifndef __GGP_LIGHTING__
 #define __GGP_LIGHTING__
 
-#define MAX_LIGHTS 128
+// Shader permutations pass this in from the C++ side (Lights.h)
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 10
+#endif
 
 #define MAX_SPECULAR_EXPONENT 256.0f
 
@@ -3,10 +3,11 @@
 #include <DirectXMath.h>
 
 //Match these definitions with those in the shaders.
+//(Shader permutations get MAX_LIGHTS from here directly)
 #define MAX_LIGHTS 10
 #define LIGHT_TYPE_DIRECTIONAL 0
 #define LIGHT_TYPE_POINT 1
-//#define LIGHT_TYPE_SPOT 2
+#define LIGHT_TYPE_SPOT 2
 
 //Remember the 16 byte rule? Oh yeah it's back!
 struct Light
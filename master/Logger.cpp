@@ -0,0 +1,211 @@
+#include "Logger.h"
+
+#include <chrono>
+
+//Singleton requirement
+Logger* Logger::instance;
+
+static uint64_t NowMs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Small, stable number per thread for the log lines
+static uint32_t CurrentThreadId()
+{
+	static std::atomic<uint32_t> nextId(0);
+	static thread_local uint32_t id = nextId.fetch_add(1);
+	return id;
+}
+
+Logger::Logger() :
+	writePosition(0),
+	readPosition(0),
+	writtenPosition(0),
+	dropped(0),
+	level(LOG_LEVEL_INFO),
+	toConsole(true),
+	file(0),
+	shuttingDown(false),
+	startTime(NowMs())
+{
+	slots = new Slot[slotCount];
+	for (unsigned int i = 0; i < slotCount; i++)
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+
+	writerThread = std::thread(&Logger::WriterLoop, this);
+}
+
+Logger::~Logger()
+{
+	// Write out whatever's left, then stop
+	shuttingDown = true;
+	wakeUp.notify_one();
+	if (writerThread.joinable())
+		writerThread.join();
+
+	if (file)
+		fclose(file);
+	delete[] slots;
+}
+
+void Logger::Initialize(bool toConsole, const std::string& filePath)
+{
+	std::lock_guard<std::mutex> lock(outputMutex);
+	this->toConsole = toConsole;
+
+	if (file)
+	{
+		fclose(file);
+		file = 0;
+	}
+	if (!filePath.empty())
+	{
+#if defined(_MSC_VER)
+		fopen_s(&file, filePath.c_str(), "w");
+#else
+		file = fopen(filePath.c_str(), "w");
+#endif
+	}
+}
+
+void Logger::Write(int level, const char* format, ...)
+{
+	va_list arguments;
+	va_start(arguments, format);
+	WriteV(level, format, arguments);
+	va_end(arguments);
+}
+
+void Logger::WriteV(int level, const char* format, va_list arguments)
+{
+	if (level < this->level.load(std::memory_order_relaxed))
+		return;
+
+	// Claim a slot (bounded MPMC queue, Vyukov style)
+	Slot* slot;
+	uint64_t position = writePosition.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		slot = &slots[position & (slotCount - 1)];
+		uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+		int64_t difference = (int64_t)sequence - (int64_t)position;
+
+		if (difference == 0)
+		{
+			if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (difference < 0)
+		{
+			// Full - the writer thread hasn't got to this slot's last message yet.
+			// Warnings and errors are worth waiting for, the rest get dropped.
+			if (level < LOG_LEVEL_WARNING)
+			{
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			wakeUp.notify_one();
+			std::this_thread::yield();
+			position = writePosition.load(std::memory_order_relaxed);
+		}
+		else
+		{
+			position = writePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->time = NowMs() - startTime;
+	slot->threadId = CurrentThreadId();
+	slot->level = level;
+	vsnprintf(slot->text, messageSize, format, arguments);
+	slot->sequence.store(position + 1, std::memory_order_release);
+
+	// Errors shouldn't sit around in case something's about to go wrong
+	if (level >= LOG_LEVEL_ERROR)
+		wakeUp.notify_one();
+}
+
+const char* Logger::GetLevelName(int level)
+{
+	switch (level)
+	{
+	case LOG_LEVEL_TRACE: return "TRACE";
+	case LOG_LEVEL_DEBUG: return "DEBUG";
+	case LOG_LEVEL_INFO: return "INFO";
+	case LOG_LEVEL_WARNING: return "WARN";
+	case LOG_LEVEL_ERROR: return "ERROR";
+	}
+	return "?";
+}
+
+// Writes out the next message if it's ready
+bool Logger::DrainOne()
+{
+	Slot& slot = slots[readPosition & (slotCount - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != readPosition + 1)
+		return false;
+
+	char line[messageSize + 64];
+	int length = snprintf(line, sizeof(line), "[%8.3f] [%-5s] [%u] %s\n",
+		slot.time / 1000.0, GetLevelName(slot.level), slot.threadId, slot.text);
+	if (length > (int)sizeof(line) - 1)
+		length = (int)sizeof(line) - 1;
+
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		if (toConsole)
+			fwrite(line, 1, length, stdout);
+		if (file)
+			fwrite(line, 1, length, file);
+	}
+
+	// Free for the lap after this one
+	slot.sequence.store(readPosition + slotCount, std::memory_order_release);
+	readPosition++;
+	writtenPosition.store(readPosition, std::memory_order_release);
+	return true;
+}
+
+void Logger::WriterLoop()
+{
+	for (;;)
+	{
+		bool wroteAnything = false;
+		while (DrainOne())
+			wroteAnything = true;
+
+		if (wroteAnything)
+		{
+			std::lock_guard<std::mutex> lock(outputMutex);
+			if (toConsole)
+				fflush(stdout);
+			if (file)
+				fflush(file);
+		}
+
+		if (shuttingDown.load(std::memory_order_acquire))
+		{
+			// One last pass for anything that slipped in
+			if (!DrainOne())
+				break;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(wakeMutex);
+		wakeUp.wait_for(lock, std::chrono::milliseconds(2));
+	}
+}
+
+void Logger::Flush()
+{
+	uint64_t target = writePosition.load(std::memory_order_acquire);
+	wakeUp.notify_one();
+	while (writtenPosition.load(std::memory_order_acquire) < target)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+		if (shuttingDown.load(std::memory_order_acquire))
+			break;
+	}
+}
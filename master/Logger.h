@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARNING 3
+#define LOG_LEVEL_ERROR 4
+
+// Anything below this is compiled out entirely. Can be set in the
+// project's preprocessor definitions; defaults to everything in
+// debug builds and info and up otherwise.
+#ifndef LOG_MIN_LEVEL
+#if defined(DEBUG) || defined(_DEBUG)
+#define LOG_MIN_LEVEL LOG_LEVEL_TRACE
+#else
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+// printf style. The level check is a constant, so filtered out
+// calls (and their arguments) never make it into the build.
+#define LOG_WRITE(level, ...) do { if ((level) >= LOG_MIN_LEVEL) Logger::GetInstance().Write(level, __VA_ARGS__); } while (0)
+#define LOG_TRACE(...) LOG_WRITE(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_WRITE(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_WRITE(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_WRITE(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_WRITE(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// --------------------------------------------------------
+// Asynchronous logger.
+//
+// Write() formats straight into a slot of a fixed ring
+// buffer and returns - claiming the slot is one CAS, and
+// there's no allocation, lock or I/O on the caller's thread.
+// A background thread drains the ring to the console and/or
+// a file. Any thread can log (multi-producer), only the
+// background thread reads (single consumer).
+//
+// When the ring is full, messages below warnings are dropped
+// and counted rather than making the caller wait. Errors wake the
+// writer thread right away, everything else is picked up
+// within a couple of milliseconds.
+// --------------------------------------------------------
+class Logger
+{
+#pragma region Singleton
+public:
+	// Gets the one and only instance of this class
+	static Logger& GetInstance()
+	{
+		if (!instance)
+		{
+			instance = new Logger();
+		}
+
+		return *instance;
+	}
+
+	// Remove these functions (C++ 11 version)
+	Logger(Logger const&) = delete;
+	void operator=(Logger const&) = delete;
+
+private:
+	static Logger* instance;
+	Logger();
+#pragma endregion
+
+public:
+	~Logger();
+
+	// Where messages go. Safe to call again later to change it.
+	// An empty path means no file.
+	void Initialize(bool toConsole, const std::string& filePath);
+
+	// Messages below this are skipped at run time (on top of LOG_MIN_LEVEL)
+	void SetLevel(int level) { this->level.store(level, std::memory_order_relaxed); }
+	int GetLevel() { return level.load(std::memory_order_relaxed); }
+
+	void Write(int level, const char* format, ...);
+	void WriteV(int level, const char* format, va_list arguments);
+
+	// Waits until everything logged so far has been written out
+	void Flush();
+
+	uint64_t GetDroppedCount() { return dropped.load(std::memory_order_relaxed); }
+	static const char* GetLevelName(int level);
+
+private:
+	static const unsigned int slotCount = 4096; // Power of 2
+	static const unsigned int messageSize = 240; // Longer messages are cut off
+
+	// sequence says who owns the slot: equal to the write position
+	// it's for when free, one past that once the message is in
+	struct alignas(64) Slot
+	{
+		std::atomic<uint64_t> sequence;
+		uint64_t time;		// Milliseconds since the logger started
+		uint32_t threadId;
+		int level;
+		char text[messageSize];
+	};
+	Slot* slots;
+
+	alignas(64) std::atomic<uint64_t> writePosition;
+	alignas(64) uint64_t readPosition; // Writer thread only
+	std::atomic<uint64_t> writtenPosition; // How far the writer thread has got, for Flush()
+	std::atomic<uint64_t> dropped;
+	std::atomic<int> level;
+
+	// Outputs, only touched by the writer thread once it's running
+	std::mutex outputMutex;
+	bool toConsole;
+	FILE* file;
+
+	std::thread writerThread;
+	std::mutex wakeMutex;
+	std::condition_variable wakeUp;
+	std::atomic<bool> shuttingDown;
+	uint64_t startTime;
+
+	void WriterLoop();
+	bool DrainOne();
+};
@@ -1,6 +1,10 @@
 
 #include <Windows.h>
 #include "Game.h"
+#include "StartupProfiler.h"
+
+#include <cstdio>
+#include <string>
 
 // --------------------------------------------------------
 // Entry point for a graphical (non-console) Windows application
@@ -11,6 +15,9 @@ int WINAPI WinMain(
 	_In_ LPSTR lpCmdLine,				// Command line params
 	_In_ int nCmdShow)					// How the window should be shown (we ignore this)
 {
+	// Time to first frame counts from here
+	StartupProfiler::GetInstance().Start();
+
 #if defined(DEBUG) | defined(_DEBUG)
 	// Enable memory leak detection as a quick and dirty
 	// way of determining if we forgot to clean something up
@@ -18,21 +25,38 @@ int WINAPI WinMain(
 	_CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+	// --benchmark (and its options) runs headless and writes a report instead
+	BenchmarkSettings benchmark;
+	std::string commandLineError;
+	if (!benchmark.Parse(lpCmdLine, &commandLineError))
+	{
+		// No message box - nobody's around to close it on a build machine
+		OutputDebugString((commandLineError + "\n").c_str());
+		fprintf(stderr, "%s\n", commandLineError.c_str());
+		return 1;
+	}
+
 	// Create the Game object using
 	// the app handle we got from WinMain
-	Game dxGame(hInstance);
+	Game dxGame(hInstance, benchmark);
 
 	// Result variable for function calls below
 	HRESULT hr = S_OK;
 
 	// Attempt to create the window for our program, and
 	// exit early if something failed
-	hr = dxGame.InitWindow();
+	{
+		STARTUP_PHASE("Window");
+		hr = dxGame.InitWindow();
+	}
 	if(FAILED(hr)) return hr;
 
 	// Attempt to initialize DirectX, and exit
 	// early if something failed
-	hr = dxGame.InitDirectX();
+	{
+		STARTUP_PHASE("DirectX");
+		hr = dxGame.InitDirectX();
+	}
 	if(FAILED(hr)) return hr;
 
 	// Begin the message and game loop, and then return
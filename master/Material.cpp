@@ -1,5 +1,8 @@
 #include "Material.h"
 #include "DX12Helper.h"
+#include "ShaderPermutations.h"
+
+unsigned int Material::nextID = 0;
 
 Material::Material(Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState,
     DirectX::XMFLOAT3 tint,
@@ -9,6 +12,10 @@ Material::Material(Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState,
     colorTint(tint),
     uvScale(uvScale),
     uvOffset(uvOffset),
+    transparent(false),
+    roughness(0.5f),
+    metal(0.0f),
+    id(nextID++),
     materialTexturesFinalized(false),
     highestSRVSlot(-1)
 {
@@ -17,12 +24,21 @@ Material::Material(Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState,
     ZeroMemory(textureSRVsBySlot, sizeof(D3D12_CPU_DESCRIPTOR_HANDLE) * 128);
 }
 
+Material::Material(std::shared_ptr<CachedPipeline> pipeline,
+    DirectX::XMFLOAT3 tint,
+    DirectX::XMFLOAT2 uvScale,
+    DirectX::XMFLOAT2 uvOffset) :
+    Material(Microsoft::WRL::ComPtr<ID3D12PipelineState>(), tint, uvScale, uvOffset)
+{
+    cachedPipeline = pipeline;
+}
+
 Material::~Material()
 {
 }
 
 Microsoft::WRL::ComPtr<ID3D12PipelineState> Material::GetPipelineState()
-{ return pipelineState; }
+{ return cachedPipeline ? cachedPipeline->Get() : pipelineState.Get(); }
 
 DirectX::XMFLOAT2 Material::GetUVScale()
 { return uvScale; }
@@ -36,9 +52,53 @@ DirectX::XMFLOAT3 Material::GetColorTint()
 D3D12_GPU_DESCRIPTOR_HANDLE Material::GetFinalGPUHandleForTextures()
 { return finalGPUHandleForSRVs; }
 
+unsigned int Material::GetID()
+{ return id; }
+
+bool Material::GetTransparent()
+{ return transparent; }
+
+float Material::GetRoughness()
+{ return roughness; }
+
+float Material::GetMetal()
+{ return metal; }
+
+uint32_t Material::GetShaderFeatures()
+{
+    //Slots match the pixel shader's texture registers
+    uint32_t features = 0;
+    if (highestSRVSlot >= 1 && textureSRVsBySlot[1].ptr) features |= SHADER_FEATURE_NORMAL_MAP;
+    if (highestSRVSlot >= 2 && textureSRVsBySlot[2].ptr) features |= SHADER_FEATURE_ROUGHNESS_MAP;
+    if (highestSRVSlot >= 3 && textureSRVsBySlot[3].ptr) features |= SHADER_FEATURE_METAL_MAP;
+    return features;
+}
+
 void Material::SetPipelineState(Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState)
 {
     this->pipelineState = pipelineState;
+    cachedPipeline.reset();
+}
+
+void Material::SetCachedPipeline(std::shared_ptr<CachedPipeline> pipeline)
+{
+    cachedPipeline = pipeline;
+}
+
+void Material::SetDepthPrepassPipelines(std::shared_ptr<CachedPipeline> depthPrepass, std::shared_ptr<CachedPipeline> equalDepth)
+{
+    depthPrepassPipeline = depthPrepass;
+    equalDepthPipeline = equalDepth;
+}
+
+void Material::SetRoughness(float roughness)
+{
+    this->roughness = roughness;
+}
+
+void Material::SetMetal(float metal)
+{
+    this->metal = metal;
 }
 
 void Material::SetUVScale(DirectX::XMFLOAT2 scale)
@@ -56,6 +116,11 @@ void Material::SetColorTint(DirectX::XMFLOAT3 tint)
     this->colorTint = tint;
 }
 
+void Material::SetTransparent(bool transparent)
+{
+    this->transparent = transparent;
+}
+
 void Material::AddTexture(D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle, int slot)
 {
     //Return out if there is no valid slot to save texture
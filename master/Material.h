@@ -7,6 +7,7 @@
 #include <unordered_map>
 
 #include "Camera.h"
+#include "PipelineCache.h"
 #include "Transform.h"
 
 class Material
@@ -18,6 +19,11 @@ public:
 		DirectX::XMFLOAT3 tint,
 		DirectX::XMFLOAT2 uvScale = DirectX::XMFLOAT2(1, 1),
 		DirectX::XMFLOAT2 uvOffset = DirectX::XMFLOAT2(0, 0));
+	//Pipeline from the cache, which may still be compiling (its fallback is used until then)
+	Material(std::shared_ptr<CachedPipeline> pipeline,
+		DirectX::XMFLOAT3 tint,
+		DirectX::XMFLOAT2 uvScale = DirectX::XMFLOAT2(1, 1),
+		DirectX::XMFLOAT2 uvOffset = DirectX::XMFLOAT2(0, 0));
 	~Material();
 
 	Microsoft::WRL::ComPtr<ID3D12PipelineState> GetPipelineState();
@@ -25,11 +31,25 @@ public:
 	DirectX::XMFLOAT2 GetUVOffset();
 	DirectX::XMFLOAT3 GetColorTint();
 	D3D12_GPU_DESCRIPTOR_HANDLE GetFinalGPUHandleForTextures();
+	unsigned int GetID();
+	bool GetTransparent();
+	float GetRoughness();
+	float GetMetal();
+	uint32_t GetShaderFeatures(); //ShaderFeature flags, from the textures it has
+
+	//Depth prepass versions of this material's pipeline (null if there aren't any)
+	CachedPipeline* GetDepthPrepassPipeline() { return depthPrepassPipeline.get(); }
+	CachedPipeline* GetEqualDepthPipeline() { return equalDepthPipeline.get(); }
 
 	void SetPipelineState(Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState);
 	void SetUVScale(DirectX::XMFLOAT2 scale);
 	void SetUVOffset(DirectX::XMFLOAT2 offset);
 	void SetColorTint(DirectX::XMFLOAT3 tint);
+	void SetTransparent(bool transparent);
+	void SetCachedPipeline(std::shared_ptr<CachedPipeline> pipeline);
+	void SetDepthPrepassPipelines(std::shared_ptr<CachedPipeline> depthPrepass, std::shared_ptr<CachedPipeline> equalDepth);
+	void SetRoughness(float roughness); //Only used without a roughness map
+	void SetMetal(float metal);			//Only used without a metal map
 
 	void AddTexture(D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorHandle, int slot);
 	void FinalizeTextures();
@@ -38,11 +58,21 @@ private:
 
 	//Shared among materials, includes shaders.
 	Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState;
+	std::shared_ptr<CachedPipeline> cachedPipeline; //Used instead when set
+	std::shared_ptr<CachedPipeline> depthPrepassPipeline; //Depth only, position only
+	std::shared_ptr<CachedPipeline> equalDepthPipeline; //Main pipeline, but testing EQUAL without writing depth
 
 	//Properties of our material
 	DirectX::XMFLOAT3 colorTint;
 	DirectX::XMFLOAT2 uvOffset;
 	DirectX::XMFLOAT2 uvScale;
+	bool transparent; // Drawn after opaque objects, back to front
+	float roughness;
+	float metal;
+
+	//Small unique number, used to build draw sort keys
+	unsigned int id;
+	static unsigned int nextID;
 
 	//Tracking for textures on GPU
 	bool materialTexturesFinalized;
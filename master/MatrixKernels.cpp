@@ -0,0 +1,381 @@
+#include "MatrixKernels.h"
+
+#include <immintrin.h>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <cmath>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX_TARGET
+#define AVX2_TARGET
+#else
+#include <cpuid.h>
+#define AVX_TARGET __attribute__((target("avx")))
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// CPU feature detection, done once and cached
+// --------------------------------------------------------
+static bool CheckAVXSupport()
+{
+	int info[4] = {};
+#if defined(_MSC_VER)
+	__cpuid(info, 1);
+#else
+	__cpuid(1, info[0], info[1], info[2], info[3]);
+#endif
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+
+	// The OS also has to save the upper halves of the YMM registers
+#if defined(_MSC_VER)
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+	return (xcr0 & 0x6) == 0x6;
+}
+
+// AVX2 and FMA3 on top of AVX (every AVX2 CPU so far has both, but check anyway)
+static bool CheckAVX2Support()
+{
+	if (!CheckAVXSupport())
+		return false;
+
+	int info[4] = {};
+#if defined(_MSC_VER)
+	__cpuid(info, 0);
+#else
+	__cpuid(0, info[0], info[1], info[2], info[3]);
+#endif
+	if (info[0] < 7)
+		return false;
+
+#if defined(_MSC_VER)
+	__cpuid(info, 1);
+#else
+	__cpuid(1, info[0], info[1], info[2], info[3]);
+#endif
+	bool fma = (info[2] & (1 << 12)) != 0;
+
+#if defined(_MSC_VER)
+	__cpuidex(info, 7, 0);
+#else
+	__cpuid_count(7, 0, info[0], info[1], info[2], info[3]);
+#endif
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	return fma && avx2;
+}
+
+static const bool avxSupported = CheckAVXSupport();
+static const bool avx2Supported = CheckAVX2Support();
+
+bool MatrixKernels::IsPathSupported(Path path)
+{
+	if (path == Path::AVX)
+		return avxSupported;
+	if (path == Path::AVX2)
+		return avx2Supported;
+
+	// x64 always has SSE2
+	return true;
+}
+
+MatrixKernels::Path MatrixKernels::GetBestPath()
+{
+	if (avx2Supported) return Path::AVX2;
+	return avxSupported ? Path::AVX : Path::SSE;
+}
+
+const char* MatrixKernels::GetPathName(Path path)
+{
+	switch (path)
+	{
+	case Path::DirectXMath: return "DirectXMath";
+	case Path::SSE: return "SSE";
+	case Path::AVX: return "AVX";
+	case Path::AVX2: return "AVX2";
+	}
+	return "Unknown";
+}
+
+void MatrixKernels::MultiplyBatch(const XMFLOAT4X4* matrices, unsigned int count, const XMFLOAT4X4& rhs, XMFLOAT4X4* out)
+{
+	if (avx2Supported)
+		MultiplyBatchAVX2(matrices, count, rhs, out);
+	else if (avxSupported)
+		MultiplyBatchAVX(matrices, count, rhs, out);
+	else
+		MultiplyBatchSSE(matrices, count, rhs, out);
+}
+
+void MatrixKernels::MultiplyBatch(Path path, const XMFLOAT4X4* matrices, unsigned int count, const XMFLOAT4X4& rhs, XMFLOAT4X4* out)
+{
+	switch (path)
+	{
+	case Path::DirectXMath: MultiplyBatchDirectXMath(matrices, count, rhs, out); break;
+	case Path::SSE: MultiplyBatchSSE(matrices, count, rhs, out); break;
+	case Path::AVX:
+		// Don't fault on machines without AVX, just fall back
+		if (avxSupported) MultiplyBatchAVX(matrices, count, rhs, out);
+		else MultiplyBatchSSE(matrices, count, rhs, out);
+		break;
+	case Path::AVX2:
+		if (avx2Supported) MultiplyBatchAVX2(matrices, count, rhs, out);
+		else MultiplyBatch(matrices, count, rhs, out);
+		break;
+	}
+}
+
+// Reference version, one XMMatrixMultiply at a time
+void MatrixKernels::MultiplyBatchDirectXMath(const XMFLOAT4X4* matrices, unsigned int count, const XMFLOAT4X4& rhs, XMFLOAT4X4* out)
+{
+	XMMATRIX b = XMLoadFloat4x4(&rhs);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		XMStoreFloat4x4(&out[i], XMMatrixMultiply(XMLoadFloat4x4(&matrices[i]), b));
+	}
+}
+
+// Each result row is (x * b0 + z * b2) + (y * b1 + w * b3)
+// which is the same order XMMatrixMultiply adds them in.
+// The right hand matrix stays in registers for the whole batch.
+void MatrixKernels::MultiplyBatchSSE(const XMFLOAT4X4* matrices, unsigned int count, const XMFLOAT4X4& rhs, XMFLOAT4X4* out)
+{
+	__m128 b0 = _mm_loadu_ps(&rhs.m[0][0]);
+	__m128 b1 = _mm_loadu_ps(&rhs.m[1][0]);
+	__m128 b2 = _mm_loadu_ps(&rhs.m[2][0]);
+	__m128 b3 = _mm_loadu_ps(&rhs.m[3][0]);
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const float* a = &matrices[i].m[0][0];
+		float* o = &out[i].m[0][0];
+
+		for (int row = 0; row < 4; row++)
+		{
+			__m128 r = _mm_loadu_ps(a + row * 4);
+			__m128 x = _mm_mul_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+			__m128 y = _mm_mul_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 1, 1, 1)), b1);
+			__m128 z = _mm_mul_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 2, 2, 2)), b2);
+			__m128 w = _mm_mul_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3)), b3);
+			_mm_storeu_ps(o + row * 4, _mm_add_ps(_mm_add_ps(x, z), _mm_add_ps(y, w)));
+		}
+	}
+}
+
+// Same math as the SSE version but two rows at a time: each 256-bit
+// register holds two rows of the left matrix, and the right hand rows
+// are broadcast into both halves. No FMA, so it rounds exactly like
+// the SSE version.
+AVX_TARGET void MatrixKernels::MultiplyBatchAVX(const XMFLOAT4X4* matrices, unsigned int count, const XMFLOAT4X4& rhs, XMFLOAT4X4* out)
+{
+	__m256 b0 = _mm256_broadcast_ps((const __m128*)&rhs.m[0][0]);
+	__m256 b1 = _mm256_broadcast_ps((const __m128*)&rhs.m[1][0]);
+	__m256 b2 = _mm256_broadcast_ps((const __m128*)&rhs.m[2][0]);
+	__m256 b3 = _mm256_broadcast_ps((const __m128*)&rhs.m[3][0]);
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const float* a = &matrices[i].m[0][0];
+		float* o = &out[i].m[0][0];
+
+		// Rows 0 & 1, then rows 2 & 3
+		__m256 r01 = _mm256_loadu_ps(a);
+		__m256 r23 = _mm256_loadu_ps(a + 8);
+
+		__m256 x01 = _mm256_mul_ps(_mm256_permute_ps(r01, 0x00), b0);
+		__m256 y01 = _mm256_mul_ps(_mm256_permute_ps(r01, 0x55), b1);
+		__m256 z01 = _mm256_mul_ps(_mm256_permute_ps(r01, 0xAA), b2);
+		__m256 w01 = _mm256_mul_ps(_mm256_permute_ps(r01, 0xFF), b3);
+
+		__m256 x23 = _mm256_mul_ps(_mm256_permute_ps(r23, 0x00), b0);
+		__m256 y23 = _mm256_mul_ps(_mm256_permute_ps(r23, 0x55), b1);
+		__m256 z23 = _mm256_mul_ps(_mm256_permute_ps(r23, 0xAA), b2);
+		__m256 w23 = _mm256_mul_ps(_mm256_permute_ps(r23, 0xFF), b3);
+
+		_mm256_storeu_ps(o, _mm256_add_ps(_mm256_add_ps(x01, z01), _mm256_add_ps(y01, w01)));
+		_mm256_storeu_ps(o + 8, _mm256_add_ps(_mm256_add_ps(x23, z23), _mm256_add_ps(y23, w23)));
+	}
+
+	// Avoid AVX -> SSE transition penalties in whatever runs next
+	_mm256_zeroupper();
+}
+
+// Two rows (in r) times the right hand matrix, fused
+AVX2_TARGET static inline __m256 MultiplyRowsAVX2(__m256 r, __m256 b0, __m256 b1, __m256 b2, __m256 b3)
+{
+	__m256 result = _mm256_mul_ps(_mm256_permute_ps(r, 0x00), b0);
+	result = _mm256_fmadd_ps(_mm256_permute_ps(r, 0x55), b1, result);
+	result = _mm256_fmadd_ps(_mm256_permute_ps(r, 0xAA), b2, result);
+	return _mm256_fmadd_ps(_mm256_permute_ps(r, 0xFF), b3, result);
+}
+
+// The AVX version's layout, but each row is one multiply and three
+// FMAs instead of four multiplies and three adds, and two matrices go
+// through per iteration so there are four independent chains in flight.
+// Fusing skips a rounding step, so results can differ from the other
+// paths in the last bit or so.
+AVX2_TARGET void MatrixKernels::MultiplyBatchAVX2(const XMFLOAT4X4* matrices, unsigned int count, const XMFLOAT4X4& rhs, XMFLOAT4X4* out)
+{
+	__m256 b0 = _mm256_broadcast_ps((const __m128*)&rhs.m[0][0]);
+	__m256 b1 = _mm256_broadcast_ps((const __m128*)&rhs.m[1][0]);
+	__m256 b2 = _mm256_broadcast_ps((const __m128*)&rhs.m[2][0]);
+	__m256 b3 = _mm256_broadcast_ps((const __m128*)&rhs.m[3][0]);
+
+	unsigned int i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		const float* a = &matrices[i].m[0][0];
+		float* o = &out[i].m[0][0];
+
+		// Load both matrices before storing anything, in case out == matrices
+		__m256 r0 = _mm256_loadu_ps(a);
+		__m256 r1 = _mm256_loadu_ps(a + 8);
+		__m256 r2 = _mm256_loadu_ps(a + 16);
+		__m256 r3 = _mm256_loadu_ps(a + 24);
+
+		_mm256_storeu_ps(o, MultiplyRowsAVX2(r0, b0, b1, b2, b3));
+		_mm256_storeu_ps(o + 8, MultiplyRowsAVX2(r1, b0, b1, b2, b3));
+		_mm256_storeu_ps(o + 16, MultiplyRowsAVX2(r2, b0, b1, b2, b3));
+		_mm256_storeu_ps(o + 24, MultiplyRowsAVX2(r3, b0, b1, b2, b3));
+	}
+
+	// Odd one out
+	if (i < count)
+	{
+		const float* a = &matrices[i].m[0][0];
+		float* o = &out[i].m[0][0];
+		__m256 r0 = _mm256_loadu_ps(a);
+		__m256 r1 = _mm256_loadu_ps(a + 8);
+		_mm256_storeu_ps(o, MultiplyRowsAVX2(r0, b0, b1, b2, b3));
+		_mm256_storeu_ps(o + 8, MultiplyRowsAVX2(r1, b0, b1, b2, b3));
+	}
+
+	_mm256_zeroupper();
+}
+
+// Fills a list of matrices with random, but reasonable, TRS values
+static void MakeRandomMatrices(std::vector<XMFLOAT4X4>& matrices, XMFLOAT4X4& rhs, unsigned int count)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> range(-10.0f, 10.0f);
+
+	matrices.resize(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		XMMATRIX m =
+			XMMatrixScaling(range(rng) * 0.1f + 1.5f, range(rng) * 0.1f + 1.5f, range(rng) * 0.1f + 1.5f) *
+			XMMatrixRotationRollPitchYaw(range(rng), range(rng), range(rng)) *
+			XMMatrixTranslation(range(rng), range(rng), range(rng));
+		XMStoreFloat4x4(&matrices[i], m);
+	}
+
+	XMMATRIX view = XMMatrixLookToLH(XMVectorSet(0, 0, -5, 1), XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0));
+	XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.01f, 100.0f);
+	XMStoreFloat4x4(&rhs, view * proj);
+}
+
+// How far apart two results can be and still count as the same. DirectXMath
+// itself may be built to use FMA (_XM_FMA3_INTRINSICS_, on with /arch:AVX2),
+// and the AVX2 path always does, so fused and unfused rounding have to both
+// pass. Relative to the size of the row, since that's where the error comes from.
+static bool NearlyEqual(const XMFLOAT4X4& a, const XMFLOAT4X4& b)
+{
+	const float tolerance = 1e-5f;
+	for (int row = 0; row < 4; row++)
+	{
+		float scale = 1.0f;
+		for (int col = 0; col < 4; col++)
+			scale = std::fmax(scale, std::fabs(a.m[row][col]));
+
+		for (int col = 0; col < 4; col++)
+		{
+			if (!(std::fabs(a.m[row][col] - b.m[row][col]) <= tolerance * scale))
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool AllNearlyEqual(const std::vector<XMFLOAT4X4>& expected, const std::vector<XMFLOAT4X4>& results)
+{
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		if (!NearlyEqual(expected[i], results[i]))
+			return false;
+	}
+	return true;
+}
+
+bool MatrixKernels::Validate(unsigned int matrixCount)
+{
+	std::vector<XMFLOAT4X4> matrices;
+	XMFLOAT4X4 rhs;
+	MakeRandomMatrices(matrices, rhs, matrixCount);
+
+	std::vector<XMFLOAT4X4> expected(matrixCount);
+	std::vector<XMFLOAT4X4> results(matrixCount);
+	MultiplyBatchDirectXMath(matrices.data(), matrixCount, rhs, expected.data());
+
+	Path paths[] = { Path::SSE, Path::AVX, Path::AVX2 };
+	for (Path path : paths)
+	{
+		if (!IsPathSupported(path))
+			continue;
+
+		MultiplyBatch(path, matrices.data(), matrixCount, rhs, results.data());
+		if (!AllNearlyEqual(expected, results))
+			return false;
+
+		// In place has to work too, since that's how the renderer may call it
+		results = matrices;
+		MultiplyBatch(path, results.data(), matrixCount, rhs, results.data());
+		if (!AllNearlyEqual(expected, results))
+			return false;
+	}
+
+	return true;
+}
+
+MatrixKernels::BenchmarkResult MatrixKernels::RunBenchmark(unsigned int matrixCount, unsigned int iterations)
+{
+	std::vector<XMFLOAT4X4> matrices;
+	XMFLOAT4X4 rhs;
+	MakeRandomMatrices(matrices, rhs, matrixCount);
+	std::vector<XMFLOAT4X4> results(matrixCount);
+
+	BenchmarkResult result = {};
+	result.matrixCount = matrixCount;
+
+	Path paths[] = { Path::DirectXMath, Path::SSE, Path::AVX, Path::AVX2 };
+	for (Path path : paths)
+	{
+		if (!IsPathSupported(path))
+			continue;
+
+		// One warm up pass so everything is in cache
+		MultiplyBatch(path, matrices.data(), matrixCount, rhs, results.data());
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < iterations; i++)
+		{
+			MultiplyBatch(path, matrices.data(), matrixCount, rhs, results.data());
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		result.nsPerMatrix[(int)path] = ns / ((double)matrixCount * iterations);
+	}
+
+	return result;
+}
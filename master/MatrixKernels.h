@@ -0,0 +1,68 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// --------------------------------------------------------
+// Batched 4x4 matrix kernels
+//
+// Multiplies a whole array of matrices by one shared matrix
+// (ex. every entity's world matrix by the frame's view-projection)
+// in one call. Picks the widest instruction set the CPU has at
+// startup: AVX2 + FMA, then AVX (two rows per instruction), then SSE.
+//
+// SSE and AVX add in the same order as XMMatrixMultiply without
+// FMA, AVX2 fuses. Validate() checks every path against DirectXMath
+// within a small tolerance rather than bit-for-bit, since how
+// DirectXMath itself rounds depends on its build flags.
+// --------------------------------------------------------
+class MatrixKernels
+{
+public:
+	enum class Path
+	{
+		DirectXMath,	// Plain XMMatrixMultiply in a loop (reference)
+		SSE,
+		AVX,
+		AVX2			// AVX2 + FMA3
+	};
+
+	// Results from a quick microbenchmark of every path
+	struct BenchmarkResult
+	{
+		unsigned int matrixCount;
+		double nsPerMatrix[4]; // Indexed by Path, 0 if the CPU can't run that path
+	};
+
+	// out[i] = matrices[i] * rhs for every i
+	// Safe to call with out == matrices
+	static void MultiplyBatch(
+		const DirectX::XMFLOAT4X4* matrices,
+		unsigned int count,
+		const DirectX::XMFLOAT4X4& rhs,
+		DirectX::XMFLOAT4X4* out);
+
+	// Same thing but forcing a specific path (for validation/benchmarking)
+	static void MultiplyBatch(
+		Path path,
+		const DirectX::XMFLOAT4X4* matrices,
+		unsigned int count,
+		const DirectX::XMFLOAT4X4& rhs,
+		DirectX::XMFLOAT4X4* out);
+
+	static Path GetBestPath();
+	static bool IsPathSupported(Path path);
+	static const char* GetPathName(Path path);
+
+	// Checks every supported path against XMMatrixMultiply on random data,
+	// returns true if all results match within tolerance
+	static bool Validate(unsigned int matrixCount = 1024);
+
+	// Times every supported path over the given number of matrices
+	static BenchmarkResult RunBenchmark(unsigned int matrixCount = 4096, unsigned int iterations = 200);
+
+private:
+	static void MultiplyBatchDirectXMath(const DirectX::XMFLOAT4X4* matrices, unsigned int count, const DirectX::XMFLOAT4X4& rhs, DirectX::XMFLOAT4X4* out);
+	static void MultiplyBatchSSE(const DirectX::XMFLOAT4X4* matrices, unsigned int count, const DirectX::XMFLOAT4X4& rhs, DirectX::XMFLOAT4X4* out);
+	static void MultiplyBatchAVX(const DirectX::XMFLOAT4X4* matrices, unsigned int count, const DirectX::XMFLOAT4X4& rhs, DirectX::XMFLOAT4X4* out);
+	static void MultiplyBatchAVX2(const DirectX::XMFLOAT4X4* matrices, unsigned int count, const DirectX::XMFLOAT4X4& rhs, DirectX::XMFLOAT4X4* out);
+};
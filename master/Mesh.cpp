@@ -1,5 +1,6 @@
 #include "Mesh.h"
 #include "DX12Helper.h"
+#include "CpuProfiler.h"
 
 #include <DirectXMath.h>
 #include <vector>
@@ -7,30 +8,59 @@
 
 using namespace DirectX;
 
+unsigned int Mesh::nextID = 0;
+
 Mesh::Mesh(Vertex* vertexArray, int numVertices, unsigned int* indexArray, int numIndices)
+	: id(nextID++)
 {
-	CreateBuffers(vertexArray, numVertices, indexArray, numIndices);
+	//Initialize in case there's nothing to draw (a failed load)
+	ibView = {};
+	vbView = {};
+	this->numIndices = 0;
+	boundsCenter = XMFLOAT3(0, 0, 0);
+	boundsRadius = 0;
+
+	if (numVertices > 0 && numIndices > 0)
+		CreateBuffers(vertexArray, numVertices, indexArray, numIndices);
 }
 
 Mesh::Mesh(const char* objFile)
+	: id(nextID++)
 {
+	PROFILE_SCOPE("Mesh load");
+
 	//Initialize in case of load fail
 	ibView = {};
 	vbView = {};
 	numIndices = 0; 
+	boundsCenter = XMFLOAT3(0, 0, 0);
+	boundsRadius = 0;
+
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	if (!LoadObj(objFile, verts, indices) || verts.empty())
+		return;
+
+	CreateBuffers(&verts[0], (int)verts.size(), &indices[0], (int)indices.size());
+}
+
+bool Mesh::LoadObj(const char* objFile, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	PROFILE_SCOPE("OBJ parse");
+
+	vertices.clear();
+	indices.clear();
 
 	//File input object
 	std::ifstream obj(objFile);
 
 	// Check for successful open
-	if (!obj.is_open())	return;
+	if (!obj.is_open())	return false;
 
 	// Variables used while reading the file
 	std::vector<XMFLOAT3> positions;     // Positions from the file
 	std::vector<XMFLOAT3> normals;       // Normals from the file
 	std::vector<XMFLOAT2> uvs;           // UVs from the file
-	std::vector<Vertex> verts;           // Verts we're assembling
-	std::vector<UINT> indices;           // Indices of these verts
 	unsigned int vertCounter = 0;        // Count of vertices/indices
 	char chars[100];                     // String for line reading
 
@@ -135,9 +165,9 @@ Mesh::Mesh(const char* objFile)
 			v3.Normal.z *= -1.0f;
 
 			// Add the verts to the vector (flipping the winding order)
-			verts.push_back(v1);
-			verts.push_back(v3);
-			verts.push_back(v2);
+			vertices.push_back(v1);
+			vertices.push_back(v3);
+			vertices.push_back(v2);
 
 			// Add three more indices
 			indices.push_back(vertCounter); vertCounter += 1;
@@ -159,9 +189,9 @@ Mesh::Mesh(const char* objFile)
 				v4.Normal.z *= -1.0f;
 
 				// Add a whole triangle (flipping the winding order)
-				verts.push_back(v1);
-				verts.push_back(v4);
-				verts.push_back(v3);
+				vertices.push_back(v1);
+				vertices.push_back(v4);
+				vertices.push_back(v3);
 
 				// Add three more indices
 				indices.push_back(vertCounter); vertCounter += 1;
@@ -171,9 +201,9 @@ Mesh::Mesh(const char* objFile)
 		}
 	}
 
-	// Close the file and create the actual buffers
+	// Close the file
 	obj.close();
-	CreateBuffers(&verts[0], vertCounter, &indices[0], vertCounter);
+	return true;
 }
 
 void Mesh::CreateBuffers(Vertex* vertexArray, int numVertices, unsigned int* indexArray, int numIndices)
@@ -183,6 +213,12 @@ void Mesh::CreateBuffers(Vertex* vertexArray, int numVertices, unsigned int* ind
 	
 	//Calculate the tangents before copying to buffer
 	CalculateTangents(vertexArray, numVertices, indexArray, numIndices);
+	CalculateBounds(vertexArray, numVertices);
+
+	positions.resize(numVertices);
+	for (int i = 0; i < numVertices; i++)
+		positions[i] = vertexArray[i].Position;
+	indices.assign(indexArray, indexArray + numIndices);
 
 	vertexBuffer = DX12Helper::GetInstance().CreateStaticBuffer(sizeof(Vertex), numVertices, vertexArray);
 	indexBuffer = DX12Helper::GetInstance().CreateStaticBuffer(sizeof(unsigned int), numIndices, indexArray);
@@ -198,6 +234,36 @@ void Mesh::CreateBuffers(Vertex* vertexArray, int numVertices, unsigned int* ind
 
 }
 
+// Sphere around the center of the vertices' box - not the tightest
+// possible, but close enough for culling and cheap to work out
+void Mesh::CalculateBounds(Vertex* vertexArray, int numVertices)
+{
+	boundsCenter = XMFLOAT3(0, 0, 0);
+	boundsRadius = 0;
+	if (numVertices <= 0)
+		return;
+
+	XMVECTOR minCorner = XMLoadFloat3(&vertexArray[0].Position);
+	XMVECTOR maxCorner = minCorner;
+	for (int i = 1; i < numVertices; i++)
+	{
+		XMVECTOR position = XMLoadFloat3(&vertexArray[i].Position);
+		minCorner = XMVectorMin(minCorner, position);
+		maxCorner = XMVectorMax(maxCorner, position);
+	}
+	XMVECTOR center = XMVectorScale(XMVectorAdd(minCorner, maxCorner), 0.5f);
+
+	float radiusSquared = 0;
+	for (int i = 0; i < numVertices; i++)
+	{
+		XMVECTOR offset = XMVectorSubtract(XMLoadFloat3(&vertexArray[i].Position), center);
+		radiusSquared = max(radiusSquared, XMVectorGetX(XMVector3LengthSq(offset)));
+	}
+
+	XMStoreFloat3(&boundsCenter, center);
+	boundsRadius = sqrtf(radiusSquared);
+}
+
 // Calculates the tangents of the vertices in a mesh
 // Code adapted from: http://www.terathon.com/code/tangent.html
 void Mesh::CalculateTangents(Vertex* vertexArray, int numVertices, unsigned int* indexArray, int numIndices)
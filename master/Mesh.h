@@ -1,7 +1,9 @@
 #pragma once
 
 #include <d3d12.h>
+#include <DirectXMath.h>
 #include <wrl/client.h>
+#include <vector>
 
 #include "Vertex.h"
 
@@ -11,19 +13,40 @@ public:
 	Mesh(Vertex* vertexArray, int numVertices, unsigned int* indexArray, int numIndices);
 	Mesh(const char* objFile);
 
+	// Just the parsing half of loading an OBJ file (no D3D), so it can
+	// run on any thread. Feed the result to the first constructor.
+	static bool LoadObj(const char* objFile, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
 	D3D12_VERTEX_BUFFER_VIEW GetVB() { return vbView; }
 	D3D12_INDEX_BUFFER_VIEW GetIB() { return ibView; }
 	int GetIndexCount() { return numIndices; }
+	unsigned int GetID() { return id; }
+
+	// Bounding sphere around the vertices, in object space
+	DirectX::XMFLOAT3 GetBoundsCenter() { return boundsCenter; }
+	float GetBoundsRadius() { return boundsRadius; }
+
+	// CPU copies of the geometry, for software occlusion
+	const std::vector<DirectX::XMFLOAT3>& GetPositions() { return positions; }
+	const std::vector<unsigned int>& GetIndices() { return indices; }
 
 private:
+	unsigned int id; // Small unique number, used to build draw sort keys
 	int numIndices;
+	DirectX::XMFLOAT3 boundsCenter;
+	float boundsRadius;
+	std::vector<DirectX::XMFLOAT3> positions;
+	std::vector<unsigned int> indices;
 	D3D12_VERTEX_BUFFER_VIEW vbView;
 	Microsoft::WRL::ComPtr<ID3D12Resource> vertexBuffer;
 	
 	D3D12_INDEX_BUFFER_VIEW ibView;
 	Microsoft::WRL::ComPtr<ID3D12Resource> indexBuffer;
 
+	void CalculateBounds(Vertex* vertexArray, int numVertices);
 	void CalculateTangents(Vertex* vertexArray, int numVertices, unsigned int* indexArray, int numIndices);
 	void CreateBuffers(Vertex* vertexArray, int numVertices, unsigned int* indexArray, int numIndices);
+
+	static unsigned int nextID;
 };
 
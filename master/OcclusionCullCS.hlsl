@@ -0,0 +1,209 @@
+// Two phase occlusion culling, feeding one indirect draw per batch.
+//
+//  Mode 0: resets both phases' draw arguments
+//  Mode 1: phase one - whatever was visible last frame (and is in
+//          the frustum) gets drawn, no occlusion test yet
+//  Mode 2: phase two - everything is tested against the Hi-Z built
+//          from phase one's depth. That's this frame's visibility,
+//          and whatever's visible but wasn't drawn in phase one
+//          (it just came out from behind something) is drawn now.
+//
+// Visible instances are copied into a compacted instance buffer
+// (phase one in the first half, phase two in the second), at the
+// batch's first instance plus however many got there before it.
+
+#define MODE_RESET 0
+#define MODE_PHASE_ONE 1
+#define MODE_PHASE_TWO 2
+
+#define MAX_HIZ_MIPS 12
+
+cbuffer CullConstants : register(b0)
+{
+	row_major float4x4 viewProjection;
+	uint instanceCount;
+	uint batchCount;
+	uint mode;
+	uint hiZMipCount;
+	uint2 depthSize;
+	uint2 padding;
+};
+
+// Same layout as the C++ InstanceData
+struct InstanceData
+{
+	row_major float4x4 world;
+	row_major float4x4 worldInverseTranspose;
+	row_major float4x4 worldViewProjection;
+};
+
+struct BatchCullData
+{
+	float3 boundsCenter;	// Mesh's local bounding sphere
+	float boundsRadius;
+	uint indexCount;
+	uint firstInstance;
+	uint2 padding;
+};
+
+// Same layout as D3D12_DRAW_INDEXED_ARGUMENTS
+struct DrawArguments
+{
+	uint indexCountPerInstance;
+	uint instanceCount;
+	uint startIndexLocation;
+	int baseVertexLocation;
+	uint startInstanceLocation;
+};
+
+StructuredBuffer<InstanceData> instances : register(t0);
+StructuredBuffer<uint2> instanceInfo : register(t1); // Entity index, batch index
+StructuredBuffer<BatchCullData> batches : register(t2);
+Texture2D<float> hiZ : register(t3);
+
+RWStructuredBuffer<DrawArguments> drawArguments : register(u0); // Phase one's batches, then phase two's
+RWStructuredBuffer<InstanceData> visibleInstances : register(u1);
+RWStructuredBuffer<uint> visibility : register(u2); // Per entity, 1 if it was visible last frame
+
+// Screen space bounds of a sphere, as depth buffer pixels plus its nearest depth.
+// False if it's out of the frustum. Anything crossing the near plane
+// counts as visible but gets no rectangle (occluded stays false).
+bool ProjectSphere(float3 center, float radius, out float4 pixelRect, out float nearestDepth, out bool crossesNear)
+{
+	float2 ndcMin = 1;
+	float2 ndcMax = -1;
+	nearestDepth = 1;
+	crossesNear = false;
+
+	// The eight corners of the sphere's box
+	uint outside[6] = { 0, 0, 0, 0, 0, 0 };
+	[unroll]
+	for (uint i = 0; i < 8; i++)
+	{
+		float3 corner = center + radius * float3(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1);
+		float4 clip = mul(float4(corner, 1), viewProjection);
+
+		outside[0] += clip.x < -clip.w ? 1 : 0;
+		outside[1] += clip.x > clip.w ? 1 : 0;
+		outside[2] += clip.y < -clip.w ? 1 : 0;
+		outside[3] += clip.y > clip.w ? 1 : 0;
+		outside[4] += clip.z < 0 ? 1 : 0;
+		outside[5] += clip.z > clip.w ? 1 : 0;
+
+		if (clip.w <= 0.0001f)
+		{
+			crossesNear = true;
+			continue;
+		}
+
+		float3 ndc = clip.xyz / clip.w;
+		ndcMin = min(ndcMin, ndc.xy);
+		ndcMax = max(ndcMax, ndc.xy);
+		nearestDepth = min(nearestDepth, ndc.z);
+	}
+
+	pixelRect = 0;
+	[unroll]
+	for (uint p = 0; p < 6; p++)
+	{
+		if (outside[p] == 8)
+			return false;
+	}
+
+	// NDC y points up, pixels go down
+	float2 size = float2(depthSize);
+	pixelRect.xy = saturate(float2(ndcMin.x, -ndcMax.y) * 0.5f + 0.5f) * size;
+	pixelRect.zw = saturate(float2(ndcMax.x, -ndcMin.y) * 0.5f + 0.5f) * size;
+	pixelRect = min(pixelRect, float4(size - 1, size - 1));
+	return true;
+}
+
+bool IsOccluded(float4 pixelRect, float nearestDepth)
+{
+	// Texel (x, y) of mip m covers depth pixels x << (m + 1) and up, so pick the
+	// first mip where the rectangle spans at most two texels each way
+	uint4 rect = uint4(pixelRect);
+	uint mip = 0;
+	while (mip < hiZMipCount &&
+		(((rect.z >> (mip + 1)) - (rect.x >> (mip + 1))) > 1 ||
+		((rect.w >> (mip + 1)) - (rect.y >> (mip + 1))) > 1))
+		mip++;
+
+	// Bigger than the pyramid can answer for
+	if (mip >= hiZMipCount)
+		return false;
+
+	uint4 texels = rect >> (mip + 1);
+	float farthest = max(
+		max(hiZ.Load(int3(texels.xy, mip)), hiZ.Load(int3(texels.zy, mip))),
+		max(hiZ.Load(int3(texels.xw, mip)), hiZ.Load(int3(texels.zw, mip))));
+
+	return nearestDepth > farthest;
+}
+
+void Append(uint batchIndex, uint phase, InstanceData instance)
+{
+	uint slot;
+	InterlockedAdd(drawArguments[phase * batchCount + batchIndex].instanceCount, 1, slot);
+	visibleInstances[phase * instanceCount + batches[batchIndex].firstInstance + slot] = instance;
+}
+
+[numthreads(64, 1, 1)]
+void main(uint3 threadID : SV_DispatchThreadID)
+{
+	uint index = threadID.x;
+
+	if (mode == MODE_RESET)
+	{
+		if (index >= batchCount)
+			return;
+
+		DrawArguments arguments;
+		arguments.indexCountPerInstance = batches[index].indexCount;
+		arguments.instanceCount = 0;
+		arguments.startIndexLocation = 0;
+		arguments.baseVertexLocation = 0;
+		arguments.startInstanceLocation = batches[index].firstInstance;
+		drawArguments[index] = arguments;
+
+		arguments.startInstanceLocation += instanceCount;
+		drawArguments[batchCount + index] = arguments;
+		return;
+	}
+
+	if (index >= instanceCount)
+		return;
+
+	InstanceData instance = instances[index];
+	uint entityIndex = instanceInfo[index].x;
+	uint batchIndex = instanceInfo[index].y;
+
+	// World space bounding sphere (scaled by the largest axis)
+	BatchCullData batch = batches[batchIndex];
+	float3 center = mul(float4(batch.boundsCenter, 1), instance.world).xyz;
+	float scale = sqrt(max(max(
+		dot(instance.world[0].xyz, instance.world[0].xyz),
+		dot(instance.world[1].xyz, instance.world[1].xyz)),
+		dot(instance.world[2].xyz, instance.world[2].xyz)));
+	float radius = batch.boundsRadius * scale;
+
+	float4 pixelRect;
+	float nearestDepth;
+	bool crossesNear;
+	bool inFrustum = ProjectSphere(center, radius, pixelRect, nearestDepth, crossesNear);
+	bool wasVisible = visibility[entityIndex] != 0;
+
+	if (mode == MODE_PHASE_ONE)
+	{
+		if (inFrustum && wasVisible)
+			Append(batchIndex, 0, instance);
+		return;
+	}
+
+	bool visible = inFrustum && (crossesNear || !IsOccluded(pixelRect, nearestDepth));
+	visibility[entityIndex] = visible ? 1 : 0;
+
+	// Phase one already drew it
+	if (visible && !wasVisible)
+		Append(batchIndex, 1, instance);
+}
@@ -0,0 +1,438 @@
+#include "OcclusionCuller.h"
+#include "DX12Helper.h"
+#include "Logger.h"
+
+#include <d3dcompiler.h>
+
+using namespace DirectX;
+
+// Must match the shaders
+#define MODE_RESET 0
+#define MODE_PHASE_ONE 1
+#define MODE_PHASE_TWO 2
+
+OcclusionCuller::OcclusionCuller() :
+	descriptorsCPU(),
+	descriptorsGPU(),
+	descriptorSize(0),
+	depthWidth(0),
+	depthHeight(0),
+	hiZMipCount(0),
+	drawArgumentsSize(0),
+	visibleInstancesSize(0),
+	visibilitySize(0),
+	constants(),
+	instanceData(0),
+	instanceInfo(0),
+	batchData(0),
+	currentSlot(0),
+	stats()
+{
+}
+
+void OcclusionCuller::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, const std::wstring& hiZShaderPath, const std::wstring& cullShaderPath, unsigned int framesInFlight)
+{
+	this->device = device;
+	retired.resize(framesInFlight);
+	readbacks.resize(framesInFlight);
+
+	// Root signature: constants, buffers by address, and two tables for the textures
+	{
+		D3D12_DESCRIPTOR_RANGE textureRange = {};
+		textureRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+		textureRange.NumDescriptors = 1;
+		textureRange.BaseShaderRegister = 3;
+		textureRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
+		D3D12_DESCRIPTOR_RANGE mipRange = {};
+		mipRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
+		mipRange.NumDescriptors = maxHiZMips;
+		mipRange.BaseShaderRegister = 3;
+		mipRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
+		D3D12_ROOT_PARAMETER rootParams[ROOT_PARAMETER_COUNT] = {};
+		for (D3D12_ROOT_PARAMETER& param : rootParams)
+			param.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+		rootParams[ROOT_CONSTANTS].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+		rootParams[ROOT_CONSTANTS].Constants.Num32BitValues = sizeof(CullConstants) / 4;
+		rootParams[ROOT_CONSTANTS].Constants.ShaderRegister = 0;
+
+		D3D12_ROOT_PARAMETER_TYPE bufferTypes[] = {
+			D3D12_ROOT_PARAMETER_TYPE_SRV, D3D12_ROOT_PARAMETER_TYPE_SRV, D3D12_ROOT_PARAMETER_TYPE_SRV,
+			D3D12_ROOT_PARAMETER_TYPE_UAV, D3D12_ROOT_PARAMETER_TYPE_UAV, D3D12_ROOT_PARAMETER_TYPE_UAV };
+		for (unsigned int i = 0; i < 6; i++)
+		{
+			rootParams[ROOT_INSTANCES + i].ParameterType = bufferTypes[i];
+			rootParams[ROOT_INSTANCES + i].Descriptor.ShaderRegister = i % 3;
+		}
+
+		rootParams[ROOT_TEXTURE].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+		rootParams[ROOT_TEXTURE].DescriptorTable.NumDescriptorRanges = 1;
+		rootParams[ROOT_TEXTURE].DescriptorTable.pDescriptorRanges = &textureRange;
+
+		rootParams[ROOT_HIZ_MIPS].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+		rootParams[ROOT_HIZ_MIPS].DescriptorTable.NumDescriptorRanges = 1;
+		rootParams[ROOT_HIZ_MIPS].DescriptorTable.pDescriptorRanges = &mipRange;
+
+		D3D12_ROOT_SIGNATURE_DESC rootSig = {};
+		rootSig.NumParameters = ROOT_PARAMETER_COUNT;
+		rootSig.pParameters = rootParams;
+
+		Microsoft::WRL::ComPtr<ID3DBlob> serializedRootSig;
+		Microsoft::WRL::ComPtr<ID3DBlob> errors;
+		D3D12SerializeRootSignature(&rootSig, D3D_ROOT_SIGNATURE_VERSION_1, serializedRootSig.GetAddressOf(), errors.GetAddressOf());
+		if (errors)
+		{
+			OutputDebugStringA((char*)errors->GetBufferPointer());
+			LOG_ERROR("Occlusion culling root signature: %s", (char*)errors->GetBufferPointer());
+		}
+
+		device->CreateRootSignature(0, serializedRootSig->GetBufferPointer(), serializedRootSig->GetBufferSize(), IID_PPV_ARGS(rootSignature.GetAddressOf()));
+	}
+
+	// Compute pipelines
+	{
+		Microsoft::WRL::ComPtr<ID3DBlob> hiZShader;
+		Microsoft::WRL::ComPtr<ID3DBlob> cullShader;
+		D3DReadFileToBlob(hiZShaderPath.c_str(), hiZShader.GetAddressOf());
+		D3DReadFileToBlob(cullShaderPath.c_str(), cullShader.GetAddressOf());
+
+		D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+		psoDesc.pRootSignature = rootSignature.Get();
+		psoDesc.CS.pShaderBytecode = hiZShader->GetBufferPointer();
+		psoDesc.CS.BytecodeLength = hiZShader->GetBufferSize();
+		device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(hiZPipeline.GetAddressOf()));
+
+		psoDesc.CS.pShaderBytecode = cullShader->GetBufferPointer();
+		psoDesc.CS.BytecodeLength = cullShader->GetBufferSize();
+		device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(cullPipeline.GetAddressOf()));
+	}
+
+	// Plain indexed draws - nothing else changes between them
+	{
+		D3D12_INDIRECT_ARGUMENT_DESC argument = {};
+		argument.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+
+		D3D12_COMMAND_SIGNATURE_DESC signatureDesc = {};
+		signatureDesc.ByteStride = sizeof(D3D12_DRAW_INDEXED_ARGUMENTS);
+		signatureDesc.NumArgumentDescs = 1;
+		signatureDesc.pArgumentDescs = &argument;
+		device->CreateCommandSignature(&signatureDesc, 0, IID_PPV_ARGS(commandSignature.GetAddressOf()));
+	}
+
+	// The Hi-Z build's group counter, which it resets itself after every use
+	UINT64 counterSize = 0;
+	GrowBuffer(hiZCounter, counterSize, sizeof(unsigned int));
+
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	descriptorsGPU = dx12Helper.ReserveDescriptors(2 + maxHiZMips, &descriptorsCPU);
+	descriptorSize = dx12Helper.GetDescriptorIncrementSize();
+}
+
+void OcclusionCuller::Resize(ID3D12Resource* depthBuffer, unsigned int width, unsigned int height)
+{
+	if (!device)
+		return;
+
+	ResourceStateTracker& stateTracker = DX12Helper::GetInstance().GetStateTracker();
+	if (hiZ)
+	{
+		stateTracker.Unregister(hiZ.Get());
+		hiZ.Reset();
+	}
+
+	depthWidth = width;
+	depthHeight = height;
+
+	// Half size (rounded up) and halving from there
+	unsigned int hiZWidth = (width + 1) / 2;
+	unsigned int hiZHeight = (height + 1) / 2;
+	hiZMipCount = 1;
+	for (unsigned int size = max(hiZWidth, hiZHeight); size > 1 && hiZMipCount < maxHiZMips; size = (size + 1) / 2)
+		hiZMipCount++;
+
+	D3D12_HEAP_PROPERTIES props = {};
+	props.Type = D3D12_HEAP_TYPE_DEFAULT;
+	props.CreationNodeMask = 1;
+	props.VisibleNodeMask = 1;
+
+	D3D12_RESOURCE_DESC desc = {};
+	desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	desc.Width = hiZWidth;
+	desc.Height = hiZHeight;
+	desc.DepthOrArraySize = 1;
+	desc.MipLevels = (UINT16)hiZMipCount;
+	desc.Format = DXGI_FORMAT_R32_FLOAT;
+	desc.SampleDesc.Count = 1;
+	desc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+	device->CreateCommittedResource(&props, D3D12_HEAP_FLAG_NONE, &desc,
+		D3D12_RESOURCE_STATE_COMMON, 0, IID_PPV_ARGS(hiZ.GetAddressOf()));
+	stateTracker.Register(hiZ.Get(), D3D12_RESOURCE_STATE_COMMON);
+
+	// Depth as a texture (the depth half of D24S8)
+	D3D12_CPU_DESCRIPTOR_HANDLE handle = descriptorsCPU;
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Texture2D.MipLevels = 1;
+	device->CreateShaderResourceView(depthBuffer, &srvDesc, handle);
+	handle.ptr += descriptorSize;
+
+	// Every Hi-Z mip at once, for the culling
+	srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	srvDesc.Texture2D.MipLevels = hiZMipCount;
+	device->CreateShaderResourceView(hiZ.Get(), &srvDesc, handle);
+	handle.ptr += descriptorSize;
+
+	// One UAV per mip for the build. The table always has all of
+	// them, so mips that don't exist get null descriptors.
+	for (unsigned int mip = 0; mip < maxHiZMips; mip++)
+	{
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+		uavDesc.Texture2D.MipSlice = mip < hiZMipCount ? mip : 0;
+		device->CreateUnorderedAccessView(mip < hiZMipCount ? hiZ.Get() : 0, 0, &uavDesc, handle);
+		handle.ptr += descriptorSize;
+	}
+}
+
+void OcclusionCuller::GrowBuffer(Microsoft::WRL::ComPtr<ID3D12Resource>& buffer, UINT64& currentSize, UINT64 size)
+{
+	if (buffer && currentSize >= size)
+		return;
+
+	// Room to grow, so a slowly growing scene isn't reallocating every frame
+	UINT64 newSize = max(size, currentSize * 2);
+	ResourceStateTracker& stateTracker = DX12Helper::GetInstance().GetStateTracker();
+	if (buffer)
+	{
+		stateTracker.Unregister(buffer.Get());
+		if (!retired.empty())
+			retired[currentSlot].push_back(buffer);
+		buffer.Reset();
+	}
+
+	D3D12_HEAP_PROPERTIES props = {};
+	props.Type = D3D12_HEAP_TYPE_DEFAULT;
+	props.CreationNodeMask = 1;
+	props.VisibleNodeMask = 1;
+
+	D3D12_RESOURCE_DESC desc = {};
+	desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+	desc.Width = newSize;
+	desc.Height = 1;
+	desc.DepthOrArraySize = 1;
+	desc.MipLevels = 1;
+	desc.Format = DXGI_FORMAT_UNKNOWN;
+	desc.SampleDesc.Count = 1;
+	desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+	desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+	// New committed resources come zeroed, which is what the visibility and the counter want
+	device->CreateCommittedResource(&props, D3D12_HEAP_FLAG_NONE, &desc,
+		D3D12_RESOURCE_STATE_COMMON, 0, IID_PPV_ARGS(buffer.GetAddressOf()));
+	stateTracker.Register(buffer.Get(), D3D12_RESOURCE_STATE_COMMON);
+	currentSize = newSize;
+}
+
+void OcclusionCuller::Prepare(
+	const std::vector<DrawBatch>& batches,
+	const std::vector<InstanceData>& instances,
+	const std::vector<uint32_t>& instanceEntities,
+	unsigned int entityCount,
+	const XMFLOAT4X4& viewProjection,
+	D3D12_GPU_VIRTUAL_ADDRESS instanceData,
+	unsigned int frameIndex)
+{
+	// This slot's last frame is done on the GPU
+	currentSlot = frameIndex % retired.size();
+	retired[currentSlot].clear();
+
+	// Pick up what it drew
+	StatsReadback& readback = readbacks[currentSlot];
+	if (readback.buffer && readback.batchCount > 0)
+	{
+		D3D12_RANGE range = { 0, (SIZE_T)readback.batchCount * 2 * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS) };
+		D3D12_DRAW_INDEXED_ARGUMENTS* arguments = 0;
+		if (SUCCEEDED(readback.buffer->Map(0, &range, (void**)&arguments)))
+		{
+			stats = {};
+			stats.instances = readback.instanceCount;
+			for (unsigned int i = 0; i < readback.batchCount; i++)
+			{
+				stats.phaseOneDrawn += arguments[i].InstanceCount;
+				stats.phaseTwoDrawn += arguments[readback.batchCount + i].InstanceCount;
+			}
+			D3D12_RANGE nothingWritten = { 0, 0 };
+			readback.buffer->Unmap(0, &nothingWritten);
+		}
+	}
+
+	unsigned int instanceCount = (unsigned int)instances.size();
+	unsigned int batchCount = (unsigned int)batches.size();
+
+	GrowBuffer(drawArguments, drawArgumentsSize, (UINT64)batchCount * 2 * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS));
+	GrowBuffer(visibleInstances, visibleInstancesSize, (UINT64)instanceCount * 2 * sizeof(InstanceData));
+	GrowBuffer(visibility, visibilitySize, (UINT64)entityCount * sizeof(unsigned int));
+
+	// Which entity and batch each instance belongs to
+	instanceInfoData.resize(instanceCount * 2);
+	batchCullData.resize(batchCount);
+	for (unsigned int b = 0; b < batchCount; b++)
+	{
+		const DrawBatch& batch = batches[b];
+		BatchCullData& data = batchCullData[b];
+		data.boundsCenter = batch.mesh->GetBoundsCenter();
+		data.boundsRadius = batch.mesh->GetBoundsRadius();
+		data.indexCount = batch.mesh->GetIndexCount();
+		data.firstInstance = batch.firstInstance;
+
+		for (unsigned int i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; i++)
+		{
+			instanceInfoData[i * 2] = instanceEntities[i];
+			instanceInfoData[i * 2 + 1] = b;
+		}
+	}
+
+	// Both go through the instance ring, read by address
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	this->instanceData = instanceData;
+	instanceInfo = dx12Helper.FillNextInstanceBufferAndGetView(instanceInfoData.data(), sizeof(uint32_t) * 2, instanceCount).BufferLocation;
+	batchData = dx12Helper.FillNextInstanceBufferAndGetView(batchCullData.data(), sizeof(BatchCullData), batchCount).BufferLocation;
+
+	constants.viewProjection = viewProjection;
+	constants.instanceCount = instanceCount;
+	constants.batchCount = batchCount;
+	constants.hiZMipCount = hiZMipCount;
+	constants.depthSize[0] = depthWidth;
+	constants.depthSize[1] = depthHeight;
+}
+
+void OcclusionCuller::SetRootParameters(ID3D12GraphicsCommandList* commandList)
+{
+	ID3D12DescriptorHeap* heap = DX12Helper::GetInstance().GetCBVSRVDescriptorHeap().Get();
+	commandList->SetDescriptorHeaps(1, &heap);
+	commandList->SetComputeRootSignature(rootSignature.Get());
+}
+
+void OcclusionCuller::RecordCull(ID3D12GraphicsCommandList* commandList, unsigned int phase)
+{
+	SetRootParameters(commandList);
+	commandList->SetPipelineState(cullPipeline.Get());
+	commandList->SetComputeRootShaderResourceView(ROOT_INSTANCES, instanceData);
+	commandList->SetComputeRootShaderResourceView(ROOT_INSTANCE_INFO, instanceInfo);
+	commandList->SetComputeRootShaderResourceView(ROOT_BATCHES, batchData);
+	commandList->SetComputeRootUnorderedAccessView(ROOT_DRAW_ARGUMENTS, drawArguments->GetGPUVirtualAddress());
+	commandList->SetComputeRootUnorderedAccessView(ROOT_VISIBLE_INSTANCES, visibleInstances->GetGPUVirtualAddress());
+	commandList->SetComputeRootUnorderedAccessView(ROOT_VISIBILITY, visibility->GetGPUVirtualAddress());
+
+	// Hi-Z (only read by phase two)
+	D3D12_GPU_DESCRIPTOR_HANDLE hiZHandle = descriptorsGPU;
+	hiZHandle.ptr += descriptorSize;
+	commandList->SetComputeRootDescriptorTable(ROOT_TEXTURE, hiZHandle);
+
+	unsigned int instanceGroups = (constants.instanceCount + 63) / 64;
+	if (phase == 0)
+	{
+		// Fresh arguments, and they have to be in before anything's appended
+		constants.mode = MODE_RESET;
+		commandList->SetComputeRoot32BitConstants(ROOT_CONSTANTS, sizeof(CullConstants) / 4, &constants, 0);
+		commandList->Dispatch((constants.batchCount + 63) / 64, 1, 1);
+
+		ResourceStateTracker& stateTracker = DX12Helper::GetInstance().GetStateTracker();
+		stateTracker.UAVBarrier(drawArguments.Get());
+		stateTracker.Flush(commandList);
+
+		constants.mode = MODE_PHASE_ONE;
+		commandList->SetComputeRoot32BitConstants(ROOT_CONSTANTS, sizeof(CullConstants) / 4, &constants, 0);
+		commandList->Dispatch(instanceGroups, 1, 1);
+	}
+	else
+	{
+		constants.mode = MODE_PHASE_TWO;
+		commandList->SetComputeRoot32BitConstants(ROOT_CONSTANTS, sizeof(CullConstants) / 4, &constants, 0);
+		commandList->Dispatch(instanceGroups, 1, 1);
+	}
+}
+
+void OcclusionCuller::RecordHiZ(ID3D12GraphicsCommandList* commandList)
+{
+	// Each group covers 64x64 pixels of depth
+	unsigned int groupsX = (depthWidth + 63) / 64;
+	unsigned int groupsY = (depthHeight + 63) / 64;
+
+	HiZConstants hiZConstants = {};
+	hiZConstants.depthSize[0] = depthWidth;
+	hiZConstants.depthSize[1] = depthHeight;
+	hiZConstants.mipCount = hiZMipCount;
+	hiZConstants.groupCount = groupsX * groupsY;
+	hiZConstants.mip5Size[0] = groupsX;
+	hiZConstants.mip5Size[1] = groupsY;
+
+	D3D12_GPU_DESCRIPTOR_HANDLE mipHandle = descriptorsGPU;
+	mipHandle.ptr += descriptorSize * 2;
+
+	SetRootParameters(commandList);
+	commandList->SetPipelineState(hiZPipeline.Get());
+	commandList->SetComputeRoot32BitConstants(ROOT_CONSTANTS, sizeof(HiZConstants) / 4, &hiZConstants, 0);
+	commandList->SetComputeRootUnorderedAccessView(ROOT_VISIBILITY, hiZCounter->GetGPUVirtualAddress());
+	commandList->SetComputeRootDescriptorTable(ROOT_TEXTURE, descriptorsGPU);
+	commandList->SetComputeRootDescriptorTable(ROOT_HIZ_MIPS, mipHandle);
+	commandList->Dispatch(groupsX, groupsY, 1);
+}
+
+void OcclusionCuller::RecordStatsReadback(ID3D12GraphicsCommandList* commandList)
+{
+	StatsReadback& readback = readbacks[currentSlot];
+	UINT64 size = (UINT64)constants.batchCount * 2 * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS);
+	readback.batchCount = 0;
+	if (size == 0)
+		return;
+
+	if (!readback.buffer || readback.size < size)
+	{
+		D3D12_HEAP_PROPERTIES props = {};
+		props.Type = D3D12_HEAP_TYPE_READBACK;
+		props.CreationNodeMask = 1;
+		props.VisibleNodeMask = 1;
+
+		D3D12_RESOURCE_DESC desc = {};
+		desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+		desc.Width = drawArgumentsSize;
+		desc.Height = 1;
+		desc.DepthOrArraySize = 1;
+		desc.MipLevels = 1;
+		desc.Format = DXGI_FORMAT_UNKNOWN;
+		desc.SampleDesc.Count = 1;
+		desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+
+		readback.buffer.Reset();
+		device->CreateCommittedResource(&props, D3D12_HEAP_FLAG_NONE, &desc,
+			D3D12_RESOURCE_STATE_COPY_DEST, 0, IID_PPV_ARGS(readback.buffer.GetAddressOf()));
+		readback.size = drawArgumentsSize;
+	}
+
+	commandList->CopyBufferRegion(readback.buffer.Get(), 0, drawArguments.Get(), 0, size);
+	readback.batchCount = constants.batchCount;
+	readback.instanceCount = constants.instanceCount;
+}
+
+D3D12_VERTEX_BUFFER_VIEW OcclusionCuller::GetInstanceView()
+{
+	D3D12_VERTEX_BUFFER_VIEW view = {};
+	view.BufferLocation = visibleInstances->GetGPUVirtualAddress();
+	view.SizeInBytes = (UINT)((UINT64)constants.instanceCount * 2 * sizeof(InstanceData));
+	view.StrideInBytes = sizeof(InstanceData);
+	return view;
+}
+
+void OcclusionCuller::DrawIndirect(ID3D12GraphicsCommandList* commandList, unsigned int batch, unsigned int phase)
+{
+	UINT64 offset = (UINT64)(phase * constants.batchCount + batch) * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS);
+	commandList->ExecuteIndirect(commandSignature.Get(), 1, drawArguments.Get(), offset, 0, 0);
+}
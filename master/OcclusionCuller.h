@@ -0,0 +1,182 @@
+#pragma once
+
+#include <d3d12.h>
+#include <DirectXMath.h>
+#include <wrl/client.h>
+#include <string>
+#include <vector>
+
+#include "BufferStructs.h"
+#include "RenderQueue.h"
+
+// Counts for the stats window, read back a few frames late
+struct OcclusionCullStats
+{
+	unsigned int instances;		// Everything that was tested
+	unsigned int phaseOneDrawn;	// Visible last frame, drawn first
+	unsigned int phaseTwoDrawn;	// Came into view this frame
+};
+
+// --------------------------------------------------------
+// Two phase occlusion culling on the GPU.
+//
+// A frame goes:
+//  1. RecordCull(list, 0): whatever was visible last frame
+//     (and is in the frustum) goes into phase one's draws
+//  2. phase one draws, laying down most of the final depth
+//  3. RecordHiZ(): the depth buffer becomes a max-depth
+//     pyramid in a single dispatch
+//  4. RecordCull(list, 1): everything is tested against the
+//     pyramid - that's this frame's visibility, kept for the
+//     next one - and whatever's visible but wasn't drawn in
+//     phase one goes into phase two's draws
+//  5. phase two draws
+//
+// Visible instances are compacted into a buffer of our own
+// and every batch becomes one ExecuteIndirect, so the CPU
+// never has to know what was culled. Batches stay separate
+// draws since pipeline and material changes can't happen
+// inside an indirect call.
+//
+// Visibility is kept per entity (by its index in the scene's
+// list), so it's only meaningful while the list stays put -
+// a stale entry just costs a frame of extra phase two work.
+// --------------------------------------------------------
+class OcclusionCuller
+{
+public:
+	OcclusionCuller();
+
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, const std::wstring& hiZShaderPath, const std::wstring& cullShaderPath, unsigned int framesInFlight);
+
+	// (Re)builds the Hi-Z pyramid for a new depth buffer
+	void Resize(ID3D12Resource* depthBuffer, unsigned int width, unsigned int height);
+
+	// Main thread, once the frame's batches and instances are uploaded.
+	// instanceData is where the instance list went on the GPU.
+	void Prepare(
+		const std::vector<DrawBatch>& batches,
+		const std::vector<InstanceData>& instances,
+		const std::vector<uint32_t>& instanceEntities,
+		unsigned int entityCount,
+		const DirectX::XMFLOAT4X4& viewProjection,
+		D3D12_GPU_VIRTUAL_ADDRESS instanceData,
+		unsigned int frameIndex);
+
+	// Phase 0 also resets the draw arguments
+	void RecordCull(ID3D12GraphicsCommandList* commandList, unsigned int phase);
+	void RecordHiZ(ID3D12GraphicsCommandList* commandList);
+	void RecordStatsReadback(ID3D12GraphicsCommandList* commandList);
+
+	// Instance buffer view for slot 1 - each phase's draws pick out their own part
+	D3D12_VERTEX_BUFFER_VIEW GetInstanceView();
+	void DrawIndirect(ID3D12GraphicsCommandList* commandList, unsigned int batch, unsigned int phase);
+
+	// For importing into the render graph
+	ID3D12Resource* GetDrawArguments() { return drawArguments.Get(); }
+	ID3D12Resource* GetVisibleInstances() { return visibleInstances.Get(); }
+	ID3D12Resource* GetVisibility() { return visibility.Get(); }
+	ID3D12Resource* GetHiZ() { return hiZ.Get(); }
+	ID3D12Resource* GetHiZCounter() { return hiZCounter.Get(); }
+
+	const OcclusionCullStats& GetStats() { return stats; }
+
+private:
+	static const unsigned int maxHiZMips = 12; // Enough for a 4096x4096 depth buffer
+
+	// Root parameters, shared by both shaders
+	enum RootParameter
+	{
+		ROOT_CONSTANTS,
+		ROOT_INSTANCES,			// t0
+		ROOT_INSTANCE_INFO,		// t1
+		ROOT_BATCHES,			// t2
+		ROOT_DRAW_ARGUMENTS,	// u0
+		ROOT_VISIBLE_INSTANCES,	// u1
+		ROOT_VISIBILITY,		// u2 (the group counter for the Hi-Z build)
+		ROOT_TEXTURE,			// t3 table: depth or Hi-Z
+		ROOT_HIZ_MIPS,			// u3-u14 table
+		ROOT_PARAMETER_COUNT
+	};
+
+	// Same layouts as the shaders' cbuffers
+	struct CullConstants
+	{
+		DirectX::XMFLOAT4X4 viewProjection;
+		unsigned int instanceCount;
+		unsigned int batchCount;
+		unsigned int mode;
+		unsigned int hiZMipCount;
+		unsigned int depthSize[2];
+		unsigned int padding[2];
+	};
+	struct HiZConstants
+	{
+		unsigned int depthSize[2];
+		unsigned int mipCount;
+		unsigned int groupCount;
+		unsigned int mip5Size[2];
+		unsigned int padding[2];
+	};
+	struct BatchCullData
+	{
+		DirectX::XMFLOAT3 boundsCenter;
+		float boundsRadius;
+		unsigned int indexCount;
+		unsigned int firstInstance;
+		unsigned int padding[2];
+	};
+
+	Microsoft::WRL::ComPtr<ID3D12Device> device;
+	Microsoft::WRL::ComPtr<ID3D12RootSignature> rootSignature;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> hiZPipeline;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> cullPipeline;
+	Microsoft::WRL::ComPtr<ID3D12CommandSignature> commandSignature;
+
+	// Descriptors: depth SRV, Hi-Z SRV, then a UAV per Hi-Z mip
+	D3D12_CPU_DESCRIPTOR_HANDLE descriptorsCPU;
+	D3D12_GPU_DESCRIPTOR_HANDLE descriptorsGPU;
+	SIZE_T descriptorSize;
+
+	// Hi-Z pyramid, half the depth buffer's size and down
+	Microsoft::WRL::ComPtr<ID3D12Resource> hiZ;
+	Microsoft::WRL::ComPtr<ID3D12Resource> hiZCounter;
+	unsigned int depthWidth;
+	unsigned int depthHeight;
+	unsigned int hiZMipCount;
+
+	// Grow as the scene does
+	Microsoft::WRL::ComPtr<ID3D12Resource> drawArguments;	// Phase one's batches, then phase two's
+	Microsoft::WRL::ComPtr<ID3D12Resource> visibleInstances;	// Twice the instance count, a half per phase
+	Microsoft::WRL::ComPtr<ID3D12Resource> visibility;		// A uint per entity
+	UINT64 drawArgumentsSize;
+	UINT64 visibleInstancesSize;
+	UINT64 visibilitySize;
+
+	// Swapped out buffers, kept until their frame slot comes around again
+	std::vector<std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>>> retired;
+
+	// This frame
+	CullConstants constants;
+	D3D12_GPU_VIRTUAL_ADDRESS instanceData;
+	D3D12_GPU_VIRTUAL_ADDRESS instanceInfo;
+	D3D12_GPU_VIRTUAL_ADDRESS batchData;
+	unsigned int currentSlot;
+	std::vector<uint32_t> instanceInfoData;
+	std::vector<BatchCullData> batchCullData;
+
+	// Draw arguments copied back per frame slot, for the stats
+	struct StatsReadback
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> buffer;
+		UINT64 size;
+		unsigned int batchCount;
+		unsigned int instanceCount;
+	};
+	std::vector<StatsReadback> readbacks;
+	OcclusionCullStats stats;
+
+	// A buffer in a default heap, big enough for at least size bytes (retiring the old one)
+	void GrowBuffer(Microsoft::WRL::ComPtr<ID3D12Resource>& buffer, UINT64& currentSize, UINT64 size);
+	void SetRootParameters(ID3D12GraphicsCommandList* commandList);
+};
@@ -0,0 +1,160 @@
+#include "OverdrawEstimator.h"
+
+// Turns the prepass on above enableThreshold and off below disableThreshold.
+// The gap keeps it from flipping back and forth every frame.
+static const float enableThreshold = 1.5f;
+static const float disableThreshold = 1.2f;
+
+OverdrawEstimator::OverdrawEstimator() :
+	readbackData(0),
+	currentSlot(0),
+	mode(DEPTH_PREPASS_AUTO),
+	usePrepass(false),
+	measuredOverdraw(0.0f),
+	overdrawLowerBound(0.0f)
+{
+	queryCounters[0] = 0;
+	queryCounters[1] = 0;
+}
+
+OverdrawEstimator::~OverdrawEstimator()
+{
+	if (readbackBuffer && readbackData)
+		readbackBuffer->Unmap(0, 0);
+}
+
+// Smooth it out a bit so one odd frame doesn't flip the decision.
+// 0 means no samples yet, so the first one is taken as is.
+static float Smooth(float average, float sample)
+{
+	return average == 0.0f ? sample : average * 0.9f + sample * 0.1f;
+}
+
+void OverdrawEstimator::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, unsigned int framesInFlight)
+{
+	slots.assign(framesInFlight, FrameSlot());
+
+	D3D12_QUERY_HEAP_DESC heapDesc = {};
+	heapDesc.Type = D3D12_QUERY_HEAP_TYPE_OCCLUSION;
+	heapDesc.Count = queriesPerFrame * framesInFlight;
+	device->CreateQueryHeap(&heapDesc, IID_PPV_ARGS(queryHeap.GetAddressOf()));
+
+	// One UINT64 per query, read on the CPU
+	D3D12_HEAP_PROPERTIES heapProps = {};
+	heapProps.Type = D3D12_HEAP_TYPE_READBACK;
+	heapProps.CreationNodeMask = 1;
+	heapProps.VisibleNodeMask = 1;
+
+	D3D12_RESOURCE_DESC desc = {};
+	desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+	desc.Width = sizeof(UINT64) * heapDesc.Count;
+	desc.Height = 1;
+	desc.DepthOrArraySize = 1;
+	desc.MipLevels = 1;
+	desc.Format = DXGI_FORMAT_UNKNOWN;
+	desc.SampleDesc.Count = 1;
+	desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+
+	device->CreateCommittedResource(
+		&heapProps,
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		D3D12_RESOURCE_STATE_COPY_DEST, // Readback buffers never leave this state
+		0,
+		IID_PPV_ARGS(readbackBuffer.GetAddressOf()));
+
+	readbackBuffer->Map(0, 0, (void**)&readbackData);
+}
+
+void OverdrawEstimator::BeginFrame(unsigned int frameIndex, unsigned int screenPixels)
+{
+	currentSlot = frameIndex % slots.size();
+	FrameSlot& slot = slots[currentSlot];
+
+	// Add up what every list measured last time around
+	UINT64 samples[2] = {};
+	const UINT64* results = readbackData + currentSlot * queriesPerFrame;
+	for (unsigned int group = 0; group < 2; group++)
+	{
+		for (unsigned int i = 0; i < slot.queryCount[group]; i++)
+			samples[group] += results[group * queriesPerGroup + i];
+	}
+
+	if (slot.queryCount[OVERDRAW_QUERY_MAIN] > 0)
+	{
+		// Whether the prepass actually ran, not just whether it was asked for
+		// (it can be skipped, like when occlusion culling is on)
+		bool usedPrepass = slot.queryCount[OVERDRAW_QUERY_PREPASS] > 0;
+		if (usedPrepass)
+		{
+			float measured = (float)samples[OVERDRAW_QUERY_PREPASS] / (float)(samples[OVERDRAW_QUERY_MAIN] ? samples[OVERDRAW_QUERY_MAIN] : 1);
+			measuredOverdraw = Smooth(measuredOverdraw, measured);
+		}
+		else
+		{
+			float lowerBound = (float)samples[OVERDRAW_QUERY_MAIN] / (float)(screenPixels ? screenPixels : 1);
+			overdrawLowerBound = Smooth(overdrawLowerBound, lowerBound);
+		}
+	}
+
+	switch (mode)
+	{
+	case DEPTH_PREPASS_ON: usePrepass = true; break;
+	case DEPTH_PREPASS_OFF: usePrepass = false; break;
+	default:
+		// Each number starts over whenever we switch into the state it's
+		// measured in, so the decision never rests on one from long ago.
+		// The lower bound never exceeds the real overdraw, so turning on
+		// above 1.5 can't be undone by the measured number dropping under 1.2.
+		if (!usePrepass && overdrawLowerBound > enableThreshold)
+		{
+			usePrepass = true;
+			measuredOverdraw = 0.0f;
+		}
+		else if (usePrepass && measuredOverdraw > 0.0f && measuredOverdraw < disableThreshold)
+		{
+			usePrepass = false;
+			overdrawLowerBound = 0.0f;
+		}
+		break;
+	}
+
+	slot.queryCount[0] = 0;
+	slot.queryCount[1] = 0;
+	queryCounters[0] = 0;
+	queryCounters[1] = 0;
+}
+
+int OverdrawEstimator::BeginQuery(ID3D12GraphicsCommandList* commandList, OverdrawQueryGroup group)
+{
+	unsigned int index = queryCounters[group].fetch_add(1);
+	if (index >= queriesPerGroup)
+		return -1;
+
+	int query = (int)(currentSlot * queriesPerFrame + group * queriesPerGroup + index);
+	commandList->BeginQuery(queryHeap.Get(), D3D12_QUERY_TYPE_OCCLUSION, query);
+	return query;
+}
+
+void OverdrawEstimator::EndQuery(ID3D12GraphicsCommandList* commandList, int query)
+{
+	if (query >= 0)
+		commandList->EndQuery(queryHeap.Get(), D3D12_QUERY_TYPE_OCCLUSION, query);
+}
+
+void OverdrawEstimator::Resolve(ID3D12GraphicsCommandList* commandList)
+{
+	FrameSlot& slot = slots[currentSlot];
+	for (unsigned int group = 0; group < 2; group++)
+	{
+		unsigned int count = queryCounters[group].load();
+		if (count > queriesPerGroup) count = queriesPerGroup;
+		slot.queryCount[group] = count;
+		if (count == 0)
+			continue;
+
+		unsigned int first = currentSlot * queriesPerFrame + group * queriesPerGroup;
+		commandList->ResolveQueryData(queryHeap.Get(), D3D12_QUERY_TYPE_OCCLUSION,
+			first, count, readbackBuffer.Get(), first * sizeof(UINT64));
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <d3d12.h>
+#include <wrl/client.h>
+#include <atomic>
+#include <vector>
+
+enum DepthPrepassMode
+{
+	DEPTH_PREPASS_AUTO,	// On or off depending on the overdraw estimate
+	DEPTH_PREPASS_ON,
+	DEPTH_PREPASS_OFF
+};
+
+// Which pass an occlusion query is measuring
+enum OverdrawQueryGroup
+{
+	OVERDRAW_QUERY_PREPASS = 0,
+	OVERDRAW_QUERY_MAIN = 1
+};
+
+// --------------------------------------------------------
+// Measures overdraw with occlusion queries (samples that pass
+// the depth test) and decides whether a depth prepass pays
+// for itself.
+//
+// With the prepass on, the prepass counts every fragment that
+// passed the depth test when drawn - what the main pass would
+// shade without it - and the main pass (EQUAL) counts only the
+// visible ones, so their ratio is the overdraw we're avoiding.
+// With it off all we have is what the main pass shaded, which
+// over the screen's pixel count is a lower bound (assumes the
+// scene covers the whole screen). The two aren't the same
+// measurement, so each is smoothed on its own and only ever
+// compared against its own threshold: the lower bound turns
+// the prepass on, the measured overdraw turns it back off.
+//
+// Queries can't span command lists, so every list that draws
+// gets a query of its own and they're summed up. Results are
+// read back when the frame slot comes around again.
+// --------------------------------------------------------
+class OverdrawEstimator
+{
+public:
+	OverdrawEstimator();
+	~OverdrawEstimator();
+
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, unsigned int framesInFlight);
+
+	// Picks up this slot's results from last time (the GPU has to be done
+	// with it) and decides whether this frame uses the prepass
+	void BeginFrame(unsigned int frameIndex, unsigned int screenPixels);
+
+	bool UsePrepass() { return usePrepass; }
+	void SetMode(DepthPrepassMode mode) { this->mode = mode; }
+	DepthPrepassMode GetMode() { return mode; }
+	// Whichever of the two numbers below the current decision rests on
+	float GetEstimate() { return usePrepass ? measuredOverdraw : overdrawLowerBound; }
+	bool IsEstimateLowerBound() { return !usePrepass; }
+
+	// Wrap a command list's draws in these. Thread safe. Returns the query
+	// index for EndQuery, or -1 once this frame runs out of queries.
+	int BeginQuery(ID3D12GraphicsCommandList* commandList, OverdrawQueryGroup group);
+	void EndQuery(ID3D12GraphicsCommandList* commandList, int query);
+
+	// Copies this frame's results to the readback buffer.
+	// Has to be recorded after every EndQuery() of the frame.
+	void Resolve(ID3D12GraphicsCommandList* commandList);
+
+private:
+	static const unsigned int queriesPerGroup = 64;
+	static const unsigned int queriesPerFrame = queriesPerGroup * 2;
+
+	Microsoft::WRL::ComPtr<ID3D12QueryHeap> queryHeap;
+	Microsoft::WRL::ComPtr<ID3D12Resource> readbackBuffer;
+	UINT64* readbackData; // Stays mapped
+
+	// How many queries each frame slot recorded, so its results make sense later
+	struct FrameSlot
+	{
+		unsigned int queryCount[2];
+	};
+	std::vector<FrameSlot> slots;
+	unsigned int currentSlot;
+	std::atomic<unsigned int> queryCounters[2];
+
+	DepthPrepassMode mode;
+	bool usePrepass;
+	float measuredOverdraw;		// Prepass over main pass samples, from frames that ran the prepass
+	float overdrawLowerBound;	// Main pass samples over screen pixels, from frames that didn't
+};
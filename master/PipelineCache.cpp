@@ -0,0 +1,261 @@
+#include "PipelineCache.h"
+#include "Hash.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+PipelineCache* PipelineCache::instance;
+
+PipelineCache::~PipelineCache()
+{
+}
+
+void PipelineCache::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, std::wstring libraryPath, std::wstring manifestPath)
+{
+	this->device = device;
+	this->libraryPath = libraryPath;
+	this->manifestPath = manifestPath;
+
+	// Pipeline libraries need ID3D12Device1
+	Microsoft::WRL::ComPtr<ID3D12Device1> device1;
+	if (SUCCEEDED(device.As(&device1)))
+	{
+		std::ifstream file(libraryPath, std::ios::binary | std::ios::ate);
+		if (file.is_open())
+		{
+			libraryData.resize((size_t)file.tellg());
+			file.seekg(0);
+			file.read(libraryData.data(), libraryData.size());
+		}
+
+		// Written by a different driver or GPU, or just garbage? Start over
+		HRESULT hr = E_FAIL;
+		if (!libraryData.empty())
+			hr = device1->CreatePipelineLibrary(libraryData.data(), libraryData.size(), IID_PPV_ARGS(library.GetAddressOf()));
+		if (FAILED(hr))
+		{
+			libraryData.clear();
+			device1->CreatePipelineLibrary(0, 0, IID_PPV_ARGS(library.GetAddressOf()));
+		}
+	}
+	stats.libraryAvailable = library != 0;
+
+	std::ifstream manifest(manifestPath);
+	std::string key;
+	while (std::getline(manifest, key))
+	{
+		if (!key.empty())
+			manifestKeys.push_back(key);
+	}
+}
+
+void PipelineCache::RegisterRootSignature(ID3D12RootSignature* rootSignature, ID3DBlob* serialized)
+{
+	rootSignatureHashes[rootSignature] = HashBytes(HashStart, serialized->GetBufferPointer(), serialized->GetBufferSize());
+}
+
+uint64_t PipelineCache::HashDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+	uint64_t hash = HashStart;
+
+	auto it = rootSignatureHashes.find(desc.pRootSignature);
+	hash = HashValue(hash, it == rootSignatureHashes.end() ? (uint64_t)0 : it->second);
+
+	const D3D12_SHADER_BYTECODE* shaders[] = { &desc.VS, &desc.PS, &desc.DS, &desc.HS, &desc.GS };
+	for (const D3D12_SHADER_BYTECODE* shader : shaders)
+	{
+		hash = HashValue(hash, shader->BytecodeLength);
+		hash = HashBytes(hash, shader->pShaderBytecode, shader->BytecodeLength);
+	}
+
+	// Anything with padding (or pointers) in it goes field by field
+	for (UINT i = 0; i < desc.InputLayout.NumElements; i++)
+	{
+		const D3D12_INPUT_ELEMENT_DESC& element = desc.InputLayout.pInputElementDescs[i];
+		hash = HashBytes(hash, element.SemanticName, strlen(element.SemanticName) + 1);
+		hash = HashValue(hash, element.SemanticIndex);
+		hash = HashValue(hash, element.Format);
+		hash = HashValue(hash, element.InputSlot);
+		hash = HashValue(hash, element.AlignedByteOffset);
+		hash = HashValue(hash, element.InputSlotClass);
+		hash = HashValue(hash, element.InstanceDataStepRate);
+	}
+
+	hash = HashValue(hash, desc.BlendState.AlphaToCoverageEnable);
+	hash = HashValue(hash, desc.BlendState.IndependentBlendEnable);
+	for (const D3D12_RENDER_TARGET_BLEND_DESC& rt : desc.BlendState.RenderTarget)
+	{
+		hash = HashValue(hash, rt.BlendEnable);
+		hash = HashValue(hash, rt.LogicOpEnable);
+		hash = HashValue(hash, rt.SrcBlend);
+		hash = HashValue(hash, rt.DestBlend);
+		hash = HashValue(hash, rt.BlendOp);
+		hash = HashValue(hash, rt.SrcBlendAlpha);
+		hash = HashValue(hash, rt.DestBlendAlpha);
+		hash = HashValue(hash, rt.BlendOpAlpha);
+		hash = HashValue(hash, rt.LogicOp);
+		hash = HashValue(hash, rt.RenderTargetWriteMask);
+	}
+
+	const D3D12_DEPTH_STENCIL_DESC& ds = desc.DepthStencilState;
+	hash = HashValue(hash, ds.DepthEnable);
+	hash = HashValue(hash, ds.DepthWriteMask);
+	hash = HashValue(hash, ds.DepthFunc);
+	hash = HashValue(hash, ds.StencilEnable);
+	hash = HashValue(hash, ds.StencilReadMask);
+	hash = HashValue(hash, ds.StencilWriteMask);
+	hash = HashValue(hash, ds.FrontFace);
+	hash = HashValue(hash, ds.BackFace);
+
+	hash = HashValue(hash, desc.RasterizerState);
+	hash = HashValue(hash, desc.SampleMask);
+	hash = HashValue(hash, desc.IBStripCutValue);
+	hash = HashValue(hash, desc.PrimitiveTopologyType);
+	hash = HashValue(hash, desc.NumRenderTargets);
+	hash = HashValue(hash, desc.RTVFormats);
+	hash = HashValue(hash, desc.DSVFormat);
+	hash = HashValue(hash, desc.SampleDesc);
+	hash = HashValue(hash, desc.NodeMask);
+	hash = HashValue(hash, desc.Flags);
+	return hash;
+}
+
+void PipelineCache::CopyDesc(CachedPipeline& pipeline, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+	pipeline.desc = desc;
+
+	D3D12_SHADER_BYTECODE* shaders[] = { &pipeline.desc.VS, &pipeline.desc.PS, &pipeline.desc.DS, &pipeline.desc.HS, &pipeline.desc.GS };
+	for (int i = 0; i < 5; i++)
+	{
+		const unsigned char* code = (const unsigned char*)shaders[i]->pShaderBytecode;
+		pipeline.shaderCode[i].assign(code, code + shaders[i]->BytecodeLength);
+		shaders[i]->pShaderBytecode = pipeline.shaderCode[i].data();
+	}
+
+	pipeline.semanticNames.resize(desc.InputLayout.NumElements);
+	pipeline.inputElements.assign(desc.InputLayout.pInputElementDescs, desc.InputLayout.pInputElementDescs + desc.InputLayout.NumElements);
+	for (UINT i = 0; i < desc.InputLayout.NumElements; i++)
+	{
+		pipeline.semanticNames[i] = desc.InputLayout.pInputElementDescs[i].SemanticName;
+		pipeline.inputElements[i].SemanticName = pipeline.semanticNames[i].c_str();
+	}
+	pipeline.desc.InputLayout.pInputElementDescs = pipeline.inputElements.data();
+
+	// Not supported (and not used), don't point at memory we don't own
+	pipeline.desc.StreamOutput = {};
+	pipeline.desc.CachedPSO = {};
+}
+
+std::shared_ptr<CachedPipeline> PipelineCache::Request(
+	const std::string& key,
+	const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> fallback)
+{
+	usedKeys.insert(key);
+
+	uint64_t hash = HashDesc(desc);
+	auto it = pipelines.find(hash);
+	if (it != pipelines.end())
+		return it->second;
+
+	std::shared_ptr<CachedPipeline> pipeline = std::make_shared<CachedPipeline>();
+	pipeline->hash = hash;
+	pipeline->ready.store(false, std::memory_order_relaxed);
+	pipeline->fallback = fallback;
+	CopyDesc(*pipeline, desc);
+	pipelines[hash] = pipeline;
+
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		stats.requests++;
+		stats.pending++;
+	}
+
+	JobSystem::GetInstance().Schedule([this, pipeline]() { Compile(*pipeline); }, &compileCounter);
+	return pipeline;
+}
+
+// Runs on a worker
+void PipelineCache::Compile(CachedPipeline& pipeline)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	wchar_t name[32];
+	swprintf_s(name, L"PSO_%016llx", (unsigned long long)pipeline.hash);
+
+	// Each pipeline only ever gets one job, so nobody else is loading
+	// this name - the one thing the library doesn't synchronize itself
+	bool fromLibrary = false;
+	if (library)
+	{
+		fromLibrary = SUCCEEDED(library->LoadGraphicsPipeline(name, &pipeline.desc, IID_PPV_ARGS(pipeline.pipelineState.GetAddressOf())));
+	}
+
+	if (!fromLibrary)
+	{
+		device->CreateGraphicsPipelineState(&pipeline.desc, IID_PPV_ARGS(pipeline.pipelineState.GetAddressOf()));
+		if (library && pipeline.pipelineState && SUCCEEDED(library->StorePipeline(name, pipeline.pipelineState.Get())))
+			libraryDirty = true;
+	}
+
+	// If compiling failed we're stuck with the fallback
+	if (pipeline.pipelineState)
+		pipeline.ready.store(true, std::memory_order_release);
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::lock_guard<std::mutex> lock(statsMutex);
+	stats.pending--;
+	stats.compileMs += ms;
+	if (fromLibrary) stats.libraryHits++;
+	else stats.compiles++;
+}
+
+void PipelineCache::Wait(const std::shared_ptr<CachedPipeline>& pipeline)
+{
+	// There's no counter per pipeline, so this waits for everything
+	// in flight - only meant for startup, before there's a fallback
+	if (!pipeline->IsReady())
+		JobSystem::GetInstance().Wait(&compileCounter);
+}
+
+void PipelineCache::Prewarm(const std::function<void(const std::string& key)>& request)
+{
+	for (const std::string& key : manifestKeys)
+		request(key);
+}
+
+void PipelineCache::Shutdown()
+{
+	JobSystem::GetInstance().Wait(&compileCounter);
+
+	if (library && libraryDirty)
+	{
+		std::vector<char> data(library->GetSerializedSize());
+		if (SUCCEEDED(library->Serialize(data.data(), data.size())))
+		{
+			// Write somewhere else first so a crash can't leave half a library behind
+			std::wstring tempPath = libraryPath + L".tmp";
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			file.write(data.data(), data.size());
+			file.close();
+			if (file)
+				MoveFileExW(tempPath.c_str(), libraryPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+		}
+		libraryDirty = false;
+	}
+
+	std::ofstream manifest(manifestPath, std::ios::trunc);
+	for (const std::string& key : usedKeys)
+		manifest << key << "\n";
+
+	pipelines.clear();
+	library.Reset();
+	libraryData.clear();
+}
+
+PipelineCacheStats PipelineCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	return stats;
+}
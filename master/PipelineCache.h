@@ -0,0 +1,156 @@
+#pragma once
+
+#include <d3d12.h>
+#include <wrl/client.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <vector>
+
+#include "JobSystem.h"
+
+// --------------------------------------------------------
+// A pipeline state that may still be compiling. Until it's
+// ready, Get() hands out the fallback instead (which has to
+// use the same root signature and input layout).
+// --------------------------------------------------------
+class CachedPipeline
+{
+public:
+	ID3D12PipelineState* Get()
+	{
+		return ready.load(std::memory_order_acquire) ? pipelineState.Get() : fallback.Get();
+	}
+
+	bool IsReady() { return ready.load(std::memory_order_acquire); }
+	uint64_t GetHash() { return hash; }
+
+private:
+	friend class PipelineCache;
+
+	uint64_t hash;
+	std::atomic<bool> ready;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> fallback;
+
+	// Our own copy of everything the description points to,
+	// since compiling happens after the caller's copy is gone
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC desc;
+	std::vector<unsigned char> shaderCode[5]; // VS, PS, DS, HS, GS
+	std::vector<D3D12_INPUT_ELEMENT_DESC> inputElements;
+	std::vector<std::string> semanticNames;
+};
+
+// Counters for the stats window
+struct PipelineCacheStats
+{
+	unsigned int requests;		// Distinct pipelines asked for
+	unsigned int libraryHits;	// Loaded straight out of the on-disk library
+	unsigned int compiles;		// Had to be compiled (and were added to the library)
+	unsigned int pending;		// Still compiling right now
+	double compileMs;			// Total time spent on workers getting pipelines ready
+	bool libraryAvailable;		// False when the driver can't do pipeline libraries
+};
+
+// --------------------------------------------------------
+// Pipeline states, cached on disk and compiled in the background.
+//
+// Every pipeline is keyed by a hash of its full description
+// (shader bytecode, input layout, root signature, states) and
+// stored in an ID3D12PipelineLibrary that's written out at
+// shutdown, so the next run only pays for loading them.
+//
+// Request() returns right away - compiling (or loading) runs as
+// a job on the JobSystem, and the pipeline's fallback is used
+// in the meantime.
+//
+// The manifest is a list of the keys the game asked for during
+// the last run. Prewarm() feeds them back to the game at startup
+// so those pipelines get going before anything needs them.
+//
+// Request(), Prewarm() and Shutdown() are main thread only.
+// --------------------------------------------------------
+class PipelineCache
+{
+#pragma region Singleton
+public:
+	// Gets the one and only instance of this class
+	static PipelineCache& GetInstance()
+	{
+		if (!instance)
+		{
+			instance = new PipelineCache();
+		}
+
+		return *instance;
+	}
+
+	// Remove these functions (C++ 11 version)
+	PipelineCache(PipelineCache const&) = delete;
+	void operator=(PipelineCache const&) = delete;
+
+private:
+	static PipelineCache* instance;
+	PipelineCache() :
+		libraryDirty(false),
+		stats()
+	{ };
+#pragma endregion
+
+public:
+	~PipelineCache();
+
+	// Opens the library (starting a fresh one if it's missing, corrupt or
+	// from another driver) and reads the manifest
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, std::wstring libraryPath, std::wstring manifestPath);
+
+	// Root signatures only exist as pointers at runtime, so their
+	// serialized form is what goes into pipeline hashes
+	void RegisterRootSignature(ID3D12RootSignature* rootSignature, ID3DBlob* serialized);
+
+	// Starts getting a pipeline ready. key is the game's own name for it
+	// (recorded in the manifest); the same description always returns the
+	// same CachedPipeline. fallback may be null if the caller Wait()s.
+	std::shared_ptr<CachedPipeline> Request(
+		const std::string& key,
+		const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+		Microsoft::WRL::ComPtr<ID3D12PipelineState> fallback);
+
+	// Blocks (helping out with jobs) until the pipeline is ready
+	void Wait(const std::shared_ptr<CachedPipeline>& pipeline);
+
+	// Calls request once for every key in last run's manifest
+	void Prewarm(const std::function<void(const std::string& key)>& request);
+
+	// Waits for outstanding compiles, then writes the library and manifest
+	void Shutdown();
+
+	PipelineCacheStats GetStats();
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> device;
+	Microsoft::WRL::ComPtr<ID3D12PipelineLibrary> library;
+	std::vector<char> libraryData; // Must outlive the library, it reads from it directly
+	std::wstring libraryPath;
+	std::wstring manifestPath;
+	std::atomic<bool> libraryDirty;
+
+	std::unordered_map<ID3D12RootSignature*, uint64_t> rootSignatureHashes;
+	std::unordered_map<uint64_t, std::shared_ptr<CachedPipeline>> pipelines;
+
+	std::vector<std::string> manifestKeys;	// From last run
+	std::set<std::string> usedKeys;			// This run, written out at shutdown
+
+	JobCounter compileCounter;
+
+	std::mutex statsMutex;
+	PipelineCacheStats stats;
+
+	uint64_t HashDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+	void CopyDesc(CachedPipeline& pipeline, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+	void Compile(CachedPipeline& pipeline);
+};
@@ -1,12 +1,27 @@
 #include "LightingClean.hlsli"
 
+// Built as-is by the project, this is the generic shader that handles
+// any material and light setup. ShaderPermutations also compiles it with
+// PERMUTATION defined, along with:
+//  - DIR_LIGHTS, POINT_LIGHTS, SPOT_LIGHTS: how many of each light there are
+//  - HAS_NORMAL_MAP, HAS_ROUGHNESS_MAP, HAS_METAL_MAP: which maps the material has
+// to get a variant specialized for one material and light setup.
+#ifndef PERMUTATION
+#define HAS_NORMAL_MAP 1
+#define HAS_ROUGHNESS_MAP 1
+#define HAS_METAL_MAP 1
+#endif
+
 cbuffer ExternalData : register(b0)
 {
 	float2 uvScale;
 	float2 uvOffset;
 	float3 cameraPosition;
 	int lightCount;
-	Light lights[MAX_LIGHTS];
+	float materialRoughness;	// Used when there's no roughness map
+	float materialMetal;		// Used when there's no metal map
+	float2 padding;
+	Light lights[MAX_LIGHTS];	// Sorted by type: directional, point, then spot
 }
 
 // Struct representing the data we expect to receive from earlier pipeline stages
@@ -36,15 +51,25 @@ float4 main(VertexToPixel input) : SV_TARGET
 	input.uv = input.uv * uvScale + uvOffset;
 
 	// Normal mapping
+#ifdef HAS_NORMAL_MAP
 	input.normal = NormalMapping(NormalMap, BasicSampler, input.uv, input.normal, input.tangent);
+#endif
 
 	// Surface color with gamma correction
 	float4 surfaceColor = AlbedoTexture.Sample(BasicSampler, input.uv);
 	surfaceColor.rgb = pow(surfaceColor.rgb, 2.2);
 
-	// Sample the other maps
+	// Sample the other maps (or use the material's constants)
+#ifdef HAS_ROUGHNESS_MAP
 	float roughness = RoughnessMap.Sample(BasicSampler, input.uv).r;
+#else
+	float roughness = materialRoughness;
+#endif
+#ifdef HAS_METAL_MAP
 	float metal = MetalMap.Sample(BasicSampler, input.uv).r;
+#else
+	float metal = materialMetal;
+#endif
 
 	// Specular color - Assuming albedo texture is actually holding specular color if metal == 1
 	// Note the use of lerp here - metal is generally 0 or 1, but might be in between
@@ -54,6 +79,31 @@ float4 main(VertexToPixel input) : SV_TARGET
 	// Keep a running total of light
 	float3 totalLight = float3(0,0,0);
 
+#ifdef PERMUTATION
+	// The light counts are known up front, so each type gets its own
+	// unrolled loop and there's no branching on the light type
+	[unroll]
+	for (int d = 0; d < DIR_LIGHTS; d++)
+	{
+		Light light = lights[d];
+		light.Direction = normalize(light.Direction);
+		totalLight += DirLightPBR(light, input.normal, input.worldPos, cameraPosition, roughness, metal, surfaceColor.rgb, specColor);
+	}
+
+	[unroll]
+	for (int p = DIR_LIGHTS; p < DIR_LIGHTS + POINT_LIGHTS; p++)
+	{
+		totalLight += PointLightPBR(lights[p], input.normal, input.worldPos, cameraPosition, roughness, metal, surfaceColor.rgb, specColor);
+	}
+
+	[unroll]
+	for (int s = DIR_LIGHTS + POINT_LIGHTS; s < DIR_LIGHTS + POINT_LIGHTS + SPOT_LIGHTS; s++)
+	{
+		Light light = lights[s];
+		light.Direction = normalize(light.Direction);
+		totalLight += SpotLightPBR(light, input.normal, input.worldPos, cameraPosition, roughness, metal, surfaceColor.rgb, specColor);
+	}
+#else
 	// Loop and handle all lights
 	for (int i = 0; i < lightCount; i++)
 	{
@@ -77,6 +127,7 @@ float4 main(VertexToPixel input) : SV_TARGET
 			break;
 		}
 	}
+#endif
 
 	// Gamma correct and return
 	return float4(pow(totalLight, 1.0f / 2.2f), 1.0f);
@@ -0,0 +1,69 @@
+#include "RadixSort.h"
+
+#include <cstring>
+
+unsigned int RadixSort64(uint64_t* keys, uint32_t* values, uint64_t* tempKeys, uint32_t* tempValues, size_t count)
+{
+	if (count < 2)
+		return 0;
+
+	// Build all 8 histograms in a single read of the keys
+	size_t histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t key = keys[i];
+		for (int pass = 0; pass < 8; pass++)
+		{
+			histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+		}
+	}
+
+	// Ping-pong between the caller's arrays and the temp arrays
+	uint64_t* srcKeys = keys;
+	uint32_t* srcValues = values;
+	uint64_t* dstKeys = tempKeys;
+	uint32_t* dstValues = tempValues;
+	unsigned int passesRun = 0;
+
+	for (int pass = 0; pass < 8; pass++)
+	{
+		size_t* histogram = histograms[pass];
+
+		// Every key has the same byte here, nothing would move
+		if (histogram[(srcKeys[0] >> (pass * 8)) & 0xFF] == count)
+			continue;
+
+		// Turn counts into starting offsets
+		size_t offsets[256];
+		size_t total = 0;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			offsets[digit] = total;
+			total += histogram[digit];
+		}
+
+		// Scatter (front to back keeps it stable)
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t digit = (srcKeys[i] >> (pass * 8)) & 0xFF;
+			size_t dst = offsets[digit]++;
+			dstKeys[dst] = srcKeys[i];
+			dstValues[dst] = srcValues[i];
+		}
+
+		// Swap roles for the next pass
+		uint64_t* swapKeys = srcKeys; srcKeys = dstKeys; dstKeys = swapKeys;
+		uint32_t* swapValues = srcValues; srcValues = dstValues; dstValues = swapValues;
+		passesRun++;
+	}
+
+	// Odd number of passes leaves the result in the temp arrays
+	if (srcKeys != keys)
+	{
+		memcpy(keys, srcKeys, sizeof(uint64_t) * count);
+		memcpy(values, srcValues, sizeof(uint32_t) * count);
+	}
+
+	return passesRun;
+}
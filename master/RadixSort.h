@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// --------------------------------------------------------
+// LSD radix sort for 64-bit keys with a 32-bit payload
+// (usually an index back into whatever the key describes).
+//
+// Sorts 8 bits per pass, and skips any pass where every key
+// has the same byte - draw keys tend to share most of their
+// high bits, so in practice only a few passes actually run.
+// Stable, so equal keys keep their original order.
+//
+// keys/values hold the input and receive the sorted result,
+// tempKeys/tempValues must be at least count long as well.
+// Returns the number of passes that actually moved data.
+// --------------------------------------------------------
+unsigned int RadixSort64(
+	uint64_t* keys,
+	uint32_t* values,
+	uint64_t* tempKeys,
+	uint32_t* tempValues,
+	size_t count);
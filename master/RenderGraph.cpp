@@ -0,0 +1,577 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+
+// --------------------------------------------------------
+// Builder
+// --------------------------------------------------------
+RGResource RenderGraphBuilder::Create(const char* name, const RGResourceDesc& desc)
+{
+	RenderGraph::ResourceInfo info = {};
+	info.name = name;
+	info.transient = true;
+	info.desc = desc;
+	info.external = 0;
+	info.initialState = RGState::Common;
+	info.finalState = RGState::Common;
+	info.heapOffset = 0;
+
+	RGResource resource = (RGResource)graph->resources.size();
+	graph->resources.push_back(info);
+	graph->passes[pass].creates.push_back(resource);
+	return resource;
+}
+
+void RenderGraphBuilder::Read(RGResource resource, RGStates state)
+{
+	graph->AddAccess(pass, resource, state, false);
+}
+
+void RenderGraphBuilder::Write(RGResource resource, RGStates state)
+{
+	graph->AddAccess(pass, resource, state, true);
+}
+
+void RenderGraphBuilder::NeverCull()
+{
+	graph->passes[pass].neverCull = true;
+}
+
+// --------------------------------------------------------
+// Graph setup
+// --------------------------------------------------------
+void RenderGraph::Reset()
+{
+	passes.clear();
+	resources.clear();
+	compiledPasses.clear();
+	finalBarriers.clear();
+	stats = {};
+}
+
+RGResource RenderGraph::Import(const char* name, void* external, RGStates initialState, RGStates finalState)
+{
+	ResourceInfo info = {};
+	info.name = name;
+	info.transient = false;
+	info.external = external;
+	info.initialState = initialState;
+	info.finalState = finalState;
+
+	resources.push_back(info);
+	return (RGResource)(resources.size() - 1);
+}
+
+void RenderGraph::AddPass(const char* name, const std::function<void(RenderGraphBuilder& builder)>& setup, const RGExecuteFunction& execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.execute = execute;
+	pass.neverCull = false;
+	pass.culled = false;
+	passes.push_back(pass);
+
+	RenderGraphBuilder builder(this, (unsigned int)passes.size() - 1);
+	setup(builder);
+}
+
+void RenderGraph::AddAccess(unsigned int pass, RGResource resource, RGStates state, bool write)
+{
+	// One access per resource per pass. Writes win, since a write
+	// state already allows reading (and the two can't be combined).
+	for (Access& access : passes[pass].accesses)
+	{
+		if (access.resource != resource)
+			continue;
+
+		if (write && !access.write)
+		{
+			access.state = state;
+			access.write = true;
+		}
+		else if (write == access.write)
+		{
+			access.state |= state;
+		}
+		return;
+	}
+
+	Access access = { resource, state, write };
+	passes[pass].accesses.push_back(access);
+}
+
+// --------------------------------------------------------
+// Compiling
+// --------------------------------------------------------
+bool RenderGraph::Compile()
+{
+	compiledPasses.clear();
+	finalBarriers.clear();
+	stats = {};
+	stats.passCount = (unsigned int)passes.size();
+
+	CullPasses();
+	return BuildBarriers();
+}
+
+// Reference counting, working back from what's actually used. Passes count
+// the resources they write, resources count the passes that read them.
+// Imported resources count as read by the outside world, so anything that
+// writes them stays. Resources aren't versioned, so a pass writing something
+// that was read earlier (but never after) is kept - good enough for us.
+void RenderGraph::CullPasses()
+{
+	std::vector<unsigned int> passRefs(passes.size(), 0);
+	std::vector<unsigned int> resourceRefs(resources.size(), 0);
+	std::vector<std::vector<unsigned int>> writers(resources.size());
+
+	for (unsigned int r = 0; r < resources.size(); r++)
+	{
+		if (!resources[r].transient)
+			resourceRefs[r]++;
+	}
+
+	for (unsigned int p = 0; p < passes.size(); p++)
+	{
+		passes[p].culled = false;
+		for (const Access& access : passes[p].accesses)
+		{
+			if (access.write)
+			{
+				passRefs[p]++;
+				writers[access.resource].push_back(p);
+			}
+			else
+			{
+				resourceRefs[access.resource]++;
+			}
+		}
+	}
+
+	// Culling a pass releases whatever it read
+	std::vector<RGResource> unused;
+	auto cull = [&](unsigned int p)
+	{
+		passes[p].culled = true;
+		stats.culledPasses++;
+		for (const Access& access : passes[p].accesses)
+		{
+			if (!access.write && --resourceRefs[access.resource] == 0)
+				unused.push_back(access.resource);
+		}
+	};
+
+	for (unsigned int r = 0; r < resources.size(); r++)
+	{
+		if (resourceRefs[r] == 0)
+			unused.push_back(r);
+	}
+	for (unsigned int p = 0; p < passes.size(); p++)
+	{
+		if (passRefs[p] == 0 && !passes[p].neverCull)
+			cull(p);
+	}
+
+	while (!unused.empty())
+	{
+		RGResource r = unused.back();
+		unused.pop_back();
+
+		for (unsigned int p : writers[r])
+		{
+			if (passes[p].culled || passes[p].neverCull)
+				continue;
+
+			if (--passRefs[p] == 0)
+				cull(p);
+		}
+	}
+}
+
+bool RenderGraph::BuildBarriers()
+{
+	// Index the passes that survived
+	std::vector<unsigned int> live;
+	for (unsigned int p = 0; p < passes.size(); p++)
+	{
+		if (!passes[p].culled)
+			live.push_back(p);
+	}
+
+	compiledPasses.resize(live.size());
+	for (unsigned int i = 0; i < live.size(); i++)
+		compiledPasses[i].pass = live[i];
+
+	// Every resource's accesses in (live) pass order
+	struct Use
+	{
+		unsigned int livePass;
+		RGStates state;
+		bool write;
+	};
+	std::vector<std::vector<Use>> uses(resources.size());
+	for (unsigned int i = 0; i < live.size(); i++)
+	{
+		for (const Access& access : passes[live[i]].accesses)
+		{
+			Use use = { i, access.state, access.write };
+			uses[access.resource].push_back(use);
+		}
+	}
+
+	std::vector<unsigned int> firstUse(resources.size(), ~0u);
+	std::vector<unsigned int> lastUse(resources.size(), ~0u);
+
+	auto addTransition = [&](RGResource r, RGStates before, RGStates after, int previousPass, unsigned int nextPass, std::vector<RGBarrier>& endList)
+	{
+		RGBarrier barrier = {};
+		barrier.type = RGBarrier::TRANSITION;
+		barrier.resource = r;
+		barrier.aliasBefore = RG_INVALID_RESOURCE;
+		barrier.before = before;
+		barrier.after = after;
+		stats.barriers++;
+
+		// At least one pass in between? Start the transition right
+		// after the last use so the GPU can overlap it with that work.
+		unsigned int beginPass = (unsigned int)(previousPass + 1);
+		if (beginPass < nextPass)
+		{
+			barrier.split = RGBarrier::SPLIT_BEGIN;
+			compiledPasses[beginPass].barriers.push_back(barrier);
+			barrier.split = RGBarrier::SPLIT_END;
+			endList.push_back(barrier);
+			stats.splitBarriers++;
+		}
+		else
+		{
+			barrier.split = RGBarrier::SPLIT_NONE;
+			endList.push_back(barrier);
+		}
+	};
+
+	for (RGResource r = 0; r < resources.size(); r++)
+	{
+		ResourceInfo& info = resources[r];
+		std::vector<Use>& list = uses[r];
+
+		if (info.transient && !list.empty() && !list[0].write)
+			return false; // Reading something nobody wrote
+
+		// Back to back reads all get the union of their states,
+		// so one transition covers the whole run
+		for (size_t i = 0; i < list.size(); )
+		{
+			if (list[i].write)
+			{
+				i++;
+				continue;
+			}
+
+			size_t end = i;
+			RGStates merged = 0;
+			while (end < list.size() && !list[end].write)
+			{
+				if (end > i && (merged & list[end].state) != list[end].state)
+					stats.mergedReads++;
+				merged |= list[end].state;
+				end++;
+			}
+			for (size_t j = i; j < end; j++)
+				list[j].state = merged;
+			i = end;
+		}
+
+		RGStates current = info.initialState;
+		int previousPass = -1;
+		bool previousWasUAVWrite = false;
+
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			const Use& use = list[i];
+			std::vector<RGBarrier>& barriers = compiledPasses[use.livePass].barriers;
+
+			if (info.transient && i == 0)
+			{
+				// Transients start in whatever state their first use needs,
+				// but their memory may have just belonged to something else
+				info.initialState = use.state;
+				current = use.state;
+
+				RGBarrier barrier = {};
+				barrier.type = RGBarrier::ALIASING;
+				barrier.split = RGBarrier::SPLIT_NONE;
+				barrier.resource = r;
+				barrier.aliasBefore = RG_INVALID_RESOURCE; // Filled in once memory is assigned
+				barriers.push_back(barrier);
+				stats.barriers++;
+			}
+			else if (use.state != current)
+			{
+				addTransition(r, current, use.state, previousPass, use.livePass, barriers);
+				current = use.state;
+			}
+			else if (use.write && previousWasUAVWrite && use.state == RGState::UnorderedAccess)
+			{
+				RGBarrier barrier = {};
+				barrier.type = RGBarrier::UAV;
+				barrier.split = RGBarrier::SPLIT_NONE;
+				barrier.resource = r;
+				barrier.aliasBefore = RG_INVALID_RESOURCE;
+				barrier.before = barrier.after = current;
+				barriers.push_back(barrier);
+				stats.barriers++;
+			}
+
+			previousWasUAVWrite = use.write && use.state == RGState::UnorderedAccess;
+			previousPass = (int)use.livePass;
+		}
+
+		if (!list.empty())
+		{
+			firstUse[r] = list.front().livePass;
+			lastUse[r] = list.back().livePass;
+		}
+
+		// Imported resources go back out in the state the owner expects
+		if (!info.transient)
+		{
+			if (current != info.finalState)
+				addTransition(r, current, info.finalState, previousPass, (unsigned int)live.size(), finalBarriers);
+		}
+		else
+		{
+			info.finalState = current;
+		}
+	}
+
+	AllocateTransients(firstUse, lastUse);
+	return true;
+}
+
+// Greedy placement, biggest first: each transient goes at the lowest
+// offset that doesn't overlap anything alive at the same time
+void RenderGraph::AllocateTransients(const std::vector<unsigned int>& firstUse, const std::vector<unsigned int>& lastUse)
+{
+	std::vector<RGResource> transients;
+	for (RGResource r = 0; r < resources.size(); r++)
+	{
+		if (resources[r].transient && firstUse[r] != ~0u)
+			transients.push_back(r);
+	}
+	stats.transientCount = (unsigned int)transients.size();
+
+	std::stable_sort(transients.begin(), transients.end(), [&](RGResource a, RGResource b)
+		{
+			return resources[a].desc.sizeInBytes > resources[b].desc.sizeInBytes;
+		});
+
+	auto lifetimesOverlap = [&](RGResource a, RGResource b)
+	{
+		return firstUse[a] <= lastUse[b] && firstUse[b] <= lastUse[a];
+	};
+	auto memoryOverlaps = [&](RGResource a, RGResource b)
+	{
+		uint64_t aEnd = resources[a].heapOffset + resources[a].desc.sizeInBytes;
+		uint64_t bEnd = resources[b].heapOffset + resources[b].desc.sizeInBytes;
+		return resources[a].heapOffset < bEnd && resources[b].heapOffset < aEnd;
+	};
+	auto alignUp = [](uint64_t value, uint64_t alignment)
+	{
+		if (alignment == 0) return value;
+		return (value + alignment - 1) / alignment * alignment;
+	};
+
+	std::vector<RGResource> placed;
+	for (RGResource r : transients)
+	{
+		ResourceInfo& info = resources[r];
+		stats.transientUnaliasedSize += alignUp(info.desc.sizeInBytes, info.desc.alignment);
+
+		// Everything already placed that's alive at the same time, lowest offset first
+		std::vector<RGResource> conflicts;
+		for (RGResource other : placed)
+		{
+			if (lifetimesOverlap(r, other))
+				conflicts.push_back(other);
+		}
+		std::sort(conflicts.begin(), conflicts.end(), [&](RGResource a, RGResource b)
+			{
+				return resources[a].heapOffset < resources[b].heapOffset;
+			});
+
+		// Walk the gaps between them until this one fits
+		uint64_t offset = 0;
+		for (RGResource other : conflicts)
+		{
+			uint64_t aligned = alignUp(offset, info.desc.alignment);
+			if (aligned + info.desc.sizeInBytes <= resources[other].heapOffset)
+				break;
+
+			uint64_t otherEnd = resources[other].heapOffset + resources[other].desc.sizeInBytes;
+			if (otherEnd > offset)
+				offset = otherEnd;
+		}
+
+		info.heapOffset = alignUp(offset, info.desc.alignment);
+		stats.transientHeapSize = std::max(stats.transientHeapSize, info.heapOffset + info.desc.sizeInBytes);
+		placed.push_back(r);
+	}
+
+	// Now that everything has an offset, each transient's aliasing barrier can
+	// name what used its memory last. More than one? Let the driver sort it out.
+	for (CompiledPass& compiled : compiledPasses)
+	{
+		for (RGBarrier& barrier : compiled.barriers)
+		{
+			if (barrier.type != RGBarrier::ALIASING)
+				continue;
+
+			RGResource r = barrier.resource;
+			unsigned int latest = 0;
+			unsigned int previousCount = 0;
+			for (RGResource other : placed)
+			{
+				if (other == r || lastUse[other] >= firstUse[r] || !memoryOverlaps(r, other))
+					continue;
+
+				previousCount++;
+				if (lastUse[other] >= latest)
+				{
+					latest = lastUse[other];
+					barrier.aliasBefore = other;
+				}
+			}
+			if (previousCount != 1)
+				barrier.aliasBefore = RG_INVALID_RESOURCE;
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Self test
+// --------------------------------------------------------
+static bool Fail(std::string* error, const char* message)
+{
+	if (error) *error = message;
+	return false;
+}
+
+static const RGBarrier* FindBarrier(const std::vector<RGBarrier>& barriers, RGResource resource, RGBarrier::Type type, RGBarrier::Split split)
+{
+	for (const RGBarrier& barrier : barriers)
+	{
+		if (barrier.resource == resource && barrier.type == type && barrier.split == split)
+			return &barrier;
+	}
+	return 0;
+}
+
+bool RenderGraph::SelfTest(std::string* error)
+{
+	RGExecuteFunction nothing = [](RenderGraphContext&) {};
+	RGResourceDesc desc = {};
+	desc.width = 1280;
+	desc.height = 720;
+	desc.sizeInBytes = 4 * 1024 * 1024;
+	desc.alignment = 64 * 1024;
+
+	// Culling: an unused chain goes away, the pass writing the back buffer stays
+	{
+		RenderGraph graph;
+		RGResource backBuffer = graph.Import("Back buffer", 0, RGState::Present, RGState::Present);
+		RGResource unusedA = RG_INVALID_RESOURCE;
+		RGResource unusedB = RG_INVALID_RESOURCE;
+
+		graph.AddPass("Unused A", [&](RenderGraphBuilder& b) { unusedA = b.Create("A", desc); b.Write(unusedA, RGState::RenderTarget); }, nothing);
+		graph.AddPass("Unused B", [&](RenderGraphBuilder& b) { b.Read(unusedA, RGState::PixelShaderResource); unusedB = b.Create("B", desc); b.Write(unusedB, RGState::RenderTarget); }, nothing);
+		graph.AddPass("Scene", [&](RenderGraphBuilder& b) { b.Write(backBuffer, RGState::RenderTarget); }, nothing);
+		graph.AddPass("Marker", [&](RenderGraphBuilder& b) { b.NeverCull(); }, nothing);
+
+		if (!graph.Compile()) return Fail(error, "Cull graph failed to compile");
+		if (!graph.IsPassCulled(0) || !graph.IsPassCulled(1)) return Fail(error, "Unused passes were not culled");
+		if (graph.IsPassCulled(2) || graph.IsPassCulled(3)) return Fail(error, "Needed passes were culled");
+		if (graph.GetStats().transientCount != 0) return Fail(error, "Culled transients were allocated");
+
+		const CompiledPass& scene = graph.GetCompiledPasses()[0];
+		if (!FindBarrier(scene.barriers, backBuffer, RGBarrier::TRANSITION, RGBarrier::SPLIT_NONE)) return Fail(error, "Missing present -> render target");
+
+		// Marker comes after scene without touching the back buffer, so going back to present is split
+		const CompiledPass& marker = graph.GetCompiledPasses()[1];
+		if (!FindBarrier(marker.barriers, backBuffer, RGBarrier::TRANSITION, RGBarrier::SPLIT_BEGIN)) return Fail(error, "Missing split begin back to present");
+		if (!FindBarrier(graph.GetFinalBarriers(), backBuffer, RGBarrier::TRANSITION, RGBarrier::SPLIT_END)) return Fail(error, "Missing split end back to present");
+	}
+
+	// Split barriers and read merging
+	{
+		RenderGraph graph;
+		RGResource backBuffer = graph.Import("Back buffer", 0, RGState::RenderTarget, RGState::RenderTarget);
+		RGResource target = RG_INVALID_RESOURCE;
+
+		graph.AddPass("Produce", [&](RenderGraphBuilder& b) { target = b.Create("Target", desc); b.Write(target, RGState::RenderTarget); }, nothing);
+		graph.AddPass("Other", [&](RenderGraphBuilder& b) { b.Write(backBuffer, RGState::RenderTarget); }, nothing);
+		graph.AddPass("Read pixel", [&](RenderGraphBuilder& b) { b.Read(target, RGState::PixelShaderResource); b.Write(backBuffer, RGState::RenderTarget); }, nothing);
+		graph.AddPass("Read compute", [&](RenderGraphBuilder& b) { b.Read(target, RGState::NonPixelShaderResource); b.Write(backBuffer, RGState::RenderTarget); }, nothing);
+
+		if (!graph.Compile()) return Fail(error, "Split graph failed to compile");
+
+		const std::vector<CompiledPass>& compiled = graph.GetCompiledPasses();
+		const RGBarrier* begin = FindBarrier(compiled[1].barriers, target, RGBarrier::TRANSITION, RGBarrier::SPLIT_BEGIN);
+		const RGBarrier* end = FindBarrier(compiled[2].barriers, target, RGBarrier::TRANSITION, RGBarrier::SPLIT_END);
+		if (!begin || !end) return Fail(error, "Transition over a gap was not split");
+		if (end->after != (RGState::PixelShaderResource | RGState::NonPixelShaderResource)) return Fail(error, "Back to back reads were not merged");
+		if (FindBarrier(compiled[3].barriers, target, RGBarrier::TRANSITION, RGBarrier::SPLIT_NONE)) return Fail(error, "Merged read still transitioned");
+		if (graph.GetStats().mergedReads != 1) return Fail(error, "Merged read count is wrong");
+		if (!graph.GetFinalBarriers().empty()) return Fail(error, "Unneeded final barrier");
+	}
+
+	// Aliasing: two transients that never live at the same time share memory
+	{
+		RenderGraph graph;
+		RGResource backBuffer = graph.Import("Back buffer", 0, RGState::RenderTarget, RGState::RenderTarget);
+		RGResource first = RG_INVALID_RESOURCE;
+		RGResource second = RG_INVALID_RESOURCE;
+		RGResource longLived = RG_INVALID_RESOURCE;
+
+		graph.AddPass("First", [&](RenderGraphBuilder& b)
+			{
+				first = b.Create("First", desc); b.Write(first, RGState::RenderTarget);
+				longLived = b.Create("Long lived", desc); b.Write(longLived, RGState::UnorderedAccess);
+			}, nothing);
+		graph.AddPass("Use first", [&](RenderGraphBuilder& b) { b.Read(first, RGState::PixelShaderResource); b.Write(longLived, RGState::UnorderedAccess); }, nothing);
+		graph.AddPass("Second", [&](RenderGraphBuilder& b) { second = b.Create("Second", desc); b.Write(second, RGState::RenderTarget); }, nothing);
+		graph.AddPass("Combine", [&](RenderGraphBuilder& b)
+			{
+				b.Read(second, RGState::PixelShaderResource);
+				b.Read(longLived, RGState::PixelShaderResource);
+				b.Write(backBuffer, RGState::RenderTarget);
+			}, nothing);
+
+		if (!graph.Compile()) return Fail(error, "Aliasing graph failed to compile");
+
+		const RGStats& stats = graph.GetStats();
+		if (stats.transientCount != 3) return Fail(error, "Wrong transient count");
+		if (graph.GetResourceInfo(first).heapOffset != graph.GetResourceInfo(second).heapOffset) return Fail(error, "Disjoint transients did not alias");
+		if (graph.GetResourceInfo(longLived).heapOffset == graph.GetResourceInfo(first).heapOffset) return Fail(error, "Overlapping transients aliased");
+		if (stats.transientHeapSize != 2 * desc.sizeInBytes || stats.transientUnaliasedSize != 3 * desc.sizeInBytes) return Fail(error, "Wrong heap size");
+
+		const RGBarrier* alias = FindBarrier(graph.GetCompiledPasses()[2].barriers, second, RGBarrier::ALIASING, RGBarrier::SPLIT_NONE);
+		if (!alias || alias->aliasBefore != first) return Fail(error, "Missing aliasing barrier");
+		if (!FindBarrier(graph.GetCompiledPasses()[1].barriers, longLived, RGBarrier::UAV, RGBarrier::SPLIT_NONE)) return Fail(error, "Missing UAV barrier");
+	}
+
+	// Reading something that was never written is an error
+	{
+		RenderGraph graph;
+		RGResource backBuffer = graph.Import("Back buffer", 0, RGState::RenderTarget, RGState::RenderTarget);
+		graph.AddPass("Bad", [&](RenderGraphBuilder& b)
+			{
+				RGResource nothingWritten = b.Create("Never written", desc);
+				b.Read(nothingWritten, RGState::PixelShaderResource);
+				b.Write(backBuffer, RGState::RenderTarget);
+			}, nothing);
+		if (graph.Compile()) return Fail(error, "Reading an unwritten transient compiled");
+	}
+
+	return true;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// Resource states the graph works with. These are the same
+// bits as D3D12_RESOURCE_STATES so they can be cast straight
+// across, but defining them here keeps the graph compiler
+// free of any D3D headers (and testable without a GPU).
+// --------------------------------------------------------
+typedef uint32_t RGStates;
+namespace RGState
+{
+	enum : RGStates
+	{
+		Common = 0,
+		VertexAndConstantBuffer = 0x1,
+		IndexBuffer = 0x2,
+		RenderTarget = 0x4,
+		UnorderedAccess = 0x8,
+		DepthWrite = 0x10,
+		DepthRead = 0x20,
+		NonPixelShaderResource = 0x40,
+		PixelShaderResource = 0x80,
+		IndirectArgument = 0x200,
+		CopyDest = 0x400,
+		CopySource = 0x800,
+		Present = 0,
+
+		// States that can be combined with each other
+		ReadOnlyMask = VertexAndConstantBuffer | IndexBuffer | DepthRead | NonPixelShaderResource |
+			PixelShaderResource | IndirectArgument | CopySource
+	};
+}
+
+// Handle to a resource in the graph (index into its resource list)
+typedef uint32_t RGResource;
+static const RGResource RG_INVALID_RESOURCE = ~0u;
+
+// What a transient resource looks like. The graph itself only cares
+// about size and alignment (for aliasing), the rest is for whoever
+// ends up creating the actual resource.
+struct RGResourceDesc
+{
+	unsigned int width;
+	unsigned int height;
+	uint32_t format;		// DXGI_FORMAT
+	uint32_t flags;			// D3D12_RESOURCE_FLAGS
+	uint64_t sizeInBytes;
+	uint64_t alignment;
+};
+
+struct RGBarrier
+{
+	enum Type
+	{
+		TRANSITION,
+		ALIASING,	// resource starts using memory that aliasBefore used last
+		UAV			// back to back unordered access writes
+	};
+
+	// Split barriers are begun as early as possible and ended right before use
+	enum Split
+	{
+		SPLIT_NONE,
+		SPLIT_BEGIN,
+		SPLIT_END
+	};
+
+	Type type;
+	Split split;
+	RGResource resource;
+	RGResource aliasBefore;	// ALIASING only, RG_INVALID_RESOURCE for "whatever was there"
+	RGStates before;
+	RGStates after;
+};
+
+// Counters from the last Compile()
+struct RGStats
+{
+	unsigned int passCount;
+	unsigned int culledPasses;
+	unsigned int transientCount;
+	unsigned int barriers;			// Everything issued, split halves counted once
+	unsigned int splitBarriers;
+	unsigned int mergedReads;		// Read transitions saved by combining back to back read states
+	uint64_t transientHeapSize;		// Memory used by transients with aliasing...
+	uint64_t transientUnaliasedSize;// ...and how much it would be without
+};
+
+// Defined by whoever executes the graph (see RenderGraphExecutor)
+struct RenderGraphContext;
+typedef std::function<void(RenderGraphContext& context)> RGExecuteFunction;
+
+class RenderGraph;
+
+// --------------------------------------------------------
+// Handed to each pass's setup function so it can declare
+// what it creates, reads and writes
+// --------------------------------------------------------
+class RenderGraphBuilder
+{
+public:
+	// A resource that only lives during this frame, starting with this pass
+	RGResource Create(const char* name, const RGResourceDesc& desc);
+
+	// Access declarations. Declaring both on one resource is fine (e.g. depth test + write).
+	void Read(RGResource resource, RGStates state);
+	void Write(RGResource resource, RGStates state);
+
+	// Keep this pass even if nothing reads what it writes
+	void NeverCull();
+
+private:
+	friend class RenderGraph;
+	RenderGraphBuilder(RenderGraph* graph, unsigned int pass) : graph(graph), pass(pass) {}
+	RenderGraph* graph;
+	unsigned int pass;
+};
+
+// --------------------------------------------------------
+// Frame render graph.
+//
+// Passes are added in submission order, declaring the
+// resources they touch. Compile() then:
+//  - culls passes whose output is never used
+//  - works out every state transition, merging back to back
+//    reads into one combined state, and splitting barriers
+//    when there are passes in between producer and consumer
+//  - packs transient resources into one heap, letting ones
+//    with non-overlapping lifetimes share memory
+//
+// The compiler is plain C++ - executing the result on a
+// command list is RenderGraphExecutor's job.
+// --------------------------------------------------------
+class RenderGraph
+{
+public:
+	struct ResourceInfo
+	{
+		std::string name;
+		bool transient;
+		RGResourceDesc desc;		// Transients only
+		void* external;				// Imported only (e.g. an ID3D12Resource*)
+		RGStates initialState;		// Imported: state coming in. Transient: state of its first use.
+		RGStates finalState;		// Imported: state it must be left in
+		uint64_t heapOffset;		// Transients only, after Compile()
+	};
+
+	struct CompiledPass
+	{
+		unsigned int pass;					// Index of the pass as it was added
+		std::vector<RGBarrier> barriers;	// Issued as one batch right before the pass
+	};
+
+	// Clears every pass and resource so the next frame can be built
+	void Reset();
+
+	// Brings a resource that lives outside the graph in (back buffers, depth, ...)
+	RGResource Import(const char* name, void* external, RGStates initialState, RGStates finalState);
+
+	void AddPass(const char* name, const std::function<void(RenderGraphBuilder& builder)>& setup, const RGExecuteFunction& execute);
+
+	// Returns false if the graph doesn't make sense (e.g. reading something nothing wrote)
+	bool Compile();
+
+	const std::vector<CompiledPass>& GetCompiledPasses() { return compiledPasses; }
+	const std::vector<RGBarrier>& GetFinalBarriers() { return finalBarriers; }
+	const RGExecuteFunction& GetExecuteFunction(unsigned int pass) { return passes[pass].execute; }
+	const std::string& GetPassName(unsigned int pass) { return passes[pass].name; }
+	const ResourceInfo& GetResourceInfo(RGResource resource) { return resources[resource]; }
+	unsigned int GetResourceCount() { return (unsigned int)resources.size(); }
+	bool IsPassCulled(unsigned int pass) { return passes[pass].culled; }
+	const RGStats& GetStats() { return stats; }
+
+	// Builds a few small graphs and checks culling, barriers and aliasing.
+	// No GPU needed. Returns false (and fills error) on the first failure.
+	static bool SelfTest(std::string* error = 0);
+
+private:
+	friend class RenderGraphBuilder;
+
+	struct Access
+	{
+		RGResource resource;
+		RGStates state;
+		bool write;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		RGExecuteFunction execute;
+		std::vector<Access> accesses;	// One per resource, reads and writes combined
+		std::vector<RGResource> creates;
+		bool neverCull;
+		bool culled;
+	};
+
+	void AddAccess(unsigned int pass, RGResource resource, RGStates state, bool write);
+	void CullPasses();
+	bool BuildBarriers();
+	void AllocateTransients(const std::vector<unsigned int>& firstUse, const std::vector<unsigned int>& lastUse);
+
+	std::vector<Pass> passes;
+	std::vector<ResourceInfo> resources;
+
+	std::vector<CompiledPass> compiledPasses;
+	std::vector<RGBarrier> finalBarriers;
+	RGStats stats;
+};
@@ -0,0 +1,371 @@
+#include "RenderGraphExecutor.h"
+#include "Logger.h"
+
+ID3D12Resource* RenderGraphContext::GetResource(RGResource resource)
+{
+	return executor->GetResource(resource);
+}
+
+RenderGraphExecutor::RenderGraphExecutor() :
+	stateTracker(0),
+	profiler(0),
+	transientHeaps(),
+	mixedTransientHeap(false)
+{
+}
+
+void RenderGraphExecutor::Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, ResourceStateTracker* stateTracker)
+{
+	this->device = device;
+	this->stateTracker = stateTracker;
+
+	// Tier 1 hardware can't mix resource classes in a heap, so each class
+	// gets its own. Tier 2 can put anything anywhere.
+	D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+	device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options));
+	mixedTransientHeap = options.ResourceHeapTier >= D3D12_RESOURCE_HEAP_TIER_2;
+	if (mixedTransientHeap)
+	{
+		transientHeaps[TRANSIENT_HEAP_RT_DS].flags = D3D12_HEAP_FLAG_ALLOW_ALL_BUFFERS_AND_TEXTURES;
+	}
+	else
+	{
+		transientHeaps[TRANSIENT_HEAP_RT_DS].flags = D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES;
+		transientHeaps[TRANSIENT_HEAP_TEXTURES].flags = D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES;
+		transientHeaps[TRANSIENT_HEAP_BUFFERS].flags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+	}
+}
+
+RGResourceDesc RenderGraphExecutor::DescribeTexture2D(unsigned int width, unsigned int height, DXGI_FORMAT format, D3D12_RESOURCE_FLAGS flags)
+{
+	D3D12_RESOURCE_DESC desc = {};
+	desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	desc.Width = width;
+	desc.Height = height;
+	desc.DepthOrArraySize = 1;
+	desc.MipLevels = 1;
+	desc.Format = format;
+	desc.SampleDesc.Count = 1;
+	desc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	desc.Flags = flags;
+
+	D3D12_RESOURCE_ALLOCATION_INFO info = device->GetResourceAllocationInfo(0, 1, &desc);
+
+	RGResourceDesc result = {};
+	result.width = width;
+	result.height = height;
+	result.format = (uint32_t)format;
+	result.flags = (uint32_t)flags;
+	result.sizeInBytes = info.SizeInBytes;
+	result.alignment = info.Alignment;
+	return result;
+}
+
+RGResourceDesc RenderGraphExecutor::DescribeBuffer(uint64_t sizeInBytes, D3D12_RESOURCE_FLAGS flags)
+{
+	RGResourceDesc result = {};
+	result.width = 0;
+	result.height = 0;
+	result.format = DXGI_FORMAT_UNKNOWN;
+	result.flags = (uint32_t)flags;
+	result.sizeInBytes = sizeInBytes;
+	result.alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+	return result;
+}
+
+ID3D12Resource* RenderGraphExecutor::GetResource(RGResource resource)
+{
+	return frameResources[resource];
+}
+
+RenderGraphExecutor::TransientHeapClass RenderGraphExecutor::GetHeapClass(const RGResourceDesc& desc)
+{
+	if (mixedTransientHeap)
+		return TRANSIENT_HEAP_RT_DS;
+	if (desc.height == 0)
+		return TRANSIENT_HEAP_BUFFERS;
+	if (desc.flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL))
+		return TRANSIENT_HEAP_RT_DS;
+	return TRANSIENT_HEAP_TEXTURES;
+}
+
+// Makes sure every transient the graph wants has a placed resource at its offset.
+// False if a heap or resource couldn't be made.
+bool RenderGraphExecutor::PrepareTransients(RenderGraph& graph)
+{
+	unsigned int resourceCount = graph.GetResourceCount();
+
+	// How far into each heap this frame's transients reach. The graph's offsets
+	// are all in one address space, on tier 1 each class uses its own part of it.
+	UINT64 neededSizes[TRANSIENT_HEAP_COUNT] = {};
+	for (RGResource r = 0; r < resourceCount; r++)
+	{
+		const RenderGraph::ResourceInfo& info = graph.GetResourceInfo(r);
+		if (!info.transient)
+			continue;
+		UINT64 end = info.heapOffset + info.desc.sizeInBytes;
+		UINT64& needed = neededSizes[GetHeapClass(info.desc)];
+		if (end > needed) needed = end;
+	}
+
+	// Bigger heap needed? Everything placed in the old one goes with it
+	for (unsigned int c = 0; c < TRANSIENT_HEAP_COUNT; c++)
+	{
+		TransientHeap& heap = transientHeaps[c];
+		if (neededSizes[c] <= heap.size)
+			continue;
+
+		for (size_t t = 0; t < transients.size(); )
+		{
+			if ((unsigned int)transients[t].heapClass == c)
+				transients.erase(transients.begin() + t);
+			else
+				t++;
+		}
+		heap.heap.Reset();
+		heap.size = 0;
+
+		D3D12_HEAP_DESC heapDesc = {};
+		heapDesc.SizeInBytes = neededSizes[c];
+		heapDesc.Properties.Type = D3D12_HEAP_TYPE_DEFAULT;
+		heapDesc.Alignment = D3D12_DEFAULT_MSAA_RESOURCE_PLACEMENT_ALIGNMENT;
+		heapDesc.Flags = heap.flags;
+		HRESULT hr = device->CreateHeap(&heapDesc, IID_PPV_ARGS(heap.heap.GetAddressOf()));
+		if (FAILED(hr))
+		{
+			LOG_ERROR("Render graph: couldn't create a %llu byte transient heap (0x%08x)",
+				(unsigned long long)neededSizes[c], (unsigned int)hr);
+			return false;
+		}
+		heap.size = neededSizes[c];
+	}
+
+	for (Transient& transient : transients)
+		transient.usedThisFrame = false;
+
+	frameResources.assign(resourceCount, 0);
+	frameTransients.assign(resourceCount, -1);
+
+	for (RGResource r = 0; r < resourceCount; r++)
+	{
+		const RenderGraph::ResourceInfo& info = graph.GetResourceInfo(r);
+		if (!info.transient)
+		{
+			frameResources[r] = (ID3D12Resource*)info.external;
+			continue;
+		}
+
+		// Same thing at the same spot as some earlier frame? Reuse it
+		int found = -1;
+		for (unsigned int t = 0; t < transients.size(); t++)
+		{
+			const Transient& transient = transients[t];
+			if (!transient.usedThisFrame &&
+				transient.offset == info.heapOffset &&
+				transient.desc.width == info.desc.width &&
+				transient.desc.height == info.desc.height &&
+				transient.desc.format == info.desc.format &&
+				transient.desc.flags == info.desc.flags &&
+				transient.desc.sizeInBytes == info.desc.sizeInBytes)
+			{
+				found = (int)t;
+				break;
+			}
+		}
+
+		if (found < 0)
+		{
+			D3D12_RESOURCE_DESC desc = {};
+			desc.DepthOrArraySize = 1;
+			desc.MipLevels = 1;
+			desc.SampleDesc.Count = 1;
+			desc.Flags = (D3D12_RESOURCE_FLAGS)info.desc.flags;
+			if (info.desc.height == 0)
+			{
+				desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+				desc.Width = info.desc.sizeInBytes;
+				desc.Height = 1;
+				desc.Format = DXGI_FORMAT_UNKNOWN;
+				desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+			}
+			else
+			{
+				desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+				desc.Width = info.desc.width;
+				desc.Height = info.desc.height;
+				desc.Format = (DXGI_FORMAT)info.desc.format;
+				desc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+			}
+
+			Transient transient = {};
+			transient.desc = info.desc;
+			transient.offset = info.heapOffset;
+			transient.heapClass = GetHeapClass(info.desc);
+			transient.state = info.initialState;
+			HRESULT hr = device->CreatePlacedResource(
+				transientHeaps[transient.heapClass].heap.Get(),
+				info.heapOffset,
+				&desc,
+				(D3D12_RESOURCE_STATES)info.initialState,
+				0,
+				IID_PPV_ARGS(transient.resource.GetAddressOf()));
+			if (FAILED(hr))
+			{
+				LOG_ERROR("Render graph: couldn't place transient %s (0x%08x)", info.name.c_str(), (unsigned int)hr);
+				return false;
+			}
+
+			transients.push_back(transient);
+			found = (int)transients.size() - 1;
+		}
+
+		transients[found].usedThisFrame = true;
+		frameTransients[r] = found;
+		frameResources[r] = transients[found].resource.Get();
+	}
+	return true;
+}
+
+void RenderGraphExecutor::IssueBarriers(RenderGraph& graph, ID3D12GraphicsCommandList* commandList, const std::vector<RGBarrier>& barriers)
+{
+	barrierScratch.clear();
+	discardScratch.clear();
+
+	for (const RGBarrier& barrier : barriers)
+	{
+		D3D12_RESOURCE_BARRIER rb = {};
+		ID3D12Resource* resource = frameResources[barrier.resource];
+
+		// Imported resources are the tracker's business
+		if (frameTransients[barrier.resource] < 0)
+		{
+			D3D12_RESOURCE_STATES after = (D3D12_RESOURCE_STATES)barrier.after;
+			if (barrier.type == RGBarrier::UAV)
+				stateTracker->UAVBarrier(resource);
+			else if (barrier.split == RGBarrier::SPLIT_BEGIN)
+				stateTracker->BeginTransition(resource, after);
+			else
+				stateTracker->Transition(resource, after); // Also ends a split begun earlier
+			continue;
+		}
+
+		if (barrier.type == RGBarrier::ALIASING)
+		{
+			// On tier 1 the previous user may be in another class's heap,
+			// so it doesn't actually share memory with this one
+			Transient& transient = transients[frameTransients[barrier.resource]];
+			ID3D12Resource* before = 0;
+			if (barrier.aliasBefore != RG_INVALID_RESOURCE &&
+				transients[frameTransients[barrier.aliasBefore]].heapClass == transient.heapClass)
+				before = frameResources[barrier.aliasBefore];
+
+			rb.Type = D3D12_RESOURCE_BARRIER_TYPE_ALIASING;
+			rb.Aliasing.pResourceBefore = before;
+			rb.Aliasing.pResourceAfter = resource;
+			barrierScratch.push_back(rb);
+
+			// The graph assumes the transient starts in its first use's state,
+			// but the resource is still in whatever state it ended last frame in
+			RGStates wanted = graph.GetResourceInfo(barrier.resource).initialState;
+			if (transient.state != wanted)
+			{
+				D3D12_RESOURCE_BARRIER transition = {};
+				transition.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+				transition.Transition.pResource = resource;
+				transition.Transition.StateBefore = (D3D12_RESOURCE_STATES)transient.state;
+				transition.Transition.StateAfter = (D3D12_RESOURCE_STATES)wanted;
+				transition.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+				barrierScratch.push_back(transition);
+			}
+
+			// Textures that just took over aliased memory have to be discarded
+			// (or cleared, or copied over) before anything else touches them.
+			// Discard needs them in a writable state, which a first use that
+			// isn't a write or a copy wouldn't have anyway.
+			D3D12_RESOURCE_STATES writable = D3D12_RESOURCE_STATE_RENDER_TARGET | D3D12_RESOURCE_STATE_DEPTH_WRITE | D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+			if (transient.desc.height != 0 && ((D3D12_RESOURCE_STATES)wanted & writable))
+				discardScratch.push_back(resource);
+			continue;
+		}
+
+		if (barrier.type == RGBarrier::UAV)
+		{
+			rb.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+			rb.UAV.pResource = resource;
+			barrierScratch.push_back(rb);
+			continue;
+		}
+
+		rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+		rb.Flags =
+			barrier.split == RGBarrier::SPLIT_BEGIN ? D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY :
+			barrier.split == RGBarrier::SPLIT_END ? D3D12_RESOURCE_BARRIER_FLAG_END_ONLY :
+			D3D12_RESOURCE_BARRIER_FLAG_NONE;
+		rb.Transition.pResource = resource;
+		rb.Transition.StateBefore = (D3D12_RESOURCE_STATES)barrier.before;
+		rb.Transition.StateAfter = (D3D12_RESOURCE_STATES)barrier.after;
+		rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+		barrierScratch.push_back(rb);
+	}
+
+	// Everything for this point in the frame goes out in one call
+	stateTracker->Flush(commandList, barrierScratch.data(), (UINT)barrierScratch.size());
+
+	for (ID3D12Resource* resource : discardScratch)
+		commandList->DiscardResource(resource, 0);
+}
+
+ID3D12GraphicsCommandList* RenderGraphExecutor::Execute(
+	RenderGraph& graph,
+	ID3D12GraphicsCommandList* firstList,
+	const std::function<ID3D12GraphicsCommandList*()>& nextList)
+{
+	if (!PrepareTransients(graph))
+		return firstList;
+
+	RenderGraphContext context = {};
+	context.executor = this;
+	context.commandList = firstList;
+
+	for (const RenderGraph::CompiledPass& compiled : graph.GetCompiledPasses())
+	{
+		if (context.listEnded)
+		{
+			context.commandList = nextList();
+			context.listEnded = false;
+		}
+
+		IssueBarriers(graph, context.commandList, compiled.barriers);
+
+		int scope = profiler ? profiler->BeginScope(context.commandList, graph.GetPassName(compiled.pass).c_str()) : -1;
+		graph.GetExecuteFunction(compiled.pass)(context);
+
+		// The pass's work may have gone into lists submitted after this one,
+		// so the closing timestamp has to go after those
+		if (scope >= 0)
+		{
+			if (context.listEnded)
+			{
+				context.commandList = nextList();
+				context.listEnded = false;
+			}
+			profiler->EndScope(context.commandList, scope);
+		}
+	}
+
+	if (context.listEnded)
+	{
+		context.commandList = nextList();
+		context.listEnded = false;
+	}
+	IssueBarriers(graph, context.commandList, graph.GetFinalBarriers());
+
+	// Remember where each transient was left for next frame
+	for (RGResource r = 0; r < graph.GetResourceCount(); r++)
+	{
+		if (frameTransients[r] >= 0)
+			transients[frameTransients[r]].state = graph.GetResourceInfo(r).finalState;
+	}
+
+	return context.commandList;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <d3d12.h>
+#include <wrl/client.h>
+#include <functional>
+#include <vector>
+
+#include "RenderGraph.h"
+#include "ResourceStateTracker.h"
+#include "GpuProfiler.h"
+
+class RenderGraphExecutor;
+
+// --------------------------------------------------------
+// What a pass gets when it runs
+// --------------------------------------------------------
+struct RenderGraphContext
+{
+	// Where this pass's commands go (barriers for it are already in here)
+	ID3D12GraphicsCommandList* commandList;
+
+	// The actual resource behind a handle (imported or transient)
+	ID3D12Resource* GetResource(RGResource resource);
+
+	// Call when this pass recorded its work into other lists that are submitted
+	// after the current one (e.g. CommandListPool::Record). Anything after
+	// this pass then goes into a fresh list so the order stays correct.
+	void EndCurrentList() { listEnded = true; }
+
+private:
+	friend class RenderGraphExecutor;
+	RenderGraphExecutor* executor;
+	bool listEnded;
+};
+
+// --------------------------------------------------------
+// Runs a compiled RenderGraph on D3D12.
+//
+// Transient resources are placed resources in one heap that
+// only grows, at the offsets the graph compiler picked, and
+// are kept around between frames as long as the graph asks
+// for the same thing at the same offset. Resource heap tier 1
+// hardware can't mix resource classes in a heap, so there it's
+// one heap per class (render targets & depth buffers, other
+// textures, buffers), each at the same offsets. Textures are
+// discarded right after their aliasing barrier, but still
+// start each frame with undefined contents - their first
+// pass has to clear (or fully overwrite) them.
+//
+// Imported resources go through the ResourceStateTracker, so
+// their states stay in sync with the rest of the engine. Each
+// pass's barriers go out in a single flush.
+//
+// With a profiler set, every pass gets a GPU timing scope
+// under its own name.
+// --------------------------------------------------------
+class RenderGraphExecutor
+{
+public:
+	RenderGraphExecutor();
+
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12Device> device, ResourceStateTracker* stateTracker);
+	void SetProfiler(GpuProfiler* profiler) { this->profiler = profiler; }
+
+	// Fills in size & alignment for a transient 2D texture
+	RGResourceDesc DescribeTexture2D(unsigned int width, unsigned int height, DXGI_FORMAT format, D3D12_RESOURCE_FLAGS flags);
+	// Same for a transient buffer (height 0 marks it as one)
+	RGResourceDesc DescribeBuffer(uint64_t sizeInBytes, D3D12_RESOURCE_FLAGS flags);
+
+	// Runs every pass that survived compilation, in order. Everything starts out
+	// in firstList; whenever a pass ends the current list, nextList() provides
+	// the one to continue in. Returns the list the graph finished in. If the
+	// transients can't be made, nothing runs and firstList comes straight back.
+	ID3D12GraphicsCommandList* Execute(
+		RenderGraph& graph,
+		ID3D12GraphicsCommandList* firstList,
+		const std::function<ID3D12GraphicsCommandList*()>& nextList);
+
+	ID3D12Resource* GetResource(RGResource resource);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> device;
+	ResourceStateTracker* stateTracker;
+	GpuProfiler* profiler;
+
+	// Heaps the transients live in. Tier 2 only uses the first one.
+	enum TransientHeapClass
+	{
+		TRANSIENT_HEAP_RT_DS,
+		TRANSIENT_HEAP_TEXTURES,
+		TRANSIENT_HEAP_BUFFERS,
+		TRANSIENT_HEAP_COUNT
+	};
+	struct TransientHeap
+	{
+		Microsoft::WRL::ComPtr<ID3D12Heap> heap;
+		UINT64 size;
+		D3D12_HEAP_FLAGS flags;
+	};
+	TransientHeap transientHeaps[TRANSIENT_HEAP_COUNT];
+	bool mixedTransientHeap; // Tier 2: everything in one heap
+
+	TransientHeapClass GetHeapClass(const RGResourceDesc& desc);
+
+	// Placed resources we've made so far
+	struct Transient
+	{
+		RGResourceDesc desc;
+		UINT64 offset;
+		TransientHeapClass heapClass;
+		Microsoft::WRL::ComPtr<ID3D12Resource> resource;
+		RGStates state;			// State it was left in at the end of the last frame it was used
+		bool usedThisFrame;
+	};
+	std::vector<Transient> transients;
+
+	// Per graph resource for the current Execute()
+	std::vector<ID3D12Resource*> frameResources;
+	std::vector<int> frameTransients; // Index into transients, -1 for imported
+
+	bool PrepareTransients(RenderGraph& graph);
+	void IssueBarriers(RenderGraph& graph, ID3D12GraphicsCommandList* commandList, const std::vector<RGBarrier>& barriers);
+
+	std::vector<D3D12_RESOURCE_BARRIER> barrierScratch;
+	std::vector<ID3D12Resource*> discardScratch; // Textures that just took over aliased memory
+};
@@ -0,0 +1,182 @@
+#include "RenderQueue.h"
+#include "MatrixKernels.h"
+#include "RadixSort.h"
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+
+using namespace DirectX;
+
+uint64_t RenderQueue::MakeSortKey(RenderPass pass, unsigned int pipelineID, unsigned int materialID, unsigned int meshID, unsigned int depth)
+{
+	// IDs that don't fit just wrap - batches are still split on the
+	// actual pointers, so the worst case is a little less grouping
+	uint64_t pipeline = pipelineID & ((1u << pipelineBits) - 1);
+	uint64_t material = materialID & ((1u << materialBits) - 1);
+	uint64_t mesh = meshID & ((1u << meshBits) - 1);
+	uint64_t state = (pipeline << (materialBits + meshBits)) | (material << meshBits) | mesh;
+	const unsigned int stateBits = pipelineBits + materialBits + meshBits;
+
+	uint64_t key = (uint64_t)pass << (stateBits + depthBits);
+	if (pass == RENDER_PASS_TRANSPARENT)
+	{
+		// Depth first (farthest first), state only breaks ties
+		uint64_t invertedDepth = ((1u << depthBits) - 1) - depth;
+		key |= (invertedDepth << stateBits) | state;
+	}
+	else
+	{
+		// State first so it groups up, nearest first within the same state
+		key |= (state << depthBits) | depth;
+	}
+	return key;
+}
+
+unsigned int RenderQueue::GetPipelineID(ID3D12PipelineState* pipelineState)
+{
+	auto it = pipelineIDs.find(pipelineState);
+	if (it != pipelineIDs.end())
+		return it->second;
+
+	// More pipelines in one frame than the key has room for? The rest
+	// share the last ID - batches are still split on the actual pointers,
+	// so they just don't group up as well
+	unsigned int id = (unsigned int)pipelineIDs.size();
+	if (id > maxPipelineID)
+		id = maxPipelineID;
+	pipelineIDs[pipelineState] = id;
+	return id;
+}
+
+void RenderQueue::Build(const std::vector<std::shared_ptr<Entity>>& entities, const XMFLOAT4X4& viewProjection)
+{
+	PROFILE_FUNCTION();
+
+	unsigned int count = (unsigned int)entities.size();
+	batches.clear();
+	stats = {};
+	stats.entityCount = count;
+
+	JobSystem& jobSystem = JobSystem::GetInstance();
+
+	// World matrices in entity order, then a batched multiply for each chunk.
+	// Transforms were brought up to date in Update, so this only reads them.
+	worldMatrices.resize(count);
+	wvpMatrices.resize(count);
+	jobSystem.ParallelFor(count, 256, [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				worldMatrices[i] = entities[i]->GetTransform()->GetWorldMatrix();
+			}
+			MatrixKernels::MultiplyBatch(&worldMatrices[begin], end - begin, viewProjection, &wvpMatrices[begin]);
+		});
+
+	// The object's origin lands at the last row of its WVP matrix,
+	// and w there is its view space depth - no extra math needed.
+	float maxDepth = 0.0001f;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		maxDepth = max(maxDepth, wvpMatrices[i].m[3][3]);
+	}
+
+	// Pipeline IDs for this frame. Neighbouring entities usually share a
+	// pipeline, so the map only gets looked at when it changes.
+	pipelineIDs.clear();
+	entityPipelineIDs.resize(count);
+	ID3D12PipelineState* lastPipeline = 0;
+	unsigned int lastPipelineID = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		ID3D12PipelineState* pipelineState = entities[i]->GetMaterial()->GetPipelineState().Get();
+		if (pipelineState != lastPipeline || i == 0)
+		{
+			lastPipeline = pipelineState;
+			lastPipelineID = GetPipelineID(pipelineState);
+		}
+		entityPipelineIDs[i] = (uint16_t)lastPipelineID;
+	}
+
+	// Build a key for every entity
+	sortKeys.resize(count);
+	sortIndices.resize(count);
+	tempKeys.resize(count);
+	tempIndices.resize(count);
+	const float depthScale = (float)((1u << depthBits) - 1) / maxDepth;
+	jobSystem.ParallelFor(count, 256, [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Material* material = entities[i]->GetMaterial().get();
+				Mesh* mesh = entities[i]->GetMesh().get();
+
+				float depth = wvpMatrices[i].m[3][3];
+				unsigned int quantizedDepth = depth <= 0.0f ? 0 : (unsigned int)min(depth * depthScale, (float)((1u << depthBits) - 1));
+
+				sortKeys[i] = MakeSortKey(
+					material->GetTransparent() ? RENDER_PASS_TRANSPARENT : RENDER_PASS_OPAQUE,
+					entityPipelineIDs[i],
+					material->GetID(),
+					mesh->GetID(),
+					quantizedDepth);
+				sortIndices[i] = i;
+			}
+		});
+
+	stats.sortPasses = RadixSort64(sortKeys.data(), sortIndices.data(), tempKeys.data(), tempIndices.data(), count);
+
+	// Pack the instance data in sorted order
+	instances.resize(count);
+	jobSystem.ParallelFor(count, 256, [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				unsigned int entityIndex = sortIndices[i];
+				instances[i].world = worldMatrices[entityIndex];
+				instances[i].worldInverseTranspose = entities[entityIndex]->GetTransform()->GetWorldITMatrix();
+				instances[i].worldViewProjection = wvpMatrices[entityIndex];
+			}
+		});
+
+	// Cut the sorted list into batches
+	for (unsigned int i = 0; i < count; i++)
+	{
+		Entity* entity = entities[sortIndices[i]].get();
+		Material* material = entity->GetMaterial().get();
+		Mesh* mesh = entity->GetMesh().get();
+		ID3D12PipelineState* pipelineState = material->GetPipelineState().Get();
+
+		// Same state as the batch we're building? Then it's just one more instance
+		if (!batches.empty() &&
+			batches.back().mesh == mesh &&
+			batches.back().material == material &&
+			batches.back().pipelineState == pipelineState)
+		{
+			batches.back().instanceCount++;
+			continue;
+		}
+
+		DrawBatch batch = {};
+		batch.mesh = mesh;
+		batch.material = material;
+		batch.pipelineState = pipelineState;
+		batch.firstInstance = i;
+		batch.instanceCount = 1;
+
+		// Only flag the state that's actually different from the previous draw
+		DrawBatch* previous = batches.empty() ? nullptr : &batches.back();
+		batch.pipelineChanged = !previous || previous->pipelineState != pipelineState;
+		batch.materialChanged = !previous || previous->material != material;
+		batch.meshChanged = !previous || previous->mesh != mesh;
+
+		stats.pipelineChanges += batch.pipelineChanged ? 1 : 0;
+		stats.materialChanges += batch.materialChanged ? 1 : 0;
+		stats.meshChanges += batch.meshChanged ? 1 : 0;
+		batches.push_back(batch);
+	}
+
+	// Before sorting, every entity set all of its state
+	stats.drawCalls = (unsigned int)batches.size();
+	stats.pipelineChangesAvoided = count - stats.pipelineChanges;
+	stats.materialChangesAvoided = count - stats.materialChanges;
+	stats.meshChangesAvoided = count - stats.meshChanges;
+}
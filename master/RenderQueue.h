@@ -0,0 +1,107 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+#include "Entity.h"
+#include "BufferStructs.h"
+
+// Which group of draws something belongs to, highest bits of the sort key
+enum RenderPass
+{
+	RENDER_PASS_OPAQUE = 0,
+	RENDER_PASS_TRANSPARENT = 1
+};
+
+// One instanced draw: every entity in it shares a mesh and a material
+struct DrawBatch
+{
+	Mesh* mesh;
+	Material* material;
+	ID3D12PipelineState* pipelineState;
+	unsigned int firstInstance; // Index into the frame's instance list (StartInstanceLocation)
+	unsigned int instanceCount;
+
+	// What actually differs from the batch drawn right before this one.
+	// Only these pieces of state need to be sent to the command list.
+	bool pipelineChanged;
+	bool materialChanged;
+	bool meshChanged;
+};
+
+// Counters for the most recent Build()
+struct RenderStats
+{
+	unsigned int entityCount;
+	unsigned int drawCalls;
+	unsigned int sortPasses;	// Radix sort passes that weren't skipped
+
+	// State changes we actually emit
+	unsigned int pipelineChanges;
+	unsigned int materialChanges;
+	unsigned int meshChanges;
+
+	// State changes saved compared to setting everything for every entity
+	unsigned int pipelineChangesAvoided;
+	unsigned int materialChangesAvoided;
+	unsigned int meshChangesAvoided;
+};
+
+// --------------------------------------------------------
+// Turns the scene's entity list into as few draws and
+// state changes as possible.
+//
+// Every entity gets a 64-bit sort key (see MakeSortKey) made
+// of its pass, pipeline, material, mesh and view depth. The
+// keys are radix sorted, which puts identical state next to
+// each other - opaque draws front to back, transparent ones
+// back to front. Runs with matching state become instanced
+// draws, and their per-instance data (world, normal and
+// world-view-projection matrices) is packed contiguously so
+// the whole frame can be uploaded in one go.
+// --------------------------------------------------------
+class RenderQueue
+{
+public:
+	void Build(const std::vector<std::shared_ptr<Entity>>& entities, const DirectX::XMFLOAT4X4& viewProjection);
+
+	const std::vector<DrawBatch>& GetBatches() { return batches; }
+	const std::vector<InstanceData>& GetInstances() { return instances; }
+	const std::vector<uint32_t>& GetInstanceEntities() { return sortIndices; } // Entity index of each instance
+	const RenderStats& GetStats() { return stats; }
+
+private:
+	// Key layout, most significant first:
+	//  Opaque:      pass(2) | pipeline(12) | material(14) | mesh(14) | depth(22)
+	//  Transparent: pass(2) | inverted depth(22) | pipeline(12) | material(14) | mesh(14)
+	static const unsigned int pipelineBits = 12;
+	static const unsigned int materialBits = 14;
+	static const unsigned int meshBits = 14;
+	static const unsigned int depthBits = 22;
+
+	static uint64_t MakeSortKey(RenderPass pass, unsigned int pipelineID, unsigned int materialID, unsigned int meshID, unsigned int depth);
+
+	// Pipeline states don't carry an ID of their own, so hand them out here.
+	// Handed out again from zero every frame, before the key building jobs
+	// run, so the map only holds pipelines that are in use and the jobs
+	// just read entityPipelineIDs.
+	static const unsigned int maxPipelineID = (1u << pipelineBits) - 1;
+	unsigned int GetPipelineID(ID3D12PipelineState* pipelineState);
+	std::unordered_map<ID3D12PipelineState*, unsigned int> pipelineIDs;
+	std::vector<uint16_t> entityPipelineIDs;
+
+	// Kept around between frames so we aren't reallocating every frame
+	std::vector<uint64_t> sortKeys;
+	std::vector<uint32_t> sortIndices;
+	std::vector<uint64_t> tempKeys;
+	std::vector<uint32_t> tempIndices;
+	std::vector<DirectX::XMFLOAT4X4> worldMatrices;
+	std::vector<DirectX::XMFLOAT4X4> wvpMatrices;
+	std::vector<InstanceData> instances;
+	std::vector<DrawBatch> batches;
+
+	RenderStats stats;
+};
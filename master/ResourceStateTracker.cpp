@@ -0,0 +1,439 @@
+#include "ResourceStateTracker.h"
+
+#include <wrl/client.h>
+
+ResourceStateTracker::ResourceStateTracker() :
+	frameStats(),
+	lastFrameStats()
+{
+}
+
+void ResourceStateTracker::Register(ID3D12Resource* resource, D3D12_RESOURCE_STATES state)
+{
+	if (!resource)
+		return;
+
+	// Mips * array slices * planes (depth/stencil formats have two planes)
+	D3D12_RESOURCE_DESC desc = resource->GetDesc();
+	UINT subresourceCount = 1;
+	if (desc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER)
+	{
+		UINT arraySize = desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D ? 1 : desc.DepthOrArraySize;
+
+		UINT planeCount = 1;
+		Microsoft::WRL::ComPtr<ID3D12Device> device;
+		if (SUCCEEDED(resource->GetDevice(IID_PPV_ARGS(device.GetAddressOf()))))
+		{
+			D3D12_FEATURE_DATA_FORMAT_INFO formatInfo = {};
+			formatInfo.Format = desc.Format;
+			if (SUCCEEDED(device->CheckFeatureSupport(D3D12_FEATURE_FORMAT_INFO, &formatInfo, sizeof(formatInfo))))
+				planeCount = formatInfo.PlaneCount;
+		}
+
+		subresourceCount = desc.MipLevels * arraySize * planeCount;
+	}
+
+	Register(resource, state, subresourceCount);
+}
+
+void ResourceStateTracker::Register(ID3D12Resource* resource, D3D12_RESOURCE_STATES state, UINT subresourceCount)
+{
+	if (!resource || subresourceCount == 0)
+		return;
+
+	std::lock_guard<std::mutex> lock(trackerMutex);
+	TrackedResource& tracked = resources[resource];
+	tracked.states.assign(subresourceCount, state);
+}
+
+void ResourceStateTracker::Unregister(ID3D12Resource* resource)
+{
+	std::lock_guard<std::mutex> lock(trackerMutex);
+	resources.erase(resource);
+
+	// Don't leave anything pointing at it
+	for (size_t i = 0; i < pendingSplits.size(); )
+	{
+		if (pendingSplits[i].resource == resource)
+			pendingSplits.erase(pendingSplits.begin() + i);
+		else
+			i++;
+	}
+	for (size_t i = 0; i < queued.size(); )
+	{
+		const D3D12_RESOURCE_BARRIER& barrier = queued[i];
+		bool matches =
+			(barrier.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION && barrier.Transition.pResource == resource) ||
+			(barrier.Type == D3D12_RESOURCE_BARRIER_TYPE_UAV && barrier.UAV.pResource == resource);
+		if (matches)
+			queued.erase(queued.begin() + i);
+		else
+			i++;
+	}
+}
+
+D3D12_RESOURCE_STATES ResourceStateTracker::GetState(ID3D12Resource* resource, UINT subresource)
+{
+	std::lock_guard<std::mutex> lock(trackerMutex);
+	auto it = resources.find(resource);
+	if (it == resources.end() || subresource >= it->second.states.size())
+		return D3D12_RESOURCE_STATE_COMMON;
+	return it->second.states[subresource];
+}
+
+bool ResourceStateTracker::AllSubresourcesIn(const TrackedResource& tracked, D3D12_RESOURCE_STATES state)
+{
+	for (D3D12_RESOURCE_STATES s : tracked.states)
+	{
+		if (s != state)
+			return false;
+	}
+	return true;
+}
+
+void ResourceStateTracker::QueueTransition(ID3D12Resource* resource, UINT subresource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, D3D12_RESOURCE_BARRIER_FLAGS flags)
+{
+	D3D12_RESOURCE_BARRIER rb = {};
+	rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	rb.Flags = flags;
+	rb.Transition.pResource = resource;
+	rb.Transition.StateBefore = before;
+	rb.Transition.StateAfter = after;
+	rb.Transition.Subresource = subresource;
+	queued.push_back(rb);
+}
+
+void ResourceStateTracker::Transition(ID3D12Resource* resource, D3D12_RESOURCE_STATES after, UINT subresource)
+{
+	std::lock_guard<std::mutex> lock(trackerMutex);
+	auto it = resources.find(resource);
+	if (it == resources.end())
+		return;
+
+	TrackedResource& tracked = it->second;
+
+	// The whole resource at once only works if every subresource agrees,
+	// otherwise each one needs its own barrier
+	if (subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES && !AllSubresourcesIn(tracked, tracked.states[0]))
+	{
+		for (UINT i = 0; i < tracked.states.size(); i++)
+			TransitionSubresource(resource, tracked, i, after);
+		return;
+	}
+
+	TransitionSubresource(resource, tracked, subresource, after);
+}
+
+// Ends every pending split that covers this subresource. A split on the
+// whole resource overlaps every subresource, and the whole resource
+// overlaps every split on it. Returns whether there were any.
+bool ResourceStateTracker::EndSplits(ID3D12Resource* resource, UINT subresource)
+{
+	bool all = subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	bool endedSplit = false;
+	for (size_t i = 0; i < pendingSplits.size(); )
+	{
+		PendingSplit split = pendingSplits[i];
+		bool overlaps = split.resource == resource &&
+			(all || split.subresource == subresource || split.subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+		if (!overlaps)
+		{
+			i++;
+			continue;
+		}
+
+		pendingSplits.erase(pendingSplits.begin() + i);
+		endedSplit = true;
+
+		if (split.beginFlushed)
+		{
+			// The begin half went out earlier, so this is a real split
+			QueueTransition(resource, split.subresource, split.before, split.after, D3D12_RESOURCE_BARRIER_FLAG_END_ONLY);
+			frameStats.split++;
+		}
+		else
+		{
+			// Begin half is still queued - no distance gained, make it a normal barrier
+			for (D3D12_RESOURCE_BARRIER& barrier : queued)
+			{
+				if (barrier.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION &&
+					barrier.Transition.pResource == resource &&
+					barrier.Transition.Subresource == split.subresource &&
+					barrier.Flags == D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY)
+				{
+					barrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+					break;
+				}
+			}
+		}
+	}
+
+	return endedSplit;
+}
+
+void ResourceStateTracker::TransitionSubresource(ID3D12Resource* resource, TrackedResource& tracked, UINT subresource, D3D12_RESOURCE_STATES after)
+{
+	bool all = subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	auto setState = [&](D3D12_RESOURCE_STATES state)
+	{
+		if (all) tracked.states.assign(tracked.states.size(), state);
+		else tracked.states[subresource] = state;
+	};
+
+	// Finish any split barrier on this subresource first
+	bool endedSplit = EndSplits(resource, subresource);
+
+	// The tracked states already hold where the splits ended up. If that's
+	// where we wanted to go, ending them was the whole transition.
+	D3D12_RESOURCE_STATES before = all ? tracked.states[0] : tracked.states[subresource];
+	if (before == after)
+	{
+		if (!endedSplit)
+			frameStats.elided++;
+		return;
+	}
+
+	// Already a transition queued for this? Fold the two together,
+	// and drop it entirely if we end up back where we started
+	for (size_t i = queued.size(); i-- > 0; )
+	{
+		D3D12_RESOURCE_BARRIER& barrier = queued[i];
+		if (barrier.Type != D3D12_RESOURCE_BARRIER_TYPE_TRANSITION ||
+			barrier.Transition.pResource != resource)
+			continue;
+
+		// Split halves have to stay as they are, and so does anything
+		// we'd be moving past (the whole resource vs. one subresource)
+		if (barrier.Transition.Subresource != subresource ||
+			barrier.Flags != D3D12_RESOURCE_BARRIER_FLAG_NONE)
+		{
+			if (all || barrier.Transition.Subresource == subresource ||
+				barrier.Transition.Subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+				break;
+			continue;
+		}
+
+		if (barrier.Transition.StateBefore == after)
+		{
+			queued.erase(queued.begin() + i);
+			frameStats.elided += 2;
+		}
+		else
+		{
+			barrier.Transition.StateAfter = after;
+			frameStats.elided++;
+		}
+		setState(after);
+		return;
+	}
+
+	QueueTransition(resource, subresource, before, after, D3D12_RESOURCE_BARRIER_FLAG_NONE);
+	setState(after);
+}
+
+void ResourceStateTracker::BeginTransition(ID3D12Resource* resource, D3D12_RESOURCE_STATES after, UINT subresource)
+{
+	std::lock_guard<std::mutex> lock(trackerMutex);
+	auto it = resources.find(resource);
+	if (it == resources.end())
+		return;
+
+	TrackedResource& tracked = it->second;
+	bool all = subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+
+	// Splitting per subresource isn't worth the bookkeeping, just do it normally
+	if (all && !AllSubresourcesIn(tracked, tracked.states[0]))
+	{
+		for (UINT i = 0; i < tracked.states.size(); i++)
+			TransitionSubresource(resource, tracked, i, after);
+		return;
+	}
+
+	// A new split can't start until any earlier one on it has ended
+	bool endedSplit = EndSplits(resource, subresource);
+
+	D3D12_RESOURCE_STATES before = all ? tracked.states[0] : tracked.states[subresource];
+	if (before == after)
+	{
+		if (!endedSplit)
+			frameStats.elided++;
+		return;
+	}
+
+	QueueTransition(resource, subresource, before, after, D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY);
+	PendingSplit split = { resource, subresource, before, after, false };
+	pendingSplits.push_back(split);
+
+	if (all) tracked.states.assign(tracked.states.size(), after);
+	else tracked.states[subresource] = after;
+}
+
+void ResourceStateTracker::UAVBarrier(ID3D12Resource* resource)
+{
+	std::lock_guard<std::mutex> lock(trackerMutex);
+	D3D12_RESOURCE_BARRIER rb = {};
+	rb.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+	rb.UAV.pResource = resource;
+	queued.push_back(rb);
+}
+
+void ResourceStateTracker::Flush(ID3D12GraphicsCommandList* commandList, const D3D12_RESOURCE_BARRIER* extraBarriers, UINT extraBarrierCount)
+{
+	std::lock_guard<std::mutex> lock(trackerMutex);
+
+	for (UINT i = 0; i < extraBarrierCount; i++)
+		queued.push_back(extraBarriers[i]);
+
+	if (!queued.empty())
+		commandList->ResourceBarrier((UINT)queued.size(), queued.data());
+	FlushQueued();
+}
+
+void ResourceStateTracker::Flush(std::vector<D3D12_RESOURCE_BARRIER>& barriers)
+{
+	std::lock_guard<std::mutex> lock(trackerMutex);
+	barriers = queued;
+	FlushQueued();
+}
+
+void ResourceStateTracker::FlushQueued()
+{
+	if (!queued.empty())
+	{
+		frameStats.issued += (unsigned int)queued.size();
+		frameStats.flushes++;
+		queued.clear();
+	}
+
+	// Any begin halves are out now, so their ends can be real splits
+	for (PendingSplit& split : pendingSplits)
+		split.beginFlushed = true;
+}
+
+void ResourceStateTracker::EndFrame()
+{
+	std::lock_guard<std::mutex> lock(trackerMutex);
+	lastFrameStats = frameStats;
+	frameStats = {};
+}
+
+bool ResourceStateTracker::SelfTest(std::string* error)
+{
+	auto fail = [&](const char* message)
+	{
+		if (error) *error = message;
+		return false;
+	};
+
+	// Never dereferenced, only used as keys
+	ID3D12Resource* texture = reinterpret_cast<ID3D12Resource*>(0x1000);
+	const UINT all = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	const D3D12_RESOURCE_STATES rt = D3D12_RESOURCE_STATE_RENDER_TARGET;
+	const D3D12_RESOURCE_STATES srv = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+	const D3D12_RESOURCE_STATES copy = D3D12_RESOURCE_STATE_COPY_SOURCE;
+
+	auto matches = [&](const D3D12_RESOURCE_BARRIER& barrier, UINT subresource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, D3D12_RESOURCE_BARRIER_FLAGS flags)
+	{
+		return barrier.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION &&
+			barrier.Transition.pResource == texture &&
+			barrier.Transition.Subresource == subresource &&
+			barrier.Transition.StateBefore == before &&
+			barrier.Transition.StateAfter == after &&
+			barrier.Flags == flags;
+	};
+
+	std::vector<D3D12_RESOURCE_BARRIER> barriers;
+
+	// A split on the whole resource, then one subresource goes elsewhere:
+	// the whole split has to end before that subresource moves on
+	{
+		ResourceStateTracker tracker;
+		tracker.Register(texture, rt, 4);
+		tracker.BeginTransition(texture, srv);
+		tracker.Flush(barriers);
+		if (barriers.size() != 1 || !matches(barriers[0], all, rt, srv, D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY))
+			return fail("Whole resource split didn't begin");
+
+		tracker.Transition(texture, copy, 1);
+		tracker.Flush(barriers);
+		if (barriers.size() != 2 ||
+			!matches(barriers[0], all, rt, srv, D3D12_RESOURCE_BARRIER_FLAG_END_ONLY) ||
+			!matches(barriers[1], 1, srv, copy, D3D12_RESOURCE_BARRIER_FLAG_NONE))
+			return fail("Whole resource split wasn't ended by a single subresource transition");
+
+		// Nothing left pending - the next transition is a plain one
+		tracker.Transition(texture, srv, 1);
+		tracker.Flush(barriers);
+		if (barriers.size() != 1 || !matches(barriers[0], 1, copy, srv, D3D12_RESOURCE_BARRIER_FLAG_NONE))
+			return fail("Split was ended twice");
+		if (tracker.GetState(texture, 0) != srv || tracker.GetState(texture, 3) != srv)
+			return fail("Other subresources lost the split's state");
+	}
+
+	// Same, but nothing flushed in between: it's just a normal barrier
+	{
+		ResourceStateTracker tracker;
+		tracker.Register(texture, rt, 4);
+		tracker.BeginTransition(texture, srv);
+		tracker.Transition(texture, srv, 2);
+		tracker.Flush(barriers);
+		if (barriers.size() != 1 || !matches(barriers[0], all, rt, srv, D3D12_RESOURCE_BARRIER_FLAG_NONE))
+			return fail("Unflushed whole resource split didn't become a normal barrier");
+	}
+
+	// A split on one subresource, then the whole resource goes there
+	{
+		ResourceStateTracker tracker;
+		tracker.Register(texture, rt, 4);
+		tracker.BeginTransition(texture, srv, 0);
+		tracker.Flush(barriers);
+		tracker.Transition(texture, srv);
+		tracker.Flush(barriers);
+		if (barriers.size() != 4 ||
+			!matches(barriers[0], 0, rt, srv, D3D12_RESOURCE_BARRIER_FLAG_END_ONLY) ||
+			!matches(barriers[1], 1, rt, srv, D3D12_RESOURCE_BARRIER_FLAG_NONE) ||
+			!matches(barriers[3], 3, rt, srv, D3D12_RESOURCE_BARRIER_FLAG_NONE))
+			return fail("Single subresource split wasn't ended by a whole resource transition");
+	}
+
+	// A split that ends where it was going is only the end half
+	{
+		ResourceStateTracker tracker;
+		tracker.Register(texture, rt, 4);
+		tracker.BeginTransition(texture, srv);
+		tracker.Flush(barriers);
+		tracker.Transition(texture, srv);
+		tracker.Flush(barriers);
+		if (barriers.size() != 1 || !matches(barriers[0], all, rt, srv, D3D12_RESOURCE_BARRIER_FLAG_END_ONLY))
+			return fail("Matching split end wasn't just the end half");
+	}
+
+	// Queued transitions that go there and back cancel out
+	{
+		ResourceStateTracker tracker;
+		tracker.Register(texture, rt, 4);
+		tracker.Transition(texture, srv);
+		tracker.Transition(texture, rt);
+		tracker.Transition(texture, rt);
+		tracker.Flush(barriers);
+		if (!barriers.empty())
+			return fail("There and back again wasn't elided");
+	}
+
+	// A single subresource can't fold into a barrier from before a whole resource one
+	{
+		ResourceStateTracker tracker;
+		tracker.Register(texture, rt, 2);
+		tracker.Transition(texture, srv, 0);
+		tracker.Transition(texture, srv, 1);
+		tracker.Transition(texture, copy);
+		tracker.Transition(texture, rt, 0);
+		tracker.Flush(barriers);
+		if (barriers.size() != 4 ||
+			!matches(barriers[2], all, srv, copy, D3D12_RESOURCE_BARRIER_FLAG_NONE) ||
+			!matches(barriers[3], 0, copy, rt, D3D12_RESOURCE_BARRIER_FLAG_NONE))
+			return fail("Folded a transition past one on the whole resource");
+	}
+
+	return true;
+}
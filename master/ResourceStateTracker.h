@@ -0,0 +1,103 @@
+#pragma once
+
+#include <d3d12.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Barrier counts for one frame
+struct BarrierStats
+{
+	unsigned int issued;		// Barriers that actually went to a command list
+	unsigned int elided;		// Transitions skipped (already in that state, or cancelled out)
+	unsigned int split;			// Transitions done as begin/end pairs
+	unsigned int flushes;		// ResourceBarrier calls
+};
+
+// --------------------------------------------------------
+// Knows what state every registered resource is in, per
+// subresource, as of the end of what's been recorded so far.
+//
+// Transitions are queued instead of recorded right away, and
+// Flush() sends everything queued in a single ResourceBarrier
+// call - so call it right before the work that needs the new
+// states. While queued, transitions that end where they began
+// cancel out, back to back ones collapse into one, and ones
+// to the state a resource is already in are dropped.
+//
+// BeginTransition() starts a split barrier: the begin half goes
+// out with the next flush and the end half with the flush
+// after the matching Transition(). If no flush happens in
+// between there's no distance to gain, so it turns back into
+// a normal barrier.
+//
+// All of this assumes lists are submitted in the order they
+// were recorded, which is how the engine works.
+// --------------------------------------------------------
+class ResourceStateTracker
+{
+public:
+	ResourceStateTracker();
+
+	// Starts tracking a resource, with every subresource in the given state
+	void Register(ID3D12Resource* resource, D3D12_RESOURCE_STATES state);
+	// Same, but with the subresource count given instead of read from the resource
+	void Register(ID3D12Resource* resource, D3D12_RESOURCE_STATES state, UINT subresourceCount);
+	void Unregister(ID3D12Resource* resource);
+
+	// Current (recorded) state of one subresource
+	D3D12_RESOURCE_STATES GetState(ID3D12Resource* resource, UINT subresource = 0);
+
+	// Queues a transition. Untracked resources are ignored.
+	void Transition(ID3D12Resource* resource, D3D12_RESOURCE_STATES after, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+
+	// Queues the first half of a split transition (see above)
+	void BeginTransition(ID3D12Resource* resource, D3D12_RESOURCE_STATES after, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+
+	// Queues a UAV barrier
+	void UAVBarrier(ID3D12Resource* resource);
+
+	// Records everything queued (plus any extra barriers the caller has) in one call
+	void Flush(ID3D12GraphicsCommandList* commandList, const D3D12_RESOURCE_BARRIER* extraBarriers = 0, UINT extraBarrierCount = 0);
+	// Same, but hands the barriers back instead of recording them
+	void Flush(std::vector<D3D12_RESOURCE_BARRIER>& barriers);
+
+	// Frame's over - snapshot the counts and start fresh
+	void EndFrame();
+	const BarrierStats& GetLastFrameStats() { return lastFrameStats; }
+
+	// Split barriers against single subresources, elision and folding.
+	// Only needs resource pointers as keys, so it uses fake ones.
+	static bool SelfTest(std::string* error);
+
+private:
+	struct TrackedResource
+	{
+		std::vector<D3D12_RESOURCE_STATES> states; // One per subresource
+	};
+
+	// A split barrier whose end half hasn't been asked for yet
+	struct PendingSplit
+	{
+		ID3D12Resource* resource;
+		UINT subresource;
+		D3D12_RESOURCE_STATES before;
+		D3D12_RESOURCE_STATES after;
+		bool beginFlushed; // Has the begin half gone out yet?
+	};
+
+	bool EndSplits(ID3D12Resource* resource, UINT subresource);
+	void TransitionSubresource(ID3D12Resource* resource, TrackedResource& tracked, UINT subresource, D3D12_RESOURCE_STATES after);
+	void QueueTransition(ID3D12Resource* resource, UINT subresource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, D3D12_RESOURCE_BARRIER_FLAGS flags);
+	bool AllSubresourcesIn(const TrackedResource& tracked, D3D12_RESOURCE_STATES state);
+	void FlushQueued(); // Counts and clears what's queued, marks begin halves as sent
+
+	std::mutex trackerMutex;
+	std::unordered_map<ID3D12Resource*, TrackedResource> resources;
+	std::vector<D3D12_RESOURCE_BARRIER> queued;
+	std::vector<PendingSplit> pendingSplits;
+
+	BarrierStats frameStats;
+	BarrierStats lastFrameStats;
+};
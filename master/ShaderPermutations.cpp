@@ -0,0 +1,296 @@
+#include "ShaderPermutations.h"
+#include "Hash.h"
+#include "JobSystem.h"
+#include "Lights.h"
+#include "Logger.h"
+
+#include <wrl/client.h>
+#include <dxcapi.h>
+#include <chrono>
+#include <fstream>
+
+// Bump whenever something that affects the output changes without
+// showing up in the sources or defines (compiler flags, for example)
+static const uint32_t CacheVersion = 1;
+
+static bool ReadWholeFile(const std::wstring& path, std::string& contents)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
+
+	contents.resize((size_t)file.tellg());
+	file.seekg(0);
+	file.read(&contents[0], contents.size());
+	return true;
+}
+
+ShaderPermutations::ShaderPermutations() :
+	compilerModule(0),
+	createInstance(0),
+	stats()
+{
+}
+
+ShaderPermutations::~ShaderPermutations()
+{
+	if (compilerModule)
+		FreeLibrary(compilerModule);
+}
+
+void ShaderPermutations::Initialize(std::wstring sourceDirectory, std::wstring cacheDirectory)
+{
+	this->sourceDirectory = sourceDirectory;
+	this->cacheDirectory = cacheDirectory;
+	CreateDirectoryW(cacheDirectory.c_str(), 0);
+
+	// Optional - without it only already cached variants are available
+	compilerModule = LoadLibraryW(L"dxcompiler.dll");
+	if (compilerModule)
+		createInstance = (void*)GetProcAddress(compilerModule, "DxcCreateInstance");
+	stats.compilerAvailable = createInstance != 0;
+}
+
+uint32_t ShaderPermutations::MakeKey(uint32_t features, unsigned int directionalLights, unsigned int pointLights, unsigned int spotLights)
+{
+	return
+		(features & 0xFF) |
+		((directionalLights & 0xFF) << 8) |
+		((pointLights & 0xFF) << 16) |
+		((spotLights & 0xFF) << 24);
+}
+
+void ShaderPermutations::Precompile(const std::vector<uint32_t>& keys, const std::vector<std::wstring>& vertexShaderFiles)
+{
+	// DXC is happy to run on several threads, as long as each has its own
+	// compiler. Vertex shaders first, they're the slow ones.
+	unsigned int vertexShaderCount = (unsigned int)vertexShaderFiles.size();
+	JobSystem::GetInstance().ParallelFor(vertexShaderCount + (unsigned int)keys.size(), 1,
+		[&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				if (i < vertexShaderCount)
+					GetVertexShader(vertexShaderFiles[i]);
+				else
+					GetPixelShader(keys[i - vertexShaderCount]);
+			}
+		});
+}
+
+const std::vector<char>& ShaderPermutations::GetPixelShader(uint32_t key)
+{
+	std::promise<std::vector<char>> promise;
+	PendingShader variant;
+	bool ours = false;
+	{
+		std::lock_guard<std::mutex> lock(variantMutex);
+		auto it = pixelShaders.find(key);
+		if (it != pixelShaders.end())
+		{
+			variant = it->second;
+		}
+		else
+		{
+			variant = promise.get_future().share();
+			pixelShaders.emplace(key, variant);
+			ours = true;
+		}
+	}
+
+	// Built (or being built) by someone else
+	if (!ours)
+		return variant.get();
+
+	uint32_t features = key & 0xFF;
+	wchar_t define[64];
+	std::vector<std::wstring> defines;
+	defines.push_back(L"PERMUTATION=1");
+	swprintf_s(define, L"DIR_LIGHTS=%u", (key >> 8) & 0xFF);
+	defines.push_back(define);
+	swprintf_s(define, L"POINT_LIGHTS=%u", (key >> 16) & 0xFF);
+	defines.push_back(define);
+	swprintf_s(define, L"SPOT_LIGHTS=%u", (key >> 24) & 0xFF);
+	defines.push_back(define);
+	if (features & SHADER_FEATURE_NORMAL_MAP) defines.push_back(L"HAS_NORMAL_MAP=1");
+	if (features & SHADER_FEATURE_ROUGHNESS_MAP) defines.push_back(L"HAS_ROUGHNESS_MAP=1");
+	if (features & SHADER_FEATURE_METAL_MAP) defines.push_back(L"HAS_METAL_MAP=1");
+
+	promise.set_value(Build(L"PixelShader.hlsl", L"ps_6_0", defines));
+	return variant.get();
+}
+
+const std::vector<char>& ShaderPermutations::GetVertexShader(const std::wstring& file)
+{
+	std::promise<std::vector<char>> promise;
+	PendingShader variant;
+	bool ours = false;
+	{
+		std::lock_guard<std::mutex> lock(variantMutex);
+		auto it = vertexShaders.find(file);
+		if (it != vertexShaders.end())
+		{
+			variant = it->second;
+		}
+		else
+		{
+			variant = promise.get_future().share();
+			vertexShaders.emplace(file, variant);
+			ours = true;
+		}
+	}
+
+	if (ours)
+		promise.set_value(Build(file, L"vs_6_0", std::vector<std::wstring>()));
+	return variant.get();
+}
+
+std::vector<char> ShaderPermutations::Build(const std::wstring& file, const wchar_t* target, const std::vector<std::wstring>& defines)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	std::wstring path = sourceDirectory + file;
+
+	// MAX_LIGHTS comes from the C++ side so the two can't disagree
+	std::vector<std::wstring> allDefines = defines;
+	wchar_t maxLights[32];
+	swprintf_s(maxLights, L"MAX_LIGHTS=%d", MAX_LIGHTS);
+	allDefines.push_back(maxLights);
+
+	// Everything that goes into the output goes into the hash
+	std::string combined;
+	GatherSource(path, combined);
+	uint64_t hash = HashValue(HashStart, CacheVersion);
+	hash = HashBytes(hash, combined.data(), combined.size());
+	hash = HashBytes(hash, target, wcslen(target) * sizeof(wchar_t));
+	for (const std::wstring& define : allDefines)
+		hash = HashBytes(hash, define.c_str(), (define.size() + 1) * sizeof(wchar_t));
+
+	wchar_t name[32];
+	swprintf_s(name, L"%016llx.dxil", (unsigned long long)hash);
+	std::wstring cachePath = cacheDirectory + name;
+
+	std::vector<char> dxil;
+	std::string cached;
+	bool hit = ReadWholeFile(cachePath, cached) && !cached.empty();
+	bool compiled = false;
+	if (hit)
+	{
+		dxil.assign(cached.begin(), cached.end());
+	}
+	else
+	{
+		std::string source;
+		if (createInstance && ReadWholeFile(path, source))
+			compiled = CompileDXC(path, source, target, allDefines, dxil);
+
+		if (compiled)
+		{
+			std::ofstream out(cachePath, std::ios::binary | std::ios::trunc);
+			out.write(dxil.data(), dxil.size());
+		}
+	}
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::lock_guard<std::mutex> lock(statsMutex);
+	if (hit) stats.cacheHits++;
+	else if (compiled) stats.compiles++;
+	else stats.failures++;
+	if (!dxil.empty() && target[0] == L'p') stats.variants++;
+	stats.compileMs += ms;
+	return dxil;
+}
+
+bool ShaderPermutations::CompileDXC(const std::wstring& path, const std::string& source, const wchar_t* target, const std::vector<std::wstring>& defines, std::vector<char>& dxil)
+{
+	// Compiler objects aren't thread safe, so every compile makes its own
+	DxcCreateInstanceProc create = (DxcCreateInstanceProc)createInstance;
+	Microsoft::WRL::ComPtr<IDxcUtils> utils;
+	Microsoft::WRL::ComPtr<IDxcCompiler3> compiler;
+	Microsoft::WRL::ComPtr<IDxcIncludeHandler> includeHandler;
+	if (FAILED(create(CLSID_DxcUtils, IID_PPV_ARGS(utils.GetAddressOf()))) ||
+		FAILED(create(CLSID_DxcCompiler, IID_PPV_ARGS(compiler.GetAddressOf()))) ||
+		FAILED(utils->CreateDefaultIncludeHandler(includeHandler.GetAddressOf())))
+		return false;
+
+	// The path comes first so includes are found next to the file
+	std::vector<LPCWSTR> args;
+	args.push_back(path.c_str());
+	args.push_back(L"-E");
+	args.push_back(L"main");
+	args.push_back(L"-T");
+	args.push_back(target);
+	args.push_back(L"-O3");
+	args.push_back(L"-Qstrip_debug");
+	args.push_back(L"-Qstrip_reflect");
+	for (const std::wstring& define : defines)
+	{
+		args.push_back(L"-D");
+		args.push_back(define.c_str());
+	}
+
+	DxcBuffer buffer = {};
+	buffer.Ptr = source.data();
+	buffer.Size = source.size();
+	buffer.Encoding = DXC_CP_UTF8;
+
+	Microsoft::WRL::ComPtr<IDxcResult> result;
+	HRESULT status = E_FAIL;
+	compiler->Compile(&buffer, args.data(), (UINT32)args.size(), includeHandler.Get(), IID_PPV_ARGS(result.GetAddressOf()));
+	if (result)
+		result->GetStatus(&status);
+
+	if (FAILED(status))
+	{
+		Microsoft::WRL::ComPtr<IDxcBlobUtf8> errors;
+		if (result && SUCCEEDED(result->GetOutput(DXC_OUT_ERRORS, IID_PPV_ARGS(errors.GetAddressOf()), 0)) && errors && errors->GetStringLength() > 0)
+		{
+			OutputDebugStringA(errors->GetStringPointer());
+			LOG_ERROR("Shader variant failed to compile: %s", errors->GetStringPointer());
+		}
+		return false;
+	}
+
+	Microsoft::WRL::ComPtr<IDxcBlob> object;
+	if (FAILED(result->GetOutput(DXC_OUT_OBJECT, IID_PPV_ARGS(object.GetAddressOf()), 0)) || !object)
+		return false;
+
+	const char* code = (const char*)object->GetBufferPointer();
+	dxil.assign(code, code + object->GetBufferSize());
+	return true;
+}
+
+void ShaderPermutations::GatherSource(const std::wstring& path, std::string& combined, int depth)
+{
+	std::string contents;
+	if (depth > 16 || !ReadWholeFile(path, contents))
+		return;
+	combined += contents;
+
+	// Follow #include "file" lines, relative to this file
+	std::wstring directory = path.substr(0, path.find_last_of(L"/\\") + 1);
+	size_t lineStart = 0;
+	while (lineStart < contents.size())
+	{
+		size_t lineEnd = contents.find('\n', lineStart);
+		if (lineEnd == std::string::npos) lineEnd = contents.size();
+
+		size_t include = contents.find("#include", lineStart);
+		if (include < lineEnd)
+		{
+			size_t open = contents.find('"', include);
+			size_t close = open == std::string::npos ? open : contents.find('"', open + 1);
+			if (close < lineEnd)
+			{
+				std::string name = contents.substr(open + 1, close - open - 1);
+				GatherSource(directory + std::wstring(name.begin(), name.end()), combined, depth + 1);
+			}
+		}
+		lineStart = lineEnd + 1;
+	}
+}
+
+ShaderPermutationStats ShaderPermutations::GetStats()
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	return stats;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Material features a pixel shader variant can be specialized on
+enum ShaderFeature : uint32_t
+{
+	SHADER_FEATURE_NORMAL_MAP = 1 << 0,
+	SHADER_FEATURE_ROUGHNESS_MAP = 1 << 1,	// Otherwise the material's constant roughness
+	SHADER_FEATURE_METAL_MAP = 1 << 2		// Otherwise the material's constant metalness
+};
+
+// Counts for the stats window
+struct ShaderPermutationStats
+{
+	unsigned int variants;		// Pixel shader variants available
+	unsigned int cacheHits;		// Loaded from the DXIL cache
+	unsigned int compiles;		// Compiled with DXC this run
+	unsigned int failures;
+	double compileMs;
+	bool compilerAvailable;		// False when dxcompiler.dll couldn't be loaded
+};
+
+// --------------------------------------------------------
+// Specialized variants of the main shaders, compiled with DXC.
+//
+// A variant is picked by a compact 32 bit key:
+//  - bits  0-7  : ShaderFeature flags
+//  - bits  8-15 : directional light count
+//  - bits 16-23 : point light count
+//  - bits 24-31 : spot light count
+// which turn into defines, so the variant has no per-light
+// branching and skips sampling any maps the material lacks.
+// Lights have to be sorted by type (directional, point, spot)
+// in the constant buffer for this to work.
+//
+// Compiled DXIL is cached on disk by a hash of everything that
+// went into it (sources and includes, defines, arguments), so
+// once a variant has been built - at load time, or by an earlier
+// run whose cache directory was shipped - it's just a file read.
+// Nothing here should be called from the hot path: Precompile()
+// everything a scene needs while loading.
+//
+// DXC output needs dxil.dll next to dxcompiler.dll to be signed,
+// otherwise D3D12 won't accept it.
+// --------------------------------------------------------
+class ShaderPermutations
+{
+public:
+	ShaderPermutations();
+	~ShaderPermutations();
+
+	// sourceDirectory holds the .hlsl files, cacheDirectory the DXIL cache
+	void Initialize(std::wstring sourceDirectory, std::wstring cacheDirectory);
+
+	static uint32_t MakeKey(uint32_t features, unsigned int directionalLights, unsigned int pointLights, unsigned int spotLights);
+
+	// Compiles (or loads) every key's pixel shader and the given vertex
+	// shaders, all spread across the job system together
+	void Precompile(const std::vector<uint32_t>& keys, const std::vector<std::wstring>& vertexShaderFiles);
+
+	// DXIL for a variant, compiling it if it isn't built yet. Empty on failure.
+	const std::vector<char>& GetPixelShader(uint32_t key);
+
+	// Vertex shaders to go with the variants - they aren't specialized, but
+	// have to be DXIL as well since DXBC and DXIL can't be mixed in a pipeline
+	const std::vector<char>& GetVertexShader(const std::wstring& file = L"VertexShader.hlsl");
+
+	ShaderPermutationStats GetStats();
+
+private:
+	std::wstring sourceDirectory;
+	std::wstring cacheDirectory;
+
+	// dxcompiler.dll is loaded on demand so the game still runs without it
+	HMODULE compilerModule;
+	void* createInstance; // DxcCreateInstanceProc
+
+	// Whoever asks for a variant first leaves a future here and builds it
+	// with no lock held. Anyone else asking meanwhile waits on the future
+	// instead of compiling it again.
+	typedef std::shared_future<std::vector<char>> PendingShader;
+	std::mutex variantMutex;
+	std::unordered_map<uint32_t, PendingShader> pixelShaders;
+	std::unordered_map<std::wstring, PendingShader> vertexShaders;
+
+	std::mutex statsMutex;
+	ShaderPermutationStats stats;
+
+	// Loads from the cache or compiles. Thread safe.
+	std::vector<char> Build(const std::wstring& file, const wchar_t* target, const std::vector<std::wstring>& defines);
+	bool CompileDXC(const std::wstring& path, const std::string& source, const wchar_t* target, const std::vector<std::wstring>& defines, std::vector<char>& dxil);
+
+	// Source plus everything it #includes, for hashing
+	void GatherSource(const std::wstring& path, std::string& combined, int depth = 0);
+};
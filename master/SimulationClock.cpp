@@ -0,0 +1,163 @@
+#include "SimulationClock.h"
+
+#include <cmath>
+
+SimulationClock::SimulationClock() :
+	step(1.0 / 60.0),
+	maxStepsPerFrame(5),
+	accumulator(0.0),
+	time(0.0),
+	stepCount(0),
+	lastSteps(0),
+	droppedSeconds(0.0)
+{
+}
+
+void SimulationClock::SetRate(double stepsPerSecond)
+{
+	step = 1.0 / (stepsPerSecond < 1.0 ? 1.0 : stepsPerSecond);
+
+	// Whatever was waiting still counts, but never more than a step of it
+	if (accumulator >= step)
+		accumulator = fmod(accumulator, step);
+}
+
+void SimulationClock::SetMaxStepsPerFrame(unsigned int steps)
+{
+	maxStepsPerFrame = steps < 1 ? 1 : steps;
+}
+
+void SimulationClock::Reset()
+{
+	accumulator = 0.0;
+	time = 0.0;
+	stepCount = 0;
+	lastSteps = 0;
+	droppedSeconds = 0.0;
+}
+
+unsigned int SimulationClock::Advance(double frameSeconds)
+{
+	// Time doesn't go backwards
+	if (!(frameSeconds > 0.0))
+		frameSeconds = 0.0;
+
+	// Subtracting whole steps one at a time (rather than dividing)
+	// keeps the remainder exact when frames are exactly a step long
+	accumulator += frameSeconds;
+	unsigned int steps = 0;
+	while (accumulator >= step && steps < maxStepsPerFrame)
+	{
+		accumulator -= step;
+		steps++;
+	}
+
+	// Too far behind to catch up - drop the rest, keep the fraction
+	// (so rendering still lands somewhere sensible between states)
+	if (accumulator >= step)
+	{
+		double excess = accumulator - fmod(accumulator, step);
+		droppedSeconds += excess;
+		accumulator -= excess;
+	}
+
+	stepCount += steps;
+	time = stepCount * step;
+	lastSteps = steps;
+	return steps;
+}
+
+// --------------------------------------------------------
+// Self test
+// --------------------------------------------------------
+bool SimulationClock::SelfTest(std::string* error)
+{
+	auto fail = [&](const char* message)
+	{
+		if (error) *error = message;
+		return false;
+	};
+
+	// Frames exactly a step long: one step each, never anything left over
+	{
+		SimulationClock clock;
+		clock.SetRate(60.0);
+		for (int i = 0; i < 1000; i++)
+		{
+			if (clock.Advance(1.0 / 60.0) != 1)
+				return fail("A frame one step long didn't run exactly one step");
+			if (clock.GetAlpha() != 0.0)
+				return fail("A frame one step long left time over");
+		}
+		if (clock.GetStepCount() != 1000)
+			return fail("Wrong step count");
+	}
+
+	// Fast frames: no step until a whole one's built up, alpha in between
+	{
+		SimulationClock clock;
+		clock.SetRate(64.0);	// Powers of two, so the sums are exact
+		unsigned int steps = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			steps += clock.Advance(1.0 / 256.0);
+			double alpha = clock.GetAlpha();
+			if (alpha < 0.0 || alpha >= 1.0)
+				return fail("Alpha out of range");
+		}
+		if (steps != 1 || clock.GetAlpha() != 0.0)
+			return fail("Four quarter steps didn't make one step");
+		clock.Advance(1.0 / 128.0);
+		if (clock.GetAlpha() != 0.5)
+			return fail("Half a step isn't an alpha of 0.5");
+	}
+
+	// One huge frame: capped, the rest dropped, alpha still the fraction
+	{
+		SimulationClock clock;
+		clock.SetRate(100.0);
+		clock.SetMaxStepsPerFrame(4);
+		unsigned int steps = clock.Advance(1.0 + 0.0025);
+		if (steps != 4)
+			return fail("The catch up cap didn't hold");
+		if (fabs(clock.GetDroppedSeconds() - 0.96) > 1e-9)
+			return fail("Wrong amount of time dropped");
+		if (fabs(clock.GetAlpha() - 0.25) > 1e-6)
+			return fail("Dropping time lost the fraction of a step");
+		if (clock.Advance(0.0) != 0 || clock.Advance(-1.0) != 0)
+			return fail("Stepped without any time passing");
+	}
+
+	// Same frame times, same steps - the replay/benchmark guarantee
+	{
+		SimulationClock a, b;
+		a.SetRate(90.0);
+		b.SetRate(90.0);
+		uint32_t random = 12345;
+		for (int i = 0; i < 10000; i++)
+		{
+			random = random * 1664525u + 1013904223u;
+			float frame = (random >> 8) / 16777216.0f * 0.05f;
+			if (a.Advance(frame) != b.Advance(frame) || a.GetAlpha() != b.GetAlpha())
+				return fail("The same frame times stepped differently");
+		}
+		if (a.GetTime() != b.GetTime() || a.GetStepCount() == 0)
+			return fail("The same frame times ended up at different times");
+
+		// Total time is conserved: steps taken + dropped + what's left
+		double total = a.GetStepCount() * a.GetStep() + a.GetDroppedSeconds() + a.GetAlpha() * a.GetStep();
+		SimulationClock c;
+		c.SetRate(90.0);
+		random = 12345;
+		double frames = 0.0;
+		for (int i = 0; i < 10000; i++)
+		{
+			random = random * 1664525u + 1013904223u;
+			frames += (double)((random >> 8) / 16777216.0f * 0.05f);
+		}
+		if (fabs(total - frames) > 1e-6)
+			return fail("Time went missing");
+	}
+
+	return true;
+}
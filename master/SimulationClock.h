@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// --------------------------------------------------------
+// Fixed timestep for the simulation, whatever the frame rate.
+//
+// Every frame's time goes into an accumulator, and Advance()
+// says how many whole steps fit - zero on fast frames, a few
+// on slow ones. More than maxStepsPerFrame and the rest of
+// the time is dropped instead (counted in GetDroppedSeconds)
+// so one long frame can't snowball into ever longer ones.
+//
+// What's left over is how far the frame is between the last
+// two simulation states: GetAlpha(), for rendering to blend
+// them with.
+//
+// Only ever fed the frame times it's given, so fixed frame
+// times (benchmarks) and replayed ones (input recordings)
+// step through exactly the same simulation every time.
+// --------------------------------------------------------
+class SimulationClock
+{
+public:
+	SimulationClock();
+
+	// Steps per second (at least 1). Takes effect from the next Advance().
+	void SetRate(double stepsPerSecond);
+	double GetRate() const { return 1.0 / step; }
+	void SetMaxStepsPerFrame(unsigned int steps);
+	unsigned int GetMaxStepsPerFrame() const { return maxStepsPerFrame; }
+
+	// Back to no time accumulated and no steps run
+	void Reset();
+
+	// Adds a frame's time, returns how many steps to run for it
+	unsigned int Advance(double frameSeconds);
+
+	double GetStep() const { return step; }
+	double GetAlpha() const { return accumulator / step; } // 0 - 1
+	double GetTime() const { return time; }	// Simulated so far
+	uint64_t GetStepCount() const { return stepCount; }
+	unsigned int GetLastSteps() const { return lastSteps; }
+	double GetDroppedSeconds() const { return droppedSeconds; }
+
+	// Step counts, the catch up cap, alpha and determinism
+	static bool SelfTest(std::string* error);
+
+private:
+	double step;
+	unsigned int maxStepsPerFrame;
+	double accumulator;	// Always less than one step after Advance()
+	double time;
+	uint64_t stepCount;
+	unsigned int lastSteps;
+	double droppedSeconds;
+};
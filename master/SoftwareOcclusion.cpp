@@ -0,0 +1,688 @@
+#include "SoftwareOcclusion.h"
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+
+#include <immintrin.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// Anything this close to (or behind) the eye can't be projected
+static const float nearW = 0.0001f;
+
+// Row vector times row-major matrix
+static void MultiplyMatrices(const float* a, const float* b, float* out)
+{
+	for (int r = 0; r < 4; r++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			out[r * 4 + c] =
+				a[r * 4 + 0] * b[0 * 4 + c] +
+				a[r * 4 + 1] * b[1 * 4 + c] +
+				a[r * 4 + 2] * b[2 * 4 + c] +
+				a[r * 4 + 3] * b[3 * 4 + c];
+		}
+	}
+}
+
+// (x, y, z, 1) times the matrix, with the rows already loaded
+static inline __m128 TransformPoint(float x, float y, float z, const __m128 rows[4])
+{
+	__m128 result = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(x), rows[0]), _mm_mul_ps(_mm_set1_ps(y), rows[1]));
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(z), rows[2]));
+	return _mm_add_ps(result, rows[3]);
+}
+
+SoftwareOcclusion::SoftwareOcclusion(unsigned int width, unsigned int height)
+{
+	tilesX = (width + tileWidth - 1) / tileWidth;
+	tilesY = (height + tileHeight - 1) / tileHeight;
+	if (tilesX == 0) tilesX = 1;
+	if (tilesY == 0) tilesY = 1;
+	this->width = tilesX * tileWidth;
+	this->height = tilesY * tileHeight;
+
+	depth.assign(this->width * this->height, 1.0f);
+	tileMaxDepth.assign(tilesX * tilesY, 1.0f);
+	memset(viewProjection, 0, sizeof(viewProjection));
+	memset(&stats, 0, sizeof(stats));
+}
+
+void SoftwareOcclusion::BeginFrame(const float viewProjection[16])
+{
+	memcpy(this->viewProjection, viewProjection, sizeof(this->viewProjection));
+	occluders.clear();
+	memset(&stats, 0, sizeof(stats));
+}
+
+void SoftwareOcclusion::AddOccluder(const float* positions, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, const float world[16])
+{
+	Occluder occluder;
+	occluder.positions = positions;
+	occluder.vertexCount = vertexCount;
+	occluder.indices = indices;
+	occluder.indexCount = indexCount - indexCount % 3;
+	MultiplyMatrices(world, viewProjection, occluder.worldViewProjection);
+	occluders.push_back(occluder);
+}
+
+// --------------------------------------------------------
+// Turns a clip space triangle into edge functions and a
+// depth plane over pixel centers. False if there's nothing
+// to draw: behind the near plane, facing away, off screen
+// or too small to cover a pixel center.
+// --------------------------------------------------------
+bool SoftwareOcclusion::SetupTriangle(const float* v0, const float* v1, const float* v2, Triangle& triangle) const
+{
+	// Conservatively skip anything crossing the near plane - an occluder
+	// that doesn't get drawn can only make things more visible
+	if (v0[3] <= nearW || v1[3] <= nearW || v2[3] <= nearW)
+		return false;
+
+	// To pixels, y down
+	float x[3], y[3], z[3];
+	const float* v[3] = { v0, v1, v2 };
+	for (int i = 0; i < 3; i++)
+	{
+		float invW = 1.0f / v[i][3];
+		x[i] = (v[i][0] * invW * 0.5f + 0.5f) * width;
+		y[i] = (0.5f - v[i][1] * invW * 0.5f) * height;
+		z[i] = v[i][2] * invW;
+	}
+
+	// Clockwise on screen is the front, same as the pipeline's default
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (!(area > 0.0f))
+		return false;
+
+	// Entirely past the far plane
+	if (z[0] > 1.0f && z[1] > 1.0f && z[2] > 1.0f)
+		return false;
+
+	// Pixel centers (i + 0.5) the triangle could cover
+	float minX = fminf(x[0], fminf(x[1], x[2]));
+	float maxX = fmaxf(x[0], fmaxf(x[1], x[2]));
+	float minY = fminf(y[0], fminf(y[1], y[2]));
+	float maxY = fmaxf(y[0], fmaxf(y[1], y[2]));
+	if (maxX < 0.0f || maxY < 0.0f || minX > (float)width || minY > (float)height)
+		return false;
+
+	triangle.minX = (int)fmaxf(ceilf(minX - 0.5f), 0.0f);
+	triangle.minY = (int)fmaxf(ceilf(minY - 0.5f), 0.0f);
+	triangle.maxX = (int)fminf(floorf(maxX - 0.5f), (float)width - 1);
+	triangle.maxY = (int)fminf(floorf(maxY - 0.5f), (float)height - 1);
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+		return false;
+
+	// Edge i runs from vertex i to the next one, positive on the inside
+	for (int i = 0; i < 3; i++)
+	{
+		int j = (i + 1) % 3;
+		triangle.edgeA[i] = y[i] - y[j];
+		triangle.edgeB[i] = x[j] - x[i];
+		triangle.edgeC[i] = (y[j] - y[i]) * x[i] - (x[j] - x[i]) * y[i];
+	}
+
+	// Depth as a plane over the screen: z = A * x + B * y + C
+	float invArea = 1.0f / area;
+	float dz1 = z[1] - z[0];
+	float dz2 = z[2] - z[0];
+	triangle.depthA = (dz1 * (y[2] - y[0]) - dz2 * (y[1] - y[0])) * invArea;
+	triangle.depthB = (dz2 * (x[1] - x[0]) - dz1 * (x[2] - x[0])) * invArea;
+	triangle.depthC = z[0] - triangle.depthA * x[0] - triangle.depthB * y[0];
+	return true;
+}
+
+// Transforms, sets up and bins one chunk's worth of occluders
+void SoftwareOcclusion::SetupChunk(Chunk& chunk, unsigned int firstOccluder, unsigned int endOccluder)
+{
+	chunk.triangles.clear();
+	chunk.bins.resize(tilesX * tilesY);
+	for (auto& bin : chunk.bins)
+		bin.clear();
+	chunk.submitted = 0;
+
+	for (unsigned int o = firstOccluder; o < endOccluder; o++)
+	{
+		const Occluder& occluder = occluders[o];
+
+		// Every vertex once, four lanes at a time
+		__m128 rows[4];
+		for (int r = 0; r < 4; r++)
+			rows[r] = _mm_loadu_ps(occluder.worldViewProjection + r * 4);
+
+		chunk.clip.resize(occluder.vertexCount * 4);
+		const float* position = occluder.positions;
+		for (unsigned int v = 0; v < occluder.vertexCount; v++, position += 3)
+			_mm_storeu_ps(&chunk.clip[v * 4], TransformPoint(position[0], position[1], position[2], rows));
+
+		chunk.submitted += occluder.indexCount / 3;
+		for (unsigned int i = 0; i < occluder.indexCount; i += 3)
+		{
+			Triangle triangle;
+			if (!SetupTriangle(
+				&chunk.clip[occluder.indices[i] * 4],
+				&chunk.clip[occluder.indices[i + 1] * 4],
+				&chunk.clip[occluder.indices[i + 2] * 4],
+				triangle))
+				continue;
+
+			unsigned int index = (unsigned int)chunk.triangles.size();
+			chunk.triangles.push_back(triangle);
+
+			for (unsigned int ty = triangle.minY / tileHeight; ty <= triangle.maxY / tileHeight; ty++)
+			{
+				for (unsigned int tx = triangle.minX / tileWidth; tx <= triangle.maxX / tileWidth; tx++)
+					chunk.bins[ty * tilesX + tx].push_back(index);
+			}
+		}
+	}
+}
+
+// Every triangle binned into this tile, in submission order
+void SoftwareOcclusion::RasterizeTile(unsigned int tile)
+{
+	int tileX0 = (int)((tile % tilesX) * tileWidth);
+	int tileY0 = (int)((tile / tilesX) * tileHeight);
+	int tileX1 = tileX0 + tileWidth - 1;
+	int tileY1 = tileY0 + tileHeight - 1;
+
+	// Clear just this tile
+	for (int y = tileY0; y <= tileY1; y++)
+	{
+		for (int x = tileX0; x < tileX0 + (int)tileWidth; x += 4)
+			_mm_storeu_ps(&depth[y * width + x], _mm_set1_ps(1.0f));
+	}
+
+	const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128i laneIndices = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (auto& chunk : chunks)
+	{
+		for (unsigned int index : chunk.bins[tile])
+		{
+			const Triangle& triangle = chunk.triangles[index];
+
+			// Rows and groups of four pixels overlapping the triangle
+			int x0 = triangle.minX > tileX0 ? (triangle.minX & ~3) : tileX0;
+			int x1 = triangle.maxX < tileX1 ? triangle.maxX : tileX1;
+			int y0 = triangle.minY > tileY0 ? triangle.minY : tileY0;
+			int y1 = triangle.maxY < tileY1 ? triangle.maxY : tileY1;
+
+			__m128 a0 = _mm_set1_ps(triangle.edgeA[0]);
+			__m128 a1 = _mm_set1_ps(triangle.edgeA[1]);
+			__m128 a2 = _mm_set1_ps(triangle.edgeA[2]);
+			__m128 depthA = _mm_set1_ps(triangle.depthA);
+			__m128i minX = _mm_set1_epi32(triangle.minX - 1);
+			__m128i maxX = _mm_set1_epi32(triangle.maxX + 1);
+
+			for (int y = y0; y <= y1; y++)
+			{
+				float py = (float)y + 0.5f;
+				__m128 row0 = _mm_set1_ps(triangle.edgeB[0] * py + triangle.edgeC[0]);
+				__m128 row1 = _mm_set1_ps(triangle.edgeB[1] * py + triangle.edgeC[1]);
+				__m128 row2 = _mm_set1_ps(triangle.edgeB[2] * py + triangle.edgeC[2]);
+				__m128 rowDepth = _mm_set1_ps(triangle.depthB * py + triangle.depthC);
+
+				for (int x = x0; x <= x1; x += 4)
+				{
+					__m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+
+					// Inside all three edges, and within the triangle's bounds (so the
+					// lanes padding out a group of four match the scalar reference)
+					__m128 inside = _mm_and_ps(
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), row0), zero),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), row1), zero));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), row2), zero));
+					__m128i lane = _mm_add_epi32(_mm_set1_epi32(x), laneIndices);
+					__m128i inBounds = _mm_and_si128(_mm_cmpgt_epi32(lane, minX), _mm_cmplt_epi32(lane, maxX));
+					inside = _mm_and_ps(inside, _mm_castsi128_ps(inBounds));
+
+					if (_mm_movemask_ps(inside) == 0)
+						continue;
+
+					float* destination = &depth[y * width + x];
+					__m128 current = _mm_loadu_ps(destination);
+					__m128 z = _mm_add_ps(_mm_mul_ps(depthA, px), rowDepth);
+					__m128 nearest = _mm_min_ps(current, z);
+					_mm_storeu_ps(destination, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+				}
+			}
+		}
+	}
+
+	// Farthest depth left in the tile
+	__m128 farthest = _mm_setzero_ps();
+	for (int y = tileY0; y <= tileY1; y++)
+	{
+		for (int x = tileX0; x < tileX0 + (int)tileWidth; x += 4)
+			farthest = _mm_max_ps(farthest, _mm_loadu_ps(&depth[y * width + x]));
+	}
+	farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+	farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+	tileMaxDepth[tile] = _mm_cvtss_f32(farthest);
+}
+
+void SoftwareOcclusion::Rasterize()
+{
+	PROFILE_SCOPE("Occlusion raster");
+	auto start = std::chrono::high_resolution_clock::now();
+	JobSystem& jobs = JobSystem::GetInstance();
+
+	// A couple of chunks per worker, but never an empty one
+	unsigned int occluderCount = (unsigned int)occluders.size();
+	unsigned int chunkCount = jobs.GetWorkerCount() * 2;
+	if (chunkCount > occluderCount) chunkCount = occluderCount;
+	if (chunkCount == 0) chunkCount = 1;
+	if (chunks.size() < chunkCount)
+		chunks.resize(chunkCount);
+	for (unsigned int c = chunkCount; c < chunks.size(); c++)
+	{
+		chunks[c].triangles.clear();
+		for (auto& bin : chunks[c].bins)
+			bin.clear();
+	}
+
+	jobs.ParallelFor(chunkCount, 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int c = begin; c < end; c++)
+			SetupChunk(chunks[c], c * occluderCount / chunkCount, (c + 1) * occluderCount / chunkCount);
+	});
+
+	jobs.ParallelFor(tilesX * tilesY, 4, [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int tile = begin; tile < end; tile++)
+			RasterizeTile(tile);
+	});
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	stats.occluders = occluderCount;
+	for (unsigned int c = 0; c < chunkCount; c++)
+	{
+		stats.trianglesSubmitted += chunks[c].submitted;
+		stats.trianglesRasterized += (unsigned int)chunks[c].triangles.size();
+		for (auto& bin : chunks[c].bins)
+			stats.binEntries += (unsigned int)bin.size();
+	}
+	stats.rasterMs = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// --------------------------------------------------------
+// A sphere is tested through the eight corners of its box:
+// their screen rectangle, and the nearest depth any of them
+// reaches. Occluded only if every pixel in that rectangle
+// is already nearer than that.
+// --------------------------------------------------------
+OcclusionResult SoftwareOcclusion::Test(const OcclusionSphere& sphere) const
+{
+	__m128 rows[4];
+	for (int r = 0; r < 4; r++)
+		rows[r] = _mm_loadu_ps(viewProjection + r * 4);
+
+	float minX = 1.0f, minY = 1.0f, maxX = -1.0f, maxY = -1.0f;
+	float nearestDepth = 1.0f;
+	unsigned int outside[6] = {};
+	bool crossesNear = false;
+	for (int i = 0; i < 8; i++)
+	{
+		float clip[4];
+		_mm_storeu_ps(clip, TransformPoint(
+			sphere.center[0] + (i & 1 ? sphere.radius : -sphere.radius),
+			sphere.center[1] + (i & 2 ? sphere.radius : -sphere.radius),
+			sphere.center[2] + (i & 4 ? sphere.radius : -sphere.radius),
+			rows));
+
+		outside[0] += clip[0] < -clip[3];
+		outside[1] += clip[0] > clip[3];
+		outside[2] += clip[1] < -clip[3];
+		outside[3] += clip[1] > clip[3];
+		outside[4] += clip[2] < 0.0f;
+		outside[5] += clip[2] > clip[3];
+
+		if (clip[3] <= nearW)
+		{
+			crossesNear = true;
+			continue;
+		}
+
+		float invW = 1.0f / clip[3];
+		minX = fminf(minX, clip[0] * invW);
+		maxX = fmaxf(maxX, clip[0] * invW);
+		minY = fminf(minY, clip[1] * invW);
+		maxY = fmaxf(maxY, clip[1] * invW);
+		nearestDepth = fminf(nearestDepth, clip[2] * invW);
+	}
+
+	for (int p = 0; p < 6; p++)
+	{
+		if (outside[p] == 8)
+			return OCCLUSION_OUTSIDE_FRUSTUM;
+	}
+	if (crossesNear || nearestDepth <= 0.0f)
+		return OCCLUSION_VISIBLE;
+
+	// Pixels the rectangle touches (NDC y points up, pixels go down)
+	int x0 = (int)(fmaxf(minX * 0.5f + 0.5f, 0.0f) * width);
+	int x1 = (int)(fminf(maxX * 0.5f + 0.5f, 1.0f) * width);
+	int y0 = (int)(fmaxf(0.5f - maxY * 0.5f, 0.0f) * height);
+	int y1 = (int)(fminf(0.5f - minY * 0.5f, 1.0f) * height);
+	if (x1 > (int)width - 1) x1 = width - 1;
+	if (y1 > (int)height - 1) y1 = height - 1;
+
+	__m128 nearest = _mm_set1_ps(nearestDepth);
+	const __m128i laneIndices = _mm_setr_epi32(0, 1, 2, 3);
+	__m128i rectMin = _mm_set1_epi32(x0 - 1);
+	__m128i rectMax = _mm_set1_epi32(x1 + 1);
+
+	for (int ty = y0 / (int)tileHeight; ty <= y1 / (int)tileHeight; ty++)
+	{
+		for (int tx = x0 / (int)tileWidth; tx <= x1 / (int)tileWidth; tx++)
+		{
+			// The whole tile is nearer - nothing to look at
+			if (nearestDepth > tileMaxDepth[ty * tilesX + tx])
+				continue;
+
+			int tileX0 = tx * tileWidth;
+			int tileY0 = ty * tileHeight;
+			int startX = x0 > tileX0 ? (x0 & ~3) : tileX0;
+			int endX = x1 < tileX0 + (int)tileWidth - 1 ? x1 : tileX0 + (int)tileWidth - 1;
+			int startY = y0 > tileY0 ? y0 : tileY0;
+			int endY = y1 < tileY0 + (int)tileHeight - 1 ? y1 : tileY0 + (int)tileHeight - 1;
+
+			for (int y = startY; y <= endY; y++)
+			{
+				for (int x = startX; x <= endX; x += 4)
+				{
+					__m128i lane = _mm_add_epi32(_mm_set1_epi32(x), laneIndices);
+					__m128i inRect = _mm_and_si128(_mm_cmpgt_epi32(lane, rectMin), _mm_cmplt_epi32(lane, rectMax));
+					__m128 notHidden = _mm_cmpge_ps(_mm_loadu_ps(&depth[y * width + x]), nearest);
+					if (_mm_movemask_ps(_mm_and_ps(notHidden, _mm_castsi128_ps(inRect))) != 0)
+						return OCCLUSION_VISIBLE;
+				}
+			}
+		}
+	}
+
+	return OCCLUSION_OCCLUDED;
+}
+
+void SoftwareOcclusion::TestBatch(const OcclusionSphere* spheres, unsigned int count, unsigned char* visible)
+{
+	PROFILE_SCOPE("Occlusion test");
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::atomic<unsigned int> occluded(0);
+	std::atomic<unsigned int> outsideFrustum(0);
+	JobSystem::GetInstance().ParallelFor(count, 256, [&](unsigned int begin, unsigned int end)
+	{
+		unsigned int localOccluded = 0;
+		unsigned int localOutside = 0;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			OcclusionResult result = Test(spheres[i]);
+			visible[i] = result == OCCLUSION_VISIBLE ? 1 : 0;
+			localOccluded += result == OCCLUSION_OCCLUDED;
+			localOutside += result == OCCLUSION_OUTSIDE_FRUSTUM;
+		}
+		occluded += localOccluded;
+		outsideFrustum += localOutside;
+	});
+
+	auto end = std::chrono::high_resolution_clock::now();
+	stats.tested = count;
+	stats.occluded = occluded;
+	stats.outsideFrustum = outsideFrustum;
+	stats.testMs = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// --------------------------------------------------------
+// Same setup, then every triangle one pixel at a time in
+// submission order. Same float operations in the same
+// order as the SIMD path, so results should be identical.
+// --------------------------------------------------------
+void SoftwareOcclusion::RasterizeReference(std::vector<float>& referenceDepth)
+{
+	referenceDepth.assign(width * height, 1.0f);
+
+	std::vector<float> clip;
+	for (auto& occluder : occluders)
+	{
+		clip.resize(occluder.vertexCount * 4);
+		for (unsigned int v = 0; v < occluder.vertexCount; v++)
+		{
+			const float* p = occluder.positions + v * 3;
+			const float* m = occluder.worldViewProjection;
+			for (int c = 0; c < 4; c++)
+				clip[v * 4 + c] = ((p[0] * m[c] + p[1] * m[4 + c]) + p[2] * m[8 + c]) + m[12 + c];
+		}
+
+		for (unsigned int i = 0; i < occluder.indexCount; i += 3)
+		{
+			Triangle triangle;
+			if (!SetupTriangle(&clip[occluder.indices[i] * 4], &clip[occluder.indices[i + 1] * 4], &clip[occluder.indices[i + 2] * 4], triangle))
+				continue;
+
+			for (int y = triangle.minY; y <= triangle.maxY; y++)
+			{
+				float py = (float)y + 0.5f;
+				for (int x = triangle.minX; x <= triangle.maxX; x++)
+				{
+					float px = (float)x + 0.5f;
+					bool inside = true;
+					for (int e = 0; e < 3; e++)
+						inside = inside && triangle.edgeA[e] * px + (triangle.edgeB[e] * py + triangle.edgeC[e]) >= 0.0f;
+					if (!inside)
+						continue;
+
+					float z = triangle.depthA * px + (triangle.depthB * py + triangle.depthC);
+					float& destination = referenceDepth[y * width + x];
+					destination = z < destination ? z : destination;
+				}
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Test helpers
+// --------------------------------------------------------
+
+// Left handed perspective, row-vector convention (like XMMatrixPerspectiveFovLH)
+static void MakeViewProjection(float* out, float aspect)
+{
+	float nearZ = 0.1f, farZ = 100.0f;
+	float yScale = 1.0f; // 90 degree vertical field of view
+	memset(out, 0, sizeof(float) * 16);
+	out[0] = yScale / aspect;
+	out[5] = yScale;
+	out[10] = farZ / (farZ - nearZ);
+	out[11] = 1.0f;
+	out[14] = -nearZ * farZ / (farZ - nearZ);
+}
+
+static void MakeTranslation(float* out, float x, float y, float z)
+{
+	memset(out, 0, sizeof(float) * 16);
+	out[0] = out[5] = out[10] = out[15] = 1.0f;
+	out[12] = x;
+	out[13] = y;
+	out[14] = z;
+}
+
+// Random triangles facing the camera, somewhere in front of it
+static void MakeRandomTriangles(std::vector<float>& positions, std::vector<unsigned int>& indices, unsigned int triangleCount, unsigned int seed)
+{
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> spread(-12.0f, 12.0f);
+	std::uniform_real_distribution<float> distance(3.0f, 40.0f);
+	std::uniform_real_distribution<float> size(0.2f, 3.0f);
+
+	positions.clear();
+	indices.clear();
+	for (unsigned int t = 0; t < triangleCount; t++)
+	{
+		float x = spread(random), y = spread(random), z = distance(random);
+		float s = size(random);
+		float corners[9] = { x, y + s, z, x + s, y - s, z + size(random) * 0.5f, x - s, y - s, z - size(random) * 0.5f };
+		for (float c : corners)
+			positions.push_back(c);
+		indices.push_back(t * 3);
+		indices.push_back(t * 3 + 1);
+		indices.push_back(t * 3 + 2);
+	}
+}
+
+bool SoftwareOcclusion::SelfTest(std::string* error)
+{
+	auto fail = [&](const char* message)
+	{
+		if (error) *error = message;
+		return false;
+	};
+
+	SoftwareOcclusion occlusion(256, 128);
+	float viewProjection[16];
+	MakeViewProjection(viewProjection, 2.0f);
+	float identity[16];
+	MakeTranslation(identity, 0, 0, 0);
+
+	// A 6x6 wall five units out, clockwise towards the camera
+	const float wall[] = { -3, 3, 5, 3, 3, 5, 3, -3, 5, -3, -3, 5 };
+	const unsigned int front[] = { 0, 1, 2, 0, 2, 3 };
+	const unsigned int back[] = { 0, 2, 1, 0, 3, 2 };
+
+	occlusion.BeginFrame(viewProjection);
+	occlusion.AddOccluder(wall, 4, front, 6, identity);
+	occlusion.Rasterize();
+
+	struct Case { OcclusionSphere sphere; OcclusionResult expected; const char* failure; };
+	const Case cases[] =
+	{
+		{ { { 0, 0, 10 }, 1 }, OCCLUSION_OCCLUDED, "Sphere behind the wall wasn't occluded" },
+		{ { { 0, 0, 2 }, 1 }, OCCLUSION_VISIBLE, "Sphere in front of the wall was culled" },
+		{ { { 0, 0, 5.5f }, 1 }, OCCLUSION_VISIBLE, "Sphere poking through the wall was culled" },
+		{ { { 9, 0, 10 }, 1 }, OCCLUSION_VISIBLE, "Sphere beside the wall was culled" },
+		{ { { 0, 0, -10 }, 1 }, OCCLUSION_OUTSIDE_FRUSTUM, "Sphere behind the camera wasn't frustum culled" },
+		{ { { 0, 0, 0 }, 1 }, OCCLUSION_VISIBLE, "Sphere around the camera was culled" },
+	};
+	for (auto& test : cases)
+	{
+		if (occlusion.Test(test.sphere) != test.expected)
+			return fail(test.failure);
+	}
+
+	// Facing away, so nothing is drawn
+	occlusion.BeginFrame(viewProjection);
+	occlusion.AddOccluder(wall, 4, back, 6, identity);
+	occlusion.Rasterize();
+	if (occlusion.Test(cases[0].sphere) != OCCLUSION_VISIBLE)
+		return fail("Backfacing wall still occluded");
+
+	// Moved by its world matrix
+	float moved[16];
+	MakeTranslation(moved, 20, 0, 0);
+	occlusion.BeginFrame(viewProjection);
+	occlusion.AddOccluder(wall, 4, front, 6, moved);
+	occlusion.Rasterize();
+	if (occlusion.Test(cases[0].sphere) != OCCLUSION_VISIBLE)
+		return fail("World matrix wasn't applied to the occluder");
+
+	// Random soup, split across several occluders (and so across chunks),
+	// has to match the scalar reference exactly
+	std::vector<float> positions;
+	std::vector<unsigned int> indices;
+	MakeRandomTriangles(positions, indices, 3000, 1234);
+
+	occlusion.BeginFrame(viewProjection);
+	for (unsigned int i = 0; i < 10; i++)
+	{
+		unsigned int first = i * 300 * 3;
+		occlusion.AddOccluder(positions.data(), (unsigned int)positions.size() / 3, indices.data() + first, 300 * 3, identity);
+	}
+	occlusion.Rasterize();
+
+	std::vector<float> reference;
+	occlusion.RasterizeReference(reference);
+	if (memcmp(reference.data(), occlusion.depth.data(), sizeof(float) * reference.size()) != 0)
+		return fail("SIMD rasterizer doesn't match the scalar reference");
+
+	bool anythingDrawn = false;
+	for (float d : reference)
+		anythingDrawn = anythingDrawn || d < 1.0f;
+	if (!anythingDrawn)
+		return fail("Random triangles didn't cover a single pixel");
+
+	return true;
+}
+
+SoftwareOcclusion::BenchmarkResult SoftwareOcclusion::RunBenchmark(unsigned int triangleCount, unsigned int iterations)
+{
+	BenchmarkResult result = {};
+	result.triangleCount = triangleCount;
+
+	SoftwareOcclusion occlusion;
+	float viewProjection[16];
+	MakeViewProjection(viewProjection, 2.0f);
+	float identity[16];
+	MakeTranslation(identity, 0, 0, 0);
+
+	std::vector<float> positions;
+	std::vector<unsigned int> indices;
+	MakeRandomTriangles(positions, indices, triangleCount, 5678);
+
+	// Split up like a real scene's occluders would be
+	const unsigned int perOccluder = 500;
+	auto addAll = [&]()
+	{
+		occlusion.BeginFrame(viewProjection);
+		for (unsigned int first = 0; first < triangleCount; first += perOccluder)
+		{
+			unsigned int count = triangleCount - first < perOccluder ? triangleCount - first : perOccluder;
+			occlusion.AddOccluder(positions.data(), (unsigned int)positions.size() / 3, indices.data() + first * 3, count * 3, identity);
+		}
+	};
+
+	// One warm up pass so the bins are allocated
+	addAll();
+	occlusion.Rasterize();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		addAll();
+		occlusion.Rasterize();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	result.rasterMs = std::chrono::duration<double, std::milli>(end - start).count() / (iterations ? iterations : 1);
+
+	std::mt19937 random(91011);
+	std::uniform_real_distribution<float> spread(-30.0f, 30.0f);
+	std::uniform_real_distribution<float> distance(1.0f, 60.0f);
+	std::uniform_real_distribution<float> radius(0.1f, 2.0f);
+	std::vector<OcclusionSphere> spheres(10000);
+	for (auto& sphere : spheres)
+	{
+		sphere.center[0] = spread(random);
+		sphere.center[1] = spread(random);
+		sphere.center[2] = distance(random);
+		sphere.radius = radius(random);
+	}
+
+	unsigned int visibleCount = 0;
+	start = std::chrono::high_resolution_clock::now();
+	for (auto& sphere : spheres)
+		visibleCount += occlusion.Test(sphere) == OCCLUSION_VISIBLE;
+	end = std::chrono::high_resolution_clock::now();
+	result.nsPerTest = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / spheres.size();
+
+	// Keeps the loop from being optimized away
+	if (visibleCount > spheres.size())
+		result.nsPerTest = -1;
+
+	return result;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Bounding sphere to test, in world space
+struct OcclusionSphere
+{
+	float center[3];
+	float radius;
+};
+
+enum OcclusionResult
+{
+	OCCLUSION_VISIBLE,
+	OCCLUSION_OCCLUDED,
+	OCCLUSION_OUTSIDE_FRUSTUM
+};
+
+// Counts and timings for the last frame
+struct SoftwareOcclusionStats
+{
+	unsigned int occluders;
+	unsigned int trianglesSubmitted;
+	unsigned int trianglesRasterized;	// Survived near plane, backface and size rejection
+	unsigned int binEntries;			// Triangle/tile pairs
+	double rasterMs;
+
+	unsigned int tested;
+	unsigned int occluded;
+	unsigned int outsideFrustum;
+	double testMs;
+};
+
+// --------------------------------------------------------
+// CPU occlusion culling with a small software rasterizer.
+//
+// A handful of big occluder meshes are drawn into a low
+// resolution depth buffer (nearest depth per pixel), then
+// bounding spheres are tested against it - a sphere is
+// occluded when every pixel its box covers already has
+// something nearer. Nothing touches the GPU, so results are
+// ready before a single draw is recorded.
+//
+// Rasterize() runs on the JobSystem in two steps:
+//  - occluders are split into chunks, and each chunk
+//    transforms its vertices (SSE), sets up its triangles
+//    and bins them into screen tiles of its own
+//  - every tile is then rasterized by one job, walking the
+//    chunks' bins in order, four pixels at a time
+// Tiles never share pixels, so there's no locking, and the
+// result doesn't depend on how many threads ran it.
+//
+// Matrices are 16 floats, row-major, row-vector convention
+// (the same memory layout as DirectXMath's XMFLOAT4X4), with
+// D3D style clip space (z from 0 to 1). No D3D or Windows
+// dependencies, so it builds and tests anywhere.
+// --------------------------------------------------------
+class SoftwareOcclusion
+{
+public:
+	struct BenchmarkResult
+	{
+		unsigned int triangleCount;
+		double rasterMs;		// Per Rasterize()
+		double nsPerTest;
+	};
+
+	// Rounded up to whole tiles
+	SoftwareOcclusion(unsigned int width = 256, unsigned int height = 128);
+
+	// Starts a new frame from this camera. Occluder data has to stay
+	// alive until Rasterize() returns - it isn't copied.
+	void BeginFrame(const float viewProjection[16]);
+	void AddOccluder(const float* positions, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, const float world[16]);
+	void Rasterize();
+
+	// Thread safe once Rasterize() is done
+	OcclusionResult Test(const OcclusionSphere& sphere) const;
+
+	// Tests a whole list across the job system, visible[i] = 1 if sphere i might be seen
+	void TestBatch(const OcclusionSphere* spheres, unsigned int count, unsigned char* visible);
+
+	unsigned int GetWidth() const { return width; }
+	unsigned int GetHeight() const { return height; }
+	const float* GetDepth() const { return depth.data(); }
+	const SoftwareOcclusionStats& GetStats() const { return stats; }
+
+	// Rasterizes a few known scenes and random triangles, checking the
+	// visibility answers and that the SIMD rasterizer matches the scalar
+	// reference exactly. Returns false (and fills error) on the first failure.
+	static bool SelfTest(std::string* error = 0);
+
+	// Times Rasterize() over random triangles and Test() over random spheres
+	static BenchmarkResult RunBenchmark(unsigned int triangleCount = 20000, unsigned int iterations = 50);
+
+private:
+	static const unsigned int tileWidth = 32;	// Multiple of 4 (SIMD width)
+	static const unsigned int tileHeight = 16;
+
+	struct Occluder
+	{
+		const float* positions;
+		unsigned int vertexCount;
+		const unsigned int* indices;
+		unsigned int indexCount;
+		float worldViewProjection[16];
+	};
+
+	// Edge functions (inside when all three are >= 0) and a depth plane, in pixels
+	struct Triangle
+	{
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		float depthA;
+		float depthB;
+		float depthC;
+		int minX, minY, maxX, maxY;
+	};
+
+	// Everything one setup job produced
+	struct Chunk
+	{
+		std::vector<float> clip; // Transformed vertices, 4 floats each (scratch)
+		std::vector<Triangle> triangles;
+		std::vector<std::vector<unsigned int>> bins; // Triangle indices per tile
+		unsigned int submitted;
+	};
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int tilesX;
+	unsigned int tilesY;
+	float viewProjection[16];
+
+	std::vector<Occluder> occluders;
+	std::vector<Chunk> chunks;
+	std::vector<float> depth;			// Row-major, nearest depth per pixel
+	std::vector<float> tileMaxDepth;	// Farthest depth in each tile, for a quick reject
+
+	SoftwareOcclusionStats stats;
+
+	void SetupChunk(Chunk& chunk, unsigned int firstOccluder, unsigned int endOccluder);
+	void RasterizeTile(unsigned int tile);
+
+	// Plain scalar version of Rasterize(), single threaded - the SIMD one has to match it bit for bit
+	void RasterizeReference(std::vector<float>& referenceDepth);
+	bool SetupTriangle(const float* v0, const float* v1, const float* v2, Triangle& triangle) const;
+};
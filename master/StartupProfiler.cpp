@@ -0,0 +1,168 @@
+#include "StartupProfiler.h"
+#include "JobSystem.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+//Singleton requirement
+StartupProfiler* StartupProfiler::instance;
+
+// How many phases the calling thread is inside of
+static thread_local unsigned int phaseDepth = 0;
+
+uint64_t StartupProfiler::Now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void StartupProfiler::Start()
+{
+	std::lock_guard<std::mutex> lock(phasesMutex);
+	start = Now();
+	phases.clear();
+	finished.store(false, std::memory_order_release);
+}
+
+void StartupProfiler::AddPhase(const char* name, unsigned int depth, uint64_t phaseStart, uint64_t phaseEnd)
+{
+	std::lock_guard<std::mutex> lock(phasesMutex);
+
+	// Anything from before Start() counts from Start()
+	phaseStart = std::max(phaseStart, start);
+	phaseEnd = std::max(phaseEnd, phaseStart);
+
+	StartupPhase phase = {};
+	phase.name = name;
+	phase.worker = JobSystem::GetInstance().GetCurrentWorkerIndex();
+	phase.depth = depth;
+	phase.startMs = (phaseStart - start) / 1000000.0;
+	phase.ms = (phaseEnd - phaseStart) / 1000000.0;
+	phases.push_back(phase);
+}
+
+void StartupProfiler::EndFrame()
+{
+	if (IsFinished())
+		return;
+
+	// Whatever happened after the last phase (the first Update and
+	// Draw, mostly) is the first frame
+	uint64_t now = Now();
+	{
+		std::lock_guard<std::mutex> lock(phasesMutex);
+		double lastEndMs = 0.0;
+		for (const StartupPhase& phase : phases)
+			lastEndMs = std::max(lastEndMs, phase.startMs + phase.ms);
+
+		firstFrameMs = (now - start) / 1000000.0;
+
+		StartupPhase frame = {};
+		frame.name = "First frame";
+		frame.startMs = lastEndMs;
+		frame.ms = std::max(0.0, firstFrameMs - lastEndMs);
+		phases.push_back(frame);
+	}
+	finished.store(true, std::memory_order_release);
+
+	for (const std::string& line : GetReport())
+		LOG_INFO("%s", line.c_str());
+}
+
+double StartupProfiler::GetPhaseMs(const char* name)
+{
+	std::lock_guard<std::mutex> lock(phasesMutex);
+	double ms = 0.0;
+	for (const StartupPhase& phase : phases)
+	{
+		bool mainThread = phase.worker == 0 || phase.worker == ~0u;
+		if (mainThread && strcmp(phase.name, name) == 0)
+			ms = phase.ms;
+	}
+	return ms;
+}
+
+std::vector<StartupPhase> StartupProfiler::GetPhases()
+{
+	std::vector<StartupPhase> sorted;
+	{
+		std::lock_guard<std::mutex> lock(phasesMutex);
+		sorted = phases;
+	}
+
+	// Phases are added when they end - put them back in the order they began,
+	// outer ones before what's inside them
+	std::stable_sort(sorted.begin(), sorted.end(), [](const StartupPhase& a, const StartupPhase& b)
+	{
+		if (a.startMs != b.startMs)
+			return a.startMs < b.startMs;
+		return a.depth < b.depth;
+	});
+	return sorted;
+}
+
+std::vector<std::string> StartupProfiler::GetReport()
+{
+	std::vector<StartupPhase> sorted = GetPhases();
+	std::vector<std::string> lines;
+	char line[256];
+
+	snprintf(line, sizeof(line), "Startup: %.1fms to first frame", firstFrameMs);
+	lines.push_back(line);
+	snprintf(line, sizeof(line), "  %-32s %-10s %10s %10s", "Phase", "Thread", "Start", "ms");
+	lines.push_back(line);
+
+	// How much work ran on the job system's workers instead of the main thread
+	double workerMs = 0.0;
+	for (const StartupPhase& phase : sorted)
+	{
+		bool mainThread = phase.worker == 0 || phase.worker == ~0u;
+		if (!mainThread && phase.depth == 0)
+			workerMs += phase.ms;
+
+		// Nested phases are indented under the one they're in
+		std::string name(phase.depth * 2, ' ');
+		name += phase.name;
+
+		char thread[16];
+		if (mainThread)
+			snprintf(thread, sizeof(thread), "main");
+		else
+			snprintf(thread, sizeof(thread), "worker %u", phase.worker);
+
+		snprintf(line, sizeof(line), "  %-32s %-10s %10.2f %10.2f", name.c_str(), thread, phase.startMs, phase.ms);
+		lines.push_back(line);
+	}
+
+	snprintf(line, sizeof(line), "Startup: %.1fms of phases ran on other workers", workerMs);
+	lines.push_back(line);
+	return lines;
+}
+
+// --------------------------------------------------------
+// Scope
+// --------------------------------------------------------
+StartupPhaseScope::StartupPhaseScope(const char* name) :
+	name(name),
+	depth(phaseDepth),
+	start(0)
+{
+	// Nothing to do once startup's over (phases in code that runs later on too)
+	if (StartupProfiler::GetInstance().IsFinished())
+		return;
+
+	start = StartupProfiler::Now();
+	phaseDepth++;
+}
+
+StartupPhaseScope::~StartupPhaseScope()
+{
+	if (!start)
+		return;
+
+	phaseDepth--;
+	StartupProfiler::GetInstance().AddPhase(name, depth, start, StartupProfiler::Now());
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// Phases of startup, from the top of WinMain to the end of
+// the first frame.
+//
+//  STARTUP_PHASE("Name")  times the rest of the block
+//
+// Any thread can time a phase - startup's asset loading runs
+// on the job system while the main thread sets up D3D, so
+// phases overlap. Names have to be string literals.
+// --------------------------------------------------------
+#define STARTUP_CONCAT_INNER(a, b) a##b
+#define STARTUP_CONCAT(a, b) STARTUP_CONCAT_INNER(a, b)
+#define STARTUP_PHASE(name) StartupPhaseScope STARTUP_CONCAT(startupPhase, __LINE__)(name)
+
+// One timed phase
+struct StartupPhase
+{
+	const char* name;
+	unsigned int worker;	// Job system worker (0 and ~0u are the main thread)
+	unsigned int depth;		// Phases inside other phases on the same thread
+	double startMs;			// Since Start()
+	double ms;
+};
+
+// --------------------------------------------------------
+// Collects startup phases and, once the first frame is done,
+// logs them all with the time to first frame.
+// --------------------------------------------------------
+class StartupProfiler
+{
+#pragma region Singleton
+public:
+	// Gets the one and only instance of this class
+	static StartupProfiler& GetInstance()
+	{
+		if (!instance)
+		{
+			instance = new StartupProfiler();
+		}
+
+		return *instance;
+	}
+
+	// Remove these functions (C++ 11 version)
+	StartupProfiler(StartupProfiler const&) = delete;
+	void operator=(StartupProfiler const&) = delete;
+
+private:
+	static StartupProfiler* instance;
+	StartupProfiler() :
+		start(0),
+		firstFrameMs(0.0),
+		finished(false)
+	{ };
+#pragma endregion
+
+public:
+	// Everything's measured from here - call it first thing
+	void Start();
+
+	// Nanoseconds on a steady clock
+	static uint64_t Now();
+
+	// Any thread. Called by StartupPhaseScope.
+	void AddPhase(const char* name, unsigned int depth, uint64_t phaseStart, uint64_t phaseEnd);
+
+	// After every frame. The first one ends startup and logs the report.
+	void EndFrame();
+
+	bool IsFinished() { return finished.load(std::memory_order_acquire); }
+	double GetTimeToFirstFrameMs() { return firstFrameMs; }
+
+	// Main thread phase (the last one of that name) in milliseconds, 0 if there wasn't one
+	double GetPhaseMs(const char* name);
+
+	// Sorted by when they started. Only complete once IsFinished().
+	std::vector<StartupPhase> GetPhases();
+
+	// The report, one line each
+	std::vector<std::string> GetReport();
+
+private:
+	uint64_t start;
+	double firstFrameMs;
+	std::atomic<bool> finished;
+
+	std::mutex phasesMutex; // A few dozen phases, once - no need for anything fancier
+	std::vector<StartupPhase> phases;
+};
+
+// Times its own lifetime as a startup phase
+class StartupPhaseScope
+{
+public:
+	StartupPhaseScope(const char* name);
+	~StartupPhaseScope();
+
+private:
+	const char* name;
+	unsigned int depth;
+	uint64_t start;
+};
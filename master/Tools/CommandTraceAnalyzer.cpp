@@ -0,0 +1,131 @@
+// --------------------------------------------------------
+// Reads a command trace (.ctrace, from the performance
+// window or --command-trace=) and reports redundant state
+// sets, binding churn per draw, barriers and the largest
+// draw batches.
+//
+// Not part of the main project - it's plain C++ with no
+// D3D12 or Windows, so it builds and runs anywhere:
+//
+//  g++ -std=c++17 -O2 -I.. CommandTraceAnalyzer.cpp ../CommandTrace.cpp -o CommandTraceAnalyzer
+//  cl /std:c++17 /O2 /EHsc /I.. CommandTraceAnalyzer.cpp ..\CommandTrace.cpp
+//
+// Usage:
+//
+//  CommandTraceAnalyzer trace.ctrace [--json=report.json]
+//      [--batches=10] [--max-redundant=percent]
+//      [--max-changes-per-draw=count] [--max-barrier-calls=count]
+//
+// The --max options turn it into a check: it exits with 2
+// (after printing the report) when the trace goes over any
+// of them, 1 when the trace can't be read, 0 otherwise.
+// --------------------------------------------------------
+#include "CommandTrace.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: CommandTraceAnalyzer trace.ctrace [--json=report.json] [--batches=10]\n"
+		"       [--max-redundant=percent] [--max-changes-per-draw=count] [--max-barrier-calls=count]\n"
+		"       CommandTraceAnalyzer --self-test\n");
+}
+
+int main(int argc, char** argv)
+{
+	std::string tracePath;
+	std::string jsonPath;
+	unsigned int batches = 10;
+	double maxRedundant = -1.0;
+	double maxChangesPerDraw = -1.0;
+	double maxBarrierCalls = -1.0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t equals = argument.find('=');
+		std::string name = argument.substr(0, equals);
+		std::string value = equals == std::string::npos ? "" : argument.substr(equals + 1);
+
+		if (argument == "--self-test")
+		{
+			std::string error;
+			bool passed = CommandTraceAnalyzer::SelfTest(&error);
+			printf("Command trace self test: %s%s\n", passed ? "passed" : "FAILED - ", error.c_str());
+			return passed ? 0 : 1;
+		}
+		else if (name == "--json" && !value.empty())
+			jsonPath = value;
+		else if (name == "--batches" && !value.empty())
+			batches = (unsigned int)strtoul(value.c_str(), 0, 10);
+		else if (name == "--max-redundant" && !value.empty())
+			maxRedundant = atof(value.c_str());
+		else if (name == "--max-changes-per-draw" && !value.empty())
+			maxChangesPerDraw = atof(value.c_str());
+		else if (name == "--max-barrier-calls" && !value.empty())
+			maxBarrierCalls = atof(value.c_str());
+		else if (argument.compare(0, 2, "--") != 0 && tracePath.empty())
+			tracePath = argument;
+		else
+		{
+			fprintf(stderr, "Unknown argument: %s\n", argument.c_str());
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (tracePath.empty())
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	std::vector<unsigned char> trace;
+	if (!CommandTraceAnalyzer::LoadFile(tracePath, trace))
+	{
+		fprintf(stderr, "Couldn't open %s\n", tracePath.c_str());
+		return 1;
+	}
+
+	CommandTraceAnalyzer analyzer;
+	std::string error;
+	if (!analyzer.Analyze(trace, &error, batches))
+	{
+		fprintf(stderr, "%s: %s\n", tracePath.c_str(), error.c_str());
+		return 1;
+	}
+
+	analyzer.WriteText(stdout);
+	if (!jsonPath.empty() && !analyzer.WriteJson(jsonPath))
+	{
+		fprintf(stderr, "Couldn't write %s\n", jsonPath.c_str());
+		return 1;
+	}
+
+	// Budgets, per frame where it matters
+	const CommandTraceStats& stats = analyzer.GetStats();
+	double changesPerDraw = stats.draws ? (double)stats.drawChanges / stats.draws : 0.0;
+	double barrierCallsPerFrame = stats.frames ? (double)stats.barrierCalls / stats.frames : 0.0;
+	bool overBudget = false;
+	if (maxRedundant >= 0.0 && analyzer.GetRedundantPercent() > maxRedundant)
+	{
+		printf("\nFAILED: %.1f%% of state sets are redundant (budget %.1f%%)\n", analyzer.GetRedundantPercent(), maxRedundant);
+		overBudget = true;
+	}
+	if (maxChangesPerDraw >= 0.0 && changesPerDraw > maxChangesPerDraw)
+	{
+		printf("\nFAILED: %.2f state changes per draw (budget %.2f)\n", changesPerDraw, maxChangesPerDraw);
+		overBudget = true;
+	}
+	if (maxBarrierCalls >= 0.0 && barrierCallsPerFrame > maxBarrierCalls)
+	{
+		printf("\nFAILED: %.1f barrier calls per frame (budget %.1f)\n", barrierCallsPerFrame, maxBarrierCalls);
+		overBudget = true;
+	}
+
+	return overBudget ? 2 : 0;
+}
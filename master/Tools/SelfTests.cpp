@@ -0,0 +1,158 @@
+// --------------------------------------------------------
+// Runs the engine's self tests headless, and optionally its
+// microbenchmarks. Not part of the main project - only the
+// pieces with no D3D12 or Windows go in, so it builds and
+// runs anywhere (see CMakeLists.txt next to this). The ones
+// that need DirectXMath are left out where there isn't one,
+// and the ones that need the D3D12 headers outside Windows.
+//
+//  cmake -S . -B build && cmake --build build
+//  ctest --test-dir build --output-on-failure
+//
+// Usage:
+//
+//  SelfTests [--benchmark] [--workers=count]
+//
+// --workers sets the job system's worker count (default 8,
+// whatever the core count, so threading bugs have room to
+// show up). Exits with 1 if any test fails, 0 otherwise.
+// --------------------------------------------------------
+#include "CommandTrace.h"
+#include "CpuFluidSolver.h"
+#include "InputRecording.h"
+#include "JobSystem.h"
+#include "RenderGraph.h"
+#include "SimulationClock.h"
+#include "SoftwareOcclusion.h"
+
+#if SELFTESTS_DIRECTXMATH
+#include "Benchmark.h"
+#include "MatrixKernels.h"
+#endif
+
+#ifdef _WIN32
+#include "ResourceStateTracker.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+typedef bool (*SelfTestFunction)(std::string* error);
+
+struct SelfTest
+{
+	const char* name;
+	SelfTestFunction function;
+};
+
+#if SELFTESTS_DIRECTXMATH
+// Every SIMD path against XMMatrixMultiply
+static bool MatrixKernelsSelfTest(std::string* error)
+{
+	if (MatrixKernels::Validate())
+		return true;
+	*error = "results aren't within tolerance of DirectXMath";
+	return false;
+}
+#endif
+
+static const SelfTest selfTests[] =
+{
+#if SELFTESTS_DIRECTXMATH
+	{ "Matrix kernels", MatrixKernelsSelfTest },
+#endif
+	{ "Job system", JobSystem::SelfTest },
+	{ "Render graph", RenderGraph::SelfTest },
+	{ "Software occlusion", SoftwareOcclusion::SelfTest },
+#if SELFTESTS_DIRECTXMATH
+	{ "Benchmark report", BenchmarkReport::SelfTest },
+#endif
+	{ "Input recording", InputRecordReader::SelfTest },
+	{ "Command trace", CommandTraceAnalyzer::SelfTest },
+	{ "Simulation clock", SimulationClock::SelfTest },
+#ifdef _WIN32
+	{ "Resource state tracker", ResourceStateTracker::SelfTest },
+#endif
+	{ "CPU fluid", CpuFluidSolver::SelfTest },
+};
+
+static void RunBenchmarks()
+{
+#if SELFTESTS_DIRECTXMATH
+	MatrixKernels::BenchmarkResult matrices = MatrixKernels::RunBenchmark();
+	printf("Matrix kernels (%u matrices): DirectXMath %.2fns, SSE %.2fns, AVX %.2fns, AVX2 %.2fns per matrix\n",
+		matrices.matrixCount,
+		matrices.nsPerMatrix[(int)MatrixKernels::Path::DirectXMath],
+		matrices.nsPerMatrix[(int)MatrixKernels::Path::SSE],
+		matrices.nsPerMatrix[(int)MatrixKernels::Path::AVX],
+		matrices.nsPerMatrix[(int)MatrixKernels::Path::AVX2]);
+#endif
+
+	SoftwareOcclusion::BenchmarkResult occlusion = SoftwareOcclusion::RunBenchmark();
+	printf("Software occlusion (%u triangles): %.3fms to rasterize, %.1fns per sphere test\n",
+		occlusion.triangleCount, occlusion.rasterMs, occlusion.nsPerTest);
+
+	CpuFluidSolver::BenchmarkResult fluid = CpuFluidSolver::RunBenchmark();
+	printf("CPU fluid (%u cells, %u workers): Scalar %.2f, AVX2 %.2f M cells/s (one thread: %.2f, %.2f)\n",
+		fluid.cellCount, fluid.workerCount,
+		fluid.cellsPerSecond[(int)CpuFluidSolver::Path::Scalar] / 1e6,
+		fluid.cellsPerSecond[(int)CpuFluidSolver::Path::AVX2] / 1e6,
+		fluid.serialCellsPerSecond[(int)CpuFluidSolver::Path::Scalar] / 1e6,
+		fluid.serialCellsPerSecond[(int)CpuFluidSolver::Path::AVX2] / 1e6);
+}
+
+static void PrintUsage()
+{
+	fprintf(stderr, "Usage: SelfTests [--benchmark] [--workers=count]\n");
+}
+
+int main(int argc, char** argv)
+{
+	bool benchmark = false;
+	unsigned int workers = 8;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t equals = argument.find('=');
+		std::string name = argument.substr(0, equals);
+		std::string value = equals == std::string::npos ? "" : argument.substr(equals + 1);
+
+		if (argument == "--benchmark")
+			benchmark = true;
+		else if (name == "--workers" && !value.empty())
+			workers = (unsigned int)strtoul(value.c_str(), 0, 10);
+		else
+		{
+			fprintf(stderr, "Unknown argument: %s\n", argument.c_str());
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	JobSystem::GetInstance().Initialize(workers);
+	printf("%u workers, CPU fluid on the %s path\n",
+		JobSystem::GetInstance().GetWorkerCount(),
+		CpuFluidSolver::GetPathName(CpuFluidSolver::GetBestPath()));
+#if SELFTESTS_DIRECTXMATH
+	printf("Matrix kernels on the %s path\n", MatrixKernels::GetPathName(MatrixKernels::GetBestPath()));
+#endif
+
+	unsigned int failed = 0;
+	for (const SelfTest& test : selfTests)
+	{
+		std::string error;
+		bool passed = test.function(&error);
+		printf("%s self test: %s%s\n", test.name, passed ? "passed" : "FAILED - ", error.c_str());
+		if (!passed)
+			failed++;
+	}
+
+	if (benchmark)
+		RunBenchmarks();
+
+	if (failed > 0)
+		printf("%u self test(s) FAILED\n", failed);
+	return failed > 0 ? 1 : 0;
+}
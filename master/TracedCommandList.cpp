@@ -0,0 +1,567 @@
+#include "TracedCommandList.h"
+#include "Hash.h"
+#include "Logger.h"
+
+#include <climits>
+
+//Singleton requirement
+CommandTracer* CommandTracer::instance;
+
+// --------------------------------------------------------
+// Traced command list
+// --------------------------------------------------------
+TracedCommandList::TracedCommandList(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> list, unsigned int id) :
+	list(list),
+	references(1),
+	id(id)
+{
+}
+
+ID3D12GraphicsCommandList* TracedCommandList::Unwrap(ID3D12GraphicsCommandList* list)
+{
+	TracedCommandList* traced = 0;
+	if (!list || FAILED(list->QueryInterface(__uuidof(TracedCommandList), (void**)&traced)))
+		return list;
+
+	// The wrapper holds on to the real list, so no reference needs keeping here
+	ID3D12GraphicsCommandList* inner = traced->GetInner();
+	traced->Release();
+	return inner;
+}
+
+bool TracedCommandList::Tracing()
+{
+	return CommandTracer::GetInstance().IsCapturing();
+}
+
+HRESULT TracedCommandList::QueryInterface(REFIID riid, void** ppvObject)
+{
+	if (!ppvObject)
+		return E_POINTER;
+
+	if (riid == __uuidof(TracedCommandList) ||
+		riid == __uuidof(ID3D12GraphicsCommandList) ||
+		riid == __uuidof(ID3D12CommandList) ||
+		riid == __uuidof(ID3D12DeviceChild) ||
+		riid == __uuidof(ID3D12Object) ||
+		riid == __uuidof(IUnknown))
+	{
+		*ppvObject = this;
+		AddRef();
+		return S_OK;
+	}
+
+	// Newer interfaces (ID3D12GraphicsCommandList1 and up) get the real
+	// list - anything recorded through those isn't traced
+	return list->QueryInterface(riid, ppvObject);
+}
+
+ULONG TracedCommandList::AddRef()
+{
+	return ++references;
+}
+
+ULONG TracedCommandList::Release()
+{
+	ULONG count = --references;
+	if (count == 0)
+		delete this;
+	return count;
+}
+
+HRESULT TracedCommandList::GetPrivateData(REFGUID guid, UINT* pDataSize, void* pData) { return list->GetPrivateData(guid, pDataSize, pData); }
+HRESULT TracedCommandList::SetPrivateData(REFGUID guid, UINT DataSize, const void* pData) { return list->SetPrivateData(guid, DataSize, pData); }
+HRESULT TracedCommandList::SetPrivateDataInterface(REFGUID guid, const IUnknown* pData) { return list->SetPrivateDataInterface(guid, pData); }
+HRESULT TracedCommandList::SetName(LPCWSTR Name) { return list->SetName(Name); }
+HRESULT TracedCommandList::GetDevice(REFIID riid, void** ppvDevice) { return list->GetDevice(riid, ppvDevice); }
+D3D12_COMMAND_LIST_TYPE TracedCommandList::GetType() { return list->GetType(); }
+
+HRESULT TracedCommandList::Close()
+{
+	if (Tracing()) trace.Record(TRACE_CLOSE);
+	return list->Close();
+}
+
+HRESULT TracedCommandList::Reset(ID3D12CommandAllocator* pAllocator, ID3D12PipelineState* pInitialState)
+{
+	// Anything from before that never got submitted is gone now
+	trace.Clear();
+	if (Tracing()) trace.Record(TRACE_RESET, pAllocator, pInitialState);
+	return list->Reset(pAllocator, pInitialState);
+}
+
+void TracedCommandList::ClearState(ID3D12PipelineState* pPipelineState)
+{
+	if (Tracing()) trace.Record(TRACE_CLEAR_STATE, pPipelineState);
+	list->ClearState(pPipelineState);
+}
+
+void TracedCommandList::DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation)
+{
+	if (Tracing()) trace.Record(TRACE_DRAW, VertexCountPerInstance, InstanceCount, StartVertexLocation, StartInstanceLocation);
+	list->DrawInstanced(VertexCountPerInstance, InstanceCount, StartVertexLocation, StartInstanceLocation);
+}
+
+void TracedCommandList::DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation)
+{
+	if (Tracing())
+	{
+		trace.Record(TRACE_DRAW_INDEXED, IndexCountPerInstance, InstanceCount, StartIndexLocation);
+		trace.PutSigned(BaseVertexLocation);
+		trace.Put(StartInstanceLocation);
+	}
+	list->DrawIndexedInstanced(IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation);
+}
+
+void TracedCommandList::Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ)
+{
+	if (Tracing()) trace.Record(TRACE_DISPATCH, ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ);
+	list->Dispatch(ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ);
+}
+
+void TracedCommandList::CopyBufferRegion(ID3D12Resource* pDstBuffer, UINT64 DstOffset, ID3D12Resource* pSrcBuffer, UINT64 SrcOffset, UINT64 NumBytes)
+{
+	if (Tracing()) trace.Record(TRACE_COPY_BUFFER, pDstBuffer, DstOffset, pSrcBuffer, SrcOffset, NumBytes);
+	list->CopyBufferRegion(pDstBuffer, DstOffset, pSrcBuffer, SrcOffset, NumBytes);
+}
+
+void TracedCommandList::CopyTextureRegion(const D3D12_TEXTURE_COPY_LOCATION* pDst, UINT DstX, UINT DstY, UINT DstZ, const D3D12_TEXTURE_COPY_LOCATION* pSrc, const D3D12_BOX* pSrcBox)
+{
+	if (Tracing()) trace.Record(TRACE_COPY_TEXTURE, pDst->pResource, pSrc->pResource);
+	list->CopyTextureRegion(pDst, DstX, DstY, DstZ, pSrc, pSrcBox);
+}
+
+void TracedCommandList::CopyResource(ID3D12Resource* pDstResource, ID3D12Resource* pSrcResource)
+{
+	if (Tracing()) trace.Record(TRACE_COPY_RESOURCE, pDstResource, pSrcResource);
+	list->CopyResource(pDstResource, pSrcResource);
+}
+
+void TracedCommandList::CopyTiles(ID3D12Resource* pTiledResource, const D3D12_TILED_RESOURCE_COORDINATE* pTileRegionStartCoordinate, const D3D12_TILE_REGION_SIZE* pTileRegionSize, ID3D12Resource* pBuffer, UINT64 BufferStartOffsetInBytes, D3D12_TILE_COPY_FLAGS Flags)
+{
+	if (Tracing()) trace.Record(TRACE_COPY_TILES, pTiledResource, pBuffer);
+	list->CopyTiles(pTiledResource, pTileRegionStartCoordinate, pTileRegionSize, pBuffer, BufferStartOffsetInBytes, Flags);
+}
+
+void TracedCommandList::ResolveSubresource(ID3D12Resource* pDstResource, UINT DstSubresource, ID3D12Resource* pSrcResource, UINT SrcSubresource, DXGI_FORMAT Format)
+{
+	if (Tracing()) trace.Record(TRACE_RESOLVE, pDstResource, pSrcResource);
+	list->ResolveSubresource(pDstResource, DstSubresource, pSrcResource, SrcSubresource, Format);
+}
+
+void TracedCommandList::IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY PrimitiveTopology)
+{
+	if (Tracing()) trace.Record(TRACE_TOPOLOGY, (uint64_t)PrimitiveTopology);
+	list->IASetPrimitiveTopology(PrimitiveTopology);
+}
+
+void TracedCommandList::RSSetViewports(UINT NumViewports, const D3D12_VIEWPORT* pViewports)
+{
+	if (Tracing()) trace.Record(TRACE_VIEWPORTS, NumViewports, HashBytes(HashStart, pViewports, sizeof(D3D12_VIEWPORT) * NumViewports));
+	list->RSSetViewports(NumViewports, pViewports);
+}
+
+void TracedCommandList::RSSetScissorRects(UINT NumRects, const D3D12_RECT* pRects)
+{
+	if (Tracing()) trace.Record(TRACE_SCISSORS, NumRects, HashBytes(HashStart, pRects, sizeof(D3D12_RECT) * NumRects));
+	list->RSSetScissorRects(NumRects, pRects);
+}
+
+void TracedCommandList::OMSetBlendFactor(const FLOAT BlendFactor[4])
+{
+	// No blend factor means all ones
+	static const FLOAT ones[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	if (Tracing()) trace.Record(TRACE_BLEND_FACTOR, HashBytes(HashStart, BlendFactor ? BlendFactor : ones, sizeof(FLOAT) * 4));
+	list->OMSetBlendFactor(BlendFactor);
+}
+
+void TracedCommandList::OMSetStencilRef(UINT StencilRef)
+{
+	if (Tracing()) trace.Record(TRACE_STENCIL_REF, StencilRef);
+	list->OMSetStencilRef(StencilRef);
+}
+
+void TracedCommandList::SetPipelineState(ID3D12PipelineState* pPipelineState)
+{
+	if (Tracing()) trace.Record(TRACE_PIPELINE, pPipelineState);
+	list->SetPipelineState(pPipelineState);
+}
+
+void TracedCommandList::ResourceBarrier(UINT NumBarriers, const D3D12_RESOURCE_BARRIER* pBarriers)
+{
+	if (Tracing())
+	{
+		trace.Record(TRACE_BARRIERS, NumBarriers);
+		for (UINT i = 0; i < NumBarriers; i++)
+		{
+			const D3D12_RESOURCE_BARRIER& barrier = pBarriers[i];
+			trace.Put((uint64_t)barrier.Type);
+			trace.Put((uint64_t)barrier.Flags);
+			switch (barrier.Type)
+			{
+			case D3D12_RESOURCE_BARRIER_TYPE_TRANSITION:
+				trace.Put(barrier.Transition.pResource);
+				trace.Put(barrier.Transition.Subresource);
+				trace.Put((uint64_t)barrier.Transition.StateBefore);
+				trace.Put((uint64_t)barrier.Transition.StateAfter);
+				break;
+			case D3D12_RESOURCE_BARRIER_TYPE_ALIASING:
+				trace.Put(barrier.Aliasing.pResourceBefore);
+				trace.Put(barrier.Aliasing.pResourceAfter);
+				break;
+			case D3D12_RESOURCE_BARRIER_TYPE_UAV:
+				trace.Put(barrier.UAV.pResource);
+				break;
+			}
+		}
+	}
+	list->ResourceBarrier(NumBarriers, pBarriers);
+}
+
+void TracedCommandList::ExecuteBundle(ID3D12GraphicsCommandList* pCommandList)
+{
+	if (Tracing()) trace.Record(TRACE_EXECUTE_BUNDLE, pCommandList);
+	list->ExecuteBundle(Unwrap(pCommandList));
+}
+
+void TracedCommandList::SetDescriptorHeaps(UINT NumDescriptorHeaps, ID3D12DescriptorHeap* const* ppDescriptorHeaps)
+{
+	if (Tracing())
+	{
+		trace.Record(TRACE_DESCRIPTOR_HEAPS, NumDescriptorHeaps);
+		for (UINT i = 0; i < NumDescriptorHeaps; i++)
+			trace.Put(ppDescriptorHeaps[i]);
+	}
+	list->SetDescriptorHeaps(NumDescriptorHeaps, ppDescriptorHeaps);
+}
+
+// Root arguments: compute is 1, graphics 0
+void TracedCommandList::SetComputeRootSignature(ID3D12RootSignature* pRootSignature)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_SIGNATURE, 1u, pRootSignature);
+	list->SetComputeRootSignature(pRootSignature);
+}
+
+void TracedCommandList::SetGraphicsRootSignature(ID3D12RootSignature* pRootSignature)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_SIGNATURE, 0u, pRootSignature);
+	list->SetGraphicsRootSignature(pRootSignature);
+}
+
+void TracedCommandList::SetComputeRootDescriptorTable(UINT RootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE BaseDescriptor)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_TABLE, 1u, RootParameterIndex, BaseDescriptor.ptr);
+	list->SetComputeRootDescriptorTable(RootParameterIndex, BaseDescriptor);
+}
+
+void TracedCommandList::SetGraphicsRootDescriptorTable(UINT RootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE BaseDescriptor)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_TABLE, 0u, RootParameterIndex, BaseDescriptor.ptr);
+	list->SetGraphicsRootDescriptorTable(RootParameterIndex, BaseDescriptor);
+}
+
+void TracedCommandList::SetComputeRoot32BitConstant(UINT RootParameterIndex, UINT SrcData, UINT DestOffsetIn32BitValues)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_CONSTANTS, 1u, RootParameterIndex, DestOffsetIn32BitValues, 1u, HashValue(HashStart, SrcData));
+	list->SetComputeRoot32BitConstant(RootParameterIndex, SrcData, DestOffsetIn32BitValues);
+}
+
+void TracedCommandList::SetGraphicsRoot32BitConstant(UINT RootParameterIndex, UINT SrcData, UINT DestOffsetIn32BitValues)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_CONSTANTS, 0u, RootParameterIndex, DestOffsetIn32BitValues, 1u, HashValue(HashStart, SrcData));
+	list->SetGraphicsRoot32BitConstant(RootParameterIndex, SrcData, DestOffsetIn32BitValues);
+}
+
+void TracedCommandList::SetComputeRoot32BitConstants(UINT RootParameterIndex, UINT Num32BitValuesToSet, const void* pSrcData, UINT DestOffsetIn32BitValues)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_CONSTANTS, 1u, RootParameterIndex, DestOffsetIn32BitValues, Num32BitValuesToSet, HashBytes(HashStart, pSrcData, Num32BitValuesToSet * 4));
+	list->SetComputeRoot32BitConstants(RootParameterIndex, Num32BitValuesToSet, pSrcData, DestOffsetIn32BitValues);
+}
+
+void TracedCommandList::SetGraphicsRoot32BitConstants(UINT RootParameterIndex, UINT Num32BitValuesToSet, const void* pSrcData, UINT DestOffsetIn32BitValues)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_CONSTANTS, 0u, RootParameterIndex, DestOffsetIn32BitValues, Num32BitValuesToSet, HashBytes(HashStart, pSrcData, Num32BitValuesToSet * 4));
+	list->SetGraphicsRoot32BitConstants(RootParameterIndex, Num32BitValuesToSet, pSrcData, DestOffsetIn32BitValues);
+}
+
+// Root views: CBV is 0, SRV 1, UAV 2
+void TracedCommandList::SetComputeRootConstantBufferView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_VIEW, 1u, 0u, RootParameterIndex, BufferLocation);
+	list->SetComputeRootConstantBufferView(RootParameterIndex, BufferLocation);
+}
+
+void TracedCommandList::SetGraphicsRootConstantBufferView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_VIEW, 0u, 0u, RootParameterIndex, BufferLocation);
+	list->SetGraphicsRootConstantBufferView(RootParameterIndex, BufferLocation);
+}
+
+void TracedCommandList::SetComputeRootShaderResourceView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_VIEW, 1u, 1u, RootParameterIndex, BufferLocation);
+	list->SetComputeRootShaderResourceView(RootParameterIndex, BufferLocation);
+}
+
+void TracedCommandList::SetGraphicsRootShaderResourceView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_VIEW, 0u, 1u, RootParameterIndex, BufferLocation);
+	list->SetGraphicsRootShaderResourceView(RootParameterIndex, BufferLocation);
+}
+
+void TracedCommandList::SetComputeRootUnorderedAccessView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_VIEW, 1u, 2u, RootParameterIndex, BufferLocation);
+	list->SetComputeRootUnorderedAccessView(RootParameterIndex, BufferLocation);
+}
+
+void TracedCommandList::SetGraphicsRootUnorderedAccessView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation)
+{
+	if (Tracing()) trace.Record(TRACE_ROOT_VIEW, 0u, 2u, RootParameterIndex, BufferLocation);
+	list->SetGraphicsRootUnorderedAccessView(RootParameterIndex, BufferLocation);
+}
+
+void TracedCommandList::IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* pView)
+{
+	if (Tracing())
+	{
+		D3D12_INDEX_BUFFER_VIEW view = pView ? *pView : D3D12_INDEX_BUFFER_VIEW{};
+		trace.Record(TRACE_INDEX_BUFFER, view.BufferLocation, view.SizeInBytes, (uint64_t)view.Format);
+	}
+	list->IASetIndexBuffer(pView);
+}
+
+void TracedCommandList::IASetVertexBuffers(UINT StartSlot, UINT NumViews, const D3D12_VERTEX_BUFFER_VIEW* pViews)
+{
+	if (Tracing())
+	{
+		trace.Record(TRACE_VERTEX_BUFFERS, StartSlot, NumViews);
+		for (UINT i = 0; i < NumViews; i++)
+		{
+			// No views unbinds the slots
+			D3D12_VERTEX_BUFFER_VIEW view = pViews ? pViews[i] : D3D12_VERTEX_BUFFER_VIEW{};
+			trace.Put(view.BufferLocation);
+			trace.Put(view.SizeInBytes);
+			trace.Put(view.StrideInBytes);
+		}
+	}
+	list->IASetVertexBuffers(StartSlot, NumViews, pViews);
+}
+
+void TracedCommandList::SOSetTargets(UINT StartSlot, UINT NumViews, const D3D12_STREAM_OUTPUT_BUFFER_VIEW* pViews)
+{
+	if (Tracing()) trace.Record(TRACE_STREAM_OUTPUT, StartSlot, NumViews, pViews ? HashBytes(HashStart, pViews, sizeof(D3D12_STREAM_OUTPUT_BUFFER_VIEW) * NumViews) : 0);
+	list->SOSetTargets(StartSlot, NumViews, pViews);
+}
+
+void TracedCommandList::OMSetRenderTargets(UINT NumRenderTargetDescriptors, const D3D12_CPU_DESCRIPTOR_HANDLE* pRenderTargetDescriptors, BOOL RTsSingleHandleToDescriptorRange, const D3D12_CPU_DESCRIPTOR_HANDLE* pDepthStencilDescriptor)
+{
+	if (Tracing())
+	{
+		trace.Record(TRACE_RENDER_TARGETS, NumRenderTargetDescriptors, RTsSingleHandleToDescriptorRange ? 1u : 0u);
+
+		// A single handle to a range only has the first one filled in
+		for (UINT i = 0; i < NumRenderTargetDescriptors; i++)
+			trace.Put(i == 0 || !RTsSingleHandleToDescriptorRange ? pRenderTargetDescriptors[i].ptr : 0);
+		trace.Put(pDepthStencilDescriptor ? pDepthStencilDescriptor->ptr : 0);
+	}
+	list->OMSetRenderTargets(NumRenderTargetDescriptors, pRenderTargetDescriptors, RTsSingleHandleToDescriptorRange, pDepthStencilDescriptor);
+}
+
+void TracedCommandList::ClearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE DepthStencilView, D3D12_CLEAR_FLAGS ClearFlags, FLOAT Depth, UINT8 Stencil, UINT NumRects, const D3D12_RECT* pRects)
+{
+	if (Tracing()) trace.Record(TRACE_CLEAR_DSV, DepthStencilView.ptr, (uint64_t)ClearFlags);
+	list->ClearDepthStencilView(DepthStencilView, ClearFlags, Depth, Stencil, NumRects, pRects);
+}
+
+void TracedCommandList::ClearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE RenderTargetView, const FLOAT ColorRGBA[4], UINT NumRects, const D3D12_RECT* pRects)
+{
+	if (Tracing()) trace.Record(TRACE_CLEAR_RTV, RenderTargetView.ptr);
+	list->ClearRenderTargetView(RenderTargetView, ColorRGBA, NumRects, pRects);
+}
+
+void TracedCommandList::ClearUnorderedAccessViewUint(D3D12_GPU_DESCRIPTOR_HANDLE ViewGPUHandleInCurrentHeap, D3D12_CPU_DESCRIPTOR_HANDLE ViewCPUHandle, ID3D12Resource* pResource, const UINT Values[4], UINT NumRects, const D3D12_RECT* pRects)
+{
+	if (Tracing()) trace.Record(TRACE_CLEAR_UAV, pResource);
+	list->ClearUnorderedAccessViewUint(ViewGPUHandleInCurrentHeap, ViewCPUHandle, pResource, Values, NumRects, pRects);
+}
+
+void TracedCommandList::ClearUnorderedAccessViewFloat(D3D12_GPU_DESCRIPTOR_HANDLE ViewGPUHandleInCurrentHeap, D3D12_CPU_DESCRIPTOR_HANDLE ViewCPUHandle, ID3D12Resource* pResource, const FLOAT Values[4], UINT NumRects, const D3D12_RECT* pRects)
+{
+	if (Tracing()) trace.Record(TRACE_CLEAR_UAV, pResource);
+	list->ClearUnorderedAccessViewFloat(ViewGPUHandleInCurrentHeap, ViewCPUHandle, pResource, Values, NumRects, pRects);
+}
+
+void TracedCommandList::DiscardResource(ID3D12Resource* pResource, const D3D12_DISCARD_REGION* pRegion)
+{
+	if (Tracing()) trace.Record(TRACE_DISCARD, pResource);
+	list->DiscardResource(pResource, pRegion);
+}
+
+void TracedCommandList::BeginQuery(ID3D12QueryHeap* pQueryHeap, D3D12_QUERY_TYPE Type, UINT Index)
+{
+	if (Tracing()) trace.Record(TRACE_BEGIN_QUERY, pQueryHeap, (uint64_t)Type, Index);
+	list->BeginQuery(pQueryHeap, Type, Index);
+}
+
+void TracedCommandList::EndQuery(ID3D12QueryHeap* pQueryHeap, D3D12_QUERY_TYPE Type, UINT Index)
+{
+	if (Tracing()) trace.Record(TRACE_END_QUERY, pQueryHeap, (uint64_t)Type, Index);
+	list->EndQuery(pQueryHeap, Type, Index);
+}
+
+void TracedCommandList::ResolveQueryData(ID3D12QueryHeap* pQueryHeap, D3D12_QUERY_TYPE Type, UINT StartIndex, UINT NumQueries, ID3D12Resource* pDestinationBuffer, UINT64 AlignedDestinationBufferOffset)
+{
+	if (Tracing()) trace.Record(TRACE_RESOLVE_QUERY, pQueryHeap, (uint64_t)Type, StartIndex, NumQueries, pDestinationBuffer);
+	list->ResolveQueryData(pQueryHeap, Type, StartIndex, NumQueries, pDestinationBuffer, AlignedDestinationBufferOffset);
+}
+
+void TracedCommandList::SetPredication(ID3D12Resource* pBuffer, UINT64 AlignedBufferOffset, D3D12_PREDICATION_OP Operation)
+{
+	if (Tracing()) trace.Record(TRACE_PREDICATION, pBuffer, AlignedBufferOffset, (uint64_t)Operation);
+	list->SetPredication(pBuffer, AlignedBufferOffset, Operation);
+}
+
+void TracedCommandList::SetMarker(UINT Metadata, const void* pData, UINT Size)
+{
+	if (Tracing()) trace.Record(TRACE_MARKER, Size);
+	list->SetMarker(Metadata, pData, Size);
+}
+
+void TracedCommandList::BeginEvent(UINT Metadata, const void* pData, UINT Size)
+{
+	if (Tracing()) trace.Record(TRACE_BEGIN_EVENT, Size);
+	list->BeginEvent(Metadata, pData, Size);
+}
+
+void TracedCommandList::EndEvent()
+{
+	if (Tracing()) trace.Record(TRACE_END_EVENT);
+	list->EndEvent();
+}
+
+void TracedCommandList::ExecuteIndirect(ID3D12CommandSignature* pCommandSignature, UINT MaxCommandCount, ID3D12Resource* pArgumentBuffer, UINT64 ArgumentBufferOffset, ID3D12Resource* pCountBuffer, UINT64 CountBufferOffset)
+{
+	if (Tracing()) trace.Record(TRACE_EXECUTE_INDIRECT, pCommandSignature, MaxCommandCount, pArgumentBuffer, ArgumentBufferOffset, pCountBuffer, CountBufferOffset);
+	list->ExecuteIndirect(pCommandSignature, MaxCommandCount, pArgumentBuffer, ArgumentBufferOffset, pCountBuffer, CountBufferOffset);
+}
+
+// --------------------------------------------------------
+// Tracer
+// --------------------------------------------------------
+void CommandTracer::Wrap(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& list)
+{
+#if COMMAND_TRACE_ENABLED
+	if (!list)
+		return;
+
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> traced;
+	traced.Attach(new TracedCommandList(list, nextListId++));
+	list = traced;
+#endif
+}
+
+void CommandTracer::RequestCapture(unsigned int frameCount, const std::string& path)
+{
+	if (capturing || frameCount == 0)
+		return;
+
+	pending = true;
+	requestedFrames = frameCount;
+	capturePath = path;
+}
+
+void CommandTracer::Submit(std::vector<ID3D12CommandList*>& lists)
+{
+	bool recording = IsCapturing();
+	if (recording)
+		capture.Record(TRACE_SUBMIT, (uint64_t)lists.size());
+
+	for (ID3D12CommandList*& entry : lists)
+	{
+		TracedCommandList* traced = 0;
+		if (FAILED(entry->QueryInterface(__uuidof(TracedCommandList), (void**)&traced)))
+		{
+			// Not one of ours - it shows up, but empty
+			if (recording)
+				capture.Record(TRACE_LIST, (uint64_t)UINT_MAX);
+			continue;
+		}
+
+		if (recording)
+		{
+			const std::vector<unsigned char>& recorded = traced->GetTrace().data;
+			capture.Record(TRACE_LIST, traced->GetId());
+			capture.data.insert(capture.data.end(), recorded.begin(), recorded.end());
+		}
+		traced->GetTrace().Clear();
+
+		entry = traced->GetInner();
+		traced->Release();
+	}
+}
+
+void CommandTracer::EndFrame()
+{
+	if (capturing)
+	{
+		if (--framesLeft > 0)
+		{
+			capture.Record(TRACE_FRAME, ++captureFrame);
+			return;
+		}
+
+		capturing = false;
+		WriteCapture();
+		return;
+	}
+
+	if (!pending)
+		return;
+
+	// Everything submitted from here on is part of the capture
+	pending = false;
+	framesLeft = requestedFrames;
+	captureFrame = 0;
+	capture.Clear();
+	capture.WriteHeader();
+	capture.Record(TRACE_FRAME, captureFrame);
+	capturing = true;
+}
+
+CommandTraceStatus CommandTracer::GetStatus()
+{
+	CommandTraceStatus status;
+	status.capturing = capturing;
+	status.pending = pending;
+	status.framesLeft = framesLeft;
+	status.lastFile = lastFile;
+	status.lastBytes = lastBytes;
+	return status;
+}
+
+void CommandTracer::WriteCapture()
+{
+	FILE* file = 0;
+	fopen_s(&file, capturePath.c_str(), "wb");
+	bool written = file && fwrite(capture.data.data(), 1, capture.data.size(), file) == capture.data.size();
+	if (file)
+		fclose(file);
+
+	if (!written)
+	{
+		LOG_ERROR("Couldn't write command trace %s", capturePath.c_str());
+		lastFile = "";
+		lastBytes = 0;
+	}
+	else
+	{
+		LOG_INFO("Wrote %u frames of commands (%llu bytes) to %s", requestedFrames, (unsigned long long)capture.data.size(), capturePath.c_str());
+		lastFile = capturePath;
+		lastBytes = capture.data.size();
+	}
+
+	// Could be megabytes - no need to keep it around
+	capture.data.clear();
+	capture.data.shrink_to_fit();
+}
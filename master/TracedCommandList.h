@@ -0,0 +1,204 @@
+#pragma once
+
+#include <d3d12.h>
+#include <wrl/client.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "CommandTrace.h"
+
+// Set to 0 (in the project's preprocessor definitions) to hand out the real command lists, untraced
+#ifndef COMMAND_TRACE_ENABLED
+#define COMMAND_TRACE_ENABLED 1
+#endif
+
+// --------------------------------------------------------
+// Stands in for a real command list, passing every call
+// straight through - and, while the CommandTracer is
+// capturing, writing each one down on the way.
+//
+// Anything that takes an ID3D12GraphicsCommandList can be
+// handed one of these. The runtime can't, so the real lists
+// are swapped back in by CommandTracer::Submit() right
+// before they're executed.
+// --------------------------------------------------------
+class __declspec(uuid("d0c041f0-2e59-4561-874b-b02ef61de307")) TracedCommandList : public ID3D12GraphicsCommandList
+{
+public:
+	TracedCommandList(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> list, unsigned int id);
+
+	// The real list if this is a wrapper, otherwise whatever was passed in
+	static ID3D12GraphicsCommandList* Unwrap(ID3D12GraphicsCommandList* list);
+
+	ID3D12GraphicsCommandList* GetInner() { return list.Get(); }
+	unsigned int GetId() { return id; }
+
+	// Everything recorded since the last Reset() (or Submit())
+	CommandTraceBuffer& GetTrace() { return trace; }
+
+	// IUnknown
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override;
+	ULONG STDMETHODCALLTYPE AddRef() override;
+	ULONG STDMETHODCALLTYPE Release() override;
+
+	// ID3D12Object, ID3D12DeviceChild, ID3D12CommandList
+	HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID guid, UINT* pDataSize, void* pData) override;
+	HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID guid, UINT DataSize, const void* pData) override;
+	HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID guid, const IUnknown* pData) override;
+	HRESULT STDMETHODCALLTYPE SetName(LPCWSTR Name) override;
+	HRESULT STDMETHODCALLTYPE GetDevice(REFIID riid, void** ppvDevice) override;
+	D3D12_COMMAND_LIST_TYPE STDMETHODCALLTYPE GetType() override;
+
+	// ID3D12GraphicsCommandList
+	HRESULT STDMETHODCALLTYPE Close() override;
+	HRESULT STDMETHODCALLTYPE Reset(ID3D12CommandAllocator* pAllocator, ID3D12PipelineState* pInitialState) override;
+	void STDMETHODCALLTYPE ClearState(ID3D12PipelineState* pPipelineState) override;
+	void STDMETHODCALLTYPE DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation) override;
+	void STDMETHODCALLTYPE DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation) override;
+	void STDMETHODCALLTYPE Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ) override;
+	void STDMETHODCALLTYPE CopyBufferRegion(ID3D12Resource* pDstBuffer, UINT64 DstOffset, ID3D12Resource* pSrcBuffer, UINT64 SrcOffset, UINT64 NumBytes) override;
+	void STDMETHODCALLTYPE CopyTextureRegion(const D3D12_TEXTURE_COPY_LOCATION* pDst, UINT DstX, UINT DstY, UINT DstZ, const D3D12_TEXTURE_COPY_LOCATION* pSrc, const D3D12_BOX* pSrcBox) override;
+	void STDMETHODCALLTYPE CopyResource(ID3D12Resource* pDstResource, ID3D12Resource* pSrcResource) override;
+	void STDMETHODCALLTYPE CopyTiles(ID3D12Resource* pTiledResource, const D3D12_TILED_RESOURCE_COORDINATE* pTileRegionStartCoordinate, const D3D12_TILE_REGION_SIZE* pTileRegionSize, ID3D12Resource* pBuffer, UINT64 BufferStartOffsetInBytes, D3D12_TILE_COPY_FLAGS Flags) override;
+	void STDMETHODCALLTYPE ResolveSubresource(ID3D12Resource* pDstResource, UINT DstSubresource, ID3D12Resource* pSrcResource, UINT SrcSubresource, DXGI_FORMAT Format) override;
+	void STDMETHODCALLTYPE IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY PrimitiveTopology) override;
+	void STDMETHODCALLTYPE RSSetViewports(UINT NumViewports, const D3D12_VIEWPORT* pViewports) override;
+	void STDMETHODCALLTYPE RSSetScissorRects(UINT NumRects, const D3D12_RECT* pRects) override;
+	void STDMETHODCALLTYPE OMSetBlendFactor(const FLOAT BlendFactor[4]) override;
+	void STDMETHODCALLTYPE OMSetStencilRef(UINT StencilRef) override;
+	void STDMETHODCALLTYPE SetPipelineState(ID3D12PipelineState* pPipelineState) override;
+	void STDMETHODCALLTYPE ResourceBarrier(UINT NumBarriers, const D3D12_RESOURCE_BARRIER* pBarriers) override;
+	void STDMETHODCALLTYPE ExecuteBundle(ID3D12GraphicsCommandList* pCommandList) override;
+	void STDMETHODCALLTYPE SetDescriptorHeaps(UINT NumDescriptorHeaps, ID3D12DescriptorHeap* const* ppDescriptorHeaps) override;
+	void STDMETHODCALLTYPE SetComputeRootSignature(ID3D12RootSignature* pRootSignature) override;
+	void STDMETHODCALLTYPE SetGraphicsRootSignature(ID3D12RootSignature* pRootSignature) override;
+	void STDMETHODCALLTYPE SetComputeRootDescriptorTable(UINT RootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE BaseDescriptor) override;
+	void STDMETHODCALLTYPE SetGraphicsRootDescriptorTable(UINT RootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE BaseDescriptor) override;
+	void STDMETHODCALLTYPE SetComputeRoot32BitConstant(UINT RootParameterIndex, UINT SrcData, UINT DestOffsetIn32BitValues) override;
+	void STDMETHODCALLTYPE SetGraphicsRoot32BitConstant(UINT RootParameterIndex, UINT SrcData, UINT DestOffsetIn32BitValues) override;
+	void STDMETHODCALLTYPE SetComputeRoot32BitConstants(UINT RootParameterIndex, UINT Num32BitValuesToSet, const void* pSrcData, UINT DestOffsetIn32BitValues) override;
+	void STDMETHODCALLTYPE SetGraphicsRoot32BitConstants(UINT RootParameterIndex, UINT Num32BitValuesToSet, const void* pSrcData, UINT DestOffsetIn32BitValues) override;
+	void STDMETHODCALLTYPE SetComputeRootConstantBufferView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override;
+	void STDMETHODCALLTYPE SetGraphicsRootConstantBufferView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override;
+	void STDMETHODCALLTYPE SetComputeRootShaderResourceView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override;
+	void STDMETHODCALLTYPE SetGraphicsRootShaderResourceView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override;
+	void STDMETHODCALLTYPE SetComputeRootUnorderedAccessView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override;
+	void STDMETHODCALLTYPE SetGraphicsRootUnorderedAccessView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override;
+	void STDMETHODCALLTYPE IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* pView) override;
+	void STDMETHODCALLTYPE IASetVertexBuffers(UINT StartSlot, UINT NumViews, const D3D12_VERTEX_BUFFER_VIEW* pViews) override;
+	void STDMETHODCALLTYPE SOSetTargets(UINT StartSlot, UINT NumViews, const D3D12_STREAM_OUTPUT_BUFFER_VIEW* pViews) override;
+	void STDMETHODCALLTYPE OMSetRenderTargets(UINT NumRenderTargetDescriptors, const D3D12_CPU_DESCRIPTOR_HANDLE* pRenderTargetDescriptors, BOOL RTsSingleHandleToDescriptorRange, const D3D12_CPU_DESCRIPTOR_HANDLE* pDepthStencilDescriptor) override;
+	void STDMETHODCALLTYPE ClearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE DepthStencilView, D3D12_CLEAR_FLAGS ClearFlags, FLOAT Depth, UINT8 Stencil, UINT NumRects, const D3D12_RECT* pRects) override;
+	void STDMETHODCALLTYPE ClearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE RenderTargetView, const FLOAT ColorRGBA[4], UINT NumRects, const D3D12_RECT* pRects) override;
+	void STDMETHODCALLTYPE ClearUnorderedAccessViewUint(D3D12_GPU_DESCRIPTOR_HANDLE ViewGPUHandleInCurrentHeap, D3D12_CPU_DESCRIPTOR_HANDLE ViewCPUHandle, ID3D12Resource* pResource, const UINT Values[4], UINT NumRects, const D3D12_RECT* pRects) override;
+	void STDMETHODCALLTYPE ClearUnorderedAccessViewFloat(D3D12_GPU_DESCRIPTOR_HANDLE ViewGPUHandleInCurrentHeap, D3D12_CPU_DESCRIPTOR_HANDLE ViewCPUHandle, ID3D12Resource* pResource, const FLOAT Values[4], UINT NumRects, const D3D12_RECT* pRects) override;
+	void STDMETHODCALLTYPE DiscardResource(ID3D12Resource* pResource, const D3D12_DISCARD_REGION* pRegion) override;
+	void STDMETHODCALLTYPE BeginQuery(ID3D12QueryHeap* pQueryHeap, D3D12_QUERY_TYPE Type, UINT Index) override;
+	void STDMETHODCALLTYPE EndQuery(ID3D12QueryHeap* pQueryHeap, D3D12_QUERY_TYPE Type, UINT Index) override;
+	void STDMETHODCALLTYPE ResolveQueryData(ID3D12QueryHeap* pQueryHeap, D3D12_QUERY_TYPE Type, UINT StartIndex, UINT NumQueries, ID3D12Resource* pDestinationBuffer, UINT64 AlignedDestinationBufferOffset) override;
+	void STDMETHODCALLTYPE SetPredication(ID3D12Resource* pBuffer, UINT64 AlignedBufferOffset, D3D12_PREDICATION_OP Operation) override;
+	void STDMETHODCALLTYPE SetMarker(UINT Metadata, const void* pData, UINT Size) override;
+	void STDMETHODCALLTYPE BeginEvent(UINT Metadata, const void* pData, UINT Size) override;
+	void STDMETHODCALLTYPE EndEvent() override;
+	void STDMETHODCALLTYPE ExecuteIndirect(ID3D12CommandSignature* pCommandSignature, UINT MaxCommandCount, ID3D12Resource* pArgumentBuffer, UINT64 ArgumentBufferOffset, ID3D12Resource* pCountBuffer, UINT64 CountBufferOffset) override;
+
+private:
+	// Only made through new, freed by the last Release()
+	~TracedCommandList() { }
+
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> list;
+	std::atomic<ULONG> references;
+	unsigned int id;
+	CommandTraceBuffer trace;
+
+	bool Tracing();
+};
+
+// Where a capture is at, for the UI
+struct CommandTraceStatus
+{
+	bool capturing;
+	bool pending;				// Requested, starts next frame
+	unsigned int framesLeft;
+	std::string lastFile;		// Empty until something's been written
+	uint64_t lastBytes;
+};
+
+// --------------------------------------------------------
+// Hands out traced command lists and collects what they
+// recorded into trace files.
+//
+// Outside a capture a traced call costs one relaxed load
+// and a branch on top of the real one. A capture covers the
+// next N frames (between EndFrame() calls): each list keeps
+// its own records, only ever touched by the thread recording
+// it, and Submit() stitches them together in the order
+// they're executed.
+// --------------------------------------------------------
+class CommandTracer
+{
+#pragma region Singleton
+public:
+	// Gets the one and only instance of this class
+	static CommandTracer& GetInstance()
+	{
+		if (!instance)
+		{
+			instance = new CommandTracer();
+		}
+
+		return *instance;
+	}
+
+	// Remove these functions (C++ 11 version)
+	CommandTracer(CommandTracer const&) = delete;
+	void operator=(CommandTracer const&) = delete;
+
+private:
+	static CommandTracer* instance;
+	CommandTracer() :
+		capturing(false),
+		pending(false),
+		requestedFrames(0),
+		framesLeft(0),
+		captureFrame(0),
+		nextListId(0),
+		lastBytes(0)
+	{ };
+#pragma endregion
+
+public:
+	// Swaps a freshly made list for a traced one (unless
+	// COMMAND_TRACE_ENABLED is 0, in which case it's left alone)
+	void Wrap(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& list);
+
+	bool IsCapturing() { return capturing.load(std::memory_order_relaxed); }
+
+	// Captures the next frameCount frames into path
+	void RequestCapture(unsigned int frameCount, const std::string& path);
+
+	// Call with the lists about to be executed, in order. Takes
+	// what they recorded and swaps each traced list for its real one.
+	void Submit(std::vector<ID3D12CommandList*>& lists);
+
+	// Once per frame, after everything's been submitted
+	void EndFrame();
+
+	CommandTraceStatus GetStatus();
+
+private:
+	std::atomic<bool> capturing;
+	bool pending;
+	unsigned int requestedFrames;
+	unsigned int framesLeft;
+	unsigned int captureFrame;
+	std::string capturePath;
+	CommandTraceBuffer capture;
+	unsigned int nextListId;
+
+	std::string lastFile;
+	uint64_t lastBytes;
+
+	void WriteCapture();
+};
@@ -1,4 +1,5 @@
 #include "Transform.h"
+#include <cmath>
 
 using namespace DirectX; //Because this is .cpp this using namespace won't propogate to rest of code
 
@@ -6,7 +7,9 @@ Transform::Transform()
 {
 	position = XMFLOAT3(0, 0, 0);
 	pitchYawRoll = XMFLOAT3(0, 0, 0);
+	rotation = XMFLOAT4(0, 0, 0, 1);
 	scale = XMFLOAT3(1, 1, 1);
+	hasUniformScale = true;
 
 	parent = nullptr;
 
@@ -46,8 +49,8 @@ void Transform::MoveRelative(float x, float y, float z)
 	// Desired movement in "world" space
 	XMVECTOR desiredMovement = XMVectorSet(x, y, z, 0);
 	
-	//Pitch yaw roll as our current rotation in quaternion form.
-	XMVECTOR rotationQuaternion = XMQuaternionRotationRollPitchYawFromVector(XMLoadFloat3(&pitchYawRoll));
+	//Our current rotation, already stored in quaternion form.
+	XMVECTOR rotationQuaternion = XMLoadFloat4(&rotation);
 
 	//Rotate desiredMovement by the same amount we are rotated.
 	XMVECTOR relativeMovement = XMVector3Rotate(
@@ -67,6 +70,9 @@ void Transform::Rotate(float pitch, float yaw, float roll)
 { 
 	XMVECTOR newRotation = XMVectorAdd(XMLoadFloat3(&pitchYawRoll), XMVectorSet(pitch, yaw, roll, 0));
 	XMStoreFloat3(&pitchYawRoll, newRotation);
+
+	//Euler angles are accumulated (so the camera never picks up roll), the quaternion is rebuilt from them
+	XMStoreFloat4(&rotation, XMQuaternionRotationRollPitchYawFromVector(newRotation));
 	MarkChildTransformDirty();
 	isDirty = true;
 }
@@ -75,6 +81,7 @@ void Transform::Scale(float x, float y, float z)
 {
 	XMVECTOR newScale = XMVectorMultiply(XMLoadFloat3(&scale), XMVectorSet(x, y, z, 0));
 	XMStoreFloat3(&scale, newScale);
+	UpdateScaleFlag();
 	MarkChildTransformDirty();
 	isDirty = true;
 }
@@ -89,12 +96,33 @@ void Transform::SetPosition(float x, float y, float z)
 void Transform::SetRotation(float pitch, float yaw, float roll)
 {
 	XMStoreFloat3(&pitchYawRoll, XMVectorSet(pitch, yaw, roll, 0));
+	XMStoreFloat4(&rotation, XMQuaternionRotationRollPitchYaw(pitch, yaw, roll));
+	MarkChildTransformDirty();
+	isDirty = true;
+}
+
+void Transform::SetRotation(DirectX::XMFLOAT4 quaternion)
+{
+	XMVECTOR quat = XMQuaternionNormalize(XMLoadFloat4(&quaternion));
+	XMStoreFloat4(&rotation, quat);
+
+	//Keep the euler angles in sync for anyone still asking for pitch/yaw/roll.
+	//RollPitchYaw builds Rz * Rx * Ry, so pull the angles back out of that matrix.
+	XMFLOAT3X3 rot;
+	XMStoreFloat3x3(&rot, XMMatrixRotationQuaternion(quat));
+	pitchYawRoll.x = asinf(fmaxf(-1.0f, fminf(1.0f, -rot._32)));
+	pitchYawRoll.y = atan2f(rot._31, rot._33);
+	pitchYawRoll.z = atan2f(rot._12, rot._22);
+
+	MarkChildTransformDirty();
 	isDirty = true;
 }
 
 void Transform::SetScale(float x, float y, float z)
 {
 	XMStoreFloat3(&scale, XMVectorSet(x, y, z, 0));
+	UpdateScaleFlag();
+	MarkChildTransformDirty();
 	isDirty = true;
 }
 
@@ -108,6 +136,11 @@ DirectX::XMFLOAT3 Transform::GetRotation()
 	return pitchYawRoll;
 }
 
+DirectX::XMFLOAT4 Transform::GetRotationQuaternion()
+{
+	return rotation;
+}
+
 DirectX::XMFLOAT3 Transform::GetScale()
 {
 	return scale;
@@ -116,32 +149,70 @@ DirectX::XMFLOAT3 Transform::GetScale()
 DirectX::XMFLOAT4X4 Transform::GetWorldMatrix()
 {
 	if (isDirty)
-	{
-		XMMATRIX translationMat = XMMatrixTranslationFromVector(XMLoadFloat3(&position));
-		XMMATRIX rotationMat = XMMatrixRotationRollPitchYawFromVector(XMLoadFloat3(&pitchYawRoll));
-		XMMATRIX scaleMat = XMMatrixScalingFromVector(XMLoadFloat3(&scale));
-
-		//Store world matrix & store it once you invert and transpose
-		XMMATRIX worldMat = scaleMat * rotationMat * translationMat;
-		if(parent)
-		{
-			XMMATRIX parentMatrix = XMLoadFloat4x4(&GetParent()->worldMatrix);
-			worldMat =  XMMatrixMultiply(worldMat, parentMatrix);		
-		}
-		XMStoreFloat4x4(&worldMatrix, worldMat);
-		XMStoreFloat4x4(&worldInverseTransposeMatrix, XMMatrixInverse(0, XMMatrixTranspose(worldMat)));
-
-		isDirty = false;
-	}
+		UpdateMatrices();
 
 	return worldMatrix;
 }
 
 DirectX::XMFLOAT4X4 Transform::GetWorldITMatrix()
 {
+	if (isDirty)
+		UpdateMatrices();
+
 	return worldInverseTransposeMatrix;
 }
 
+//Rebuilds the world and inverse transpose matrices straight from
+//the TRS pieces instead of multiplying three matrices together
+//and running a general 4x4 inverse on the result.
+void Transform::UpdateMatrices()
+{
+	XMMATRIX rotationMat = XMMatrixRotationQuaternion(XMLoadFloat4(&rotation));
+
+	//S * R * T with row vectors is just the rows of R scaled by S
+	//and the position dropped into the last row.
+	XMMATRIX worldMat;
+	worldMat.r[0] = XMVectorScale(rotationMat.r[0], scale.x);
+	worldMat.r[1] = XMVectorScale(rotationMat.r[1], scale.y);
+	worldMat.r[2] = XMVectorScale(rotationMat.r[2], scale.z);
+	worldMat.r[3] = XMVectorSetW(XMLoadFloat3(&position), 1.0f);
+
+	//Inverse transpose of (S * R) is S^-1 * R, the rotation is orthonormal so
+	//its inverse transpose is itself. Only the upper 3x3 is used (for normals).
+	//With a uniform scale S^-1 only changes the length, which the shader
+	//normalizes away, so skip it and hand back the rotation.
+	XMMATRIX normalMat = rotationMat;
+	if (!hasUniformScale)
+	{
+		normalMat.r[0] = XMVectorScale(rotationMat.r[0], 1.0f / scale.x);
+		normalMat.r[1] = XMVectorScale(rotationMat.r[1], 1.0f / scale.y);
+		normalMat.r[2] = XMVectorScale(rotationMat.r[2], 1.0f / scale.z);
+	}
+	normalMat.r[3] = g_XMIdentityR3;
+
+	if(parent)
+	{
+		//(A * B)^-T == A^-T * B^-T, so the parent's cached matrices can be chained as is.
+		//Make sure the parent is up to date first.
+		parent->GetWorldMatrix();
+		worldMat = XMMatrixMultiply(worldMat, XMLoadFloat4x4(&parent->worldMatrix));
+		normalMat = XMMatrixMultiply(normalMat, XMLoadFloat4x4(&parent->worldInverseTransposeMatrix));
+	}
+	XMStoreFloat4x4(&worldMatrix, worldMat);
+	XMStoreFloat4x4(&worldInverseTransposeMatrix, normalMat);
+
+	isDirty = false;
+}
+
+//Uniform (and not mirrored) scale means the normal matrix doesn't need the inverse scale
+void Transform::UpdateScaleFlag()
+{
+	hasUniformScale =
+		scale.x > 0.0f &&
+		fabsf(scale.x - scale.y) <= 1e-5f * scale.x &&
+		fabsf(scale.x - scale.z) <= 1e-5f * scale.x;
+}
+
 void Transform::AddChild(Transform* child)
 {
 	if (child != nullptr)
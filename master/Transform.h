@@ -18,11 +18,13 @@ public:
 	// Methods to overwrite existing transforms
 	void SetPosition(float x, float y, float z);
 	void SetRotation(float pitch, float yaw, float roll);
+	void SetRotation(DirectX::XMFLOAT4 quaternion);
 	void SetScale(float x, float y, float z);
 
 	// Methods to retrieve transform data
 	DirectX::XMFLOAT3 GetPosition();
 	DirectX::XMFLOAT3 GetRotation();
+	DirectX::XMFLOAT4 GetRotationQuaternion();
 	DirectX::XMFLOAT3 GetScale();
 	
 	// Method to return/calculate the resulting world matrix
@@ -42,15 +44,19 @@ public:
 private:
 
 	void MarkChildTransformDirty();
+	void UpdateMatrices();
+	void UpdateScaleFlag();
 
 	//A place to store the raw transform values
 	DirectX::XMFLOAT3 position;
-	DirectX::XMFLOAT3 pitchYawRoll; // Not a quaternion, simply 3 Euler angles
+	DirectX::XMFLOAT3 pitchYawRoll; // Euler angles, kept for callers that think in pitch/yaw/roll (camera)
+	DirectX::XMFLOAT4 rotation; // Quaternion built from pitchYawRoll, this is what the matrices are made from
 	DirectX::XMFLOAT3 scale; 
 
 	DirectX::XMFLOAT4X4 worldMatrix; // Most recent matrix created
-	DirectX::XMFLOAT4X4 worldInverseTransposeMatrix; // Inverse&transpose of current worldmatrix
+	DirectX::XMFLOAT4X4 worldInverseTransposeMatrix; // Inverse&transpose of current worldmatrix (only upper 3x3 is meaningful)
 	bool isDirty; // Has the matrix value been changed? If so remake matrix
+	bool hasUniformScale; // x == y == z (and positive) so the normal matrix is just the rotation
 
 	Transform* parent; //Should be null(0) if there is no parent
 
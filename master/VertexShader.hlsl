@@ -1,20 +1,27 @@
 #include "LightingClean.hlsli"
 
-cbuffer ExternalData : register(b0)
-{
-	matrix world;
-	matrix worldInverseTranspose;
-	matrix view;
-	matrix projection;
-}
-
 // Struct representing a single vertex worth of data
+// plus the per-instance data from the second vertex buffer
 struct VertexShaderInput
 {
 	float3 localPosition	: POSITION;
 	float2 uv				: TEXCOORD;
 	float3 normal			: NORMAL;
 	float3 tangent			: TANGENT;
+
+	// Instance matrices, one row per element (match InstanceData!)
+	float4 world0			: WORLD0;
+	float4 world1			: WORLD1;
+	float4 world2			: WORLD2;
+	float4 world3			: WORLD3;
+	float4 worldIT0			: WORLDIT0;
+	float4 worldIT1			: WORLDIT1;
+	float4 worldIT2			: WORLDIT2;
+	float4 worldIT3			: WORLDIT3;
+	float4 wvp0				: WVP0;
+	float4 wvp1				: WVP1;
+	float4 wvp2				: WVP2;
+	float4 wvp3				: WVP3;
 };
 
 // Struct representing the data we're sending down the pipeline
@@ -32,16 +39,22 @@ VertexToPixel main( VertexShaderInput input )
 	// Set up output struct
 	VertexToPixel output;
 
-	// Calc screen position
-	matrix wvp = mul(projection, mul(view, world));
-	output.screenPosition = mul(wvp, float4(input.localPosition, 1.0f));
+	// Rebuild the instance matrices (rows straight from DirectXMath, so vector goes on the left)
+	float4x4 world = float4x4(input.world0, input.world1, input.world2, input.world3);
+	float4x4 worldInverseTranspose = float4x4(input.worldIT0, input.worldIT1, input.worldIT2, input.worldIT3);
+	float4x4 worldViewProjection = float4x4(input.wvp0, input.wvp1, input.wvp2, input.wvp3);
+
+	// Calc screen position (world * view * projection was done on the CPU)
+	// Precise, and the same math as DepthPrepassVS.hlsl, so the depth prepass matches exactly
+	precise float4 screenPosition = mul(float4(input.localPosition, 1.0f), worldViewProjection);
+	output.screenPosition = screenPosition;
 
 	// Make sure the lighting vectors are in world space
-	output.normal = normalize(mul((float3x3)worldInverseTranspose, input.normal));
-	output.tangent = normalize(mul((float3x3)worldInverseTranspose, input.tangent));
+	output.normal = normalize(mul(input.normal, (float3x3)worldInverseTranspose));
+	output.tangent = normalize(mul(input.tangent, (float3x3)worldInverseTranspose));
 
 	// Calc vertex world pos
-	output.worldPos = mul(world, float4(input.localPosition, 1.0f)).xyz;
+	output.worldPos = mul(float4(input.localPosition, 1.0f), world).xyz;
 
 	// Pass through the uv
 	output.uv = input.uv;